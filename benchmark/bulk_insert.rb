@@ -0,0 +1,36 @@
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+require 'rubygems'
+require 'benchmark/ips'
+require 'mysql2'
+
+# Inserting 1000 rows: one multi-row INSERT per max_allowed_packet versus one
+# prepared-statement execute per row.
+client = Mysql2::Client.new(host: "localhost", username: "root", database: "test")
+client.query("DROP TABLE IF EXISTS mysql2_bulk_insert_bench")
+client.query("CREATE TABLE mysql2_bulk_insert_bench (id INT PRIMARY KEY AUTO_INCREMENT, name VARCHAR(64), score DOUBLE, created_at DATETIME)")
+
+now = Time.now
+rows = Array.new(1000) { |i| ["name #{i}", i * 1.5, now] }
+columns = %w[name score created_at]
+statement = client.prepare("INSERT INTO mysql2_bulk_insert_bench (name, score, created_at) VALUES (?, ?, ?)")
+
+Benchmark.ips do |x|
+  x.report "bulk_insert" do
+    client.bulk_insert("mysql2_bulk_insert_bench", columns, rows)
+  end
+
+  x.report "prepared, per row" do
+    rows.each { |row| statement.execute(*row) }
+  end
+
+  x.report "prepared, per row, one transaction" do
+    client.query("BEGIN")
+    rows.each { |row| statement.execute(*row) }
+    client.query("COMMIT")
+  end
+
+  x.compare!
+end
+
+client.query("DROP TABLE mysql2_bulk_insert_bench")
@@ -0,0 +1,45 @@
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+require 'rubygems'
+require 'benchmark/ips'
+require 'mysql2'
+
+# Protocol compression trades CPU for bytes on the wire. Against a local
+# server the wire is never the bottleneck, so this shows the cost side:
+# queries per second, and client CPU time and bytes received per query.
+# Run setup_db.rb first. 127.0.0.1 rather than localhost so the connection is
+# TCP and Client#stats has wire counters.
+opts = { host: "127.0.0.1", username: "root", database: "test" }
+sql = "SELECT * FROM mysql2_test LIMIT #{ENV['ROWS'] || 1000}"
+
+configs = { "uncompressed" => {}, "zlib" => { compression: :zlib } }
+if Mysql2::Client::ZSTD_COMPRESSION_SUPPORTED
+  configs["zstd"] = { compression: :zstd }
+  configs["zstd (level 10)"] = { compression: :zstd, compression_level: 10 }
+end
+
+clients = configs.map do |label, config|
+  client = Mysql2::Client.new(opts.merge(config))
+  warn "#{label}: negotiated #{client.stats[:compression].inspect}"
+  [label, client]
+end
+
+clients.each do |label, client|
+  iterations = 200
+  bytes = client.stats[:bytes_received]
+  cpu = Process.clock_gettime(Process::CLOCK_PROCESS_CPUTIME_ID)
+  iterations.times { client.query(sql, cache_rows: false).each {} }
+  cpu = Process.clock_gettime(Process::CLOCK_PROCESS_CPUTIME_ID) - cpu
+  bytes = client.stats[:bytes_received] - bytes if bytes
+  puts format("%-16s %8.3f ms CPU/query %10s bytes/query", label, cpu * 1000 / iterations, bytes ? bytes / iterations : "n/a")
+end
+
+Benchmark.ips do |x|
+  clients.each do |label, client|
+    x.report(label) do
+      client.query(sql, cache_rows: false).each {}
+    end
+  end
+
+  x.compare!
+end
@@ -0,0 +1,40 @@
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+require 'rubygems'
+require 'benchmark/ips'
+require 'mysql2'
+
+# Scatter-gather: one query fanned out over SHARDS connections, results
+# gathered as they arrive.
+opts = { host: "localhost", username: "root", database: "test" }
+sql = "SELECT * FROM mysql2_test LIMIT 10"
+shards = Array.new((ENV['SHARDS'] || 24).to_i) { Mysql2::Client.new(opts) }
+multiplexer = Mysql2::Multiplexer.new(*shards)
+ios = shards.map { |client| IO.for_fd(client.socket, autoclose: false) }
+clients_by_io = ios.zip(shards).to_h
+
+Benchmark.ips do |x|
+  x.report "IO.select + async_result" do
+    shards.each { |client| client.query(sql, async: true) }
+    pending = ios.dup
+    until pending.empty?
+      readable, = IO.select(pending)
+      readable.each do |io|
+        clients_by_io[io].async_result.to_a
+        pending.delete(io)
+      end
+    end
+  end
+
+  x.report "Multiplexer#wait + async_result" do
+    shards.each { |client| client.query(sql, async: true) }
+    multiplexer.wait.each { |client| client.async_result.to_a } until multiplexer.pending.zero?
+  end
+
+  x.report "Multiplexer#each_result" do
+    shards.each { |client| client.query(sql, async: true) }
+    multiplexer.each_result { |_, result| result.to_a }
+  end
+
+  x.compare!
+end
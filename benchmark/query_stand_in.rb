@@ -0,0 +1,45 @@
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+require 'rubygems'
+require 'benchmark/ips'
+require 'mysql2'
+require 'tmpdir'
+require_relative 'stand_in_server'
+
+# The fetch, cast and streaming paths against the scripted stand-in server
+# rather than a real one, so the numbers don't move with the server. The
+# server gets a process of its own where there's fork, keeping its work off
+# this process's GVL. ROWS sets the rows per result, SOCKET=1 connects over
+# a Unix socket instead of TCP.
+rows = (ENV['ROWS'] || 1000).to_i
+socket = ENV['SOCKET'] && File.join(Dir.tmpdir, "mysql2-stand-in-#{Process.pid}.sock")
+server = StandInServer.new(port: socket ? nil : 0, socket: socket)
+server.script(/\ASELECT/, rows: rows)
+
+if RUBY_PLATFORM =~ /mswin|mingw/
+  server.start
+else
+  pid = fork { server.run }
+  at_exit do
+    Process.kill(:TERM, pid)
+    Process.wait(pid)
+    server.stop
+  end
+end
+
+client = if socket
+  Mysql2::Client.new(socket: socket, username: "root")
+else
+  Mysql2::Client.new(host: "127.0.0.1", port: server.port, username: "root")
+end
+sql = "SELECT * FROM stand_in"
+
+Benchmark.ips do |x|
+  x.report("cast") { client.query(sql).each {} }
+  x.report("cast, as: :array") { client.query(sql, as: :array).each {} }
+  x.report("cast: false") { client.query(sql, cast: false).each {} }
+  x.report("cache_rows: false") { client.query(sql, cache_rows: false).each {} }
+  x.report("stream") { client.query(sql, stream: true, cache_rows: false).each {} }
+
+  x.compare!
+end
@@ -0,0 +1,42 @@
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+require 'rubygems'
+require 'benchmark'
+require 'etc'
+require 'mysql2'
+
+# Row casting is CPU-bound Ruby work, so threads take turns on the GVL while
+# Ractors each have their own. Every worker owns one connection and fetches
+# and casts the same result QUERIES times. Run setup_db.rb first.
+Warning[:experimental] = false
+
+opts = { host: "localhost", username: "root", database: "test" }.freeze
+sql = "SELECT * FROM mysql2_test LIMIT 1000".freeze
+queries = (ENV['QUERIES'] || 50).to_i
+workers = (ENV['WORKERS'] || Etc.nprocessors).to_i
+
+module RactorBenchmark
+  def self.work(opts, sql, queries)
+    client = Mysql2::Client.new(opts)
+    rows = 0
+    queries.times { rows += client.query(sql, cache_rows: false).count { true } }
+    client.close
+    rows
+  end
+end
+
+Benchmark.bm(24) do |x|
+  x.report("1 thread") do
+    RactorBenchmark.work(opts, sql, queries * workers)
+  end
+
+  x.report("#{workers} threads") do
+    Array.new(workers) { Thread.new { RactorBenchmark.work(opts, sql, queries) } }.each(&:value)
+  end
+
+  x.report("#{workers} ractors") do
+    ractors = Array.new(workers) { Ractor.new(opts, sql, queries) { |o, s, n| RactorBenchmark.work(o, s, n) } }
+    # Ractor#value replaced Ractor#take in Ruby 4.0
+    ractors.each { |r| r.respond_to?(:value) ? r.value : r.take }
+  end
+end
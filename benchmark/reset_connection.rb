@@ -0,0 +1,32 @@
+$LOAD_PATH.unshift File.expand_path(File.dirname(__FILE__) + '/../lib')
+
+require 'rubygems'
+require 'benchmark/ips'
+require 'mysql2'
+
+# Ways to hand a pooled connection to its next user with a clean session.
+opts = { host: "localhost", username: "root", database: "test" }
+client = Mysql2::Client.new(opts)
+
+Benchmark.ips do |x|
+  x.report "reset_connection" do
+    client.reset_connection
+  end
+
+  x.report "SET battery" do
+    client.query("ROLLBACK")
+    client.query("SET @a = NULL, @b = NULL, @c = NULL")
+    client.query("SET SESSION sql_mode = DEFAULT, SESSION time_zone = DEFAULT, SESSION autocommit = 1")
+  end
+
+  x.report "reconnect" do
+    client.close
+    client = Mysql2::Client.new(opts)
+  end
+
+  x.report "reconnect (TLS)" do
+    Mysql2::Client.new(opts.merge(ssl_mode: :required)).close
+  end
+
+  x.compare!
+end
@@ -0,0 +1,396 @@
+require 'socket'
+
+# A deterministic stand-in for a MySQL server: it speaks just enough of the
+# client/server protocol for libmysqlclient and MariaDB Connector/C to
+# connect, then answers each COM_QUERY with a canned response. Results are
+# encoded once, when they are scripted, so serving one is a single write and
+# the numbers measure the client's fetch, cast and streaming paths rather
+# than a real server's variance.
+#
+#   server = StandInServer.new(port: 0)
+#   server.script(/\ASELECT/, columns: [[:id, :long], [:name, :varchar, 64]], rows: 1000)
+#   server.start
+#   client = Mysql2::Client.new(host: '127.0.0.1', port: server.port, username: 'root')
+#
+# Or stand-alone, for a client in another process:
+#
+#   ruby benchmark/stand_in_server.rb --port 3307 --rows 1000 --columns id:long,name:varchar:64
+#
+# Any credentials are accepted. There is no TLS, no protocol compression and
+# no binary protocol: prepared statements get an error.
+class StandInServer
+  SERVER_VERSION = "8.0.36-stand-in".freeze
+
+  # Deliberately without CLIENT_SSL, CLIENT_COMPRESS and
+  # CLIENT_DEPRECATE_EOF: the client settles for a plain connection and
+  # classic EOF-terminated result sets.
+  CAPABILITIES = 0x00000001 | # CLIENT_LONG_PASSWORD
+                 0x00000002 | # CLIENT_FOUND_ROWS
+                 0x00000004 | # CLIENT_LONG_FLAG
+                 0x00000008 | # CLIENT_CONNECT_WITH_DB
+                 0x00000200 | # CLIENT_PROTOCOL_41
+                 0x00000400 | # CLIENT_INTERACTIVE
+                 0x00002000 | # CLIENT_TRANSACTIONS
+                 0x00008000 | # CLIENT_SECURE_CONNECTION
+                 0x00010000 | # CLIENT_MULTI_STATEMENTS
+                 0x00020000 | # CLIENT_MULTI_RESULTS
+                 0x00080000 | # CLIENT_PLUGIN_AUTH
+                 0x00100000 | # CLIENT_CONNECT_ATTRS
+                 0x00200000   # CLIENT_PLUGIN_AUTH_LENENC_CLIENT_DATA
+
+  SERVER_STATUS_AUTOCOMMIT = 0x0002
+  MAX_PAYLOAD = 0xffffff
+  UTF8MB4_GENERAL_CI = 45
+  BINARY = 63
+  BINARY_FLAG = 128
+  NUM_FLAG = 32_768
+
+  COM_QUIT = 0x01
+  COM_INIT_DB = 0x02
+  COM_QUERY = 0x03
+  COM_PING = 0x0e
+  COM_STMT_CLOSE = 0x19
+  COM_SET_OPTION = 0x1b
+  COM_RESET_CONNECTION = 0x1f
+
+  EPOCH = Time.utc(2024, 1, 1)
+
+  # name => [field type, charset, flags, display length, decimals, value]
+  # The value block gets the row number and the column's size.
+  TYPES = {
+    tiny: [1, BINARY, NUM_FLAG, 4, 0, ->(i, _) { (i % 128).to_s }],
+    short: [2, BINARY, NUM_FLAG, 6, 0, ->(i, _) { (i % 32_768).to_s }],
+    long: [3, BINARY, NUM_FLAG, 11, 0, ->(i, _) { i.to_s }],
+    longlong: [8, BINARY, NUM_FLAG, 20, 0, ->(i, _) { (i * 1_000_003).to_s }],
+    float: [4, BINARY, NUM_FLAG, 12, 31, ->(i, _) { format('%.2f', i / 4.0) }],
+    double: [5, BINARY, NUM_FLAG, 22, 31, ->(i, _) { format('%.6f', i * 1.5) }],
+    decimal: [246, BINARY, NUM_FLAG, 12, 3, ->(i, _) { format('%d.%03d', i, i % 1000) }],
+    date: [10, BINARY, BINARY_FLAG, 10, 0, ->(i, _) { (EPOCH + (i * 86_400)).strftime('%Y-%m-%d') }],
+    datetime: [12, BINARY, BINARY_FLAG, 19, 0, ->(i, _) { (EPOCH + (i * 61)).strftime('%Y-%m-%d %H:%M:%S') }],
+    timestamp: [7, BINARY, BINARY_FLAG, 19, 0, ->(i, _) { (EPOCH + (i * 61)).strftime('%Y-%m-%d %H:%M:%S') }],
+    time: [11, BINARY, BINARY_FLAG, 10, 0, ->(i, _) { format('%02d:%02d:%02d', i / 3600 % 24, i / 60 % 60, i % 60) }],
+    year: [13, BINARY, NUM_FLAG, 4, 0, ->(i, _) { (1901 + (i % 255)).to_s }],
+    varchar: [253, UTF8MB4_GENERAL_CI, 0, 255, 31, ->(i, size) { text(i, size || 32) }],
+    char: [254, UTF8MB4_GENERAL_CI, 0, 40, 31, ->(i, size) { text(i, size || 10) }],
+    text: [252, UTF8MB4_GENERAL_CI, 0, 65_535, 31, ->(i, size) { text(i, size || 1024) }],
+    blob: [252, BINARY, BINARY_FLAG, 65_535, 0, ->(i, size) { Array.new(size || 1024) { |j| (i + j) & 0xff }.pack('C*') }],
+    json: [245, BINARY, BINARY_FLAG, 4_294_967_295, 0, ->(i, _) { %({"row": #{i}}) }],
+    null: [6, BINARY, BINARY_FLAG, 0, 0, ->(_, _) {}],
+  }.freeze
+
+  DEFAULT_COLUMNS = [
+    [:id, :long],
+    [:name, :varchar, 32],
+    [:amount, :decimal],
+    [:ratio, :double],
+    [:created_at, :datetime],
+    [:birthday, :date],
+    [:notes, :text, 256],
+    [:nothing, :null],
+  ].freeze
+
+  attr_reader :port, :socket
+
+  def self.text(row, size)
+    pattern = "row #{row} "
+    (pattern * ((size / pattern.bytesize) + 1))[0, size]
+  end
+
+  # Binds straight away (port: 0 picks a free one, see #port), so a client
+  # can be pointed at the server before it is started, or the server forked
+  # off into a process of its own.
+  def initialize(host: '127.0.0.1', port: nil, socket: nil, latency: 0, database: 'test')
+    @latency = latency
+    @database = database
+    @scripts = []
+    @listeners = []
+    @threads = []
+    @connection_id = 0
+    @mutex = Mutex.new
+
+    if port
+      @listeners << TCPServer.new(host, port)
+      @port = @listeners.last.addr[1]
+    end
+    if socket
+      File.unlink(socket) if File.socket?(socket)
+      @listeners << UNIXServer.new(socket)
+      @socket = socket
+    end
+    raise ArgumentError, "give a port:, a socket: or both" if @listeners.empty?
+
+    script(/\ASELECT @@max_allowed_packet\z/i, columns: [[:'@@max_allowed_packet', :longlong]], rows: [['67108864']])
+    script(/\A\s*(SET|USE|BEGIN|START|COMMIT|ROLLBACK|DO|KILL)\b/i, affected_rows: 0)
+  end
+
+  # Scripts the response to the queries +match+ (an exact String or a
+  # Regexp) picks out. Later scripts take precedence. The response is one of
+  #
+  # * a result set: columns: [[name, type, size], ...] (see TYPES; size is
+  #   the byte length of strings and blobs) and rows: either a count, the
+  #   values generated from the row number, or an Array of rows of Strings
+  #   and nils;
+  # * an OK packet: affected_rows: and insert_id:;
+  # * an error: error: [code, message] or error: [code, message, sqlstate].
+  #
+  # latency: (seconds) overrides the server's for this response.
+  def script(match, latency: nil, **response)
+    encoded = encode_response(response).freeze
+    @mutex.synchronize { @scripts.unshift([match, encoded, latency]) }
+    self
+  end
+
+  def start
+    @listeners.each do |listener|
+      @threads << Thread.new { accept_loop(listener) }
+    end
+    self
+  end
+
+  def run
+    start
+    @threads.first.join
+  end
+
+  def stop
+    @threads.each(&:kill)
+    @listeners.each do |listener|
+      begin
+        listener.close
+      rescue IOError
+        nil
+      end
+    end
+    File.unlink(@socket) if @socket && File.socket?(@socket)
+  end
+
+  private
+
+  def accept_loop(listener)
+    loop do
+      sock = listener.accept
+      sock.setsockopt(Socket::IPPROTO_TCP, Socket::TCP_NODELAY, 1) if sock.is_a?(TCPSocket)
+      @threads << Thread.new(sock) { |s| serve(s) }
+    end
+  rescue IOError
+    nil
+  end
+
+  def serve(sock)
+    return unless handshake(sock)
+
+    loop do
+      payload, = read_packet(sock)
+      break if payload.nil? || payload.getbyte(0) == COM_QUIT
+
+      command(sock, payload)
+    end
+  rescue IOError, SystemCallError
+    nil
+  ensure
+    sock.close unless sock.closed?
+  end
+
+  def handshake(sock)
+    nonce = Array.new(20) { |i| 0x21 + ((i * 7) % 90) }.pack('C*')
+    id = @mutex.synchronize { @connection_id += 1 }
+    greeting = [10].pack('C') + SERVER_VERSION + "\0" + [id].pack('V') + nonce[0, 8] + "\0" +
+               [CAPABILITIES & 0xffff, UTF8MB4_GENERAL_CI, SERVER_STATUS_AUTOCOMMIT, CAPABILITIES >> 16, 21].pack('vCvvC') +
+               "\0" * 10 + nonce[8, 12] + "\0" + "caching_sha2_password\0"
+    sock.write(packet(greeting, 0))
+
+    payload, seq = read_packet(sock)
+    return false if payload.nil?
+
+    plugin, auth = parse_handshake_response(payload)
+    seq += 1
+    # A caching_sha2_password scramble waits for the fast-auth verdict
+    # before the OK. An empty password sends no scramble (or a lone NUL),
+    # and mysql_native_password goes straight to the OK.
+    if plugin == 'caching_sha2_password' && auth.bytesize == 32
+      sock.write(packet("\x01\x03", seq))
+      seq += 1
+    end
+    sock.write(packet(ok_payload(0, 0), seq))
+    true
+  end
+
+  def parse_handshake_response(payload)
+    caps = payload.unpack('V').first
+    pos = 32
+    pos = payload.index("\0", pos) + 1 # user
+    if caps & 0x00200000 != 0
+      len, pos = read_lenenc(payload, pos)
+    elsif caps & 0x00008000 != 0
+      len = payload.getbyte(pos)
+      pos += 1
+    else
+      len = payload.index("\0", pos) - pos
+    end
+    auth = payload.byteslice(pos, len)
+    pos += len
+    pos += 1 if caps & 0x00208000 == 0
+    pos = payload.index("\0", pos) + 1 if caps & 0x00000008 != 0 && pos < payload.bytesize
+    plugin = payload.byteslice(pos, payload.index("\0", pos) - pos) if caps & 0x00080000 != 0 && pos < payload.bytesize
+    [plugin, auth]
+  end
+
+  def command(sock, payload)
+    case payload.getbyte(0)
+    when COM_QUERY
+      encoded, latency = lookup(payload.byteslice(1, payload.bytesize - 1))
+      sleep(latency) if latency > 0
+      sock.write(encoded)
+    when COM_INIT_DB, COM_PING, COM_SET_OPTION, COM_RESET_CONNECTION
+      sock.write(packet(ok_payload(0, 0), 1))
+    when COM_STMT_CLOSE
+      nil
+    else
+      sock.write(packet(err_payload(1047, "Unknown command", '08S01'), 1))
+    end
+  end
+
+  def lookup(sql)
+    sql.force_encoding(Encoding::UTF_8)
+    sql.force_encoding(Encoding::BINARY) unless sql.valid_encoding?
+    scripts = @mutex.synchronize { @scripts.dup }
+    scripts.each do |match, encoded, latency|
+      return [encoded, latency || @latency] if match.is_a?(Regexp) ? match =~ sql : match == sql
+    end
+    [packet(err_payload(1064, "No stand-in response scripted for: #{sql}", '42000'), 1), @latency]
+  end
+
+  def encode_response(response)
+    if response[:error]
+      code, message, state = response[:error]
+      packet(err_payload(code, message, state || 'HY000'), 1)
+    elsif response[:columns] || response[:rows]
+      encode_result_set(response[:columns] || DEFAULT_COLUMNS, response.fetch(:rows, 0))
+    else
+      packet(ok_payload(response.fetch(:affected_rows, 0), response.fetch(:insert_id, 0)), 1)
+    end
+  end
+
+  def encode_result_set(columns, rows)
+    columns = columns.map { |name, type, size| [name.to_s, TYPES.fetch(type.to_sym), size] }
+    rows = Array.new(rows) { |i| columns.map { |_, type, size| type[5].call(i + 1, size) } } if rows.is_a?(Integer)
+
+    payloads = [lenenc_int(columns.size)]
+    columns.each do |name, (type, charset, flags, length, decimals)|
+      payloads << lenenc_str('def') + lenenc_str(@database) + lenenc_str('stand_in') + lenenc_str('stand_in') +
+                  lenenc_str(name) + lenenc_str(name) + [0x0c, charset, length, type, flags, decimals, 0].pack('CvVCvCv')
+    end
+    payloads << eof_payload
+    rows.each do |row|
+      payloads << row.map { |value| value.nil? ? "\xfb".b : lenenc_str(value) }.join
+    end
+    payloads << eof_payload
+
+    seq = 1
+    payloads.map do |payload|
+      encoded = packet(payload, seq)
+      seq += (payload.bytesize / MAX_PAYLOAD) + 1
+      encoded
+    end.join
+  end
+
+  def read_packet(sock)
+    payload = ''.b
+    loop do
+      header = sock.read(4)
+      return nil if header.nil? || header.bytesize < 4
+
+      len = header.getbyte(0) | (header.getbyte(1) << 8) | (header.getbyte(2) << 16)
+      payload << sock.read(len) if len > 0
+      return [payload, header.getbyte(3)] if len < MAX_PAYLOAD
+    end
+  end
+
+  # Payloads of 16MB and up are split, each chunk taking the next sequence
+  # id.
+  def packet(payload, seq)
+    payload = payload.b
+    out = String.new(encoding: Encoding::BINARY)
+    offset = 0
+    loop do
+      chunk = payload.byteslice(offset, MAX_PAYLOAD) || ''.b
+      out << [chunk.bytesize & 0xffff, chunk.bytesize >> 16, seq & 0xff].pack('vCC') << chunk
+      offset += chunk.bytesize
+      seq += 1
+      return out if chunk.bytesize < MAX_PAYLOAD
+    end
+  end
+
+  def ok_payload(affected_rows, insert_id)
+    "\x00".b + lenenc_int(affected_rows) + lenenc_int(insert_id) + [SERVER_STATUS_AUTOCOMMIT, 0].pack('vv')
+  end
+
+  def eof_payload
+    [0xfe, 0, SERVER_STATUS_AUTOCOMMIT].pack('Cvv')
+  end
+
+  def err_payload(code, message, state)
+    [0xff, code].pack('Cv') + '#' + state + message.b
+  end
+
+  def lenenc_int(int)
+    if int < 251
+      [int].pack('C')
+    elsif int < 0x10000
+      [0xfc, int].pack('Cv')
+    elsif int < 0x1000000
+      [0xfd, int & 0xffff, int >> 16].pack('CvC')
+    else
+      [0xfe, int].pack('CQ<')
+    end
+  end
+
+  def lenenc_str(str)
+    str = str.b
+    lenenc_int(str.bytesize) + str
+  end
+
+  def read_lenenc(payload, pos)
+    first = payload.getbyte(pos)
+    case first
+    when 0xfc then [payload.byteslice(pos + 1, 2).unpack('v').first, pos + 3]
+    when 0xfd then [(payload.byteslice(pos + 1, 3) + "\0").unpack('V').first, pos + 4]
+    when 0xfe then [payload.byteslice(pos + 1, 8).unpack('Q<').first, pos + 9]
+    else [first, pos + 1]
+    end
+  end
+end
+
+if $PROGRAM_NAME == __FILE__
+  require 'optparse'
+
+  options = { port: 3307 }
+  columns = StandInServer::DEFAULT_COLUMNS
+  rows = 1000
+  match = /\A\s*SELECT/i
+  OptionParser.new do |opts|
+    opts.banner = "Usage: ruby #{File.basename(__FILE__)} [options]"
+    opts.on('--host HOST', 'TCP address to listen on (127.0.0.1)') { |v| options[:host] = v }
+    opts.on('--port PORT', Integer, 'TCP port to listen on (3307, 0 for none)') { |v| options[:port] = v.zero? ? nil : v }
+    opts.on('--socket PATH', 'Unix socket to listen on') { |v| options[:socket] = v }
+    opts.on('--rows N', Integer, 'rows in each result set (1000)') { |v| rows = v }
+    opts.on('--columns LIST', 'name:type[:size],... (see StandInServer::TYPES)') do |v|
+      columns = v.split(',').map do |column|
+        name, type, size = column.split(':')
+        [name, type.to_sym, size && Integer(size)]
+      end
+    end
+    opts.on('--latency SECONDS', Float, 'delay before each response (0)') { |v| options[:latency] = v }
+    opts.on('--match REGEXP', 'queries answered with the result set (any SELECT)') { |v| match = Regexp.new(v) }
+  end.parse!
+
+  server = StandInServer.new(**options)
+  server.script(match, columns: columns, rows: rows)
+  warn "stand-in server listening on #{[server.port && "port #{server.port}", server.socket].compact.join(' and ')}"
+  %w[INT TERM].each { |signal| trap(signal) { exit } }
+  begin
+    server.run
+  ensure
+    server.stop
+  end
+end
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <time.h>
 #include <errno.h>
+#include <math.h>
 #ifndef _WIN32
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -12,15 +13,30 @@
 #include <unistd.h>
 #endif
 #include <fcntl.h>
+#ifndef _WIN32
+#include <poll.h>
+#endif
+#ifdef HAVE_STRUCT_TCP_INFO_TCPI_SEGS_IN
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#endif
 #include "wait_for_single_fd.h"
 
 #include "mysql_enc_name_to_ruby.h"
 
 VALUE cMysql2Client;
-extern VALUE mMysql2, cMysql2Error, cMysql2ConnectionError, cMysql2TimeoutError;
-static VALUE sym_id, sym_version, sym_header_version, sym_async, sym_symbolize_keys, sym_as, sym_array, sym_stream;
+extern VALUE mMysql2, cMysql2Error, cMysql2ConnectionError, cMysql2TimeoutError, cMysql2ResultLimitError;
+static VALUE sym_id, sym_version, sym_header_version, sym_async, sym_symbolize_keys, sym_as, sym_array, sym_stream, sym_timeout,
+  sym_on_duplicate, sym_ignore, sym_replace, sym_update, sym_infile, sym_send, sym_server, sym_store, sym_cast,
+  sym_queries, sym_bytes_sent, sym_bytes_received, sym_packets_sent, sym_packets_received, sym_rows_fetched, sym_buffered_bytes,
+  sym_rows_materialized, sym_materialized_bytes, sym_max_result_rows, sym_max_result_bytes, sym_on_result_limit,
+  sym_raise, sym_spill, sym_compression, sym_tcp_bytes_sent, sym_tcp_bytes_received, sym_tcp_segments_sent,
+  sym_tcp_segments_received;
+static VALUE cBigDecimal, cDateTime, cDate;
 static ID intern_brackets, intern_merge, intern_merge_bang, intern_new_with_args,
-  intern_current_query_options, intern_read_timeout, intern_values;
+  intern_current_query_options, intern_read_timeout, intern_values, intern_close,
+  intern_to_s, intern_finite_p, intern_sec_fraction, intern_mul, intern_truncate, intern_usec, intern_sec,
+  intern_min, intern_hour, intern_day, intern_month, intern_year;
 
 #define REQUIRE_INITIALIZED(wrapper) \
   if (!wrapper->initialized) { \
@@ -45,6 +61,17 @@ static ID intern_brackets, intern_merge, intern_merge_bang, intern_new_with_args
     rb_raise(cMysql2Error, "MySQL connection is already open"); \
   }
 
+/* Whether an error number is the client library's own (errmsg.h) rather
+ * than one the server sent: server numbers sit on both sides of the CR_*
+ * range, with MySQL's 3000s and MariaDB's 4000s above it. Connector/C
+ * numbers its later client errors from CER_MIN_ERROR. */
+#ifdef CER_MIN_ERROR
+  #define MYSQL2_CLIENT_ERRNO_P(n) (((n) >= CR_MIN_ERROR && (n) <= CR_MAX_ERROR) || \
+                                    ((n) >= CER_MIN_ERROR && (n) <= CER_MAX_ERROR))
+#else
+  #define MYSQL2_CLIENT_ERRNO_P(n) ((n) >= CR_MIN_ERROR && (n) <= CR_MAX_ERROR)
+#endif
+
 /*
  * compatibility with mysql-connector-c, where LIBMYSQL_VERSION is the correct
  * variable to use, but MYSQL_SERVER_VERSION gives the correct numbers when
@@ -127,6 +154,7 @@ struct query_completion {
 
 struct nogvl_send_query_args {
   MYSQL *mysql;
+  VALUE self;
   VALUE sql;
   const char *sql_ptr;
   long sql_len;
@@ -144,6 +172,9 @@ struct nogvl_select_db_args {
 };
 
 static VALUE rb_mysql_client_close(VALUE self);
+static VALUE disconnect_and_mark_inactive(VALUE self);
+static int mysql2_next_result(VALUE self, mysql_client_wrapper *wrapper);
+static VALUE mysql2_next_result_reset_state(VALUE completionval);
 
 /*
  * ssl_mode: :verify_identity enforcement for MariaDB Connector/C.
@@ -481,6 +512,8 @@ static void rb_mysql_client_mark(void * wrapper) {
     rb_gc_mark_movable(w->active_fiber);
     rb_gc_mark_movable(w->prepared_statements);
     rb_gc_mark_movable(w->active_streaming_result);
+    rb_gc_mark_movable(w->infile_source);
+    rb_gc_mark_movable(w->infile_error);
   }
 }
 
@@ -492,7 +525,7 @@ static void rb_mysql_client_free(void *ptr) {
 
 static size_t rb_mysql_client_memsize(const void * wrapper) {
   const mysql_client_wrapper * w = wrapper;
-  return sizeof(*w);
+  return sizeof(*w) + (w->latency ? sizeof(*w->latency) : 0);
 }
 
 static void rb_mysql_client_compact(void * wrapper) {
@@ -502,6 +535,8 @@ static void rb_mysql_client_compact(void * wrapper) {
     rb_mysql2_gc_location(w->active_fiber);
     rb_mysql2_gc_location(w->prepared_statements);
     rb_mysql2_gc_location(w->active_streaming_result);
+    rb_mysql2_gc_location(w->infile_source);
+    rb_mysql2_gc_location(w->infile_error);
   }
 }
 
@@ -522,7 +557,9 @@ const rb_data_type_t rb_mysql_client_type = {
 #endif
 };
 
-VALUE rb_raise_mysql2_error(mysql_client_wrapper *wrapper) {
+/* The Mysql2::Error for the connection's last error, without raising it --
+ * Client#pipeline hands a failed statement's error back in its place. */
+static VALUE mysql2_client_error(mysql_client_wrapper *wrapper) {
   VALUE rb_error_msg = rb_str_new2(mysql_error(wrapper->client));
   VALUE rb_sql_state = rb_str_new2(mysql_sqlstate(wrapper->client));
   VALUE e;
@@ -535,7 +572,11 @@ VALUE rb_raise_mysql2_error(mysql_client_wrapper *wrapper) {
                  LONG2FIX(wrapper->server_version),
                  UINT2NUM(mysql_errno(wrapper->client)),
                  rb_sql_state);
-  rb_exc_raise(e);
+  return e;
+}
+
+VALUE rb_raise_mysql2_error(mysql_client_wrapper *wrapper) {
+  rb_exc_raise(mysql2_client_error(wrapper));
 }
 
 static void *nogvl_init(void *ptr) {
@@ -547,6 +588,14 @@ static void *nogvl_init(void *ptr) {
 
   if (client) mysql2_set_local_infile(client, wrapper);
 
+#ifdef MYSQL2_ASYNC_CONTEXT
+  /* Allocates the async context the _start/_cont calls run on. Blocking
+   * calls are unaffected by it, so it is enabled unconditionally. */
+  if (client && mysql_options(client, MYSQL_OPT_NONBLOCK, 0) == 0) {
+    wrapper->nonblocking = 1;
+  }
+#endif
+
   return (void*)(client ? Qtrue : Qfalse);
 }
 
@@ -629,6 +678,87 @@ static void invalidate_socket(mysql_client_wrapper *wrapper)
 }
 #endif /* _WIN32 */
 
+#if defined(MYSQL2_NONBLOCKING_QUERY_CONT) || defined(MYSQL2_NONBLOCKING_QUERY_POLL)
+struct nonblocking_connect_args {
+  VALUE self;
+  struct nogvl_connect_args *connect;
+  MYSQL *result;
+  int completed;
+};
+
+#ifdef MYSQL2_NONBLOCKING_QUERY_CONT
+static VALUE do_nonblocking_connect(VALUE argsval) {
+  struct nonblocking_connect_args *args = (void *)argsval;
+  struct nogvl_connect_args *c = args->connect;
+  int status;
+
+  status = mysql_real_connect_start(&args->result, c->mysql, c->host, c->user, c->passwd,
+                                    c->db, c->port, c->unix_socket, c->client_flag);
+  while (status) {
+    status = mysql_real_connect_cont(&args->result, c->mysql, mysql2_wait_for_async_status(args->self, c->mysql, status, 1));
+  }
+
+  args->completed = 1;
+  return Qnil;
+}
+#else
+static VALUE do_nonblocking_connect(VALUE argsval) {
+  struct nonblocking_connect_args *args = (void *)argsval;
+  struct nogvl_connect_args *c = args->connect;
+  enum net_async_status status;
+  /* Only the TCP connect waits to write: the handshake packets after it
+   * never fill a socket buffer, so every later wait is for the server's
+   * next packet. */
+  int wait = MYSQL_WAIT_WRITE;
+
+  while ((status = mysql_real_connect_nonblocking(c->mysql, c->host, c->user, c->passwd, c->db, c->port,
+                                                  c->unix_socket, c->client_flag)) == NET_ASYNC_NOT_READY) {
+    mysql2_wait_for_async_status(args->self, c->mysql, wait, 1);
+    wait = MYSQL_WAIT_READ;
+  }
+
+  args->result = status == NET_ASYNC_COMPLETE ? c->mysql : NULL;
+  args->completed = 1;
+  return Qnil;
+}
+#endif
+
+/* An interrupt mid-handshake leaves a half-open socket behind; drop it so
+ * nothing can mistake the handle for a connected one. */
+static VALUE nonblocking_connect_ensure(VALUE argsval) {
+  struct nonblocking_connect_args *args = (void *)argsval;
+
+  if (!args->completed) {
+    GET_CLIENT(args->self);
+    invalidate_socket(wrapper);
+  }
+  return Qnil;
+}
+#endif
+
+/* mysql_real_connect, through the connector's async context or
+ * libmysqlclient's nonblocking connect when there is one: the handshake's
+ * waits (TCP connect, greeting, TLS, auth) then happen in Ruby, so a Fiber
+ * scheduler runs other fibers meanwhile. Returns Qtrue or Qfalse. */
+static VALUE mysql2_connect(VALUE self, struct nogvl_connect_args *args) {
+#if defined(MYSQL2_NONBLOCKING_QUERY_CONT) || defined(MYSQL2_NONBLOCKING_QUERY_POLL)
+  GET_CLIENT(self);
+#ifdef MYSQL2_NONBLOCKING_QUERY_POLL
+  wrapper->nonblocking = !wrapper->reconnect_enabled;
+#endif
+  if (wrapper->nonblocking) {
+    struct nonblocking_connect_args nb_args;
+    nb_args.self = self;
+    nb_args.connect = args;
+    nb_args.result = NULL;
+    nb_args.completed = 0;
+    rb_ensure(do_nonblocking_connect, (VALUE)&nb_args, nonblocking_connect_ensure, (VALUE)&nb_args);
+    return nb_args.result ? Qtrue : Qfalse;
+  }
+#endif
+  return (VALUE)rb_thread_call_without_gvl(nogvl_connect, args, RUBY_UBF_IO, 0);
+}
+
 void mysql2_enqueue_pending_stmt_close(mysql_client_wrapper *wrapper, MYSQL_STMT *stmt, uintptr_t wrapper_key)
 {
   /* Deliberately plain malloc(), not Ruby's xmalloc(): this runs from a
@@ -653,6 +783,10 @@ static void *nogvl_stmt_close_raw(void *ptr) {
 void mysql2_reap_pending_stmt_closes(mysql_client_wrapper *wrapper)
 {
   mysql2_pending_stmt_close *node = wrapper->pending_stmt_closes;
+
+  if (node) {
+    MYSQL2_PROBE2(stmt__close__reap, mysql_thread_id(wrapper->client), wrapper->pending_stmt_close_count);
+  }
   wrapper->pending_stmt_closes = NULL;
   wrapper->pending_stmt_close_count = 0;
 
@@ -660,6 +794,8 @@ void mysql2_reap_pending_stmt_closes(mysql_client_wrapper *wrapper)
     mysql2_pending_stmt_close *next = node->next;
 
     if (wrapper->initialized && !wrapper->closed && CONNECTED(wrapper)) {
+      /* COM_STMT_CLOSE: the command byte and statement id, unanswered */
+      mysql2_net_count_command(wrapper, 1 + 4);
       rb_thread_call_without_gvl(nogvl_stmt_close_raw, node->stmt, RUBY_UBF_IO, 0);
     }
     rb_hash_delete(wrapper->prepared_statements, ULL2NUM((unsigned long long)node->wrapper_key));
@@ -712,6 +848,10 @@ static void *nogvl_free_result_raw(void *ptr) {
 void mysql2_reap_pending_result_frees(mysql_client_wrapper *wrapper)
 {
   mysql2_pending_result_free *node = wrapper->pending_result_frees;
+
+  if (node) {
+    MYSQL2_PROBE2(result__free__reap, mysql_thread_id(wrapper->client), wrapper->pending_result_free_count);
+  }
   wrapper->pending_result_frees = NULL;
   wrapper->pending_result_free_count = 0;
 
@@ -739,9 +879,70 @@ void mysql2_reap_pending_result_frees(mysql_client_wrapper *wrapper)
 void mysql2_abandon_active_stream(mysql_client_wrapper *wrapper)
 {
   if (wrapper->state == MYSQL2_CLIENT_STREAMING && wrapper->active_streaming_result != Qnil) {
+    MYSQL2_PROBE1(stream__abandon, mysql_thread_id(wrapper->client));
     mysql2_result_force_free(wrapper->active_streaming_result);
     wrapper->active_streaming_result = Qnil;
+    MYSQL2_PROBE1(stream__drained, mysql_thread_id(wrapper->client));
+  }
+}
+
+/* See client.h. */
+int mysql2_client_probe_idle(mysql_client_wrapper *wrapper)
+{
+  if (!wrapper->initialized || wrapper->closed || !CONNECTED(wrapper)) {
+    return 0;
+  }
+  if (!NIL_P(wrapper->active_fiber) || wrapper->state != MYSQL2_CLIENT_IDLE ||
+      mysql2_forked_without_reconnect(wrapper)) {
+    return 0;
+  }
+#ifndef _WIN32
+  {
+    struct pollfd pfd;
+    int rv;
+
+    pfd.fd = wrapper->client->net.fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    rv = poll(&pfd, 1, 0);
+    if (rv == 0) {
+      return 1;
+    }
+    return rv < 0 ? -1 : 0;
+  }
+#else
+  return -1;
+#endif
+}
+
+/* See client.h. */
+int mysql2_client_async_socket(mysql_client_wrapper *wrapper, int *in_flight)
+{
+  *in_flight = 0;
+  if (!wrapper->initialized || wrapper->closed || !CONNECTED(wrapper)) {
+    return -1;
+  }
+  *in_flight = !NIL_P(wrapper->active_fiber) && wrapper->state == MYSQL2_CLIENT_QUERYING;
+  return wrapper->client->net.fd;
+}
+
+/* See client.h. */
+int mysql2_client_reset_for_reuse(mysql_client_wrapper *wrapper)
+{
+  if (!wrapper->initialized || wrapper->closed || !CONNECTED(wrapper)) {
+    return 0;
   }
+  if (!NIL_P(wrapper->active_fiber) || wrapper->state == MYSQL2_CLIENT_QUERYING ||
+      mysql_more_results(wrapper->client)) {
+    return 0;
+  }
+
+  mysql2_abandon_active_stream(wrapper);
+  mysql2_reap_pending_result_frees(wrapper);
+  mysql2_reap_pending_stmt_closes(wrapper);
+  wrapper->state = MYSQL2_CLIENT_IDLE;
+
+  return 1;
 }
 
 /* See client.h. */
@@ -765,9 +966,34 @@ void mysql2_warn_forked_without_reconnect(mysql_client_wrapper *wrapper, const c
 #endif
 }
 
+/* Closes the KILL QUERY side connection, if one was opened. One inherited
+ * across a fork() is only let go of, never QUIT: the process that opened
+ * it still owns the session. Pure C, so it can run without the GVL. */
+static void mysql2_close_killer(mysql_client_wrapper *wrapper) {
+  MYSQL *killer = wrapper->killer;
+
+  if (!killer) {
+    return;
+  }
+  wrapper->killer = NULL;
+
+#ifndef _WIN32
+  if (wrapper->killer_pid != getpid() && killer->net.fd != -1) {
+    if (invalidate_fd(killer->net.fd) == Qfalse) {
+      close(killer->net.fd);
+    }
+    killer->net.fd = -1;
+  }
+#endif
+
+  mysql_close(killer);
+}
+
 static void *nogvl_close(void *ptr) {
   mysql_client_wrapper *wrapper = ptr;
 
+  mysql2_close_killer(wrapper);
+
   if (wrapper->initialized && !wrapper->closed) {
     mysql_close(wrapper->client);
     wrapper->closed = 1;
@@ -861,6 +1087,7 @@ void decr_mysql2_client(mysql_client_wrapper *wrapper)
 
   nogvl_close(wrapper);
   xfree(wrapper->client);
+  xfree(wrapper->latency);
   xfree(wrapper);
 }
 
@@ -876,17 +1103,35 @@ static VALUE allocate(VALUE klass) {
   wrapper->active_fiber = Qnil;
   wrapper->prepared_statements = rb_hash_new();
   wrapper->active_streaming_result = Qnil;
+  wrapper->infile_source = Qnil;
+  wrapper->infile_gvl_released = 0;
+  wrapper->infile_state = 0;
+  wrapper->infile_error = Qnil;
   wrapper->automatic_close = 1;
   wrapper->server_version = 0;
   wrapper->reconnect_enabled = 0;
   wrapper->connect_timeout = 0;
+  wrapper->write_timeout = 0;
   wrapper->initialized = 0; /* will be set true after calling mysql_init */
   wrapper->closed = 1; /* will be set false after calling mysql_real_connect */
   wrapper->tls_verify_identity = 0;
   wrapper->tls_identity_verified = 0;
+  wrapper->nonblocking = 0;
   wrapper->refcount = 1;
   wrapper->affected_rows = -1;
   wrapper->query_start = 0;
+  wrapper->send_end = 0;
+  wrapper->latency = NULL;
+  wrapper->queries = 0;
+  wrapper->rows_fetched = 0;
+  wrapper->rows_materialized = 0;
+  wrapper->materialized_bytes = 0;
+  wrapper->buffered_bytes = 0;
+  wrapper->bytes_sent = 0;
+  wrapper->packets_sent = 0;
+  wrapper->packets_received = 0;
+  wrapper->payload_received = 0;
+  wrapper->pkt_nr_seen = 0;
   wrapper->client = (MYSQL*)xmalloc(sizeof(MYSQL));
   wrapper->state = MYSQL2_CLIENT_IDLE;
   wrapper->connect_pid = 0; /* 0 means never successfully connected */
@@ -894,6 +1139,8 @@ static VALUE allocate(VALUE klass) {
   wrapper->pending_stmt_close_count = 0;
   wrapper->pending_result_frees = NULL;
   wrapper->pending_result_free_count = 0;
+  wrapper->killer = NULL;
+  wrapper->killer_pid = 0;
 
   return obj;
 }
@@ -1167,7 +1414,7 @@ static VALUE rb_mysql_connect(VALUE self, VALUE user, VALUE pass, VALUE host, VA
 
   if (wrapper->connect_timeout)
     time(&start_time);
-  rv = (VALUE) rb_thread_call_without_gvl(nogvl_connect, &args, RUBY_UBF_IO, 0);
+  rv = mysql2_connect(self, &args);
   if (rv == Qfalse) {
     while (rv == Qfalse && errno == EINTR) {
       if (wrapper->connect_timeout) {
@@ -1185,7 +1432,7 @@ static VALUE rb_mysql_connect(VALUE self, VALUE user, VALUE pass, VALUE host, VA
         mysql_options(wrapper->client, MYSQL_OPT_CONNECT_TIMEOUT, &connect_timeout);
       }
       errno = 0;
-      rv = (VALUE) rb_thread_call_without_gvl(nogvl_connect, &args, RUBY_UBF_IO, 0);
+      rv = mysql2_connect(self, &args);
     }
     /* restore the connect timeout for reconnecting */
     if (wrapper->connect_timeout)
@@ -1212,6 +1459,8 @@ static VALUE rb_mysql_connect(VALUE self, VALUE user, VALUE pass, VALUE host, VA
   wrapper->connect_pid = getpid();
 #endif
   wrapper->server_version = mysql_get_server_version(wrapper->client);
+  /* The handshake isn't one of this client's commands. */
+  wrapper->pkt_nr_seen = wrapper->client->net.pkt_nr;
 
 #ifdef MYSQL2_VERIFY_IDENTITY_SHIM
   /* Tripwire for the #879 bug class: verify_identity enforcement was
@@ -1372,6 +1621,51 @@ double mysql2_monotonic_now(void) {
 #endif
 }
 
+/* The bucket an interval of usec microseconds is counted in; see
+ * mysql2_latency_histogram. */
+static int mysql2_latency_bucket(unsigned long long usec) {
+  int exp = MYSQL2_LATENCY_SUB_BITS;
+
+  if (usec < MYSQL2_LATENCY_SUB_BUCKETS) {
+    return (int)usec;
+  }
+  if (usec >> MYSQL2_LATENCY_MAX_EXP) {
+    return MYSQL2_LATENCY_BUCKETS - 1;
+  }
+  while (usec >> (exp + 1)) {
+    exp++;
+  }
+  return (exp - MYSQL2_LATENCY_SUB_BITS + 1) * MYSQL2_LATENCY_SUB_BUCKETS +
+    (int)(usec >> (exp - MYSQL2_LATENCY_SUB_BITS)) - MYSQL2_LATENCY_SUB_BUCKETS;
+}
+
+/* The upper bound, in microseconds, of the values counted in bucket. */
+static double mysql2_latency_bucket_upper(int bucket) {
+  int exp, sub;
+
+  if (bucket < MYSQL2_LATENCY_SUB_BUCKETS) {
+    return bucket + 1;
+  }
+  if (bucket == MYSQL2_LATENCY_BUCKETS - 1) {
+    return HUGE_VAL;
+  }
+  exp = bucket / MYSQL2_LATENCY_SUB_BUCKETS + MYSQL2_LATENCY_SUB_BITS - 1;
+  sub = bucket % MYSQL2_LATENCY_SUB_BUCKETS + MYSQL2_LATENCY_SUB_BUCKETS;
+  return ldexp(sub + 1, exp - MYSQL2_LATENCY_SUB_BITS);
+}
+
+void mysql2_latency_record(mysql_client_wrapper *wrapper, mysql2_latency_phase_t phase, double start, double end) {
+  double elapsed = end - start;
+
+  if (start < 0 || end < 0) {
+    return;
+  }
+  if (wrapper->latency == NULL) {
+    wrapper->latency = xcalloc(1, sizeof(mysql2_latency_histogram));
+  }
+  wrapper->latency->counts[phase][mysql2_latency_bucket(elapsed > 0 ? (unsigned long long)(elapsed * 1000000.0) : 0)]++;
+}
+
 /*
  * mysql_send_query is unlikely to block since most queries are small
  * enough to fit in a socket buffer, but sometimes large UPDATE and
@@ -1386,21 +1680,57 @@ static void *nogvl_send_query(void *ptr) {
   return (void*)(rv == 0 ? Qtrue : Qfalse);
 }
 
+/* mysql_send_query through the nonblocking API where there is one: a query
+ * large enough to fill the socket buffer then waits for writability in
+ * Ruby -- interruptibly, and yielding to a Fiber scheduler -- instead of
+ * inside the client library. Returns Qtrue or Qfalse. */
+static VALUE mysql2_send_query(struct nogvl_send_query_args *args) {
+#if defined(MYSQL2_NONBLOCKING_QUERY_CONT)
+  GET_CLIENT(args->self);
+  if (wrapper->nonblocking) {
+    int ret = 0;
+    int status = mysql_send_query_start(&ret, args->mysql, args->sql_ptr, args->sql_len);
+    while (status) {
+      status = mysql_send_query_cont(&ret, args->mysql, mysql2_wait_for_async_status(args->self, args->mysql, status, 0));
+    }
+    return ret == 0 ? Qtrue : Qfalse;
+  }
+#elif defined(MYSQL2_NONBLOCKING_QUERY_POLL)
+  GET_CLIENT(args->self);
+  if (wrapper->nonblocking) {
+    enum net_async_status status;
+    while ((status = mysql_send_query_nonblocking(args->mysql, args->sql_ptr, args->sql_len)) == NET_ASYNC_NOT_READY) {
+      mysql2_wait_for_async_status(args->self, args->mysql, MYSQL_WAIT_WRITE, 0);
+    }
+    return status == NET_ASYNC_COMPLETE ? Qtrue : Qfalse;
+  }
+#endif
+  return (VALUE)rb_thread_call_without_gvl(nogvl_send_query, args, RUBY_UBF_IO, 0);
+}
+
 static VALUE do_send_query(VALUE args) {
   struct nogvl_send_query_args *query_args = (void *)args;
   mysql_client_wrapper *wrapper = query_args->completion.wrapper;
-  if ((VALUE)rb_thread_call_without_gvl(nogvl_send_query, query_args, RUBY_UBF_IO, 0) == Qfalse) {
+
+  MYSQL2_PROBE2(query__send, mysql_thread_id(wrapper->client), query_args->sql_len);
+  /* COM_QUERY: the command byte, then the statement text */
+  mysql2_net_count_command(wrapper, 1 + (unsigned long long)query_args->sql_len);
+  if (mysql2_send_query(query_args) == Qfalse) {
     /* An error occurred: raise it and let disconnect_query_if_incomplete
      * (this call's rb_ensure companion) do the cleanup, same as any other
      * kind of unwind out of this function. */
     rb_raise_mysql2_error(wrapper);
   }
   query_args->completion.completed = 1;
+  wrapper->queries++;
+  wrapper->send_end = mysql2_monotonic_now();
+  mysql2_latency_record(wrapper, MYSQL2_LATENCY_SEND, wrapper->query_start, wrapper->send_end);
   return Qnil;
 }
 
 struct nogvl_read_query_result_args {
   MYSQL *mysql;
+  mysql_client_wrapper *wrapper; /* set by mysql2_read_query_result */
   /* Round-trip close stamp, taken while the GVL is still released: under
    * contention, reacquisition means queueing behind every runnable thread,
    * and a stamp taken after it would charge that wait to the server. */
@@ -1414,22 +1744,49 @@ struct nogvl_read_query_result_args {
  */
 static void *nogvl_read_query_result(void *ptr) {
   struct nogvl_read_query_result_args *args = ptr;
-  my_bool res = mysql_read_query_result(args->mysql);
+  my_bool res;
+
+  args->wrapper->infile_gvl_released = 1;
+  res = mysql_read_query_result(args->mysql);
+  args->wrapper->infile_gvl_released = 0;
 
   args->query_end = mysql2_monotonic_now();
 
   return (void *)(res == 0 ? Qtrue : Qfalse);
 }
 
-static void *nogvl_do_result(void *ptr, char use_result) {
-  mysql_client_wrapper *wrapper = ptr;
-  MYSQL_RES *result;
-
-  if (use_result) {
-    result = mysql_use_result(wrapper->client);
-  } else {
-    result = mysql_store_result(wrapper->client);
+/* mysql_read_query_result, waiting in Ruby when the connector can suspend
+ * it (see MYSQL2_NONBLOCKING_QUERY_POLL for why libmysqlclient can't).
+ * Returns Qtrue or Qfalse. A LOAD DATA LOCAL INFILE reading from a Ruby
+ * source always takes the blocking path: the source is read by re-taking
+ * the GVL from inside the client library's infile callbacks (infile.c),
+ * which only works from a thread that released it, not from the
+ * connector's own coroutine stack. */
+static VALUE mysql2_read_query_result(VALUE self, struct nogvl_read_query_result_args *args) {
+  VALUE ok;
+  GET_CLIENT(self);
+  args->wrapper = wrapper;
+#ifdef MYSQL2_NONBLOCKING_QUERY_CONT
+  if (wrapper->nonblocking && NIL_P(wrapper->infile_source)) {
+    my_bool ret = 0;
+    int status = mysql_read_query_result_start(&ret, args->mysql);
+    while (status) {
+      status = mysql_read_query_result_cont(&ret, args->mysql, mysql2_wait_for_async_status(self, args->mysql, status, 0));
+    }
+    args->query_end = mysql2_monotonic_now();
+    MYSQL2_PROBE2(query__first__byte, mysql_thread_id(args->mysql), ret == 0);
+    return ret == 0 ? Qtrue : Qfalse;
   }
+#endif
+  ok = (VALUE)rb_thread_call_without_gvl(nogvl_read_query_result, args, RUBY_UBF_IO, 0);
+  MYSQL2_PROBE2(query__first__byte, mysql_thread_id(args->mysql), ok == Qtrue);
+  mysql2_infile_rethrow(wrapper);
+  return ok;
+}
+
+static void *nogvl_use_result(void *ptr) {
+  mysql_client_wrapper *wrapper = ptr;
+  MYSQL_RES *result = mysql_use_result(wrapper->client);
 
   /* once our result is stored off, this connection is
      ready for another command to be issued */
@@ -1438,13 +1795,71 @@ static void *nogvl_do_result(void *ptr, char use_result) {
   return result;
 }
 
-/* mysql_store_result may (unlikely) read rows off the socket */
+struct nogvl_store_result_args {
+  mysql_client_wrapper *wrapper;
+  MYSQL_RES *result;
+  size_t rows_memsize;
+  unsigned long long payload; /* of the rows' packets; see result.h */
+};
+
+/* Measures the rows of args->result while the GVL is still released, so a
+ * large result isn't walked a second time with it held. */
+static void *nogvl_measure_result(void *ptr) {
+  struct nogvl_store_result_args *args = ptr;
+
+  args->payload = 0;
+  args->rows_memsize = args->result ? mysql2_buffered_rows_memsize(args->result, &args->payload) : 0;
+  return NULL;
+}
+
+/* mysql_store_result may (unlikely) read rows off the socket. Leaves
+ * active_fiber alone, for callers that hold the claim across several
+ * result sets. */
+static void *nogvl_store_result_measured(void *ptr) {
+  struct nogvl_store_result_args *args = ptr;
+
+  args->result = mysql_store_result(args->wrapper->client);
+  return nogvl_measure_result(args);
+}
+
 static void *nogvl_store_result(void *ptr) {
-  return nogvl_do_result(ptr, 0);
+  struct nogvl_store_result_args *args = ptr;
+
+  nogvl_store_result_measured(args);
+  /* once our result is stored off, this connection is
+     ready for another command to be issued */
+  args->wrapper->active_fiber = Qnil;
+  return NULL;
 }
 
-static void *nogvl_use_result(void *ptr) {
-  return nogvl_do_result(ptr, 1);
+/* mysql_store_result, waiting for rows in Ruby where the client library can
+ * suspend it. Releases the claim once stored, same as nogvl_store_result.
+ * Fills in args->result and args->rows_memsize. */
+static void mysql2_store_result(VALUE self, mysql_client_wrapper *wrapper, struct nogvl_store_result_args *args) {
+  args->wrapper = wrapper;
+  args->result = NULL;
+  args->rows_memsize = 0;
+  args->payload = 0;
+#if defined(MYSQL2_NONBLOCKING_QUERY_CONT) || defined(MYSQL2_NONBLOCKING_QUERY_POLL)
+  if (wrapper->nonblocking) {
+#ifdef MYSQL2_NONBLOCKING_QUERY_CONT
+    int status = mysql_store_result_start(&args->result, wrapper->client);
+    while (status) {
+      status = mysql_store_result_cont(&args->result, wrapper->client, mysql2_wait_for_async_status(self, wrapper->client, status, 0));
+    }
+#else
+    while (mysql_store_result_nonblocking(wrapper->client, &args->result) == NET_ASYNC_NOT_READY) {
+      mysql2_wait_for_async_status(self, wrapper->client, MYSQL_WAIT_READ, 0);
+    }
+#endif
+    wrapper->active_fiber = Qnil;
+    if (args->result && mysql_num_rows(args->result) > 0) {
+      rb_thread_call_without_gvl(nogvl_measure_result, args, RUBY_UBF_IO, 0);
+    }
+    return;
+  }
+#endif
+  rb_thread_call_without_gvl(nogvl_store_result, args, RUBY_UBF_IO, 0);
 }
 
 /* Unlike nogvl_store_result above, leaves active_fiber alone: the drain loop
@@ -1455,23 +1870,312 @@ static void *nogvl_store_result_raw(void *ptr) {
   return mysql_store_result(wrapper->client);
 }
 
+/* The :max_result_rows/:max_result_bytes budget a query's buffered result
+ * sets are held to, what :on_result_limit says to do past it, and where
+ * :spill puts their rows. */
+struct mysql2_result_budget {
+  unsigned long long max_rows;  /* 0 for no limit */
+  unsigned long long max_bytes; /* 0 for no limit */
+  int stream_on_limit;
+  VALUE spill_dir; /* frozen String, Qnil without :spill */
+};
+
+static unsigned long long mysql2_result_budget_limit(VALUE opts, VALUE key) {
+  VALUE val = rb_hash_aref(opts, key);
+  long long limit;
+
+  if (NIL_P(val)) {
+    return 0;
+  }
+  if (!RB_INTEGER_TYPE_P(val)) {
+    rb_raise(rb_eTypeError, "%" PRIsVALUE " must be an Integer", rb_sym2str(key));
+  }
+  limit = NUM2LL(val);
+  if (limit <= 0) {
+    rb_raise(rb_eArgError, "%" PRIsVALUE " must be positive (got %lld)", rb_sym2str(key), limit);
+  }
+  return (unsigned long long)limit;
+}
+
+/* Parses the budget out of a query's options, raising ArgumentError for bad
+ * values. Returns whether the result sets need spooling at all. Called from
+ * rb_mysql_query before the send, so the call in mysql2_fetch_result_set,
+ * after it, cannot raise. */
+static int mysql2_result_budget_from_options(VALUE opts, struct mysql2_result_budget *budget) {
+  VALUE on_limit = rb_hash_aref(opts, sym_on_result_limit);
+  VALUE spill = rb_hash_aref(opts, sym_spill);
+
+  budget->max_rows = mysql2_result_budget_limit(opts, sym_max_result_rows);
+  budget->max_bytes = mysql2_result_budget_limit(opts, sym_max_result_bytes);
+  if (!NIL_P(on_limit) && on_limit != sym_raise && on_limit != sym_stream) {
+    rb_raise(rb_eArgError, "on_result_limit must be :raise or :stream, you passed %" PRIsVALUE, on_limit);
+  }
+  budget->stream_on_limit = on_limit == sym_stream;
+
+  /* spill: true puts the temp file in $TMPDIR (or /tmp), spill: "dir" in
+   * dir. */
+  budget->spill_dir = Qnil;
+  if (RTEST(spill)) {
+#ifdef _WIN32
+    rb_raise(rb_eNotImpError, ":spill is not supported on Windows");
+#else
+    if (spill == Qtrue) {
+      const char *tmpdir = getenv("TMPDIR");
+      budget->spill_dir = rb_str_new_cstr(tmpdir && *tmpdir ? tmpdir : "/tmp");
+    } else if (RB_TYPE_P(spill, T_STRING)) {
+      budget->spill_dir = rb_str_new_frozen(spill);
+    } else {
+      rb_raise(rb_eTypeError, "spill must be true or a directory name, you passed %" PRIsVALUE, spill);
+    }
+    StringValueCStr(budget->spill_dir);
+#endif
+  }
+  return budget->max_rows || budget->max_bytes || !NIL_P(budget->spill_dir);
+}
+
+struct nogvl_spool_result_args {
+  mysql_client_wrapper *wrapper;
+  const struct mysql2_result_budget *budget;
+  const char *spill_dir;
+  MYSQL_RES *result;
+  mysql2_row_spool *spool;
+  int spool_errno; /* the spool's own failure, not the connection's */
+  int exceeded;
+  unsigned long long payload; /* of the fields and spooled rows' packets */
+  struct query_completion completion;
+};
+
+/* mysql_use_result, then rows into a spool until the result set ends or
+ * outgrows the budget -- the row over it is kept, so a fallback to
+ * streaming loses nothing. Unlike nogvl_use_result this keeps the claim:
+ * the rows are still coming off the connection. */
+static void *nogvl_spool_result(void *ptr) {
+  struct nogvl_spool_result_args *args = ptr;
+  MYSQL *client = args->wrapper->client;
+  const struct mysql2_result_budget *budget = args->budget;
+  MYSQL_ROW row;
+
+  args->result = mysql_use_result(client);
+  if (args->result == NULL) {
+    return NULL;
+  }
+  args->payload = mysql2_fields_payload(args->result);
+  args->spool = mysql2_spool_new(mysql_num_fields(args->result), args->spill_dir);
+  if (args->spool == NULL) {
+    args->spool_errno = errno ? errno : ENOMEM;
+    return NULL;
+  }
+  while ((row = mysql_fetch_row(args->result)) != NULL) {
+    unsigned long *lengths = mysql_fetch_lengths(args->result);
+
+    args->payload += mysql2_text_row_payload(row, lengths, mysql_num_fields(args->result));
+    if (mysql2_spool_push(args->spool, row, lengths)) {
+      args->spool_errno = errno;
+      return NULL;
+    }
+    if ((budget->max_rows && args->spool->rows > budget->max_rows) ||
+        (budget->max_bytes && args->spool->bytes > budget->max_bytes)) {
+      args->exceeded = 1;
+      break;
+    }
+  }
+  if ((!args->exceeded || budget->stream_on_limit) && mysql2_spool_finish(args->spool)) {
+    args->spool_errno = errno;
+  }
+  return NULL;
+}
+
+static VALUE do_spool_result(VALUE argsval) {
+  struct nogvl_spool_result_args *args = (void *)argsval;
+
+  rb_thread_call_without_gvl(nogvl_spool_result, args, RUBY_UBF_IO, 0);
+  args->completion.completed = 1;
+  return Qnil;
+}
+
+/* rb_ensure companion for do_spool_result: an interrupt that lands while
+ * rows are being read leaves the connection to disconnect_and_mark_inactive,
+ * which invalidates it, so the result is freed without draining it first --
+ * the same status reset that function makes. */
+static VALUE mysql2_spool_result_interrupted(VALUE argsval) {
+  struct nogvl_spool_result_args *args = (void *)argsval;
+
+  if (!args->completion.completed) {
+    mysql2_spool_free(args->spool);
+    args->spool = NULL;
+    if (args->result) {
+      args->wrapper->client->status = MYSQL_STATUS_READY;
+      mysql_free_result(args->result);
+      args->result = NULL;
+    }
+  }
+  return Qnil;
+}
+
+/* Reads and discards whatever is left of a result set that won't be
+ * returned. Clears args->result from inside the call, so the ensure below
+ * can tell a finished drain from one an already-pending interrupt skipped
+ * -- both surface as the same raise. */
+static void *nogvl_drain_spooled_result(void *ptr) {
+  struct nogvl_spool_result_args *args = ptr;
+
+  mysql_free_result(args->result);
+  args->result = NULL;
+  return NULL;
+}
+
+static VALUE do_drain_spooled_result(VALUE argsval) {
+  rb_thread_call_without_gvl(nogvl_drain_spooled_result, (void *)argsval, RUBY_UBF_IO, 0);
+  return Qnil;
+}
+
+/* rb_ensure companion for do_drain_spooled_result: the claim is held until
+ * the drain is over, so no other thread sends a command into the rows still
+ * arriving. A drain that didn't finish leaves the connection mid-result set,
+ * so it is invalidated and the result freed without reading the rest. */
+static VALUE mysql2_drain_spooled_result_done(VALUE argsval) {
+  struct nogvl_spool_result_args *args = (void *)argsval;
+  mysql_client_wrapper *wrapper = args->wrapper;
+
+  if (args->result) {
+    mysql2_invalidate_after_interrupted_query(wrapper);
+    wrapper->client->status = MYSQL_STATUS_READY;
+    mysql_free_result(args->result);
+    args->result = NULL;
+  } else {
+    wrapper->active_fiber = Qnil;
+    wrapper->state = MYSQL2_CLIENT_IDLE;
+  }
+  return Qnil;
+}
+
+/* mysql2_fetch_result_set for a query with a budget or :spill: read the
+ * result set with mysql_use_result into a spool (spool.h) instead of letting
+ * mysql_store_result buffer all of it. Within budget, the Result iterates
+ * the spool as it would stored rows. Past it, either the rest of the result
+ * set is drained and discarded and Mysql2::Error::ResultLimitError raised,
+ * leaving the connection ready for the next command, or (on_result_limit:
+ * :stream) the Result carries on as a stream: true one, spooled rows first. */
+static VALUE mysql2_fetch_spooled_result_set(VALUE self, mysql_client_wrapper *wrapper, VALUE opts,
+                                             const struct mysql2_result_budget *budget, double query_elapsed) {
+  struct nogvl_spool_result_args args;
+  VALUE resultObj, current, spill_dir = budget->spill_dir;
+  double store_start = mysql2_monotonic_now();
+
+  args.wrapper = wrapper;
+  args.budget = budget;
+  args.spill_dir = NIL_P(spill_dir) ? NULL : RSTRING_PTR(spill_dir);
+  args.result = NULL;
+  args.spool = NULL;
+  args.spool_errno = 0;
+  args.exceeded = 0;
+  args.payload = 0;
+  args.completion.wrapper = wrapper;
+  args.completion.completed = 0;
+  rb_ensure(do_spool_result, (VALUE)&args, mysql2_spool_result_interrupted, (VALUE)&args);
+
+  mysql2_latency_record(wrapper, MYSQL2_LATENCY_STORE, store_start, mysql2_monotonic_now());
+  wrapper->affected_rows = mysql_affected_rows(wrapper->client);
+  if (args.spool) {
+    wrapper->rows_fetched += args.spool->rows;
+  }
+  wrapper->payload_received += args.payload;
+
+  if (args.result == NULL) {
+    wrapper->active_fiber = Qnil;
+    wrapper->state = MYSQL2_CLIENT_IDLE;
+    if (mysql_errno(wrapper->client) != 0) {
+      rb_raise_mysql2_error(wrapper);
+    }
+    return Qnil;
+  }
+
+  if (args.spool_errno || (args.exceeded && !budget->stream_on_limit) ||
+      (!args.exceeded && mysql_errno(wrapper->client) != 0)) {
+    unsigned long rows = args.spool ? args.spool->rows : 0;
+
+    mysql2_spool_free(args.spool);
+    args.spool = NULL;
+    rb_ensure(do_drain_spooled_result, (VALUE)&args, mysql2_drain_spooled_result_done, (VALUE)&args);
+    mysql2_reap_pending_result_frees(wrapper);
+    mysql2_reap_pending_stmt_closes(wrapper);
+
+    if (args.spool_errno == ENOMEM) {
+      rb_memerror();
+    }
+    if (args.spool_errno) {
+      errno = args.spool_errno;
+      rb_sys_fail_str(spill_dir);
+    }
+    if (args.exceeded) {
+      if (budget->max_rows && rows > budget->max_rows) {
+        rb_raise(cMysql2ResultLimitError, "Result set exceeded max_result_rows (%llu); the rest of it was discarded", budget->max_rows);
+      }
+      rb_raise(cMysql2ResultLimitError, "Result set exceeded max_result_bytes (%llu) after %lu rows; the rest of it was discarded",
+               budget->max_bytes, rows);
+    }
+    rb_raise_mysql2_error(wrapper);
+  }
+
+  wrapper->active_fiber = Qnil;
+  MYSQL2_PROBE2(result__stored, mysql_thread_id(wrapper->client), args.spool->rows);
+  current = rb_hash_dup(opts);
+  if (args.exceeded) {
+    /* The cursor is still open, exactly as if stream: true had been asked
+     * for up front. */
+    rb_hash_aset(current, sym_stream, Qtrue);
+    wrapper->state = MYSQL2_CLIENT_STREAMING;
+  } else {
+    wrapper->state = MYSQL2_CLIENT_IDLE;
+    mysql2_reap_pending_result_frees(wrapper);
+    mysql2_reap_pending_stmt_closes(wrapper);
+  }
+  resultObj = rb_mysql_result_spooled_to_obj(self, wrapper->encoding, current, args.result, args.spool, query_elapsed);
+  if (args.exceeded) {
+    wrapper->active_streaming_result = resultObj;
+  }
+  (void)RB_GC_GUARD(spill_dir);
+
+  return resultObj;
+}
+
 /* Shared by async_result (a query's first result set) and store_result (a
  * later one, from a multi-statement batch): fetch the current result set as
  * either streamed or fully-buffered, per :stream, track it on wrapper, and
  * wrap it as a Result carrying query_elapsed as its #query_time (negative
- * for none). */
-static VALUE mysql2_fetch_result_set(VALUE self, mysql_client_wrapper *wrapper, double query_elapsed) {
+ * for none). budgeted says whether :max_result_rows/:max_result_bytes and
+ * :spill apply; Client#pipeline, which buffers every result by design,
+ * passes 0. */
+static VALUE mysql2_fetch_result_set(VALUE self, mysql_client_wrapper *wrapper, double query_elapsed, int budgeted) {
+  struct mysql2_result_budget budget;
+  struct nogvl_store_result_args store_args;
   MYSQL_RES *result;
-  VALUE resultObj, current, is_streaming;
+  VALUE resultObj, current, is_streaming, opts;
 
-  is_streaming = rb_hash_aref(rb_ivar_get(self, intern_current_query_options), sym_stream);
+  opts = rb_ivar_get(self, intern_current_query_options);
+  is_streaming = rb_hash_aref(opts, sym_stream);
+  if (budgeted && is_streaming != Qtrue && mysql2_result_budget_from_options(opts, &budget)) {
+    return mysql2_fetch_spooled_result_set(self, wrapper, opts, &budget, query_elapsed);
+  }
   if (is_streaming == Qtrue) {
     result = (MYSQL_RES *)rb_thread_call_without_gvl(nogvl_use_result, wrapper, RUBY_UBF_IO, 0);
+    if (result) {
+      wrapper->payload_received += mysql2_fields_payload(result);
+    }
     /* A cursor is now open; leave the connection BUSY until the Result
      * finishes (or abandons) streaming rows -- see result.c. */
     wrapper->state = MYSQL2_CLIENT_STREAMING;
   } else {
-    result = (MYSQL_RES *)rb_thread_call_without_gvl(nogvl_store_result, wrapper, RUBY_UBF_IO, 0);
+    double store_start = mysql2_monotonic_now();
+
+    mysql2_store_result(self, wrapper, &store_args);
+    result = store_args.result;
+    mysql2_latency_record(wrapper, MYSQL2_LATENCY_STORE, store_start, mysql2_monotonic_now());
+    if (result) {
+      wrapper->rows_fetched += mysql_num_rows(result);
+      wrapper->payload_received += mysql2_fields_payload(result) + store_args.payload;
+      MYSQL2_PROBE2(result__stored, mysql_thread_id(wrapper->client), mysql_num_rows(result));
+    }
     /* The whole result set is buffered locally; the connection is free to
      * run another command right away. */
     wrapper->state = MYSQL2_CLIENT_IDLE;
@@ -1498,7 +2202,11 @@ static VALUE mysql2_fetch_result_set(VALUE self, mysql_client_wrapper *wrapper,
   current = rb_hash_dup(rb_ivar_get(self, intern_current_query_options));
   (void)RB_GC_GUARD(current);
   Check_Type(current, T_HASH);
-  resultObj = rb_mysql_result_to_obj(self, wrapper->encoding, current, result, Qnil, query_elapsed);
+  if (is_streaming == Qtrue) {
+    resultObj = rb_mysql_result_to_obj(self, wrapper->encoding, current, result, Qnil, query_elapsed);
+  } else {
+    resultObj = rb_mysql_result_stored_to_obj(self, wrapper->encoding, current, result, store_args.rows_memsize, query_elapsed);
+  }
 
   /* Track the open cursor so a later command can force-drain it if it's
    * abandoned instead of exhausted -- see mysql2_abandon_active_stream. */
@@ -1509,12 +2217,7 @@ static VALUE mysql2_fetch_result_set(VALUE self, mysql_client_wrapper *wrapper,
   return resultObj;
 }
 
-/* call-seq:
- *    client.async_result
- *
- * Returns the result for the last async issued query.
- */
-static VALUE rb_mysql_client_async_result(VALUE self) {
+static VALUE mysql2_async_result(VALUE self) {
   struct nogvl_read_query_result_args read_args;
   double query_elapsed;
   GET_CLIENT(self);
@@ -1525,7 +2228,7 @@ static VALUE rb_mysql_client_async_result(VALUE self) {
 
   REQUIRE_CONNECTED(wrapper);
   read_args.mysql = wrapper->client;
-  if ((VALUE)rb_thread_call_without_gvl(nogvl_read_query_result, &read_args, RUBY_UBF_IO, 0) == Qfalse) {
+  if (mysql2_read_query_result(self, &read_args) == Qfalse) {
     /* an error occurred, mark this connection inactive */
     wrapper->active_fiber = Qnil;
     wrapper->state = MYSQL2_CLIENT_IDLE;
@@ -1540,21 +2243,40 @@ static VALUE rb_mysql_client_async_result(VALUE self) {
    * failed; pass the sentinel through so the reading is nil, not garbage. */
   query_elapsed = (wrapper->query_start < 0 || read_args.query_end < 0)
     ? -1 : read_args.query_end - wrapper->query_start;
+  mysql2_latency_record(wrapper, MYSQL2_LATENCY_SERVER, wrapper->send_end, read_args.query_end);
 
-  return mysql2_fetch_result_set(self, wrapper, query_elapsed);
+  return mysql2_fetch_result_set(self, wrapper, query_elapsed, 1);
+}
+
+/* call-seq:
+ *    client.async_result
+ *
+ * Returns the result for the last async issued query.
+ *
+ * With a nonblocking client library the read and store wait in Ruby, where
+ * an interrupt can land mid-response; disconnect_and_mark_inactive then
+ * drops the half-read connection rather than leave it claimed. It does
+ * nothing once the result (or a server error) released the claim.
+ */
+VALUE rb_mysql_client_async_result(VALUE self) {
+  return rb_ensure(mysql2_async_result, self, disconnect_and_mark_inactive, self);
 }
 
 #ifndef _WIN32
 struct async_query_args {
   int fd;
   VALUE self;
+  /* Client#query's :timeout as a mysql2_monotonic_now() stamp, negative
+   * for none; do_query sets timed_out instead of waiting past it. */
+  double deadline;
+  int timed_out;
   struct query_completion completion;
 };
 
 /* Shared cleanup for an interrupted send/read/ping: none of them reached
  * their own normal completion, so the connection may be left
  * mid-protocol-exchange. */
-static void invalidate_after_interrupted_query(mysql_client_wrapper *wrapper) {
+void mysql2_invalidate_after_interrupted_query(mysql_client_wrapper *wrapper) {
   wrapper->active_fiber = Qnil;
   wrapper->state = MYSQL2_CLIENT_IDLE;
 
@@ -1568,7 +2290,7 @@ static void invalidate_after_interrupted_query(mysql_client_wrapper *wrapper) {
  * single blocking call, so it has no Thread#exit window to worry about. */
 static VALUE disconnect_and_raise(VALUE self, VALUE error) {
   GET_CLIENT(self);
-  invalidate_after_interrupted_query(wrapper);
+  mysql2_invalidate_after_interrupted_query(wrapper);
   rb_exc_raise(error);
 }
 
@@ -1581,59 +2303,471 @@ static VALUE disconnect_query_if_incomplete(VALUE completionval) {
   struct query_completion *completion = (void *)completionval;
 
   if (!completion->completed) {
-    invalidate_after_interrupted_query(completion->wrapper);
+    mysql2_invalidate_after_interrupted_query(completion->wrapper);
   }
 
   return Qnil;
 }
 
-/* Waits for fd to become readable, honoring @read_timeout. Shared by
- * do_query below and next_result_nonblocking further down in this file.
- * rb_wait_for_single_fd itself releases the GVL and is interruptible
- * (Thread#raise, Timeout.timeout), unlike a raw blocking read inside
- * libmysqlclient. */
-static void wait_for_readable_with_timeout(VALUE self, int fd) {
+/* mysql2_wait_for_socket, additionally bounded by deadline (a
+ * mysql2_monotonic_now() stamp, negative for none): returns 0 when the
+ * deadline passes first, where an expired @read_timeout raises. Whichever
+ * of the two is nearer is the one waited out. */
+static int mysql2_wait_for_socket_until(VALUE self, int fd, int events, double deadline) {
   struct timeval tv;
   struct timeval *tvp;
-  long int sec;
+  double wait;
+  int by_deadline = 0;
   int retval;
   VALUE read_timeout;
 
   read_timeout = rb_ivar_get(self, intern_read_timeout);
 
-  tvp = NULL;
+  wait = -1;
   if (!NIL_P(read_timeout)) {
-    Check_Type(read_timeout, T_FIXNUM);
-    tvp = &tv;
-    sec = FIX2INT(read_timeout);
-    /* TODO: support partial seconds?
-       also, this check is here for sanity, we also check up in Ruby */
-    if (sec >= 0) {
-      tvp->tv_sec = sec;
-    } else {
-      rb_raise(cMysql2Error, "read_timeout must be a positive integer, you passed %ld", sec);
+    /* this check is here for sanity, we also check up in Ruby */
+    wait = NUM2DBL(read_timeout);
+    if (wait < 0) {
+      rb_raise(cMysql2Error, "read_timeout must be a positive number, you passed %" PRIsVALUE, read_timeout);
+    }
+  }
+  if (deadline >= 0) {
+    double remaining = deadline - mysql2_monotonic_now();
+    if (remaining < 0) {
+      remaining = 0;
+    }
+    if (wait < 0 || remaining <= wait) {
+      wait = remaining;
+      by_deadline = 1;
     }
-    tvp->tv_usec = 0;
   }
 
-  retval = rb_wait_for_single_fd(fd, RB_WAITFD_IN, tvp);
+  tvp = NULL;
+  if (wait >= 0) {
+    tvp = &tv;
+    tvp->tv_sec = (time_t)wait;
+    tvp->tv_usec = (long)((wait - (double)tvp->tv_sec) * 1000000.0);
+  }
+
+  retval = rb_wait_for_single_fd(fd, events, tvp);
 
   if (retval == 0) {
-    rb_raise(cMysql2TimeoutError, "Timeout waiting for a response from the last query. (waited %d seconds)", FIX2INT(read_timeout));
+    if (by_deadline) {
+      return 0;
+    }
+    rb_raise(cMysql2TimeoutError, "Timeout waiting for a response from the last query. (waited %" PRIsVALUE " seconds)", read_timeout);
   }
   if (retval < 0) {
     rb_sys_fail(0);
   }
+
+  return retval;
+}
+
+/* See client.h. Shared by do_query below, mysql2_wait_for_async_status's
+ * response waits, and the nonblocking Statement#execute in statement.c.
+ * rb_wait_for_single_fd itself releases the GVL and is interruptible
+ * (Thread#raise, Timeout.timeout), unlike a raw blocking read inside
+ * libmysqlclient. */
+int mysql2_wait_for_socket(VALUE self, int fd, int events) {
+  return mysql2_wait_for_socket_until(self, fd, events, -1);
+}
+
+#if defined(MYSQL2_ASYNC_CONTEXT) || defined(MYSQL2_NONBLOCKING_QUERY_POLL)
+/* rb_wait_for_single_fd for at most timeout_sec seconds, 0 for no limit.
+ * Returns 0 when the time runs out. */
+static int mysql2_wait_for_socket_sec(int fd, int events, unsigned int timeout_sec) {
+  struct timeval tv;
+  int ready;
+
+  tv.tv_sec = timeout_sec;
+  tv.tv_usec = 0;
+  ready = rb_wait_for_single_fd(fd, events, timeout_sec ? &tv : NULL);
+  if (ready < 0) {
+    rb_sys_fail(0);
+  }
+  return ready;
+}
+
+/* See client.h. */
+int mysql2_wait_for_async_status(VALUE self, MYSQL *mysql, int status, int connecting) {
+  int events = 0;
+  int ready;
+  int ready_status = 0;
+#ifdef MYSQL2_ASYNC_CONTEXT
+  int fd = mysql_get_socket(mysql);
+#else
+  int fd = mysql->net.fd;
+#endif
+  GET_CLIENT(self);
+
+  if (status & MYSQL_WAIT_READ) events |= RB_WAITFD_IN;
+  if (status & MYSQL_WAIT_WRITE) events |= RB_WAITFD_OUT;
+  if (status & MYSQL_WAIT_EXCEPT) events |= RB_WAITFD_PRI;
+
+  if (!events) {
+    return MYSQL_WAIT_TIMEOUT;
+  }
+
+#ifdef MYSQL2_ASYNC_CONTEXT
+  if (connecting && (status & MYSQL_WAIT_TIMEOUT)) {
+    unsigned int timeout_ms = mysql_get_timeout_value_ms(mysql);
+    struct timeval tv;
+
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    ready = rb_wait_for_single_fd(fd, events, &tv);
+    if (ready < 0) {
+      rb_sys_fail(0);
+    }
+    if (ready == 0) {
+      /* Let the connector report its own connect timeout. */
+      return MYSQL_WAIT_TIMEOUT;
+    }
+  } else
+#endif
+  if (connecting) {
+    ready = mysql2_wait_for_socket_sec(fd, events, wrapper->connect_timeout);
+    if (ready == 0) {
+      rb_raise(cMysql2TimeoutError, "Timeout waiting for the server to complete the connection handshake. (waited %u seconds)", wrapper->connect_timeout);
+    }
+  } else if (events == RB_WAITFD_OUT) {
+    ready = mysql2_wait_for_socket_sec(fd, events, wrapper->write_timeout);
+    if (ready == 0) {
+      rb_raise(cMysql2TimeoutError, "Timeout waiting to send the query to the server. (waited %u seconds)", wrapper->write_timeout);
+    }
+  } else {
+    ready = mysql2_wait_for_socket(self, fd, events);
+  }
+
+  if (ready & RB_WAITFD_IN) ready_status |= MYSQL_WAIT_READ;
+  if (ready & RB_WAITFD_OUT) ready_status |= MYSQL_WAIT_WRITE;
+  if (ready & RB_WAITFD_PRI) ready_status |= MYSQL_WAIT_EXCEPT;
+  return ready_status;
 }
+#endif
 
 static VALUE do_query(VALUE args) {
   struct async_query_args *async_args = (void *)args;
 
-  wait_for_readable_with_timeout(async_args->self, async_args->fd);
+  if (!mysql2_wait_for_socket_until(async_args->self, async_args->fd, RB_WAITFD_IN, async_args->deadline)) {
+    /* Still mid-exchange, but nothing was read: the connection is intact
+     * for rb_mysql_query to kill the query and resynchronize. */
+    async_args->timed_out = 1;
+  }
 
   async_args->completion.completed = 1;
   return Qnil;
 }
+
+/* Seconds the KILL QUERY side connection may take to connect or answer, and
+ * the original connection to report the killed statement afterward, before
+ * a timed-out query falls back to dropping the connection. */
+#define MYSQL2_KILL_TIMEOUT 2
+
+#ifdef HAVE_MYSQL_GET_OPTION
+/* String-valued options (paths, cipher lists, plugin names) the KILL QUERY
+ * side connection takes over from the original handle. The option files
+ * come first so the explicit settings after them win, as on the original. */
+static const enum mysql_option mysql2_killer_str_options[] = {
+  MYSQL_READ_DEFAULT_FILE,
+  MYSQL_READ_DEFAULT_GROUP,
+  MYSQL_PLUGIN_DIR,
+  MYSQL_OPT_SSL_KEY,
+  MYSQL_OPT_SSL_CERT,
+  MYSQL_OPT_SSL_CA,
+  MYSQL_OPT_SSL_CAPATH,
+  MYSQL_OPT_SSL_CIPHER,
+#ifdef HAVE_CONST_MYSQL_OPT_SSL_CRL
+  MYSQL_OPT_SSL_CRL,
+#endif
+#ifdef HAVE_CONST_MYSQL_OPT_SSL_CRLPATH
+  MYSQL_OPT_SSL_CRLPATH,
+#endif
+#ifdef HAVE_CONST_MYSQL_OPT_TLS_VERSION
+  MYSQL_OPT_TLS_VERSION,
+#endif
+#ifdef HAVE_CONST_MYSQL_OPT_TLS_CIPHERSUITES
+  MYSQL_OPT_TLS_CIPHERSUITES,
+#endif
+#ifdef HAVE_CONST_MYSQL_OPT_TLS_SNI_SERVERNAME
+  MYSQL_OPT_TLS_SNI_SERVERNAME,
+#endif
+#ifdef HAVE_CONST_MARIADB_OPT_TLS_PASSPHRASE
+  MARIADB_OPT_TLS_PASSPHRASE,
+#endif
+#ifdef HAVE_CONST_MARIADB_OPT_TLS_PEER_FP
+  MARIADB_OPT_TLS_PEER_FP,
+#endif
+#ifdef HAVE_CONST_MARIADB_OPT_TLS_PEER_FP_LIST
+  MARIADB_OPT_TLS_PEER_FP_LIST,
+#endif
+#ifdef HAVE_CONST_MYSQL_DEFAULT_AUTH
+  MYSQL_DEFAULT_AUTH,
+#endif
+#ifdef HAVE_CONST_MYSQL_SERVER_PUBLIC_KEY
+  MYSQL_SERVER_PUBLIC_KEY,
+#endif
+};
+
+/* Copies one boolean option to killer if the original handle has it set. */
+static int mysql2_copy_killer_bool_option(MYSQL *mysql, MYSQL *killer, enum mysql_option option) {
+  my_bool value = 0;
+
+  if (mysql_get_option(mysql, option, &value) != 0) {
+    return -1;
+  }
+  return value ? mysql_options(killer, option, &value) : 0;
+}
+
+/* Applies the original handle's TLS and authentication options to killer.
+ * Returns 0 on success, nonzero if any of them couldn't be read back or
+ * re-applied. An option the original never set stays unset. */
+static int mysql2_copy_killer_options(mysql_client_wrapper *wrapper, MYSQL *killer) {
+  MYSQL *mysql = wrapper->client;
+  int tls_in_use = mysql_get_ssl_cipher(mysql) != NULL;
+  size_t i;
+
+  for (i = 0; i < sizeof(mysql2_killer_str_options) / sizeof(mysql2_killer_str_options[0]); i++) {
+    const char *value = NULL;
+
+    if (mysql_get_option(mysql, mysql2_killer_str_options[i], &value) != 0) {
+      return -1;
+    }
+    if (value && mysql_options(killer, mysql2_killer_str_options[i], value) != 0) {
+      return -1;
+    }
+  }
+
+  /* The pre-ssl_mode switches matter only where ssl_mode= falls back to them. */
+#ifndef FULL_SSL_MODE_SUPPORT
+#ifdef HAVE_CONST_MYSQL_OPT_SSL_VERIFY_SERVER_CERT
+  if (mysql2_copy_killer_bool_option(mysql, killer, MYSQL_OPT_SSL_VERIFY_SERVER_CERT) != 0) {
+    return -1;
+  }
+#endif
+#ifdef HAVE_CONST_MYSQL_OPT_SSL_ENFORCE
+  if (mysql2_copy_killer_bool_option(mysql, killer, MYSQL_OPT_SSL_ENFORCE) != 0) {
+    return -1;
+  }
+#endif
+#endif
+#ifdef HAVE_CONST_MYSQL_ENABLE_CLEARTEXT_PLUGIN
+  if (mysql2_copy_killer_bool_option(mysql, killer, MYSQL_ENABLE_CLEARTEXT_PLUGIN) != 0) {
+    return -1;
+  }
+#endif
+#ifdef HAVE_CONST_MYSQL_OPT_GET_SERVER_PUBLIC_KEY
+  if (mysql2_copy_killer_bool_option(mysql, killer, MYSQL_OPT_GET_SERVER_PUBLIC_KEY) != 0) {
+    return -1;
+  }
+#endif
+
+  /* The original connection negotiated TLS: require it of the side
+   * connection too, even under a merely preferred ssl_mode, so a peer that
+   * declines TLS this time can't collect the password in the clear. */
+#ifdef FULL_SSL_MODE_SUPPORT
+  {
+    unsigned int mode = SSL_MODE_PREFERRED;
+
+    if (mysql_get_option(mysql, MYSQL_OPT_SSL_MODE, &mode) != 0) {
+      return -1;
+    }
+    if (tls_in_use && mode < SSL_MODE_REQUIRED) {
+      mode = SSL_MODE_REQUIRED;
+    }
+    if (mysql_options(killer, MYSQL_OPT_SSL_MODE, &mode) != 0) {
+      return -1;
+    }
+  }
+#elif defined(HAVE_CONST_MYSQL_OPT_SSL_ENFORCE)
+  if (tls_in_use) {
+    my_bool enforce = 1;
+
+    if (mysql_options(killer, MYSQL_OPT_SSL_ENFORCE, &enforce) != 0) {
+      return -1;
+    }
+  }
+#else
+  if (tls_in_use) {
+    return -1;
+  }
+#endif
+
+#ifdef MYSQL2_VERIFY_IDENTITY_SHIM
+  if (wrapper->tls_verify_identity &&
+      mysql_options(killer, MARIADB_OPT_TLS_VERIFICATION_CALLBACK,
+                    (const void *)mysql2_tls_verification_callback) != 0) {
+    return -1;
+  }
+#endif
+
+  return 0;
+}
+#endif
+
+/* Opens the KILL QUERY side connection with the credentials and the TLS and
+ * authentication options libmysqlclient kept from the original connect, so
+ * the password never crosses a weaker channel than the client itself was
+ * held to. Returns NULL when that can't be guaranteed -- the client library
+ * has no mysql_get_option to read the options back, one of them won't
+ * carry over, or the connection fails -- and the timed-out query's
+ * connection is then dropped rather than killed. Pure C. */
+static MYSQL *mysql2_open_killer(mysql_client_wrapper *wrapper) {
+#ifdef HAVE_MYSQL_GET_OPTION
+  MYSQL *mysql = wrapper->client;
+  unsigned int timeout = MYSQL2_KILL_TIMEOUT;
+  MYSQL *killer = mysql_init(NULL);
+
+  if (!killer) {
+    return NULL;
+  }
+  mysql_options(killer, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+  mysql_options(killer, MYSQL_OPT_READ_TIMEOUT, &timeout);
+  mysql_options(killer, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+  if (mysql2_copy_killer_options(wrapper, killer) != 0 ||
+      !mysql_real_connect(killer, mysql->host, mysql->user, mysql->passwd, NULL,
+                          mysql->port, mysql->unix_socket, 0) ||
+      (mysql_get_ssl_cipher(mysql) != NULL && mysql_get_ssl_cipher(killer) == NULL)) {
+    mysql_close(killer);
+    return NULL;
+  }
+
+#ifdef MYSQL2_VERIFY_IDENTITY_SHIM
+  /* The same post-connect tripwire rb_mysql_connect runs. */
+  if (wrapper->tls_verify_identity) {
+    MARIADB_PVIO *pvio = killer->net.pvio;
+    mysql2_mariadb_tls_head *ctls = pvio ? (mysql2_mariadb_tls_head *)pvio->ctls : NULL;
+    unsigned int status;
+    char detail[MYSQL_ERRMSG_SIZE];
+
+    if (ctls == NULL || pvio->mysql != killer || ctls->pvio != pvio ||
+        mysql2_tls_check_peer_identity(killer, ctls, &status, detail, sizeof(detail)) != NULL) {
+      mysql_close(killer);
+      return NULL;
+    }
+  }
+#endif
+
+  return killer;
+#else
+  (void)wrapper;
+  return NULL;
+#endif
+}
+
+/* Sends KILL QUERY for the client's connection over wrapper->killer,
+ * opening it first if need be with mysql2_open_killer. A cached side connection the server has
+ * since dropped gets one fresh retry. Returns Qtrue once the server has
+ * accepted the kill. Pure C: runs without the GVL. */
+static void *nogvl_kill_query(void *ptr) {
+  mysql_client_wrapper *wrapper = ptr;
+  MYSQL *mysql = wrapper->client;
+  char sql[sizeof("KILL QUERY ") + 20];
+  int len = snprintf(sql, sizeof(sql), "KILL QUERY %lu", mysql_thread_id(mysql));
+  int attempt;
+
+  for (attempt = 0; attempt < 2; attempt++) {
+    if (!wrapper->killer) {
+      MYSQL *killer = mysql2_open_killer(wrapper);
+
+      if (!killer) {
+        return (void *)Qfalse;
+      }
+      wrapper->killer = killer;
+      wrapper->killer_pid = getpid();
+    }
+
+    if (mysql_real_query(wrapper->killer, sql, len) == 0) {
+      return (void *)Qtrue;
+    }
+    if (!MYSQL2_CLIENT_ERRNO_P(mysql_errno(wrapper->killer))) {
+      /* The server itself refused; a new connection won't change that. */
+      return (void *)Qfalse;
+    }
+    mysql2_close_killer(wrapper);
+  }
+
+  return (void *)Qfalse;
+}
+
+struct killed_query_args {
+  VALUE self;
+  int killed;
+  struct query_completion completion;
+};
+
+/* Kills the statement, then reads and discards whatever its connection
+ * answers with: ER_QUERY_INTERRUPTED for most statements, but a normal result for
+ * ones that cut their work short instead (SELECT SLEEP() returns 1), or
+ * that finished just before the kill landed. Either way the reply is
+ * complete and the connection back in sync, unless the client library
+ * itself failed reading it. */
+static VALUE do_drain_killed_query(VALUE argsval) {
+  struct killed_query_args *args = (void *)argsval;
+  VALUE self = args->self;
+  struct nogvl_read_query_result_args read_args;
+  GET_CLIENT(self);
+
+  if ((VALUE)rb_thread_call_without_gvl(nogvl_kill_query, wrapper, RUBY_UBF_IO, 0) == Qfalse) {
+    /* completed stays unset: the statement runs on, and the connection
+     * with it is dropped. */
+    return Qnil;
+  }
+  args->killed = 1;
+
+  if (!mysql2_wait_for_socket_until(self, wrapper->client->net.fd, RB_WAITFD_IN,
+                                    mysql2_monotonic_now() + MYSQL2_KILL_TIMEOUT)) {
+    /* Not even the kill got an answer out of it: leave completed unset so
+     * the rb_ensure companion drops the connection. */
+    return Qnil;
+  }
+
+  read_args.mysql = wrapper->client;
+  if (mysql2_read_query_result(self, &read_args) == Qtrue) {
+    for (;;) {
+      MYSQL_RES *result = (MYSQL_RES *)rb_thread_call_without_gvl(nogvl_store_result_raw, wrapper, RUBY_UBF_IO, 0);
+
+      if (result != NULL) {
+        mysql_free_result(result);
+      }
+      if (mysql_more_results(wrapper->client) != 1 || mysql2_next_result(self, wrapper) != 0) {
+        break;
+      }
+    }
+  }
+
+  args->completion.completed = !MYSQL2_CLIENT_ERRNO_P(mysql_errno(wrapper->client));
+  return Qnil;
+}
+
+/* Client#query's :timeout expired with the query still running: kill it on
+ * the server, so it stops holding locks and burning CPU there, then read
+ * the connection back to idle so it stays usable. Only when the kill can't
+ * be sent or doesn't take does the connection get dropped instead, as a
+ * read_timeout expiry would. Always raises Mysql2::Error::TimeoutError. */
+static VALUE mysql2_kill_timed_out_query(VALUE self, double timeout) {
+  struct killed_query_args args;
+  GET_CLIENT(self);
+
+  args.self = self;
+  args.killed = 0;
+  args.completion.wrapper = wrapper;
+  args.completion.completed = 0;
+
+  /* The kill is inside the ensure too: an interrupt while it is sent would
+   * otherwise leave the connection claimed with the reply unread. */
+  rb_ensure(do_drain_killed_query, (VALUE)&args, mysql2_next_result_reset_state, (VALUE)&args.completion);
+
+  if (!args.killed) {
+    rb_raise(cMysql2TimeoutError, "Query exceeded its %.3f second timeout and could not be killed; the connection was closed", timeout);
+  }
+  if (!args.completion.completed) {
+    rb_raise(cMysql2TimeoutError, "Query exceeded its %.3f second timeout and was killed; the connection was closed", timeout);
+  }
+  rb_raise(cMysql2TimeoutError, "Query exceeded its %.3f second timeout and was killed", timeout);
+  return Qnil; /* unreached */
+}
 #endif
 
 static VALUE disconnect_and_mark_inactive(VALUE self) {
@@ -1679,7 +2813,7 @@ static VALUE release_claim_or_disconnect(VALUE completionval) {
     wrapper->active_fiber = Qnil;
   } else {
 #ifndef _WIN32
-    invalidate_after_interrupted_query(wrapper);
+    mysql2_invalidate_after_interrupted_query(wrapper);
 #else
     wrapper->active_fiber = Qnil;
     wrapper->state = MYSQL2_CLIENT_IDLE;
@@ -1739,17 +2873,1009 @@ static VALUE rb_mysql_client_abandon_results(VALUE self) {
   return rb_ensure(do_abandon_results, (VALUE)&completion, release_claim_or_disconnect, (VALUE)&completion);
 }
 
+/* Bytes value's literal can take, escaping included, for sizing the
+ * interpolated SQL up front; raises TypeError for a value that can't be
+ * bound, and ArgumentError for a NaN or infinite one. Arrays are bound one
+ * level deep, for IN (?). */
+static long mysql2_bind_capacity(VALUE value, long index, int in_array) {
+  switch (TYPE(value)) {
+    case T_FLOAT:
+      if (isnan(RFLOAT_VALUE(value)) || isinf(RFLOAT_VALUE(value))) {
+        rb_raise(rb_eArgError, "can't bind parameter %ld: MySQL has no literal for %" PRIsVALUE, index + 1, value);
+      }
+      return 32;
+    case T_NIL:
+    case T_TRUE:
+    case T_FALSE:
+    case T_FIXNUM:
+      return 32;
+    case T_BIGNUM:
+      return 64;
+    case T_STRING:
+      /* Transcoding to the connection's encoding can grow it; allow for a
+       * worst-case doubling before the escaping doubles it again. */
+      return RSTRING_LEN(value) * 4 + 2;
+    case T_ARRAY:
+      if (!in_array) {
+        long i, capacity = 4;
+        for (i = 0; i < RARRAY_LEN(value); i++) {
+          capacity += mysql2_bind_capacity(RARRAY_AREF(value, i), index, 1) + 2;
+        }
+        return capacity;
+      }
+      break;
+    default:
+      if (CLASS_OF(value) == rb_cTime || CLASS_OF(value) == cDateTime || CLASS_OF(value) == cDate) {
+        return 32;
+      } else if (CLASS_OF(value) == cBigDecimal) {
+        if (!RTEST(rb_funcall(value, intern_finite_p, 0))) {
+          rb_raise(rb_eArgError, "can't bind parameter %ld: MySQL has no literal for %" PRIsVALUE, index + 1, rb_inspect(value));
+        }
+        return 64;
+      }
+      break;
+  }
+
+  rb_raise(rb_eTypeError, "can't bind parameter %ld: no conversion for %s%s",
+           index + 1, in_array ? "nested " : "", rb_obj_classname(value));
+  return 0; /* unreached */
+}
+
+/* Appends str to buf as a quoted string literal, escaped by the client
+ * library straight into buf's own storage. */
+static void mysql2_append_quoted(mysql_client_wrapper *wrapper, VALUE buf, VALUE str, rb_encoding *conn_enc) {
+  unsigned long len, escaped;
+  long pos = RSTRING_LEN(buf);
+  char *dst;
+
+  str = rb_str_export_to_enc(str, conn_enc);
+  len = RSTRING_LEN(str);
+  rb_str_modify_expand(buf, (long)len * 2 + 2);
+  dst = RSTRING_PTR(buf) + pos;
+
+  *dst++ = '\'';
+#ifdef HAVE_MYSQL_REAL_ESCAPE_STRING_QUOTE
+  escaped = mysql_real_escape_string_quote(wrapper->client, dst, RSTRING_PTR(str), len, '\'');
+#else
+  escaped = mysql_real_escape_string(wrapper->client, dst, RSTRING_PTR(str), len);
+#endif
+  if (escaped == (unsigned long)-1) {
+    rb_raise_mysql2_error(wrapper);
+  }
+  dst[escaped] = '\'';
+  rb_str_set_len(buf, pos + 1 + (long)escaped + 1);
+  (void)RB_GC_GUARD(str);
+}
+
+/* See client.h. The date and time types are written from their own
+ * wall-clock fields, as Statement#execute binds them. */
+int mysql2_format_scalar(VALUE value, char *tmp) {
+  int len;
+
+  switch (TYPE(value)) {
+    case T_FIXNUM:
+      return snprintf(tmp, MYSQL2_SCALAR_LEN, "%ld", FIX2LONG(value));
+    case T_FLOAT:
+      {
+        double d = RFLOAT_VALUE(value);
+        int prec;
+
+        if (isnan(d) || isinf(d)) {
+          rb_raise(rb_eArgError, "can't bind %" PRIsVALUE ": MySQL has no literal for it", value);
+        }
+        /* The shortest of %.15g..%.17g that reads back as the same double,
+         * so 0.1 goes out as 0.1 rather than 0.10000000000000001. */
+        for (prec = 15; prec <= 17; prec++) {
+          len = snprintf(tmp, MYSQL2_SCALAR_LEN, "%.*g", prec, d);
+          if (strtod(tmp, NULL) == d) {
+            break;
+          }
+        }
+        return len;
+      }
+    default:
+      break;
+  }
+
+  if (CLASS_OF(value) == rb_cTime || CLASS_OF(value) == cDateTime) {
+    unsigned long usec;
+
+    if (CLASS_OF(value) == rb_cTime) {
+      usec = NUM2ULONG(rb_funcall(value, intern_usec, 0));
+    } else {
+      /* sec_fraction is an exact Rational; see Statement#execute. */
+      VALUE fraction = rb_funcall(rb_funcall(value, intern_sec_fraction, 0), intern_mul, 1, INT2FIX(1000000));
+      usec = NUM2ULONG(rb_funcall(fraction, intern_truncate, 0));
+    }
+    len = snprintf(tmp, MYSQL2_SCALAR_LEN, "%04d-%02d-%02d %02d:%02d:%02d",
+                   NUM2INT(rb_funcall(value, intern_year, 0)), NUM2INT(rb_funcall(value, intern_month, 0)),
+                   NUM2INT(rb_funcall(value, intern_day, 0)), NUM2INT(rb_funcall(value, intern_hour, 0)),
+                   NUM2INT(rb_funcall(value, intern_min, 0)), NUM2INT(rb_funcall(value, intern_sec, 0)));
+    if (usec) {
+      len += snprintf(tmp + len, MYSQL2_SCALAR_LEN - len, ".%06lu", usec);
+    }
+    return len;
+  } else if (CLASS_OF(value) == cDate) {
+    return snprintf(tmp, MYSQL2_SCALAR_LEN, "%04d-%02d-%02d",
+                    NUM2INT(rb_funcall(value, intern_year, 0)), NUM2INT(rb_funcall(value, intern_month, 0)),
+                    NUM2INT(rb_funcall(value, intern_day, 0)));
+  }
+
+  return -1;
+}
+
+/* See client.h. */
+VALUE mysql2_bigdecimal_literal(VALUE value) {
+  if (CLASS_OF(value) != cBigDecimal) {
+    return Qnil;
+  }
+  /* The plain-notation form: the default scientific one would reach the
+   * server as an approximate (DOUBLE) literal. */
+  return rb_funcall(value, intern_to_s, 1, rb_str_new_cstr("F"));
+}
+
+/* Appends value's SQL literal to buf. */
+static void mysql2_append_bind(mysql_client_wrapper *wrapper, VALUE buf, VALUE value, rb_encoding *conn_enc) {
+  char tmp[MYSQL2_SCALAR_LEN];
+  int len;
+
+  switch (TYPE(value)) {
+    case T_NIL:
+      rb_str_buf_cat(buf, "NULL", 4);
+      return;
+    case T_TRUE:
+      rb_str_buf_cat(buf, "TRUE", 4);
+      return;
+    case T_FALSE:
+      rb_str_buf_cat(buf, "FALSE", 5);
+      return;
+    case T_BIGNUM:
+      rb_str_buf_append(buf, rb_big2str(value, 10));
+      return;
+    case T_STRING:
+      mysql2_append_quoted(wrapper, buf, value, conn_enc);
+      return;
+    case T_ARRAY:
+      {
+        long i;
+
+        if (RARRAY_LEN(value) == 0) {
+          /* IN (NULL) matches nothing, which is what IN () would mean if
+           * MySQL allowed it. */
+          rb_str_buf_cat(buf, "NULL", 4);
+          return;
+        }
+        for (i = 0; i < RARRAY_LEN(value); i++) {
+          if (i > 0) {
+            rb_str_buf_cat(buf, ", ", 2);
+          }
+          mysql2_append_bind(wrapper, buf, RARRAY_AREF(value, i), conn_enc);
+        }
+      }
+      return;
+    default:
+      break;
+  }
+
+  len = mysql2_format_scalar(value, tmp);
+  if (len < 0) {
+    rb_str_buf_append(buf, mysql2_bigdecimal_literal(value));
+  } else if (RB_TYPE_P(value, T_FIXNUM) || RB_TYPE_P(value, T_FLOAT)) {
+    rb_str_buf_cat(buf, tmp, len);
+  } else {
+    rb_str_buf_cat(buf, "'", 1);
+    rb_str_buf_cat(buf, tmp, len);
+    rb_str_buf_cat(buf, "'", 1);
+  }
+}
+
+/* Client#query's binds: sql with each ? outside quotes and comments replaced
+ * by the matching value's literal, built in one buffer sized up front and
+ * returned in the connection's encoding, ready to send. */
+static VALUE mysql2_interpolate_binds(mysql_client_wrapper *wrapper, VALUE sql, VALUE binds) {
+  rb_encoding *conn_enc = rb_to_encoding(wrapper->encoding);
+  const char *start, *p, *end;
+  long placeholders = 0, capacity, bind = 0, i;
+  VALUE buf;
+
+  Check_Type(binds, T_ARRAY);
+  sql = rb_str_export_to_enc(sql, conn_enc);
+  start = p = RSTRING_PTR(sql);
+  end = start + RSTRING_LEN(sql);
+
+  while (p < end) {
+    const char *next = mysql2_sql_skip_literal(p, end, conn_enc);
+
+    if (!next) {
+      break;
+    } else if (next != p) {
+      p = next;
+    } else {
+      if (*p == '?') {
+        placeholders++;
+      }
+      p++;
+    }
+  }
+  if (placeholders != RARRAY_LEN(binds)) {
+    rb_raise(rb_eArgError, "wrong number of bind values (given %ld, expected %ld)", RARRAY_LEN(binds), placeholders);
+  }
+
+  capacity = RSTRING_LEN(sql);
+  for (i = 0; i < RARRAY_LEN(binds); i++) {
+    capacity += mysql2_bind_capacity(RARRAY_AREF(binds, i), i, 0);
+  }
+  buf = rb_str_buf_new(capacity);
+  rb_enc_associate(buf, conn_enc);
+
+  p = start;
+  while (p < end) {
+    const char *next = mysql2_sql_skip_literal(p, end, conn_enc);
+
+    if (!next) {
+      p = end;
+    } else if (next != p) {
+      p = next;
+    } else if (*p == '?') {
+      rb_str_buf_cat(buf, start, p - start);
+      mysql2_append_bind(wrapper, buf, RARRAY_AREF(binds, bind), conn_enc);
+      bind++;
+      start = ++p;
+    } else {
+      p++;
+    }
+  }
+  rb_str_buf_cat(buf, start, end - start);
+  (void)RB_GC_GUARD(sql);
+
+  return buf;
+}
+
 /* call-seq:
  *    client.query(sql, options = {})
+ *    client.query(sql, binds, options = {})
  *
  * Query the database with +sql+, with optional +options+.  For the possible
- * options, see default_query_options on the Mysql2::Client class.
+ * options, see default_query_options on the Mysql2::Client class. With
+ * +binds+, an Array, each ? in +sql+ is replaced by the next value escaped
+ * and formatted as a SQL literal.
  */
-static VALUE rb_mysql_query(VALUE self, VALUE sql, VALUE current) {
+static VALUE rb_mysql_query(VALUE self, VALUE sql, VALUE binds, VALUE current) {
 #ifndef _WIN32
   struct async_query_args async_args;
 #endif
   struct nogvl_send_query_args args;
+  VALUE timeout, infile;
+  double timeout_sec = -1;
+  GET_CLIENT(self);
+
+  REQUIRE_CONNECTED(wrapper);
+
+  if (mysql2_forked_without_reconnect(wrapper) && wrapper->automatic_close) {
+    mysql2_warn_forked_without_reconnect(wrapper, "send a query");
+  }
+
+  args.mysql = wrapper->client;
+
+  (void)RB_GC_GUARD(current);
+  Check_Type(current, T_HASH);
+  /* Resolve :force_encoding to an Encoding object up front: invalid values
+   * raise here, before anything is written to the wire, leaving the
+   * connection untouched and reusable. Nothing downstream of the send may
+   * raise for this option -- rb_mysql_result_to_obj in particular. */
+  mysql2_canonicalize_force_encoding(current);
+  /* Text-protocol streaming is mysql_use_result: the server pushes rows and
+   * the client pulls them off the socket, so there is no prefetch to size.
+   * The stream: {size: N} spelling is prepared-statement-only
+   * (Statement#execute drives a server-side cursor, which does prefetch);
+   * reject it here rather than silently stream one row at a time. */
+  if (RB_TYPE_P(rb_hash_aref(current, sym_stream), T_HASH)) {
+    rb_raise(rb_eArgError, "stream: {size: N} is only supported for prepared statements; Client#query streams with mysql_use_result, which has no prefetch");
+  }
+  /* Likewise :max_result_rows/:max_result_bytes/:on_result_limit/:spill,
+   * which are only read once the response arrives (mysql2_fetch_result_set). */
+  {
+    struct mysql2_result_budget budget;
+    mysql2_result_budget_from_options(current, &budget);
+    if (!NIL_P(budget.spill_dir) && RTEST(rb_hash_aref(current, sym_stream))) {
+      rb_raise(rb_eArgError, ":spill buffers the result; it cannot be combined with :stream");
+    }
+  }
+  timeout = rb_hash_aref(current, sym_timeout);
+  if (!NIL_P(timeout)) {
+#ifdef _WIN32
+    rb_raise(rb_eNotImpError, ":timeout is not supported on Windows");
+#else
+    timeout_sec = NUM2DBL(timeout);
+    if (timeout_sec < 0) {
+      rb_raise(rb_eArgError, "timeout must be a positive number, you passed %" PRIsVALUE, timeout);
+    }
+#endif
+  }
+  infile = rb_hash_aref(current, sym_infile);
+  if (!NIL_P(infile)) {
+    infile = mysql2_infile_source(infile);
+  }
+  rb_ivar_set(self, intern_current_query_options, current);
+
+  Check_Type(sql, T_STRING);
+  if (!NIL_P(binds)) {
+    /* Already in the connection's encoding. */
+    sql = mysql2_interpolate_binds(wrapper, sql, binds);
+  }
+  /* ensure the string is in the encoding the connection is expecting */
+  args.sql = rb_str_export_to_enc(sql, rb_to_encoding(wrapper->encoding));
+  args.sql_ptr = RSTRING_PTR(args.sql);
+  args.sql_len = RSTRING_LEN(args.sql);
+  args.self = self;
+  args.completion.wrapper = wrapper;
+  args.completion.completed = 0;
+
+  rb_mysql_client_set_active_fiber(self, false);
+
+  /* We're about to issue a new command: this is a safe point to close out
+   * any statements that were GC'd while we were busy earlier, and to free
+   * any abandoned result sets left over from a stream that was dropped
+   * mid-iteration -- including one that hasn't been collected by GC yet,
+   * which the reap below alone wouldn't catch (mysql2_abandon_active_stream).
+   * Deliberately last, right before the actual network write below --
+   * rb_ivar_set/rb_str_export_to_enc above can themselves allocate, and
+   * under GC.stress (or just unlucky timing) that can be what triggers the
+   * GC sweep that abandons a stream, so reaping any earlier can still leave
+   * a fresh pending free undrained when we send. Must also run before the
+   * state assignment below: mysql2_abandon_active_stream only acts while
+   * state is still STREAMING. */
+  mysql2_abandon_active_stream(wrapper);
+  mysql2_reap_pending_result_frees(wrapper);
+  mysql2_reap_pending_stmt_closes(wrapper);
+
+  wrapper->state = MYSQL2_CLIENT_QUERYING;
+  /* Only ever this command's: a LOAD DATA LOCAL INFILE it runs reads from
+   * it instead of the named file. */
+  wrapper->infile_source = infile;
+
+  /* Open the round-trip bracket that async_result closes once the first
+   * response has been fully read -- including the socket wait in do_query,
+   * which is where most of a slow query's time goes. */
+  wrapper->query_start = mysql2_monotonic_now();
+
+#ifndef _WIN32
+  rb_ensure(do_send_query, (VALUE)&args, disconnect_query_if_incomplete, (VALUE)&args.completion);
+  (void)RB_GC_GUARD(sql);
+
+  if (rb_hash_aref(current, sym_async) == Qtrue) {
+    return Qnil;
+  } else {
+    async_args.fd = wrapper->client->net.fd;
+    async_args.self = self;
+    /* Measured from the send, so a slow write counts against it too. */
+    async_args.deadline = timeout_sec < 0 ? -1 : wrapper->query_start + timeout_sec;
+    async_args.timed_out = 0;
+    async_args.completion.wrapper = wrapper;
+    async_args.completion.completed = 0;
+
+    rb_ensure(do_query, (VALUE)&async_args, disconnect_query_if_incomplete, (VALUE)&async_args.completion);
+
+    if (async_args.timed_out) {
+      return mysql2_kill_timed_out_query(self, timeout_sec);
+    }
+
+    return rb_mysql_client_async_result(self);
+  }
+#else
+  do_send_query((VALUE)&args);
+  (void)RB_GC_GUARD(sql);
+
+  /* this will just block until the result is ready */
+  return rb_mysql_client_async_result(self);
+#endif
+}
+
+/* Appends name to buf as a backquoted identifier; with qualified, each
+ * .-separated part is quoted on its own, for db.table. The name is walked
+ * a character at a time in the connection's encoding: in GBK, Big5 or
+ * SJIS a multibyte character's trailing byte can be 0x60, and doubling
+ * that byte would split the character and unbalance the quoting. */
+static void mysql2_append_identifier(VALUE buf, VALUE name, rb_encoding *conn_enc, int qualified) {
+  const char *p, *end;
+
+  if (SYMBOL_P(name)) {
+    name = rb_sym_to_s(name);
+  }
+  Check_Type(name, T_STRING);
+  name = rb_str_export_to_enc(name, conn_enc);
+  p = RSTRING_PTR(name);
+  end = p + RSTRING_LEN(name);
+
+  rb_str_buf_cat(buf, "`", 1);
+  while (p < end) {
+    int len = rb_enc_mbclen(p, end, conn_enc);
+
+    if (len == 1 && *p == '`') {
+      rb_str_buf_cat(buf, "``", 2);
+    } else if (len == 1 && *p == '.' && qualified) {
+      rb_str_buf_cat(buf, "`.`", 3);
+    } else {
+      rb_str_buf_cat(buf, p, len);
+    }
+    p += len;
+  }
+  rb_str_buf_cat(buf, "`", 1);
+  (void)RB_GC_GUARD(name);
+}
+
+/* Appends one row's "(v1, v2, ...)" to buf. */
+static void mysql2_append_row(mysql_client_wrapper *wrapper, VALUE buf, VALUE row, rb_encoding *conn_enc) {
+  long i;
+
+  rb_str_buf_cat(buf, "(", 1);
+  for (i = 0; i < RARRAY_LEN(row); i++) {
+    if (i > 0) {
+      rb_str_buf_cat(buf, ", ", 2);
+    }
+    mysql2_append_bind(wrapper, buf, RARRAY_AREF(row, i), conn_enc);
+  }
+  rb_str_buf_cat(buf, ")", 1);
+}
+
+/* Sends the INSERT built up in buf through the same path as Client#query
+ * and returns its affected-row count. */
+static unsigned long long mysql2_bulk_insert_send(VALUE self, VALUE buf, VALUE current) {
+  GET_CLIENT(self);
+
+  rb_mysql_query(self, buf, Qnil, current);
+  return (unsigned long long)wrapper->affected_rows;
+}
+
+/* call-seq:
+ *    client.bulk_insert(table, columns, rows, options = {})
+ *
+ * Inserts +rows+, an Array of Arrays of values in +columns+ order, with as
+ * few multi-row INSERT statements as fit under +max_packet+ bytes each
+ * (the server's max_allowed_packet, read by the Ruby wrapper). Values are
+ * formatted as for Client#query's binds. Every row is checked before the
+ * first statement is sent. Returns the total affected rows, which
+ * Client#affected_rows reports afterward too.
+ */
+static VALUE rb_mysql_client_bulk_insert(VALUE self, VALUE table, VALUE columns, VALUE rows, VALUE max_packet, VALUE current) {
+  rb_encoding *conn_enc;
+  const char *verb = "INSERT INTO ";
+  VALUE on_duplicate, update_columns = Qnil, buf, suffix;
+  long limit, prefix_len, i, j, in_chunk = 0;
+  unsigned long long total = 0;
+  GET_CLIENT(self);
+
+  REQUIRE_CONNECTED(wrapper);
+  Check_Type(columns, T_ARRAY);
+  Check_Type(rows, T_ARRAY);
+  Check_Type(current, T_HASH);
+  conn_enc = rb_to_encoding(wrapper->encoding);
+  /* Slack for the command byte and packet header. */
+  limit = NUM2LONG(max_packet) - 64;
+
+  if (RARRAY_LEN(columns) == 0) {
+    rb_raise(rb_eArgError, "bulk_insert needs at least one column");
+  }
+
+  on_duplicate = rb_hash_delete(current, sym_on_duplicate);
+  if (NIL_P(on_duplicate)) {
+    /* plain INSERT */
+  } else if (on_duplicate == sym_ignore) {
+    verb = "INSERT IGNORE INTO ";
+  } else if (on_duplicate == sym_replace) {
+    verb = "REPLACE INTO ";
+  } else if (on_duplicate == sym_update) {
+    update_columns = columns;
+  } else if (RB_TYPE_P(on_duplicate, T_ARRAY) && RARRAY_LEN(on_duplicate) > 0) {
+    update_columns = on_duplicate;
+  } else {
+    rb_raise(rb_eArgError, "on_duplicate must be :ignore, :replace, :update, or an Array of columns to update, not %" PRIsVALUE, rb_inspect(on_duplicate));
+  }
+  /* Each statement is read to completion here, one after another. */
+  rb_hash_delete(current, sym_async);
+  rb_hash_delete(current, sym_stream);
+
+  /* Validate everything first, so a bad row raises before any statement
+   * has been sent rather than after some of them were. */
+  for (i = 0; i < RARRAY_LEN(rows); i++) {
+    VALUE row = RARRAY_AREF(rows, i);
+
+    Check_Type(row, T_ARRAY);
+    if (RARRAY_LEN(row) != RARRAY_LEN(columns)) {
+      rb_raise(rb_eArgError, "row %ld has %ld values for %ld columns", i, RARRAY_LEN(row), RARRAY_LEN(columns));
+    }
+    for (j = 0; j < RARRAY_LEN(row); j++) {
+      mysql2_bind_capacity(RARRAY_AREF(row, j), j, 1);
+    }
+  }
+
+  if (RARRAY_LEN(rows) == 0) {
+    wrapper->affected_rows = 0;
+    return INT2FIX(0);
+  }
+
+  suffix = rb_str_buf_new(0);
+  rb_enc_associate(suffix, conn_enc);
+  if (!NIL_P(update_columns)) {
+    rb_str_buf_cat_ascii(suffix, " ON DUPLICATE KEY UPDATE ");
+    for (i = 0; i < RARRAY_LEN(update_columns); i++) {
+      if (i > 0) {
+        rb_str_buf_cat(suffix, ", ", 2);
+      }
+      mysql2_append_identifier(suffix, RARRAY_AREF(update_columns, i), conn_enc, 0);
+      rb_str_buf_cat(suffix, " = VALUES(", 10);
+      mysql2_append_identifier(suffix, RARRAY_AREF(update_columns, i), conn_enc, 0);
+      rb_str_buf_cat(suffix, ")", 1);
+    }
+  }
+
+  buf = rb_str_buf_new(limit < 1024 * 1024 ? limit : 1024 * 1024);
+  rb_enc_associate(buf, conn_enc);
+  rb_str_buf_cat_ascii(buf, verb);
+  mysql2_append_identifier(buf, table, conn_enc, 1);
+  rb_str_buf_cat(buf, " (", 2);
+  for (i = 0; i < RARRAY_LEN(columns); i++) {
+    if (i > 0) {
+      rb_str_buf_cat(buf, ", ", 2);
+    }
+    mysql2_append_identifier(buf, RARRAY_AREF(columns, i), conn_enc, 0);
+  }
+  rb_str_buf_cat(buf, ") VALUES ", 9);
+  prefix_len = RSTRING_LEN(buf);
+
+  for (i = 0; i < RARRAY_LEN(rows); i++) {
+    long row_start = RSTRING_LEN(buf);
+
+    if (in_chunk > 0) {
+      rb_str_buf_cat(buf, ", ", 2);
+    }
+    mysql2_append_row(wrapper, buf, RARRAY_AREF(rows, i), conn_enc);
+
+    if (RSTRING_LEN(buf) + RSTRING_LEN(suffix) <= limit) {
+      in_chunk++;
+      continue;
+    }
+    if (in_chunk == 0) {
+      rb_raise(rb_eArgError, "row %ld alone is %ld bytes, over max_allowed_packet", i,
+               RSTRING_LEN(buf) - prefix_len);
+    }
+
+    /* This row doesn't fit: send the ones before it, then start the next
+     * statement with it. */
+    rb_str_set_len(buf, row_start);
+    rb_str_buf_append(buf, suffix);
+    total += mysql2_bulk_insert_send(self, buf, current);
+
+    rb_str_set_len(buf, prefix_len);
+    in_chunk = 0;
+    i--;
+  }
+
+  rb_str_buf_append(buf, suffix);
+  total += mysql2_bulk_insert_send(self, buf, current);
+
+  wrapper->affected_rows = total;
+  return ULL2NUM(total);
+}
+
+struct pipeline_args {
+  VALUE self;
+  VALUE statements;
+  VALUE results;
+  int multi_statements_toggled;
+  struct query_completion completion;
+};
+
+/* A statement in the batch failed. A server-reported error is a complete
+ * reply: keep it as that statement's entry and carry on. A client-side one
+ * (lost connection, out of memory) leaves the exchange in doubt, so it's
+ * raised and the rb_ensure companion drops the connection. */
+static void mysql2_pipeline_capture_error(struct pipeline_args *args) {
+  mysql_client_wrapper *wrapper = args->completion.wrapper;
+
+  wrapper->state = MYSQL2_CLIENT_IDLE;
+  if (MYSQL2_CLIENT_ERRNO_P(mysql_errno(wrapper->client))) {
+    rb_raise_mysql2_error(wrapper);
+  }
+  rb_ary_push(args->results, mysql2_client_error(wrapper));
+}
+
+/* Sends every statement not yet answered as one multi-statement command and
+ * reads the responses back in order. The server stops a batch at its first
+ * failing statement, so after an error the rest go out again as a new batch:
+ * one round trip when nothing fails, one more per failure otherwise. */
+static VALUE do_pipeline(VALUE argsval) {
+  struct pipeline_args *args = (void *)argsval;
+  VALUE self = args->self;
+  mysql_client_wrapper *wrapper = args->completion.wrapper;
+  long count = RARRAY_LEN(args->statements);
+  long next = 0;
+
+  while (next < count) {
+    struct nogvl_send_query_args send_args;
+    struct nogvl_read_query_result_args read_args;
+#ifndef _WIN32
+    struct async_query_args async_args;
+#endif
+    double query_elapsed;
+    VALUE sql = rb_str_buf_new(0);
+    long i;
+
+    for (i = next; i < count; i++) {
+      if (i > next) {
+        rb_str_buf_cat(sql, "\n;", 2);
+      }
+      rb_str_buf_append(sql, RARRAY_AREF(args->statements, i));
+    }
+
+    send_args.mysql = wrapper->client;
+    send_args.self = self;
+    send_args.sql = sql;
+    send_args.sql_ptr = RSTRING_PTR(sql);
+    send_args.sql_len = RSTRING_LEN(sql);
+    send_args.completion.wrapper = wrapper;
+    send_args.completion.completed = 0;
+
+    wrapper->state = MYSQL2_CLIENT_QUERYING;
+    wrapper->query_start = mysql2_monotonic_now();
+
+    rb_ensure(do_send_query, (VALUE)&send_args, disconnect_query_if_incomplete, (VALUE)&send_args.completion);
+#ifndef _WIN32
+    async_args.fd = wrapper->client->net.fd;
+    async_args.self = self;
+    async_args.deadline = -1;
+    async_args.timed_out = 0;
+    async_args.completion.wrapper = wrapper;
+    async_args.completion.completed = 0;
+    rb_ensure(do_query, (VALUE)&async_args, disconnect_query_if_incomplete, (VALUE)&async_args.completion);
+#endif
+    (void)RB_GC_GUARD(sql);
+
+    read_args.mysql = wrapper->client;
+    if (mysql2_read_query_result(self, &read_args) == Qfalse) {
+      mysql2_pipeline_capture_error(args);
+      next++;
+      continue;
+    }
+
+    /* Only the batch's first result carries a #query_time, as with a
+     * multi-statement Client#query. */
+    query_elapsed = (wrapper->query_start < 0 || read_args.query_end < 0)
+      ? -1 : read_args.query_end - wrapper->query_start;
+    mysql2_latency_record(wrapper, MYSQL2_LATENCY_SERVER, wrapper->send_end, read_args.query_end);
+
+    for (;;) {
+      rb_ary_push(args->results, mysql2_fetch_result_set(self, wrapper, query_elapsed, 0));
+      /* Storing the result released the claim; this call still owns the
+       * connection until the whole pipeline has been read. */
+      wrapper->active_fiber = rb_fiber_current();
+      query_elapsed = -1;
+      next++;
+
+      if (!mysql_more_results(wrapper->client)) {
+        break;
+      }
+      if (next >= count) {
+        /* Some statement answered with more than one result set, so the
+         * entries no longer line up with the statements. Raising before
+         * completion drops the connection along with the unread rest. */
+        rb_raise(cMysql2Error, "Client#pipeline got more result sets than statements; each statement must return at most one");
+      }
+      wrapper->state = MYSQL2_CLIENT_QUERYING;
+      if (mysql2_next_result(self, wrapper) > 0) {
+        mysql2_pipeline_capture_error(args);
+        next++;
+        break;
+      }
+    }
+  }
+
+  args->completion.completed = 1;
+  return args->results;
+}
+
+/* rb_ensure companion for do_pipeline: turns MULTI_STATEMENTS back off if
+ * the pipeline turned it on, then releases the claim, or drops the
+ * connection if the pipeline was interrupted mid-exchange. A connection
+ * that can't be switched back is dropped too, rather than handed back
+ * accepting multi-statement queries its owner never asked for. */
+static VALUE mysql2_pipeline_finish(VALUE argsval) {
+  struct pipeline_args *args = (void *)argsval;
+  mysql_client_wrapper *wrapper = args->completion.wrapper;
+
+  if (args->completion.completed && args->multi_statements_toggled) {
+    mysql2_net_count_command(wrapper, 3);
+    if (mysql_set_server_option(wrapper->client, MYSQL_OPTION_MULTI_STATEMENTS_OFF) != 0) {
+      args->completion.completed = 0;
+    }
+  }
+
+  return release_claim_or_disconnect((VALUE)&args->completion);
+}
+
+/* call-seq:
+ *    client.pipeline(statements, options = {})
+ *
+ * Runs every SQL String in +statements+ in a single round trip and returns
+ * an Array with one entry per statement, in order: a Result, nil for a
+ * statement without a result set, or the Mysql2::Error a failed statement
+ * raised. A failure doesn't abort the statements after it.
+ */
+static VALUE rb_mysql_client_pipeline(VALUE self, VALUE statements, VALUE current) {
+  struct pipeline_args args;
+  long count, i;
+  rb_encoding *conn_enc;
+  GET_CLIENT(self);
+
+  REQUIRE_CONNECTED(wrapper);
+
+  if (mysql2_forked_without_reconnect(wrapper) && wrapper->automatic_close) {
+    mysql2_warn_forked_without_reconnect(wrapper, "send a query");
+  }
+
+  Check_Type(statements, T_ARRAY);
+  (void)RB_GC_GUARD(current);
+  Check_Type(current, T_HASH);
+  mysql2_canonicalize_force_encoding(current);
+  /* Every response in the batch has to be read before the call returns,
+   * so there's nothing to stream and nothing to hand back asynchronously. */
+  if (RTEST(rb_hash_aref(current, sym_stream))) {
+    rb_raise(rb_eArgError, "Client#pipeline buffers every result; :stream is not supported");
+  }
+  if (RTEST(rb_hash_aref(current, sym_async))) {
+    rb_raise(rb_eArgError, "Client#pipeline does not support :async");
+  }
+
+  /* Validate the whole batch before anything goes out on the wire. */
+  count = RARRAY_LEN(statements);
+  conn_enc = rb_to_encoding(wrapper->encoding);
+  args.statements = rb_ary_new_capa(count);
+  for (i = 0; i < count; i++) {
+    VALUE sql = rb_ary_entry(statements, i);
+
+    Check_Type(sql, T_STRING);
+    sql = rb_str_export_to_enc(sql, conn_enc);
+    if (RSTRING_LEN(sql) == 0 || !mysql2_sql_is_single_statement(RSTRING_PTR(sql), RSTRING_END(sql), conn_enc)) {
+      rb_raise(rb_eArgError, "pipeline statement %ld must be a single, complete SQL statement", i);
+    }
+    /* A procedure's result sets would each take a statement's entry. */
+    if (mysql2_sql_starts_with_keyword(RSTRING_PTR(sql), RSTRING_END(sql), conn_enc, "CALL")) {
+      rb_raise(rb_eArgError, "pipeline statement %ld is a CALL, which may return more than one result set", i);
+    }
+    rb_ary_push(args.statements, sql);
+  }
+
+  args.results = rb_ary_new_capa(count);
+  if (count == 0) {
+    return args.results;
+  }
+
+  rb_ivar_set(self, intern_current_query_options, current);
+  wrapper->infile_source = Qnil;
+
+  args.self = self;
+  args.multi_statements_toggled = 0;
+  args.completion.wrapper = wrapper;
+  args.completion.completed = 0;
+
+  rb_mysql_client_set_active_fiber(self, false);
+
+  /* Safe point before a new command; see rb_mysql_query. */
+  mysql2_abandon_active_stream(wrapper);
+  mysql2_reap_pending_result_frees(wrapper);
+  mysql2_reap_pending_stmt_closes(wrapper);
+
+  /* A connection made without MULTI_STATEMENTS gets it for the length of
+   * the pipeline only. Both COM_SET_OPTION round trips run with the GVL
+   * held, like Client#set_server_option. */
+  if (count > 1 && !(wrapper->client->client_flag & CLIENT_MULTI_STATEMENTS)) {
+    mysql2_net_count_command(wrapper, 3);
+    if (mysql_set_server_option(wrapper->client, MYSQL_OPTION_MULTI_STATEMENTS_ON) != 0) {
+      wrapper->active_fiber = Qnil;
+      rb_raise_mysql2_error(wrapper);
+    }
+    args.multi_statements_toggled = 1;
+  }
+
+  return rb_ensure(do_pipeline, (VALUE)&args, mysql2_pipeline_finish, (VALUE)&args);
+}
+
+/* One statement of a Client#query_all batch, as read off the wire: its
+ * buffered result set, or NULL and the rows it affected. */
+struct query_all_entry {
+  MYSQL_RES *result;
+  size_t rows_memsize;
+  uint64_t affected_rows;
+};
+
+struct query_all_args {
+  VALUE self;
+  VALUE sql;
+  struct query_all_entry *entries;
+  long count;
+  long capa;
+  double query_elapsed;
+  int multi_statements_toggled;
+  struct query_completion completion;
+};
+
+/* A statement in the batch failed: the server doesn't run the rest. A
+ * server-reported error is a complete reply, so only the claim is
+ * released; a client-side one drops the connection. */
+static void mysql2_query_all_raise(struct query_all_args *args) {
+  mysql_client_wrapper *wrapper = args->completion.wrapper;
+
+  args->completion.completed = !MYSQL2_CLIENT_ERRNO_P(mysql_errno(wrapper->client));
+  rb_raise_mysql2_error(wrapper);
+}
+
+/* Sends the batch, then reads every statement's reply in one loop, with the
+ * GVL released for each store and next_result. Nothing Ruby-side is built
+ * here: result sets are kept as bare MYSQL_RES until the batch is done. */
+static VALUE do_query_all(VALUE argsval) {
+  struct query_all_args *args = (void *)argsval;
+  VALUE self = args->self;
+  mysql_client_wrapper *wrapper = args->completion.wrapper;
+  struct nogvl_send_query_args send_args;
+  struct nogvl_read_query_result_args read_args;
+#ifndef _WIN32
+  struct async_query_args async_args;
+#endif
+
+  send_args.mysql = wrapper->client;
+  send_args.self = self;
+  send_args.sql = args->sql;
+  send_args.sql_ptr = RSTRING_PTR(args->sql);
+  send_args.sql_len = RSTRING_LEN(args->sql);
+  send_args.completion.wrapper = wrapper;
+  send_args.completion.completed = 0;
+
+  wrapper->state = MYSQL2_CLIENT_QUERYING;
+  wrapper->query_start = mysql2_monotonic_now();
+
+  rb_ensure(do_send_query, (VALUE)&send_args, disconnect_query_if_incomplete, (VALUE)&send_args.completion);
+#ifndef _WIN32
+  async_args.fd = wrapper->client->net.fd;
+  async_args.self = self;
+  async_args.deadline = -1;
+  async_args.timed_out = 0;
+  async_args.completion.wrapper = wrapper;
+  async_args.completion.completed = 0;
+  rb_ensure(do_query, (VALUE)&async_args, disconnect_query_if_incomplete, (VALUE)&async_args.completion);
+#endif
+
+  read_args.mysql = wrapper->client;
+  if (mysql2_read_query_result(self, &read_args) == Qfalse) {
+    mysql2_query_all_raise(args);
+  }
+  args->query_elapsed = (wrapper->query_start < 0 || read_args.query_end < 0)
+    ? -1 : read_args.query_end - wrapper->query_start;
+  mysql2_latency_record(wrapper, MYSQL2_LATENCY_SERVER, wrapper->send_end, read_args.query_end);
+
+  for (;;) {
+    double store_start = mysql2_monotonic_now();
+    struct nogvl_store_result_args store_args;
+    MYSQL_RES *result;
+    int ret;
+
+    store_args.wrapper = wrapper;
+    rb_thread_call_without_gvl(nogvl_store_result_measured, &store_args, RUBY_UBF_IO, 0);
+    result = store_args.result;
+
+    mysql2_latency_record(wrapper, MYSQL2_LATENCY_STORE, store_start, mysql2_monotonic_now());
+    if (result) {
+      wrapper->rows_fetched += mysql_num_rows(result);
+      wrapper->payload_received += mysql2_fields_payload(result) + store_args.payload;
+      MYSQL2_PROBE2(result__stored, mysql_thread_id(wrapper->client), mysql_num_rows(result));
+    }
+
+    if (result == NULL && mysql_field_count(wrapper->client) != 0) {
+      mysql2_query_all_raise(args);
+    }
+    if (args->count == args->capa) {
+      args->capa = args->capa ? args->capa * 2 : 16;
+      REALLOC_N(args->entries, struct query_all_entry, args->capa);
+    }
+    args->entries[args->count].result = result;
+    args->entries[args->count].rows_memsize = store_args.rows_memsize;
+    args->entries[args->count].affected_rows = result ? 0 : mysql_affected_rows(wrapper->client);
+    args->count++;
+
+    ret = mysql2_next_result(self, wrapper);
+    if (ret > 0) {
+      mysql2_query_all_raise(args);
+    } else if (ret < 0) {
+      break;
+    }
+  }
+
+  wrapper->affected_rows = args->entries[args->count - 1].affected_rows;
+  args->completion.completed = 1;
+  return Qnil;
+}
+
+/* rb_ensure companion for do_query_all: turns MULTI_STATEMENTS back off if
+ * it was turned on for the batch, marks the connection idle, and releases
+ * the claim (or drops the connection after an interrupted exchange). */
+static VALUE mysql2_query_all_finish(VALUE argsval) {
+  struct query_all_args *args = (void *)argsval;
+  mysql_client_wrapper *wrapper = args->completion.wrapper;
+
+  if (args->completion.completed && args->multi_statements_toggled) {
+    mysql2_net_count_command(wrapper, 3);
+    if (mysql_set_server_option(wrapper->client, MYSQL_OPTION_MULTI_STATEMENTS_OFF) != 0) {
+      args->completion.completed = 0;
+    }
+  }
+
+  return mysql2_next_result_reset_state((VALUE)&args->completion);
+}
+
+/* Builds the return value once the connection is free again: a Result per
+ * result set, the affected-row count for every other statement. */
+static VALUE mysql2_query_all_results(VALUE argsval) {
+  struct query_all_args *args = (void *)argsval;
+  VALUE self = args->self;
+  VALUE results = rb_ary_new_capa(args->count);
+  VALUE current = rb_ivar_get(self, intern_current_query_options);
+  long i;
+  GET_CLIENT(self);
+
+  for (i = 0; i < args->count; i++) {
+    struct query_all_entry *entry = &args->entries[i];
+
+    if (entry->result) {
+      MYSQL_RES *result = entry->result;
+
+      entry->result = NULL;
+      /* Only the batch's first result carries a #query_time, as with a
+       * multi-statement Client#query. */
+      rb_ary_push(results, rb_mysql_result_stored_to_obj(self, wrapper->encoding, rb_hash_dup(current), result, entry->rows_memsize,
+                                                         i == 0 ? args->query_elapsed : -1));
+    } else {
+      rb_ary_push(results, ULL2NUM(entry->affected_rows));
+    }
+  }
+
+  return results;
+}
+
+/* rb_ensure companion for everything after the send: frees the result sets
+ * not handed to a Result -- all of them, when the batch failed. */
+static VALUE mysql2_query_all_free(VALUE argsval) {
+  struct query_all_args *args = (void *)argsval;
+  long i;
+
+  for (i = 0; i < args->count; i++) {
+    if (args->entries[i].result) {
+      mysql_free_result(args->entries[i].result);
+    }
+  }
+  xfree(args->entries);
+  args->entries = NULL;
+
+  return Qnil;
+}
+
+static VALUE mysql2_query_all_run(VALUE argsval) {
+  struct query_all_args *args = (void *)argsval;
+
+  rb_ensure(do_query_all, argsval, mysql2_query_all_finish, argsval);
+  return mysql2_query_all_results((VALUE)args);
+}
+
+/* call-seq:
+ *    client.query_all(sql, options = {})
+ *
+ * Runs +sql+, any number of ;-separated statements, and returns an Array
+ * with one entry per statement, in order: a Result for each statement with
+ * a result set, the number of affected rows for each without. Every result
+ * set is stored and every next_result read in one C loop, with the GVL
+ * released for each; the Results are only built once the batch is done. A
+ * failing statement raises its error, and the server runs none after it.
+ */
+static VALUE rb_mysql_client_query_all(VALUE self, VALUE sql, VALUE current) {
+  struct query_all_args args;
   GET_CLIENT(self);
 
   REQUIRE_CONNECTED(wrapper);
@@ -1758,81 +3884,60 @@ static VALUE rb_mysql_query(VALUE self, VALUE sql, VALUE current) {
     mysql2_warn_forked_without_reconnect(wrapper, "send a query");
   }
 
-  args.mysql = wrapper->client;
-
   (void)RB_GC_GUARD(current);
   Check_Type(current, T_HASH);
-  /* Resolve :force_encoding to an Encoding object up front: invalid values
-   * raise here, before anything is written to the wire, leaving the
-   * connection untouched and reusable. Nothing downstream of the send may
-   * raise for this option -- rb_mysql_result_to_obj in particular. */
   mysql2_canonicalize_force_encoding(current);
-  /* Text-protocol streaming is mysql_use_result: the server pushes rows and
-   * the client pulls them off the socket, so there is no prefetch to size.
-   * The stream: {size: N} spelling is prepared-statement-only
-   * (Statement#execute drives a server-side cursor, which does prefetch);
-   * reject it here rather than silently stream one row at a time. */
-  if (RB_TYPE_P(rb_hash_aref(current, sym_stream), T_HASH)) {
-    rb_raise(rb_eArgError, "stream: {size: N} is only supported for prepared statements; Client#query streams with mysql_use_result, which has no prefetch");
+  if (RTEST(rb_hash_aref(current, sym_stream))) {
+    rb_raise(rb_eArgError, "Client#query_all buffers every result; :stream is not supported");
+  }
+  if (RTEST(rb_hash_aref(current, sym_async))) {
+    rb_raise(rb_eArgError, "Client#query_all does not support :async");
+  }
+  /* Its store loop neither waits against a deadline nor checks a result
+   * budget, so refuse these rather than ignore them. */
+  if (!NIL_P(rb_hash_aref(current, sym_timeout))) {
+    rb_raise(rb_eArgError, "Client#query_all does not support :timeout");
+  }
+  if (!NIL_P(rb_hash_aref(current, sym_max_result_rows)) || !NIL_P(rb_hash_aref(current, sym_max_result_bytes))) {
+    rb_raise(rb_eArgError, "Client#query_all does not support :max_result_rows or :max_result_bytes");
+  }
+  if (!NIL_P(rb_hash_aref(current, sym_spill))) {
+    rb_raise(rb_eArgError, "Client#query_all does not support :spill");
   }
-  rb_ivar_set(self, intern_current_query_options, current);
 
   Check_Type(sql, T_STRING);
-  /* ensure the string is in the encoding the connection is expecting */
   args.sql = rb_str_export_to_enc(sql, rb_to_encoding(wrapper->encoding));
-  args.sql_ptr = RSTRING_PTR(args.sql);
-  args.sql_len = RSTRING_LEN(args.sql);
+  args.self = self;
+  args.entries = NULL;
+  args.count = 0;
+  args.capa = 0;
+  args.query_elapsed = -1;
+  args.multi_statements_toggled = 0;
   args.completion.wrapper = wrapper;
   args.completion.completed = 0;
 
+  rb_ivar_set(self, intern_current_query_options, current);
+  wrapper->infile_source = Qnil;
+
   rb_mysql_client_set_active_fiber(self, false);
 
-  /* We're about to issue a new command: this is a safe point to close out
-   * any statements that were GC'd while we were busy earlier, and to free
-   * any abandoned result sets left over from a stream that was dropped
-   * mid-iteration -- including one that hasn't been collected by GC yet,
-   * which the reap below alone wouldn't catch (mysql2_abandon_active_stream).
-   * Deliberately last, right before the actual network write below --
-   * rb_ivar_set/rb_str_export_to_enc above can themselves allocate, and
-   * under GC.stress (or just unlucky timing) that can be what triggers the
-   * GC sweep that abandons a stream, so reaping any earlier can still leave
-   * a fresh pending free undrained when we send. Must also run before the
-   * state assignment below: mysql2_abandon_active_stream only acts while
-   * state is still STREAMING. */
+  /* Safe point before a new command; see rb_mysql_query. */
   mysql2_abandon_active_stream(wrapper);
   mysql2_reap_pending_result_frees(wrapper);
   mysql2_reap_pending_stmt_closes(wrapper);
 
-  wrapper->state = MYSQL2_CLIENT_QUERYING;
-
-  /* Open the round-trip bracket that async_result closes once the first
-   * response has been fully read -- including the socket wait in do_query,
-   * which is where most of a slow query's time goes. */
-  wrapper->query_start = mysql2_monotonic_now();
-
-#ifndef _WIN32
-  rb_ensure(do_send_query, (VALUE)&args, disconnect_query_if_incomplete, (VALUE)&args.completion);
-  (void)RB_GC_GUARD(sql);
-
-  if (rb_hash_aref(current, sym_async) == Qtrue) {
-    return Qnil;
-  } else {
-    async_args.fd = wrapper->client->net.fd;
-    async_args.self = self;
-    async_args.completion.wrapper = wrapper;
-    async_args.completion.completed = 0;
-
-    rb_ensure(do_query, (VALUE)&async_args, disconnect_query_if_incomplete, (VALUE)&async_args.completion);
-
-    return rb_ensure(rb_mysql_client_async_result, self, disconnect_and_mark_inactive, self);
+  /* Same as Client#pipeline: MULTI_STATEMENTS for the length of the call
+   * on a connection made without it. */
+  if (!(wrapper->client->client_flag & CLIENT_MULTI_STATEMENTS)) {
+    mysql2_net_count_command(wrapper, 3);
+    if (mysql_set_server_option(wrapper->client, MYSQL_OPTION_MULTI_STATEMENTS_ON) != 0) {
+      wrapper->active_fiber = Qnil;
+      rb_raise_mysql2_error(wrapper);
+    }
+    args.multi_statements_toggled = 1;
   }
-#else
-  do_send_query((VALUE)&args);
-  (void)RB_GC_GUARD(sql);
 
-  /* this will just block until the result is ready */
-  return rb_ensure(rb_mysql_client_async_result, self, disconnect_and_mark_inactive, self);
-#endif
+  return rb_ensure(mysql2_query_all_run, (VALUE)&args, mysql2_query_all_free, (VALUE)&args);
 }
 
 /* call-seq:
@@ -1982,6 +4087,24 @@ static VALUE _mysql_client_options(VALUE self, int opt, VALUE value) {
       break;
 #endif
 
+    case MYSQL_OPT_COMPRESS:
+      /* Takes no argument */
+      break;
+
+#ifdef HAVE_CONST_MYSQL_OPT_COMPRESSION_ALGORITHMS
+    case MYSQL_OPT_COMPRESSION_ALGORITHMS:
+      charval = (const char *)StringValueCStr(value);
+      retval  = charval;
+      break;
+#endif
+
+#ifdef HAVE_CONST_MYSQL_OPT_ZSTD_COMPRESSION_LEVEL
+    case MYSQL_OPT_ZSTD_COMPRESSION_LEVEL:
+      intval = NUM2UINT(value);
+      retval = &intval;
+      break;
+#endif
+
     default:
       return Qfalse;
   }
@@ -1996,10 +4119,19 @@ static VALUE _mysql_client_options(VALUE self, int opt, VALUE value) {
     switch (opt) {
       case MYSQL_OPT_RECONNECT:
         wrapper->reconnect_enabled = boolval;
+#ifdef MYSQL2_NONBLOCKING_QUERY_POLL
+        /* A reconnect would open a blocking connection underneath. */
+        if (boolval) {
+          wrapper->nonblocking = 0;
+        }
+#endif
         break;
       case MYSQL_OPT_CONNECT_TIMEOUT:
         wrapper->connect_timeout = intval;
         break;
+      case MYSQL_OPT_WRITE_TIMEOUT:
+        wrapper->write_timeout = intval;
+        break;
     }
   }
 
@@ -2157,6 +4289,7 @@ static void *nogvl_select_db(void *ptr) {
 static VALUE do_select_db(VALUE argsval) {
   struct nogvl_select_db_args *args = (void *)argsval;
 
+  mysql2_net_count_command(args->completion.wrapper, 1 + (unsigned long long)strlen(args->db));
   if (rb_thread_call_without_gvl(nogvl_select_db, args, RUBY_UBF_IO, 0) == Qfalse) {
     /* A complete round trip -- the server replied with an error -- so the
      * rb_ensure companion only releases the claim. */
@@ -2197,6 +4330,84 @@ static VALUE rb_mysql_client_select_db(VALUE self, VALUE db)
   return db;
 }
 
+#ifdef HAVE_MYSQL_RESET_CONNECTION
+static void *nogvl_reset_connection(void *ptr) {
+  MYSQL *client = ptr;
+
+  return (void *)(mysql_reset_connection(client) == 0 ? Qtrue : Qfalse);
+}
+
+static VALUE do_reset_connection(VALUE completionval) {
+  struct query_completion *completion = (void *)completionval;
+
+  mysql2_net_count_command(completion->wrapper, 1);
+  if (rb_thread_call_without_gvl(nogvl_reset_connection, completion->wrapper->client, RUBY_UBF_IO, 0) == Qfalse) {
+    /* A complete round trip (e.g. a server too old for
+     * COM_RESET_CONNECTION), so the connection itself is still usable. */
+    completion->completed = 1;
+    rb_raise_mysql2_error(completion->wrapper);
+  }
+
+  completion->completed = 1;
+  return Qnil;
+}
+#endif
+
+/* call-seq:
+ *    client.reset_connection
+ *
+ * Returns the session to the state it had right after connecting, without
+ * reconnecting: rolls back any open transaction, drops temporary tables,
+ * and clears user variables, session variables and locks (see
+ * COM_RESET_CONNECTION). :init_command is not run again.
+ *
+ * The server releases every prepared statement, so each Statement prepared
+ * on this client is closed too. Requires MySQL 5.7.3 / MariaDB 10.2.4 or
+ * later on both ends; see RESET_CONNECTION_SUPPORTED.
+ */
+static VALUE rb_mysql_client_reset_connection(VALUE self) {
+#ifdef HAVE_MYSQL_RESET_CONNECTION
+  struct query_completion completion;
+  VALUE statements;
+  long i;
+  GET_CLIENT(self);
+
+  REQUIRE_CONNECTED(wrapper);
+
+  if (mysql2_forked_without_reconnect(wrapper) && wrapper->automatic_close) {
+    mysql2_warn_forked_without_reconnect(wrapper, "reset the connection");
+  }
+
+  completion.wrapper = wrapper;
+  completion.completed = 0;
+
+  rb_mysql_client_set_active_fiber(self, false);
+
+  /* Safe point before a new command; see rb_mysql_query. Pending statement
+   * closes are left for after the reset, when they no longer need a round
+   * trip each. */
+  mysql2_abandon_active_stream(wrapper);
+  mysql2_reap_pending_result_frees(wrapper);
+
+  /* Busy while the GVL is released, same as next_result; the companion
+   * puts it back to IDLE, reaps, and releases the claim. */
+  wrapper->state = MYSQL2_CLIENT_QUERYING;
+  rb_ensure(do_reset_connection, (VALUE)&completion, mysql2_next_result_reset_state, (VALUE)&completion);
+
+  /* The client library detached every statement handle from the
+   * connection, so closing the live ones is local bookkeeping only. */
+  statements = rb_funcall(wrapper->prepared_statements, intern_values, 0);
+  for (i = 0; i < RARRAY_LEN(statements); i++) {
+    rb_funcall(rb_ary_entry(statements, i), intern_close, 0);
+  }
+  wrapper->affected_rows = -1;
+
+  return Qnil;
+#else
+  rb_raise(rb_eNotImpError, "reset_connection requires a client library with mysql_reset_connection");
+#endif
+}
+
 static void *nogvl_ping(void *ptr) {
   MYSQL *client = ptr;
 
@@ -2220,6 +4431,7 @@ static VALUE do_ping(VALUE args) {
   if (!CONNECTED(wrapper)) {
     result = Qfalse;
   } else {
+    mysql2_net_count_command(wrapper, 1);
     result = (VALUE)rb_thread_call_without_gvl(nogvl_ping, wrapper->client, RUBY_UBF_IO, 0);
   }
   wrapper->active_fiber = Qnil;
@@ -2259,6 +4471,7 @@ static VALUE rb_mysql_client_ping(VALUE self) {
   if (!CONNECTED(wrapper)) {
     result = Qfalse;
   } else {
+    mysql2_net_count_command(wrapper, 1);
     result = (VALUE)rb_thread_call_without_gvl(nogvl_ping, wrapper->client, RUBY_UBF_IO, 0);
   }
   wrapper->active_fiber = Qnil;
@@ -2284,6 +4497,8 @@ static VALUE rb_mysql_client_set_server_option(VALUE self, VALUE value) {
    * the GVL held, so nothing can raise -- and no interrupt can land --
    * between this claim and its release below. */
   rb_mysql_client_set_active_fiber(self, false);
+  /* COM_SET_OPTION: the command byte and a two-byte option */
+  mysql2_net_count_command(wrapper, 3);
   rv = mysql_set_server_option(wrapper->client, option);
   wrapper->active_fiber = Qnil;
 
@@ -2304,12 +4519,12 @@ static VALUE rb_mysql_client_more_results(VALUE self)
     return Qtrue;
 }
 
-#if defined(HAVE_MYSQL_NEXT_RESULT_NONBLOCKING) && !defined(_WIN32)
-/* Polls mysql_next_result_nonblocking() (added in MySQL 8.0.16), which
- * never blocks by its own contract, instead of calling the blocking
- * mysql_next_result() directly. Mixing this with the ordinary blocking
- * API on the same connection is explicitly documented as supported, so
- * nothing else in this file needs to change:
+#ifdef MYSQL2_NONBLOCKING_QUERY_POLL
+/* Polls mysql_next_result_nonblocking() (added in MySQL 8.0.16) on a
+ * connection opened with mysql_real_connect_nonblocking, where it returns
+ * instead of blocking, waiting in Ruby for the next result's first packet.
+ * Mixing this with the ordinary blocking API on the same connection is
+ * explicitly documented as supported:
  * https://dev.mysql.com/doc/c-api/8.0/en/c-api-asynchronous-interface-usage.html
  */
 static enum net_async_status next_result_nonblocking(VALUE self, mysql_client_wrapper *wrapper) {
@@ -2320,25 +4535,66 @@ static enum net_async_status next_result_nonblocking(VALUE self, mysql_client_wr
     if (status != NET_ASYNC_NOT_READY) {
       return status;
     }
-    wait_for_readable_with_timeout(self, wrapper->client->net.fd);
+    mysql2_wait_for_async_status(self, wrapper->client, MYSQL_WAIT_READ, 0);
   }
 }
-#else
-/* Fallback for MariaDB (mysql_next_result_nonblocking doesn't exist there
- * under this name -- MariaDB Connector/C has its own mysql_next_result_start
- * / _cont pair instead, not yet wired up here) and for MySQL builds older
- * than 8.0.16. Releasing the GVL around the still-blocking call at least
- * lets other Ruby threads run during the wait; it does not make the call
- * interruptible via Thread#raise/Timeout.timeout the way the nonblocking
- * path above is, since libmysqlclient's own blocking read loop may retry
- * internally on the signal RUBY_UBF_IO sends. */
+#endif
+
+/* Fallback for MySQL builds older than 8.0.16 or on a connection that may
+ * reconnect, and for MariaDB without an async context (with one,
+ * mysql2_next_result below uses mysql_next_result_start/_cont instead). Releasing the GVL around the
+ * still-blocking call at least lets other Ruby threads run during the
+ * wait; it does not make the call interruptible via
+ * Thread#raise/Timeout.timeout the way the nonblocking paths are, since
+ * libmysqlclient's own blocking read loop may retry internally on the
+ * signal RUBY_UBF_IO sends. Also what every build uses while a LOAD DATA
+ * LOCAL INFILE source is set; see mysql2_read_query_result. */
 static void *nogvl_next_result(void *ptr) {
   mysql_client_wrapper *wrapper = ptr;
+  int ret;
+
+  wrapper->infile_gvl_released = 1;
+  ret = mysql_next_result(wrapper->client);
+  wrapper->infile_gvl_released = 0;
   /* Cast through intptr_t, not straight through void*, to round-trip a
    * signed int (including -1 for "no more results") intact. */
-  return (void *)(intptr_t)mysql_next_result(wrapper->client);
+  return (void *)(intptr_t)ret;
 }
+
+/* mysql_next_result by whichever means this build has; same return
+ * convention: 0 for another result, -1 for no more, >0 for an error. */
+static int mysql2_next_result(VALUE self, mysql_client_wrapper *wrapper) {
+  if (!NIL_P(wrapper->infile_source)) {
+    int ret = (int)(intptr_t)rb_thread_call_without_gvl(nogvl_next_result, wrapper, RUBY_UBF_IO, 0);
+
+    mysql2_infile_rethrow(wrapper);
+    return ret;
+  }
+#ifdef MYSQL2_NONBLOCKING_QUERY_CONT
+  if (wrapper->nonblocking) {
+    int ret = 0;
+    int status = mysql_next_result_start(&ret, wrapper->client);
+    while (status) {
+      status = mysql_next_result_cont(&ret, wrapper->client, mysql2_wait_for_async_status(self, wrapper->client, status, 0));
+    }
+    return ret;
+  }
 #endif
+#ifdef MYSQL2_NONBLOCKING_QUERY_POLL
+  if (wrapper->nonblocking) {
+    switch (next_result_nonblocking(self, wrapper)) {
+      case NET_ASYNC_ERROR:
+        return 1;
+      case NET_ASYNC_COMPLETE_NO_MORE_RESULTS:
+        return -1;
+      case NET_ASYNC_COMPLETE:
+      default:
+        return 0;
+    }
+  }
+#endif
+  return (int)(intptr_t)rb_thread_call_without_gvl(nogvl_next_result, wrapper, RUBY_UBF_IO, 0);
+}
 
 static VALUE mysql2_next_result_reset_state(VALUE completionval) {
   struct query_completion *completion = (void *)completionval;
@@ -2371,31 +4627,11 @@ static VALUE mysql2_next_result_body(VALUE argsval) {
    * the QUERYING/IDLE bracket rb_mysql_query uses for the same reason. */
   wrapper->state = MYSQL2_CLIENT_QUERYING;
 
-#if defined(HAVE_MYSQL_NEXT_RESULT_NONBLOCKING) && !defined(_WIN32)
   {
-    enum net_async_status status = next_result_nonblocking(self, wrapper);
-    /* The exchange finished: even NET_ASYNC_ERROR is a complete reply (a
-     * failed statement in the batch), not a mid-protocol interruption, so
-     * the rb_ensure companion only releases the claim. */
-    args->completion.completed = 1;
-    wrapper->affected_rows = mysql_affected_rows(wrapper->client);
-
-    switch (status) {
-      case NET_ASYNC_ERROR:
-        rb_raise_mysql2_error(wrapper);
-        return Qfalse; /* unreached */
-      case NET_ASYNC_COMPLETE_NO_MORE_RESULTS:
-        return Qfalse;
-      case NET_ASYNC_COMPLETE:
-      default:
-        return Qtrue;
-    }
-  }
-#else
-  {
-    int ret = (int)(intptr_t)rb_thread_call_without_gvl(nogvl_next_result, wrapper, RUBY_UBF_IO, 0);
-    /* Same as the nonblocking path: a nonzero ret is a complete
-     * server-reported error, not a mid-protocol interruption. */
+    int ret = mysql2_next_result(self, wrapper);
+    /* The exchange finished: even an error is a complete reply (a failed
+     * statement in the batch), not a mid-protocol interruption, so the
+     * rb_ensure companion only releases the claim. */
     args->completion.completed = 1;
     wrapper->affected_rows = mysql_affected_rows(wrapper->client);
 
@@ -2408,7 +4644,6 @@ static VALUE mysql2_next_result_body(VALUE argsval) {
       return Qfalse;
     }
   }
-#endif
 }
 
 /* call-seq:
@@ -2432,6 +4667,11 @@ static VALUE rb_mysql_client_next_result(VALUE self)
   return rb_ensure(mysql2_next_result_body, (VALUE)&args, mysql2_next_result_reset_state, (VALUE)&args.completion);
 }
 
+static VALUE do_store_result(VALUE self) {
+  GET_CLIENT(self);
+  return mysql2_fetch_result_set(self, wrapper, -1, 1);
+}
+
 /* call-seq:
  *    client.store_result
  *
@@ -2440,8 +4680,6 @@ static VALUE rb_mysql_client_next_result(VALUE self)
  */
 static VALUE rb_mysql_client_store_result(VALUE self)
 {
-  GET_CLIENT(self);
-
   /* The claim is released inside nogvl_do_result once the result is stored
    * (or, on a fetch error, by mysql2_fetch_result_set before it raises) --
    * the same lifecycle a query's own result fetch follows. */
@@ -2458,8 +4696,10 @@ static VALUE rb_mysql_client_store_result(VALUE self)
    * No round-trip reading: this result set's response was read and consumed
    * by Client#next_result, which no bracket surrounds -- the number the
    * original bracket produced belongs to the batch's first result set, not
-   * this one. So #query_time is nil here. */
-  return mysql2_fetch_result_set(self, wrapper, -1);
+   * this one. So #query_time is nil here.
+   *
+   * Ensured like async_result: the store may wait in Ruby. */
+  return rb_ensure(do_store_result, self, disconnect_and_mark_inactive, self);
 }
 
 /* call-seq:
@@ -2562,17 +4802,26 @@ static VALUE set_connect_timeout(VALUE self, VALUE value) {
 }
 
 static VALUE set_read_timeout(VALUE self, VALUE value) {
-  long int sec;
-  Check_Type(value, T_FIXNUM);
-  sec = FIX2INT(value);
+  double sec;
+  unsigned int whole_sec;
+  if (!RB_TYPE_P(value, T_FLOAT)) {
+    Check_Type(value, T_FIXNUM);
+  }
+  sec = NUM2DBL(value);
   if (sec < 0) {
-    rb_raise(cMysql2Error, "read_timeout must be a positive integer, you passed %ld", sec);
+    rb_raise(cMysql2Error, "read_timeout must be a positive number, you passed %" PRIsVALUE, value);
   }
   /* Set the instance variable here even though _mysql_client_options
      might not succeed, because the timeout is used in other ways
-     elsewhere */
+     elsewhere: mysql2_wait_for_socket honors fractional seconds, while the
+     client library only takes whole ones, so it gets the value rounded up
+     and never fires first. */
   rb_ivar_set(self, intern_read_timeout, value);
-  return _mysql_client_options(self, MYSQL_OPT_READ_TIMEOUT, value);
+  whole_sec = (unsigned int)sec;
+  if (whole_sec < sec) {
+    whole_sec++;
+  }
+  return _mysql_client_options(self, MYSQL_OPT_READ_TIMEOUT, UINT2NUM(whole_sec));
 }
 
 static VALUE set_write_timeout(VALUE self, VALUE value) {
@@ -2690,6 +4939,63 @@ static VALUE set_tls_version(VALUE self, VALUE value) {
 #endif
 }
 
+/* The :compression connect option: true (zlib), an algorithm name, or a
+ * list of them, e.g. [:zstd, :zlib] -- the set allowed, not an order of
+ * preference: the handshake picks zlib whenever both sides allow it.
+ * libmysqlclient 8.0.18+ takes the list as-is; anywhere else zlib is all the protocol
+ * speaks, so anything naming only zstd is refused rather than connecting
+ * uncompressed behind the caller's back. */
+static VALUE set_compression(VALUE self, VALUE value) {
+  VALUE names, algorithms = rb_str_new(NULL, 0);
+  int zlib = 0;
+  long i;
+
+  if (!RTEST(value)) {
+    return Qfalse;
+  }
+  if (value == Qtrue) {
+    value = rb_str_new_cstr("zlib");
+  }
+  names = RB_TYPE_P(value, T_ARRAY) ? value : rb_ary_new_from_args(1, value);
+  if (RARRAY_LEN(names) == 0) {
+    rb_raise(rb_eArgError, "compression needs at least one algorithm");
+  }
+  for (i = 0; i < RARRAY_LEN(names); i++) {
+    VALUE name = rb_funcall(RARRAY_AREF(names, i), intern_to_s, 0);
+
+    if (strcmp(StringValueCStr(name), "zlib") == 0) {
+      zlib = 1;
+    } else if (strcmp(RSTRING_PTR(name), "zstd") != 0) {
+      rb_raise(rb_eArgError, "unknown compression algorithm %" PRIsVALUE ", expected zlib or zstd", name);
+    }
+    if (i > 0) rb_str_cat_cstr(algorithms, ",");
+    rb_str_append(algorithms, name);
+  }
+
+#ifdef HAVE_CONST_MYSQL_OPT_COMPRESSION_ALGORITHMS
+  (void)zlib;
+  return _mysql_client_options(self, MYSQL_OPT_COMPRESSION_ALGORITHMS, algorithms);
+#else
+  if (!zlib) {
+    rb_raise(cMysql2Error, "zstd compression is not available, you may need a newer MySQL client library");
+  }
+  return _mysql_client_options(self, MYSQL_OPT_COMPRESS, Qtrue);
+#endif
+}
+
+static VALUE set_compression_level(VALUE self, VALUE value) {
+#ifdef HAVE_CONST_MYSQL_OPT_ZSTD_COMPRESSION_LEVEL
+  int level = NUM2INT(value);
+
+  if (level < 1 || level > 22) {
+    rb_raise(rb_eArgError, "compression_level must be between 1 and 22, got %d", level);
+  }
+  return _mysql_client_options(self, MYSQL_OPT_ZSTD_COMPRESSION_LEVEL, value);
+#else
+  rb_raise(cMysql2Error, "compression_level is not available, you may need a newer MySQL client library");
+#endif
+}
+
 static VALUE set_enable_cleartext_plugin(VALUE self, VALUE value) {
 #ifdef HAVE_CONST_MYSQL_ENABLE_CLEARTEXT_PLUGIN
   return _mysql_client_options(self, MYSQL_ENABLE_CLEARTEXT_PLUGIN, value);
@@ -2774,6 +5080,204 @@ static VALUE rb_mysql_client_pending_result_frees(VALUE self) {
   return ULONG2NUM(wrapper->pending_result_free_count);
 }
 
+/* call-seq:
+ *    client.latency_histogram
+ *
+ * How long this connection's commands spent in each phase, as a Hash from
+ * :send (writing the command), :server (from then until the first response
+ * was read), :store (buffering a result set) and :cast (building the Ruby
+ * rows of a buffered result, once per result) to a Hash from each bucket's
+ * upper bound in seconds (Float::INFINITY for the last) to its count. The
+ * buckets are log-linear, none wider than an eighth of its lower bound, so
+ * percentiles read off them are within 12.5%. Empty buckets are left out.
+ *
+ * A prepared statement's execute writes the command and reads the response
+ * in a single library call, so all of it is counted under :server.
+ */
+static VALUE rb_mysql_client_latency_histogram(VALUE self) {
+  static VALUE *phases[MYSQL2_LATENCY_PHASES] = { &sym_send, &sym_server, &sym_store, &sym_cast };
+  VALUE histogram = rb_hash_new();
+  int phase, i;
+  GET_CLIENT(self);
+
+  for (phase = 0; phase < MYSQL2_LATENCY_PHASES; phase++) {
+    VALUE buckets = rb_hash_new();
+
+    for (i = 0; wrapper->latency && i < MYSQL2_LATENCY_BUCKETS; i++) {
+      if (wrapper->latency->counts[phase][i] == 0) {
+        continue;
+      }
+      rb_hash_aset(buckets, DBL2NUM(mysql2_latency_bucket_upper(i) / 1000000.0), ULL2NUM(wrapper->latency->counts[phase][i]));
+    }
+    rb_hash_aset(histogram, *phases[phase], buckets);
+  }
+  return histogram;
+}
+
+/* call-seq:
+ *    client.reset_latency_histogram
+ *
+ * Zeroes every count in #latency_histogram, e.g. after a metrics exporter
+ * has scraped it.
+ */
+static VALUE rb_mysql_client_reset_latency_histogram(VALUE self) {
+  GET_CLIENT(self);
+
+  if (wrapper->latency) {
+    memset(wrapper->latency, 0, sizeof(*wrapper->latency));
+  }
+  return Qnil;
+}
+
+/* Adds the packets the client library read since pkt_nr_seen to
+ * packets_received. net.pkt_nr starts over with each command and counts
+ * every packet of the exchange, written or read; the commands booked by
+ * mysql2_net_count_command set pkt_nr_seen to what they wrote. A pkt_nr
+ * below pkt_nr_seen means one the client library sent on its own (a
+ * statement reset, a reconnect's queries): booked here as one packet
+ * carrying a bare command byte, the rest of its exchange as read. */
+static void mysql2_net_fold_received(mysql_client_wrapper *wrapper) {
+  unsigned int nr;
+
+  if (!wrapper->initialized || wrapper->closed || !CONNECTED(wrapper)) {
+    return;
+  }
+  nr = wrapper->client->net.pkt_nr;
+  if (nr >= wrapper->pkt_nr_seen) {
+    wrapper->packets_received += nr - wrapper->pkt_nr_seen;
+  } else {
+    wrapper->packets_sent++;
+    wrapper->bytes_sent += 4 + 1;
+    wrapper->packets_received += nr ? nr - 1 : 0;
+  }
+  wrapper->pkt_nr_seen = nr;
+}
+
+void mysql2_net_count_command(mysql_client_wrapper *wrapper, unsigned long long payload_len) {
+  /* A payload of 2^24-1 bytes or more goes in as many full packets as it
+   * fills, then one more with the remainder, empty if there is none. */
+  unsigned long long packets = payload_len / 0xffffff + 1;
+
+  mysql2_net_fold_received(wrapper);
+  wrapper->packets_sent += packets;
+  wrapper->bytes_sent += payload_len + 4 * packets;
+  wrapper->pkt_nr_seen = (unsigned int)packets;
+}
+
+void mysql2_net_count_packet(mysql_client_wrapper *wrapper, unsigned long long payload_len) {
+  wrapper->packets_sent++;
+  wrapper->bytes_sent += payload_len + 4;
+  wrapper->pkt_nr_seen++;
+}
+
+/* The kernel's counters for the connection's TCP socket: bytes acknowledged
+ * by the server, bytes received, and segments sent and received. Returns 0,
+ * filling nothing, where there are none: not Linux, a Unix socket or named
+ * pipe, or no open connection. */
+static int mysql2_tcp_counters(mysql_client_wrapper *wrapper, unsigned long long counters[4]) {
+#ifdef HAVE_STRUCT_TCP_INFO_TCPI_SEGS_IN
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+
+  if (!wrapper->initialized || wrapper->closed || !CONNECTED(wrapper)) {
+    return 0;
+  }
+  memset(&info, 0, sizeof(info));
+  if (getsockopt(wrapper->client->net.fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0 ||
+      len < offsetof(struct tcp_info, tcpi_segs_in) + sizeof(info.tcpi_segs_in)) {
+    return 0;
+  }
+  counters[0] = info.tcpi_bytes_acked;
+  counters[1] = info.tcpi_bytes_received;
+  counters[2] = info.tcpi_segs_out;
+  counters[3] = info.tcpi_segs_in;
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/* Which algorithm the handshake settled on, from the capability flags the
+ * client library kept after masking its own with the server's: a server
+ * offered both zlib and zstd picks zlib, so that flag wins here too. */
+static VALUE mysql2_compression_algorithm(mysql_client_wrapper *wrapper) {
+  if (!wrapper->initialized || wrapper->closed || !CONNECTED(wrapper) || !wrapper->client->net.compress) {
+    return Qnil;
+  }
+#ifdef CLIENT_ZSTD_COMPRESSION_ALGORITHM
+  if (!(wrapper->client->client_flag & CLIENT_COMPRESS) &&
+      (wrapper->client->client_flag & CLIENT_ZSTD_COMPRESSION_ALGORITHM)) {
+    return rb_usascii_str_new_cstr("zstd");
+  }
+#endif
+  return rb_usascii_str_new_cstr("zlib");
+}
+
+/* call-seq:
+ *    client.stats
+ *
+ * A frozen Hash of this client's traffic counters, for diffing around a
+ * query or scraping into metrics:
+ *
+ * [:queries] commands sent, including each prepared statement execute
+ * [:bytes_sent, :bytes_received] protocol bytes, packet headers included,
+ *                                before compression and TLS
+ * [:packets_sent, :packets_received] protocol packets, likewise
+ * [:rows_fetched] rows read into the client library, whether buffered or
+ *                 streamed
+ * [:buffered_bytes] client-library memory the buffered rows took, as
+ *                   ObjectSpace.memsize_of(result) counts it; statements'
+ *                   rows aren't included
+ * [:rows_materialized] rows built into Ruby objects
+ * [:materialized_bytes] bytes of column data those rows were built from
+ *
+ * [:compression] the protocol compression the connection negotiated,
+ *                "zlib" or "zstd", or nil when it is uncompressed
+ *
+ * Over a TCP connection on Linux, the kernel's own counters for the socket
+ * follow, with TLS and compression included:
+ *
+ * [:tcp_bytes_sent, :tcp_bytes_received] bytes acknowledged by the server
+ *                                        and bytes received
+ * [:tcp_segments_sent, :tcp_segments_received] TCP segments
+ *
+ * Those start over when the connection does; the rest count for the
+ * Client's lifetime. The protocol counters cover the commands this client
+ * sends and every packet read back, but bytes_received only counts the
+ * payload of result set rows and column definitions in the text protocol:
+ * OK, EOF and error packets, and prepared statements' rows, add their
+ * 4-byte headers alone. A command the client library sends on its own,
+ * such as a reconnect's, counts as one packet of a bare command byte. While
+ * a query is in flight on another thread, its replies aren't counted yet.
+ */
+static VALUE rb_mysql_client_stats(VALUE self) {
+  VALUE stats = rb_hash_new();
+  unsigned long long counters[4];
+  GET_CLIENT(self);
+
+  /* Reading net.pkt_nr is only meaningful between commands. */
+  if (NIL_P(wrapper->active_fiber)) {
+    mysql2_net_fold_received(wrapper);
+  }
+  rb_hash_aset(stats, sym_queries, ULL2NUM(wrapper->queries));
+  rb_hash_aset(stats, sym_bytes_sent, ULL2NUM(wrapper->bytes_sent));
+  rb_hash_aset(stats, sym_bytes_received, ULL2NUM(wrapper->payload_received + 4 * wrapper->packets_received));
+  rb_hash_aset(stats, sym_packets_sent, ULL2NUM(wrapper->packets_sent));
+  rb_hash_aset(stats, sym_packets_received, ULL2NUM(wrapper->packets_received));
+  rb_hash_aset(stats, sym_rows_fetched, ULL2NUM(wrapper->rows_fetched));
+  rb_hash_aset(stats, sym_buffered_bytes, ULL2NUM(wrapper->buffered_bytes));
+  rb_hash_aset(stats, sym_rows_materialized, ULL2NUM(wrapper->rows_materialized));
+  rb_hash_aset(stats, sym_materialized_bytes, ULL2NUM(wrapper->materialized_bytes));
+  rb_hash_aset(stats, sym_compression, mysql2_compression_algorithm(wrapper));
+  if (mysql2_tcp_counters(wrapper, counters)) {
+    rb_hash_aset(stats, sym_tcp_bytes_sent, ULL2NUM(counters[0]));
+    rb_hash_aset(stats, sym_tcp_bytes_received, ULL2NUM(counters[1]));
+    rb_hash_aset(stats, sym_tcp_segments_sent, ULL2NUM(counters[2]));
+    rb_hash_aset(stats, sym_tcp_segments_received, ULL2NUM(counters[3]));
+  }
+  return rb_obj_freeze(stats);
+}
+
 void init_mysql2_client(void) {
 #ifdef _WIN32
   /* verify the libmysql we're about to use was the version we were built against
@@ -2825,8 +5329,12 @@ void init_mysql2_client(void) {
   rb_define_method(cMysql2Client, "prepared_statements", rb_mysql_client_prepared_statements_read, 0);
   rb_define_method(cMysql2Client, "pending_prepared_statement_closes", rb_mysql_client_pending_prepared_statement_closes, 0);
   rb_define_method(cMysql2Client, "pending_result_frees", rb_mysql_client_pending_result_frees, 0);
+  rb_define_method(cMysql2Client, "latency_histogram", rb_mysql_client_latency_histogram, 0);
+  rb_define_method(cMysql2Client, "reset_latency_histogram", rb_mysql_client_reset_latency_histogram, 0);
+  rb_define_method(cMysql2Client, "stats", rb_mysql_client_stats, 0);
   rb_define_method(cMysql2Client, "thread_id", rb_mysql_client_thread_id, 0);
   rb_define_method(cMysql2Client, "ping", rb_mysql_client_ping, 0);
+  rb_define_method(cMysql2Client, "reset_connection", rb_mysql_client_reset_connection, 0);
   rb_define_method(cMysql2Client, "select_db", rb_mysql_client_select_db, 1);
   rb_define_method(cMysql2Client, "set_server_option", rb_mysql_client_set_server_option, 1);
   rb_define_method(cMysql2Client, "more_results?", rb_mysql_client_more_results, 0);
@@ -2861,9 +5369,14 @@ void init_mysql2_client(void) {
   rb_define_private_method(cMysql2Client, "tls_passphrase=", rb_set_tls_passphrase, 1);
   rb_define_private_method(cMysql2Client, "enable_cleartext_plugin=", set_enable_cleartext_plugin, 1);
   rb_define_private_method(cMysql2Client, "tls_version=", set_tls_version, 1);
+  rb_define_private_method(cMysql2Client, "compression=", set_compression, 1);
+  rb_define_private_method(cMysql2Client, "compression_level=", set_compression_level, 1);
   rb_define_private_method(cMysql2Client, "initialize_ext", initialize_ext, 0);
   rb_define_private_method(cMysql2Client, "connect", rb_mysql_connect, 9);
-  rb_define_private_method(cMysql2Client, "_query", rb_mysql_query, 2);
+  rb_define_private_method(cMysql2Client, "_query", rb_mysql_query, 3);
+  rb_define_private_method(cMysql2Client, "_bulk_insert", rb_mysql_client_bulk_insert, 5);
+  rb_define_private_method(cMysql2Client, "_pipeline", rb_mysql_client_pipeline, 2);
+  rb_define_private_method(cMysql2Client, "_query_all", rb_mysql_client_query_all, 2);
 
   sym_id              = ID2SYM(rb_intern("id"));
   sym_version         = ID2SYM(rb_intern("version"));
@@ -2873,6 +5386,35 @@ void init_mysql2_client(void) {
   sym_as              = ID2SYM(rb_intern("as"));
   sym_array           = ID2SYM(rb_intern("array"));
   sym_stream          = ID2SYM(rb_intern("stream"));
+  sym_timeout         = ID2SYM(rb_intern("timeout"));
+  sym_max_result_rows = ID2SYM(rb_intern("max_result_rows"));
+  sym_max_result_bytes = ID2SYM(rb_intern("max_result_bytes"));
+  sym_on_result_limit = ID2SYM(rb_intern("on_result_limit"));
+  sym_raise           = ID2SYM(rb_intern("raise"));
+  sym_spill           = ID2SYM(rb_intern("spill"));
+  sym_on_duplicate    = ID2SYM(rb_intern("on_duplicate"));
+  sym_ignore          = ID2SYM(rb_intern("ignore"));
+  sym_replace         = ID2SYM(rb_intern("replace"));
+  sym_update          = ID2SYM(rb_intern("update"));
+  sym_infile          = ID2SYM(rb_intern("infile"));
+  sym_send            = ID2SYM(rb_intern("send"));
+  sym_server          = ID2SYM(rb_intern("server"));
+  sym_store           = ID2SYM(rb_intern("store"));
+  sym_cast            = ID2SYM(rb_intern("cast"));
+  sym_queries         = ID2SYM(rb_intern("queries"));
+  sym_bytes_sent      = ID2SYM(rb_intern("bytes_sent"));
+  sym_bytes_received  = ID2SYM(rb_intern("bytes_received"));
+  sym_packets_sent    = ID2SYM(rb_intern("packets_sent"));
+  sym_packets_received = ID2SYM(rb_intern("packets_received"));
+  sym_rows_fetched    = ID2SYM(rb_intern("rows_fetched"));
+  sym_buffered_bytes  = ID2SYM(rb_intern("buffered_bytes"));
+  sym_tcp_bytes_sent  = ID2SYM(rb_intern("tcp_bytes_sent"));
+  sym_tcp_bytes_received = ID2SYM(rb_intern("tcp_bytes_received"));
+  sym_tcp_segments_sent = ID2SYM(rb_intern("tcp_segments_sent"));
+  sym_tcp_segments_received = ID2SYM(rb_intern("tcp_segments_received"));
+  sym_rows_materialized = ID2SYM(rb_intern("rows_materialized"));
+  sym_materialized_bytes = ID2SYM(rb_intern("materialized_bytes"));
+  sym_compression     = ID2SYM(rb_intern("compression"));
 
   intern_brackets = rb_intern("[]");
   intern_merge = rb_intern("merge");
@@ -2881,6 +5423,26 @@ void init_mysql2_client(void) {
   intern_current_query_options = rb_intern("@current_query_options");
   intern_read_timeout = rb_intern("@read_timeout");
   intern_values = rb_intern("values");
+  intern_close = rb_intern("close");
+  intern_to_s = rb_intern("to_s");
+  intern_finite_p = rb_intern("finite?");
+  intern_sec_fraction = rb_intern("sec_fraction");
+  intern_mul = rb_intern("*");
+  intern_truncate = rb_intern("truncate");
+  intern_usec = rb_intern("usec");
+  intern_sec = rb_intern("sec");
+  intern_min = rb_intern("min");
+  intern_hour = rb_intern("hour");
+  intern_day = rb_intern("day");
+  intern_month = rb_intern("month");
+  intern_year = rb_intern("year");
+
+  cDate = rb_const_get(rb_cObject, rb_intern("Date"));
+  rb_global_variable(&cDate);
+  cDateTime = rb_const_get(rb_cObject, rb_intern("DateTime"));
+  rb_global_variable(&cDateTime);
+  cBigDecimal = rb_const_get(rb_cObject, rb_intern("BigDecimal"));
+  rb_global_variable(&cBigDecimal);
 
 #ifdef CLIENT_LONG_PASSWORD
   rb_const_set(cMysql2Client, rb_intern("LONG_PASSWORD"),
@@ -3072,6 +5634,27 @@ void init_mysql2_client(void) {
   rb_const_set(cMysql2Client, rb_intern("TLS_VERSION_SUPPORTED"), Qfalse);
 #endif
 
+#ifdef HAVE_CONST_MYSQL_OPT_COMPRESSION_ALGORITHMS
+  rb_const_set(cMysql2Client, rb_intern("ZSTD_COMPRESSION_SUPPORTED"), Qtrue);
+#else
+  rb_const_set(cMysql2Client, rb_intern("ZSTD_COMPRESSION_SUPPORTED"), Qfalse);
+#endif
+
+  /* Whether Client#query waits in Ruby (see MYSQL2_NONBLOCKING_QUERY_CONT
+   * and MYSQL2_NONBLOCKING_QUERY_POLL in client.h) rather than inside the
+   * client library for more than the server's first response. */
+#if defined(MYSQL2_NONBLOCKING_QUERY_CONT) || defined(MYSQL2_NONBLOCKING_QUERY_POLL)
+  rb_const_set(cMysql2Client, rb_intern("NONBLOCKING_QUERY_SUPPORTED"), Qtrue);
+#else
+  rb_const_set(cMysql2Client, rb_intern("NONBLOCKING_QUERY_SUPPORTED"), Qfalse);
+#endif
+
+#ifdef HAVE_MYSQL_RESET_CONNECTION
+  rb_const_set(cMysql2Client, rb_intern("RESET_CONNECTION_SUPPORTED"), Qtrue);
+#else
+  rb_const_set(cMysql2Client, rb_intern("RESET_CONNECTION_SUPPORTED"), Qfalse);
+#endif
+
 #ifdef HAVE_MYSQL_REAL_ESCAPE_STRING_QUOTE
   rb_const_set(cMysql2Client, rb_intern("ESCAPE_QUOTE_SUPPORTED"), Qtrue);
 #else
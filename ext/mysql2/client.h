@@ -1,6 +1,52 @@
 #ifndef MYSQL2_CLIENT_H
 #define MYSQL2_CLIENT_H
 
+/* MariaDB Connector/C's nonblocking API: with MYSQL_OPT_NONBLOCK set, each
+ * blocking call has a _start/_cont pair that returns MYSQL_WAIT_* bits
+ * instead of blocking, so mysql2 can wait on the socket through Ruby (and
+ * so through a Fiber scheduler) instead of blocking a native thread inside
+ * the client library. */
+#if defined(HAVE_CONST_MYSQL_OPT_NONBLOCK) && !defined(_WIN32)
+#define MYSQL2_ASYNC_CONTEXT 1
+#endif
+
+/* Statement#execute through mysql_stmt_execute_start/_cont. libmysqlclient
+ * has no nonblocking prepared-statement execute at all, so MySQL builds
+ * keep the blocking path. */
+#if defined(MYSQL2_ASYNC_CONTEXT) && defined(HAVE_MYSQL_STMT_EXECUTE_START)
+#define MYSQL2_NONBLOCKING_STMT_EXECUTE 1
+#endif
+
+/* Client#query's whole exchange -- connect, send, read, store, next_result
+ * -- through the MariaDB _start/_cont pairs. */
+#if defined(MYSQL2_ASYNC_CONTEXT) && defined(HAVE_MYSQL_SEND_QUERY_START)
+#define MYSQL2_NONBLOCKING_QUERY_CONT 1
+#endif
+
+/* Most of it through libmysqlclient's *_nonblocking calls (MySQL 8.0.16+)
+ * instead. They only return early on a connection opened with
+ * mysql_real_connect_nonblocking -- on any other they block inside vio --
+ * so the connection is opened that way, and a client that may reconnect,
+ * which libmysqlclient does with the blocking connect, keeps the blocking
+ * calls. They report only NET_ASYNC_NOT_READY, not which way they are
+ * waiting, so mysql2 supplies the MYSQL_WAIT_* direction itself: write for
+ * a send, read for a store or next_result. There is no public nonblocking
+ * mysql_read_query_result (mysql_real_query_nonblocking reads the response
+ * only as the second half of its own send, which Client#query's :async
+ * can't wait for), so the response header is still read with the GVL
+ * released, after do_query has waited in Ruby for it to arrive. */
+#if !defined(MYSQL2_NONBLOCKING_QUERY_CONT) && defined(HAVE_MYSQL_REAL_CONNECT_NONBLOCKING) && \
+    defined(HAVE_MYSQL_SEND_QUERY_NONBLOCKING) && defined(HAVE_MYSQL_STORE_RESULT_NONBLOCKING) && \
+    defined(HAVE_MYSQL_NEXT_RESULT_NONBLOCKING) && !defined(_WIN32)
+#define MYSQL2_NONBLOCKING_QUERY_POLL 1
+#ifndef MYSQL_WAIT_READ
+#define MYSQL_WAIT_READ 1
+#define MYSQL_WAIT_WRITE 2
+#define MYSQL_WAIT_EXCEPT 4
+#define MYSQL_WAIT_TIMEOUT 8
+#endif
+#endif
+
 /* Whether the connection is in the middle of a protocol exchange that a
  * concurrent mysql_stmt_close() would corrupt. QUERYING covers the window
  * from sending a command through reading/storing its result; STREAMING
@@ -42,6 +88,29 @@ typedef struct mysql2_pending_result_free {
   struct mysql2_pending_result_free *next;
 } mysql2_pending_result_free;
 
+/* Client#latency_histogram: one log-linear histogram of microseconds per
+ * phase of a command, HDR-style. Values under MYSQL2_LATENCY_SUB_BUCKETS us
+ * get a bucket each; past that, every power of two is split into
+ * MYSQL2_LATENCY_SUB_BUCKETS equal buckets, so a bucket is never wider than
+ * 1/8 of its lower bound. Everything from 2^MYSQL2_LATENCY_MAX_EXP us
+ * (about 71 minutes) up lands in the last bucket. */
+#define MYSQL2_LATENCY_SUB_BITS 3
+#define MYSQL2_LATENCY_SUB_BUCKETS (1 << MYSQL2_LATENCY_SUB_BITS)
+#define MYSQL2_LATENCY_MAX_EXP 32
+#define MYSQL2_LATENCY_BUCKETS ((MYSQL2_LATENCY_MAX_EXP - MYSQL2_LATENCY_SUB_BITS + 1) * MYSQL2_LATENCY_SUB_BUCKETS)
+
+typedef enum {
+  MYSQL2_LATENCY_SEND = 0, /* writing the command */
+  MYSQL2_LATENCY_SERVER,   /* sent until the first response is read */
+  MYSQL2_LATENCY_STORE,    /* buffering a result set's rows */
+  MYSQL2_LATENCY_CAST,     /* building Ruby rows from a buffered result */
+  MYSQL2_LATENCY_PHASES
+} mysql2_latency_phase_t;
+
+typedef struct {
+  unsigned long long counts[MYSQL2_LATENCY_PHASES][MYSQL2_LATENCY_BUCKETS];
+} mysql2_latency_histogram;
+
 typedef struct {
   VALUE encoding;
   VALUE active_fiber; /* rb_fiber_current() or Qnil */
@@ -58,6 +127,9 @@ typedef struct {
   long server_version;
   int reconnect_enabled;
   unsigned int connect_timeout;
+  /* :write_timeout, for the socket waits mysql2 does itself (see
+   * mysql2_wait_for_async_status). */
+  unsigned int write_timeout;
   int active;
   int automatic_close;
   int initialized;
@@ -78,6 +150,12 @@ typedef struct {
    * verification against the live TLS session. Reported by Client#tls_info
    * as :identity_verified. */
   int tls_identity_verified;
+  /* MYSQL_OPT_NONBLOCK was accepted at mysql_init time, so the connector's
+   * async context exists and the _start/_cont calls are usable; or, with
+   * MYSQL2_NONBLOCKING_QUERY_POLL, the connection was opened with
+   * mysql_real_connect_nonblocking and can't reconnect behind mysql2's
+   * back. Always 0 otherwise. */
+  int nonblocking;
   MYSQL *client;
   mysql2_client_state_t state;
   /* The pid that established this connection (set on every successful
@@ -92,6 +170,47 @@ typedef struct {
   unsigned long pending_stmt_close_count; /* O(1) mirror of the list above, for Client#pending_prepared_statement_closes */
   mysql2_pending_result_free *pending_result_frees;
   unsigned long pending_result_free_count;
+  /* Side connection Client#query's :timeout sends KILL QUERY over, opened
+   * on first use and kept for the next one; NULL until then. killer_pid is
+   * the process that opened it, for the same fork rule as connect_pid. */
+  MYSQL *killer;
+  int killer_pid;
+  /* The current command's :infile -- what a LOAD DATA LOCAL INFILE reads
+   * instead of the named file -- or Qnil. See infile.c. */
+  VALUE infile_source;
+  /* Set while mysql_read_query_result/mysql_next_result run with the GVL
+   * released, the only place infile.c may take it back to read the source. */
+  int infile_gvl_released;
+  /* What interrupted the :infile source, parked until the client library
+   * call reading it returns: the rb_protect state (0 for none) and the
+   * error info that goes with it. See mysql2_infile_rethrow. */
+  int infile_state;
+  VALUE infile_error;
+  /* When the current command finished going out on the wire: the end of
+   * its send phase and the start of its server phase. */
+  double send_end;
+  /* Allocated with the first sample, so a client that never runs a command
+   * doesn't carry it; NULL until then. */
+  mysql2_latency_histogram *latency;
+  /* Client#stats: commands sent, rows read into the client library
+   * (counted whole at store time for a buffered result, one at a time as
+   * a stream is read), the client-library memory the buffered ones took
+   * (as result.c reports it to the GC), and rows built into Ruby objects
+   * along with the bytes of column data they were built from. */
+  unsigned long long queries;
+  unsigned long long rows_fetched;
+  unsigned long long buffered_bytes;
+  unsigned long long rows_materialized;
+  unsigned long long materialized_bytes;
+  /* Client#stats' protocol counters (see mysql2_net_count_command): packets
+   * and bytes, headers included, of the commands this client wrote; packets
+   * read, from how far net.pkt_nr advanced past pkt_nr_seen; and the payload
+   * bytes of the result sets read, rebuilt from the rows and fields. */
+  unsigned long long bytes_sent;
+  unsigned long long packets_sent;
+  unsigned long long packets_received;
+  unsigned long long payload_received;
+  unsigned int pkt_nr_seen;
 } mysql_client_wrapper;
 
 extern const rb_data_type_t rb_mysql_client_type;
@@ -109,12 +228,65 @@ extern const rb_data_type_t rb_mysql_client_type;
 void init_mysql2_client(void);
 void decr_mysql2_client(mysql_client_wrapper *wrapper);
 
+/* Formats the literal of a value that needs no escaping -- an Integer that
+ * fits a long, a Float, or a Time, DateTime or Date (without quotes) --
+ * into tmp, which must hold MYSQL2_SCALAR_LEN bytes. Returns its length, or
+ * -1 for any other type. Raises for a non-finite Float. */
+#define MYSQL2_SCALAR_LEN 64
+int mysql2_format_scalar(VALUE value, char *tmp);
+/* A BigDecimal's exact, plain-notation literal as a new String, or Qnil
+ * for anything else. */
+VALUE mysql2_bigdecimal_literal(VALUE value);
+
+#ifndef _WIN32
+/* Waits for fd to become ready for events (RB_WAITFD_IN/OUT/PRI),
+ * honoring the client's @read_timeout: raises Mysql2::Error::TimeoutError
+ * when it expires, and returns the ready events otherwise. Releases the
+ * GVL while waiting, is interruptible, and defers to Fiber.scheduler's
+ * io_wait hook when one is set. */
+int mysql2_wait_for_socket(VALUE self, int fd, int events);
+
+#if defined(MYSQL2_ASYNC_CONTEXT) || defined(MYSQL2_NONBLOCKING_QUERY_POLL)
+/* Waits out the MYSQL_WAIT_* bits a MariaDB _start/_cont call suspended on
+ * (or the direction a libmysqlclient *_nonblocking call is taken to be
+ * waiting in) and returns the ones that fired, for the next _cont. Each
+ * phase keeps its own timeout: pass connecting for a handshake, bounded by
+ * connect_timeout (or the connector's own MYSQL_WAIT_TIMEOUT). Otherwise a
+ * wait to write is bounded by write_timeout and a wait to read by
+ * read_timeout, through mysql2_wait_for_socket. Each raises
+ * Mysql2::Error::TimeoutError naming what it was waiting for. */
+int mysql2_wait_for_async_status(VALUE self, MYSQL *mysql, int status, int connecting);
+#endif
+
+/* Cleanup for a command interrupted mid-exchange (Thread#raise, timeout):
+ * releases the fiber claim, marks the connection IDLE, and invalidates the
+ * socket, since the protocol state can no longer be trusted. */
+void mysql2_invalidate_after_interrupted_query(mysql_client_wrapper *wrapper);
+#endif
+
 /* Seconds on a clock suitable for measuring elapsed intervals: monotonic
  * (immune to wall-clock adjustment) where available, gettimeofday otherwise.
  * Negative if the clock call itself fails. Calls no Ruby APIs, so it is
  * safe inside rb_thread_call_without_gvl functions. */
 double mysql2_monotonic_now(void);
 
+/* Counts end - start (mysql2_monotonic_now() stamps) in the phase's
+ * latency histogram. Either stamp negative means the clock failed, and
+ * nothing is counted. Call with the GVL held: the first sample allocates
+ * the histogram. */
+void mysql2_latency_record(mysql_client_wrapper *wrapper, mysql2_latency_phase_t phase, double start, double end);
+
+/* Books a command with a payload_len-byte payload (command byte included)
+ * in Client#stats, and folds the packets read since the last one into it.
+ * Call with the GVL held and the connection claimed, just before the
+ * client library call that writes the command: that call restarts
+ * net.pkt_nr, the sequence number the packets read are counted from. */
+void mysql2_net_count_command(mysql_client_wrapper *wrapper, unsigned long long payload_len);
+
+/* Books one more packet of an exchange already under way, as the client
+ * library writes it -- LOAD DATA LOCAL INFILE's file contents. */
+void mysql2_net_count_packet(mysql_client_wrapper *wrapper, unsigned long long payload_len);
+
 /* Raises a Mysql2::Error built from the client's current mysql_error()/
  * mysql_errno()/mysql_sqlstate() -- the only correct way to surface a
  * server/connection error with error_number and sql_state populated.
@@ -176,6 +348,30 @@ void mysql2_reap_pending_result_frees(mysql_client_wrapper *wrapper);
  * execute, ping, statement close). */
 void mysql2_abandon_active_stream(mysql_client_wrapper *wrapper);
 
+/* Whether an idle connection can be handed out again without a ping: 1 if
+ * it is open, IDLE, unclaimed, and its socket has nothing to read; 0 if any
+ * of that fails -- a server that dropped the session (wait_timeout, KILL)
+ * leaves an error packet or EOF on the socket. -1 when the socket can't be
+ * probed (Windows, or poll itself failing), meaning ping to find out. */
+int mysql2_client_probe_idle(mysql_client_wrapper *wrapper);
+
+/* The connection's socket, or -1 once it is closed; *in_flight says
+ * whether an async Client#query is waiting on it for its response (the
+ * client is claimed and QUERYING). For Mysql2::Multiplexer, which watches
+ * many of them at once. */
+int mysql2_client_async_socket(mysql_client_wrapper *wrapper, int *in_flight);
+
+/* Client#async_result: reads and returns the response to the async query
+ * in flight, or nil when there is none. */
+VALUE rb_mysql_client_async_result(VALUE self);
+
+/* Readies a connection handed back to Mysql2::Pool for its next user:
+ * drains an abandoned stream and reaps the pending frees and closes. Returns
+ * 0, touching nothing, if the connection is closed, claimed, mid-command or
+ * has unread multi-statement results, any of which means drop it instead.
+ * Ordinary-Ruby-level-only, like the reap functions above. */
+int mysql2_client_reset_for_reuse(mysql_client_wrapper *wrapper);
+
 /* Whether this process is not the one that established wrapper's
  * connection (a fork() happened and nobody reconnected). Always false on
  * Windows, which has no fork(). Safe to call from anywhere, including a
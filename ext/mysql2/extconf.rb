@@ -52,9 +52,21 @@ have_func('rb_hash_new_capa', 'ruby.h')
 # 2.3+ (guarded so the funcall path remains available on anything older)
 have_func('rb_time_timespec_new', 'ruby.h')
 
+# 2.4+
+have_func('rb_gc_adjust_memory_usage', 'ruby.h')
+
+# 3.0+
+have_func('rb_ext_ractor_safe', 'ruby.h')
+
 # Monotonic clock for Result#query_time (gettimeofday fallback otherwise)
 have_func('clock_gettime', 'time.h')
 
+# Kernel TCP counters for Client#stats' wire bytes and packets (Linux 4.2+)
+have_struct_member('struct tcp_info', 'tcpi_segs_in', 'linux/tcp.h')
+
+# Mysql2::Multiplexer waits on an epoll set where there is one, poll() elsewhere
+have_header('sys/epoll.h')
+
 ### Find OpenSSL library
 
 # User-specified OpenSSL if explicitly specified
@@ -187,6 +199,12 @@ have_const('MYSQL_OPTION_MULTI_STATEMENTS_OFF', mysql_h)
 have_const('MYSQL_OPT_GET_SERVER_PUBLIC_KEY', mysql_h)
 have_const('MYSQL_OPT_TLS_SNI_SERVERNAME', mysql_h) # Added in MySQL 8.1; no MariaDB equivalent (MDEV-10658)
 have_const('MYSQL_OPT_TLS_VERSION', mysql_h) # Added in MySQL 5.7.10; MariaDB Connector/C 3.4.3+ defines the same enum member
+have_const('MYSQL_OPT_TLS_CIPHERSUITES', mysql_h) # Added in MySQL 8.0.16
+have_const('MYSQL_OPT_SSL_CRL', mysql_h)
+have_const('MYSQL_OPT_SSL_CRLPATH', mysql_h)
+have_const('MYSQL_SERVER_PUBLIC_KEY', mysql_h)
+have_const('MYSQL_OPT_COMPRESSION_ALGORITHMS', mysql_h) # Added in MySQL 8.0.18 with zstd; MariaDB speaks zlib only, through MYSQL_OPT_COMPRESS
+have_const('MYSQL_OPT_ZSTD_COMPRESSION_LEVEL', mysql_h) # Added in MySQL 8.0.18
 
 # my_bool is replaced by C99 bool in MySQL 8.0, but we want
 # to retain compatibility with the typedef in earlier MySQLs.
@@ -270,7 +288,15 @@ $CFLAGS << ' -DMYSQL2_VERIFY_IDENTITY_SHIM' if have_verify_identity_shim
 # detect mysql functions
 have_func('mysql_ssl_set', mysql_h)
 have_func('mysql_next_result_nonblocking', mysql_h) # Added in MySQL 8.0.16; no MariaDB Connector/C equivalent under this name (see mysql_next_result_start/_cont)
+have_func('mysql_real_connect_nonblocking', mysql_h) # Added in MySQL 8.0.16; the other *_nonblocking calls only return early on a connection it opened
+have_func('mysql_send_query_nonblocking', mysql_h) # Added in MySQL 8.0.16
+have_func('mysql_store_result_nonblocking', mysql_h) # Added in MySQL 8.0.16
 have_func('mysql_real_escape_string_quote', mysql_h) # Added in MySQL 5.7.6; no MariaDB Connector/C equivalent
+have_func('mysql_stmt_execute_start', mysql_h) # MariaDB Connector/C nonblocking API; libmysqlclient has no nonblocking prepared-statement execute
+have_const('MYSQL_OPT_NONBLOCK', mysql_h) # Enables the async context the MariaDB _start/_cont calls run on
+have_func('mysql_send_query_start', mysql_h) # MariaDB Connector/C nonblocking text protocol (send/read/store/next_result/connect)
+have_func('mysql_reset_connection', mysql_h) # Added in MySQL 5.7.3 and MariaDB Connector/C 3.0
+have_func('mysql_get_option', mysql_h) # Added in MySQL 5.7.3 and MariaDB Connector/C 3.0; without it :timeout drops the connection instead of sending KILL QUERY
 
 ### Compiler flags to help catch errors
 
@@ -339,6 +365,14 @@ unless enabled_sanitizers.empty?
   $CFLAGS << ' -g -fno-omit-frame-pointer'
 end
 
+### USDT probes (see probes.h), off unless asked for
+
+if enable_config('dtrace', false)
+  abort "-----\nCannot enable USDT probes: sys/sdt.h is missing. Install systemtap-sdt-dev or systemtap-sdt-devel, and try again.\n-----" unless have_header('sys/sdt.h')
+  warn "-----\nEnabling USDT probes\n-----"
+  $CFLAGS << ' -DMYSQL2_USDT'
+end
+
 ### Find MySQL Client on Windows, set RPATH to find the library at runtime
 
 if RUBY_PLATFORM =~ /mswin|mingw/ && !defined?(RubyInstaller)
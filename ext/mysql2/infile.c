@@ -7,14 +7,297 @@
 #include <fcntl.h>
 
 #define ERROR_LEN 1024
+/* How much of a Ruby source is encoded per trip back into Ruby. */
+#define MYSQL2_INFILE_CHUNK (256 * 1024)
+
+static ID intern_read, intern_next, intern_each, intern_to_enum;
+
 typedef struct
 {
   int fd;
   char *filename;
   char error[ERROR_LEN];
   mysql_client_wrapper *wrapper;
+  /* Reading wrapper->infile_source rather than fd: its bytes are encoded
+   * into buf, MYSQL2_INFILE_CHUNK at a time, and handed out from buf_pos. */
+  int from_source;
+  int eof;
+  char *buf;
+  size_t buf_len;
+  size_t buf_pos;
+  size_t buf_capa;
+  long offset; /* next byte of a String source, next row of an Array one */
 } mysql2_local_infile_data;
 
+/* call-seq: (internal)
+ *
+ * Checks a query's :infile option, before anything is sent: a String (sent
+ * as is), anything with #read (read in chunks, sent as is), an Array of
+ * rows, or anything with #each yielding rows. A row is an Array of values,
+ * encoded here in LOAD DATA's default format -- tab-separated fields,
+ * newline-ended lines, backslash escapes, \N for NULL -- or a String taken
+ * as an already encoded line, newline-ended if it isn't already. Returns
+ * what infile_source should hold: an Enumerator in place of a plain
+ * Enumerable, since rows are pulled one at a time.
+ */
+VALUE mysql2_infile_source(VALUE source)
+{
+  if (RB_TYPE_P(source, T_STRING) || RB_TYPE_P(source, T_ARRAY) ||
+      rb_respond_to(source, intern_read) || rb_respond_to(source, intern_next)) {
+    return source;
+  }
+  if (rb_respond_to(source, intern_each)) {
+    return rb_funcall(source, intern_to_enum, 0);
+  }
+  rb_raise(rb_eTypeError, ":infile must be a String, an IO, or an Enumerable of rows, not %s",
+           rb_obj_classname(source));
+  return Qnil; /* unreached */
+}
+
+static void mysql2_infile_reserve(mysql2_local_infile_data *data, size_t extra)
+{
+  if (data->buf_len + extra > data->buf_capa) {
+    size_t capa = data->buf_capa ? data->buf_capa * 2 : MYSQL2_INFILE_CHUNK;
+    char *buf;
+
+    while (capa < data->buf_len + extra) capa *= 2;
+    buf = realloc(data->buf, capa);
+    if (!buf) {
+      rb_raise(rb_eNoMemError, "failed to allocate memory for LOAD DATA LOCAL INFILE");
+    }
+    data->buf = buf;
+    data->buf_capa = capa;
+  }
+}
+
+static void mysql2_infile_append(mysql2_local_infile_data *data, const char *p, size_t len)
+{
+  mysql2_infile_reserve(data, len);
+  memcpy(data->buf + data->buf_len, p, len);
+  data->buf_len += len;
+}
+
+static void mysql2_infile_append_field(mysql2_local_infile_data *data, VALUE value)
+{
+  char tmp[MYSQL2_SCALAR_LEN];
+  int len;
+
+  switch (TYPE(value)) {
+    case T_NIL:
+      mysql2_infile_append(data, "\\N", 2);
+      return;
+    case T_TRUE:
+      mysql2_infile_append(data, "1", 1);
+      return;
+    case T_FALSE:
+      mysql2_infile_append(data, "0", 1);
+      return;
+    case T_BIGNUM:
+      value = rb_big2str(value, 10);
+      mysql2_infile_append(data, RSTRING_PTR(value), RSTRING_LEN(value));
+      return;
+    case T_STRING:
+      {
+        rb_encoding *enc = rb_to_encoding(data->wrapper->encoding);
+        const char *p, *end;
+        char *out;
+
+        value = rb_str_export_to_enc(value, enc);
+        p = RSTRING_PTR(value);
+        end = p + RSTRING_LEN(value);
+        mysql2_infile_reserve(data, RSTRING_LEN(value) * 2);
+        out = data->buf + data->buf_len;
+        while (p < end) {
+          /* Character by character: in SJIS, GBK and Big5 a multibyte
+           * character's trailing byte can be 0x5C, which the server reads
+           * as part of the character, not as a backslash. */
+          int clen = rb_enc_mbclen(p, end, enc);
+
+          if (clen > 1) {
+            memcpy(out, p, clen);
+            out += clen;
+            p += clen;
+            continue;
+          }
+          switch (*p) {
+            case '\\': *out++ = '\\'; *out++ = '\\'; break;
+            case '\t':  *out++ = '\\'; *out++ = 't'; break;
+            case '\n':  *out++ = '\\'; *out++ = 'n'; break;
+            case '\r':  *out++ = '\\'; *out++ = 'r'; break;
+            case '\0':  *out++ = '\\'; *out++ = '0'; break;
+            default:    *out++ = *p; break;
+          }
+          p++;
+        }
+        data->buf_len = out - data->buf;
+        (void)RB_GC_GUARD(value);
+      }
+      return;
+    default:
+      break;
+  }
+
+  len = mysql2_format_scalar(value, tmp);
+  if (len >= 0) {
+    mysql2_infile_append(data, tmp, len);
+    return;
+  }
+  {
+    VALUE literal = mysql2_bigdecimal_literal(value);
+
+    if (NIL_P(literal)) {
+      rb_raise(rb_eTypeError, "no LOAD DATA encoding for %s", rb_obj_classname(value));
+    }
+    mysql2_infile_append(data, RSTRING_PTR(literal), RSTRING_LEN(literal));
+  }
+}
+
+static void mysql2_infile_append_row(mysql2_local_infile_data *data, VALUE row)
+{
+  long i;
+
+  if (RB_TYPE_P(row, T_STRING)) {
+    long len = RSTRING_LEN(row);
+
+    /* An already-encoded line: ended with "\n" as an Array row would be,
+     * unless it carries its own. */
+    mysql2_infile_append(data, RSTRING_PTR(row), len);
+    if (len == 0 || RSTRING_PTR(row)[len - 1] != '\n') {
+      mysql2_infile_append(data, "\n", 1);
+    }
+    return;
+  }
+  Check_Type(row, T_ARRAY);
+  for (i = 0; i < RARRAY_LEN(row); i++) {
+    if (i > 0) {
+      mysql2_infile_append(data, "\t", 1);
+    }
+    mysql2_infile_append_field(data, RARRAY_AREF(row, i));
+  }
+  mysql2_infile_append(data, "\n", 1);
+}
+
+static VALUE mysql2_infile_next(VALUE source)
+{
+  return rb_funcall(source, intern_next, 0);
+}
+
+static VALUE mysql2_infile_stop(VALUE ptr, RB_MYSQL_UNUSED VALUE error)
+{
+  mysql2_local_infile_data *data = (mysql2_local_infile_data *)ptr;
+  data->eof = 1;
+  return Qundef;
+}
+
+/* Refills buf from the source with the GVL held, under rb_protect. */
+static VALUE mysql2_infile_fill_protected(VALUE ptr)
+{
+  mysql2_local_infile_data *data = (mysql2_local_infile_data *)ptr;
+  /* Read through the wrapper every time: it is what keeps the source
+   * marked, and where compaction would update a moved one. */
+  VALUE source = data->wrapper->infile_source;
+
+  data->buf_len = data->buf_pos = 0;
+  while (!data->eof && data->buf_len < MYSQL2_INFILE_CHUNK) {
+    if (RB_TYPE_P(source, T_STRING)) {
+      long len = RSTRING_LEN(source) - data->offset;
+
+      if (len > MYSQL2_INFILE_CHUNK) len = MYSQL2_INFILE_CHUNK;
+      if (len <= 0) {
+        data->eof = 1;
+      } else {
+        mysql2_infile_append(data, RSTRING_PTR(source) + data->offset, len);
+        data->offset += len;
+      }
+    } else if (RB_TYPE_P(source, T_ARRAY)) {
+      if (data->offset >= RARRAY_LEN(source)) {
+        data->eof = 1;
+      } else {
+        mysql2_infile_append_row(data, RARRAY_AREF(source, data->offset++));
+      }
+    } else if (rb_respond_to(source, intern_read)) {
+      VALUE chunk = rb_funcall(source, intern_read, 1, INT2FIX(MYSQL2_INFILE_CHUNK));
+
+      if (NIL_P(chunk)) {
+        data->eof = 1;
+      } else {
+        StringValue(chunk);
+        mysql2_infile_append(data, RSTRING_PTR(chunk), RSTRING_LEN(chunk));
+      }
+    } else {
+      VALUE row = rb_rescue2(mysql2_infile_next, source, mysql2_infile_stop, ptr, rb_eStopIteration, (VALUE)0);
+
+      if (row != Qundef) {
+        mysql2_infile_append_row(data, row);
+      }
+    }
+  }
+
+  return Qnil;
+}
+
+/* rb_thread_call_with_gvl callback. Whatever ends the source's Ruby code
+ * early -- an exception, Thread#kill, throw -- must not unwind through the
+ * client library: it is caught here and parked on the wrapper, the
+ * transfer is aborted with a LOAD DATA error, and mysql2_infile_rethrow
+ * resumes it once the library call has returned. */
+static void *mysql2_infile_fill(void *ptr)
+{
+  mysql2_local_infile_data *data = (mysql2_local_infile_data *)ptr;
+  mysql_client_wrapper *wrapper = data->wrapper;
+  int state = 0;
+
+  rb_protect(mysql2_infile_fill_protected, (VALUE)data, &state);
+  if (state) {
+    VALUE error = rb_errinfo();
+
+    wrapper->infile_state = state;
+    wrapper->infile_error = error;
+    data->eof = 1;
+    if (RB_TYPE_P(error, T_OBJECT) && rb_obj_is_kind_of(error, rb_eException)) {
+      int message_state = 0;
+      VALUE message = rb_protect(rb_obj_as_string, error, &message_state);
+
+      if (message_state) {
+        snprintf(data->error, ERROR_LEN, "%s: (message unavailable)", rb_obj_classname(error));
+      } else {
+        snprintf(data->error, ERROR_LEN, "%s: %.*s", rb_obj_classname(error),
+                 (int)RSTRING_LEN(message), RSTRING_PTR(message));
+      }
+      rb_set_errinfo(Qnil);
+    } else {
+      /* throw or Thread#kill: the pending jump lives in the thread's
+       * error info, which is left for rb_jump_tag to pick back up. */
+      snprintf(data->error, ERROR_LEN, "LOAD DATA LOCAL INFILE source was interrupted");
+    }
+  }
+
+  return NULL;
+}
+
+/* See infile.h. */
+void mysql2_infile_rethrow(mysql_client_wrapper *wrapper)
+{
+  int state = wrapper->infile_state;
+  VALUE error = wrapper->infile_error;
+
+  if (!state) {
+    return;
+  }
+  wrapper->infile_state = 0;
+  wrapper->infile_error = Qnil;
+  /* The library sent the end-of-data packet and read the server's reply to
+   * the aborted LOAD DATA, so the connection is back in sync: release the
+   * claim as a server error would. */
+  wrapper->active_fiber = Qnil;
+  wrapper->state = MYSQL2_CLIENT_IDLE;
+
+  if (RB_TYPE_P(error, T_OBJECT) && rb_obj_is_kind_of(error, rb_eException)) {
+    rb_exc_raise(error);
+  }
+  rb_jump_tag(state);
+}
+
 /* MySQL calls this function when a user begins a LOAD DATA LOCAL INFILE query.
  *
  * Allocate a data struct and pass it back through the data pointer.
@@ -30,8 +313,14 @@ mysql2_local_infile_init(void **ptr, const char *filename, void *userdata)
   if (!data) return 1;
 
   *ptr = data;
+  data->fd = -1;
   data->error[0] = 0;
   data->wrapper = userdata;
+  data->from_source = !NIL_P(data->wrapper->infile_source);
+  data->eof = 0;
+  data->buf = NULL;
+  data->buf_len = data->buf_pos = data->buf_capa = 0;
+  data->offset = 0;
 
   data->filename = strdup(filename);
   if (!data->filename) {
@@ -39,6 +328,11 @@ mysql2_local_infile_init(void **ptr, const char *filename, void *userdata)
     return 1;
   }
 
+  if (data->from_source) {
+    /* The query's :infile stands in for whatever file it names. */
+    return 0;
+  }
+
   data->fd = open(filename, O_RDONLY);
   if (data->fd < 0) {
     snprintf(data->error, ERROR_LEN, "%s: %s", strerror(errno), filename);
@@ -48,6 +342,46 @@ mysql2_local_infile_init(void **ptr, const char *filename, void *userdata)
   return 0;
 }
 
+/* The next chunk of the file for mysql2_local_infile_read below. */
+static int
+mysql2_local_infile_read_chunk(void *ptr, char *buf, unsigned int buf_len)
+{
+  int count;
+  mysql2_local_infile_data *data = (mysql2_local_infile_data *)ptr;
+
+  if (data->from_source) {
+    if (data->buf_pos == data->buf_len) {
+      if (data->eof) {
+        return 0;
+      }
+      if (!data->wrapper->infile_gvl_released) {
+        /* Holding the GVL already, maybe on a connector's coroutine stack:
+         * see mysql2_read_query_result. */
+        snprintf(data->error, ERROR_LEN, "LOAD DATA LOCAL INFILE can't read :infile here; send it with Client#query");
+        return -1;
+      }
+      rb_thread_call_with_gvl(mysql2_infile_fill, data);
+      if (data->error[0]) {
+        return -1;
+      }
+    }
+    count = (int)(data->buf_len - data->buf_pos);
+    if ((unsigned int)count > buf_len) {
+      count = (int)buf_len;
+    }
+    memcpy(buf, data->buf + data->buf_pos, count);
+    data->buf_pos += count;
+    return count;
+  }
+
+  count = (int)read(data->fd, buf, buf_len);
+  if (count < 0) {
+    snprintf(data->error, ERROR_LEN, "%s: %s", strerror(errno), data->filename);
+  }
+
+  return count;
+}
+
 /* MySQL calls this function to read data from the local file.
  *
  * Returns:
@@ -58,14 +392,12 @@ mysql2_local_infile_init(void **ptr, const char *filename, void *userdata)
 static int
 mysql2_local_infile_read(void *ptr, char *buf, unsigned int buf_len)
 {
-  int count;
   mysql2_local_infile_data *data = (mysql2_local_infile_data *)ptr;
+  int count = mysql2_local_infile_read_chunk(ptr, buf, buf_len);
 
-  count = (int)read(data->fd, buf, buf_len);
-  if (count < 0) {
-    snprintf(data->error, ERROR_LEN, "%s: %s", strerror(errno), data->filename);
-  }
-
+  /* The client library writes each chunk as one packet, and ends the file,
+   * even a failed one, with an empty packet. */
+  mysql2_net_count_packet(data->wrapper, count > 0 ? (unsigned long long)count : 0);
   return count;
 }
 
@@ -82,6 +414,7 @@ mysql2_local_infile_end(void *ptr)
       close(data->fd);
     if (data->filename)
       free(data->filename);
+    free(data->buf);
     free(data);
   }
 }
@@ -120,3 +453,11 @@ void mysql2_set_local_infile(MYSQL *mysql, void *userdata)
                                  mysql2_local_infile_end,
                                  mysql2_local_infile_error, userdata);
 }
+
+void init_mysql2_infile(void)
+{
+  intern_read = rb_intern("read");
+  intern_next = rb_intern("next");
+  intern_each = rb_intern("each");
+  intern_to_enum = rb_intern("to_enum");
+}
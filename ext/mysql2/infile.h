@@ -1 +1,7 @@
 void mysql2_set_local_infile(MYSQL *mysql, void *userdata);
+VALUE mysql2_infile_source(VALUE source);
+/* Re-raises, or resumes the throw or thread kill, that interrupted an
+ * :infile source mid-transfer; call once the client library call that read
+ * it has returned. Does nothing if the source finished normally. */
+void mysql2_infile_rethrow(mysql_client_wrapper *wrapper);
+void init_mysql2_infile(void);
@@ -0,0 +1,543 @@
+#include <mysql2_ext.h>
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <poll.h>
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#include "wait_for_single_fd.h"
+
+extern VALUE mMysql2, cMysql2Client, cMysql2Error, cMysql2TimeoutError;
+static VALUE cMysql2Multiplexer;
+
+#ifndef NEW_TYPEDDATA_WRAPPER
+#define TypedData_Get_Struct(obj, type, ignore, sval) Data_Get_Struct(obj, type, sval)
+#endif
+
+#define GET_MULTIPLEXER(self) \
+  mysql2_multiplexer_wrapper *mux; \
+  TypedData_Get_Struct(self, mysql2_multiplexer_wrapper, &rb_mysql2_multiplexer_type, mux);
+
+static void rb_mysql2_multiplexer_mark(void *ptr) {
+  mysql2_multiplexer_wrapper *mux = ptr;
+  long i;
+  if (!mux) return;
+
+  for (i = 0; i < mux->count; i++) {
+    rb_gc_mark_movable(mux->entries[i].client);
+  }
+}
+
+static void rb_mysql2_multiplexer_free(void *ptr) {
+  mysql2_multiplexer_wrapper *mux = ptr;
+
+#ifdef HAVE_SYS_EPOLL_H
+  if (mux->epfd >= 0) {
+    close(mux->epfd);
+  }
+#endif
+  xfree(mux->entries);
+  xfree(mux);
+}
+
+static size_t rb_mysql2_multiplexer_memsize(const void *ptr) {
+  const mysql2_multiplexer_wrapper *mux = ptr;
+  return sizeof(*mux) + mux->capa * sizeof(mysql2_multiplexer_entry);
+}
+
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+static void rb_mysql2_multiplexer_compact(void *ptr) {
+  mysql2_multiplexer_wrapper *mux = ptr;
+  long i;
+  if (!mux) return;
+
+  for (i = 0; i < mux->count; i++) {
+    rb_mysql2_gc_location(mux->entries[i].client);
+  }
+}
+#endif
+
+static const rb_data_type_t rb_mysql2_multiplexer_type = {
+  "rb_mysql2_multiplexer",
+  {
+    rb_mysql2_multiplexer_mark,
+    rb_mysql2_multiplexer_free,
+    rb_mysql2_multiplexer_memsize,
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    rb_mysql2_multiplexer_compact,
+#endif
+  },
+  0,
+  0,
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+  RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+static VALUE allocate(VALUE klass) {
+  VALUE obj;
+  mysql2_multiplexer_wrapper *mux;
+#ifdef NEW_TYPEDDATA_WRAPPER
+  obj = TypedData_Make_Struct(klass, mysql2_multiplexer_wrapper, &rb_mysql2_multiplexer_type, mux);
+#else
+  obj = Data_Make_Struct(klass, mysql2_multiplexer_wrapper, rb_mysql2_multiplexer_mark, rb_mysql2_multiplexer_free, mux);
+#endif
+  mux->entries = NULL;
+  mux->count = 0;
+  mux->capa = 0;
+  mux->epfd = -1;
+  mux->epoll_pid = 0;
+  mux->waiting = 0;
+  return obj;
+}
+
+static long mysql2_multiplexer_find(mysql2_multiplexer_wrapper *mux, VALUE client) {
+  long i;
+
+  for (i = 0; i < mux->count; i++) {
+    if (mux->entries[i].client == client) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* A wait's timeout in seconds as a mysql2_monotonic_now() deadline, or
+ * negative for none (nil). */
+static double mysql2_multiplexer_deadline(VALUE timeout) {
+  double seconds;
+
+  if (NIL_P(timeout)) {
+    return -1;
+  }
+  seconds = NUM2DBL(timeout);
+  if (seconds < 0 || isnan(seconds)) {
+    rb_raise(rb_eArgError, "timeout must be nil or a non-negative number of seconds");
+  }
+  return mysql2_monotonic_now() + seconds;
+}
+
+/* How many of the clients have an async query waiting on its response. */
+static long mysql2_multiplexer_in_flight(mysql2_multiplexer_wrapper *mux) {
+  long i, count = 0;
+
+  for (i = 0; i < mux->count; i++) {
+    int in_flight;
+    GET_CLIENT(mux->entries[i].client);
+
+    mysql2_client_async_socket(wrapper, &in_flight);
+    count += in_flight;
+  }
+  return count;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/* Takes the entry out of the epoll set. A socket that is no longer the
+ * client's was closed, and closing it already did that -- the descriptor
+ * number may even be another client's by now, so it is left alone. */
+static void mysql2_multiplexer_unregister(mysql2_multiplexer_wrapper *mux, mysql2_multiplexer_entry *entry) {
+  int in_flight;
+  GET_CLIENT(entry->client);
+
+  if (entry->fd < 0) return;
+  if (mysql2_client_async_socket(wrapper, &in_flight) == entry->fd) {
+    epoll_ctl(mux->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+  }
+  entry->fd = -1;
+}
+
+/* Brings the epoll set in line with the clients: every one with a response
+ * to wait for is in it, under its current socket and for its current
+ * query, and nothing else is. Returns how many are in it. */
+static long mysql2_multiplexer_register(mysql2_multiplexer_wrapper *mux) {
+  long i, count = 0;
+
+  if (mux->epfd >= 0 && mux->epoll_pid != (int)getpid()) {
+    /* Forked: the instance is still the parent's. Drop it unchanged. */
+    close(mux->epfd);
+    mux->epfd = -1;
+    for (i = 0; i < mux->count; i++) {
+      mux->entries[i].fd = -1;
+    }
+  }
+  if (mux->epfd < 0) {
+    mux->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (mux->epfd < 0) {
+      rb_sys_fail("epoll_create1");
+    }
+    mux->epoll_pid = (int)getpid();
+  }
+
+  for (i = 0; i < mux->count; i++) {
+    mysql2_multiplexer_entry *entry = &mux->entries[i];
+    struct epoll_event event;
+    int fd, in_flight;
+    GET_CLIENT(entry->client);
+
+    fd = mysql2_client_async_socket(wrapper, &in_flight);
+    /* A new query may have reconnected onto the same descriptor number,
+     * so a registration is only good for the query it was made for. */
+    if (entry->fd >= 0 && (fd != entry->fd || !in_flight || wrapper->queries != entry->queries)) {
+      mysql2_multiplexer_unregister(mux, entry);
+    }
+    if (!in_flight) continue;
+
+    if (entry->fd < 0) {
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+      if (epoll_ctl(mux->epfd, EPOLL_CTL_ADD, fd, &event) != 0 &&
+          (errno != EEXIST || epoll_ctl(mux->epfd, EPOLL_CTL_MOD, fd, &event) != 0)) {
+        rb_sys_fail("epoll_ctl");
+      }
+      entry->fd = fd;
+      entry->queries = wrapper->queries;
+    }
+    count++;
+  }
+  return count;
+}
+
+/* Waits on the epoll descriptor itself, which turns readable as soon as
+ * any socket in the set does: rb_wait_for_single_fd releases the GVL, is
+ * interruptible, and hands the wait to Fiber.scheduler when one is set.
+ * The ready sockets are then picked up without blocking, and leave the set
+ * as they are reported. */
+static VALUE mysql2_multiplexer_wait_ready(mysql2_multiplexer_wrapper *mux, double deadline) {
+  for (;;) {
+    struct epoll_event *events;
+    struct timeval tv, *tvp = NULL;
+    VALUE ready, events_holder;
+    long pending = mysql2_multiplexer_register(mux);
+    int i, n, rv;
+
+    if (pending == 0) {
+      return Qfalse;
+    }
+    if (deadline >= 0) {
+      double remaining = deadline - mysql2_monotonic_now();
+      if (remaining < 0) remaining = 0;
+      tv.tv_sec = (time_t)remaining;
+      tv.tv_usec = (long)((remaining - (double)tv.tv_sec) * 1000000.0);
+      tvp = &tv;
+    }
+
+    rv = rb_wait_for_single_fd(mux->epfd, RB_WAITFD_IN, tvp);
+    if (rv < 0) {
+      rb_sys_fail("epoll");
+    }
+    if (rv == 0) {
+      return rb_ary_new();
+    }
+
+    events = ALLOCV_N(struct epoll_event, events_holder, pending);
+    n = epoll_wait(mux->epfd, events, (int)pending, 0);
+    if (n < 0 && errno != EINTR) {
+      ALLOCV_END(events_holder);
+      rb_sys_fail("epoll_wait");
+    }
+    ready = rb_ary_new_capa(n > 0 ? n : 0);
+    for (i = 0; i < n; i++) {
+      long j;
+
+      for (j = 0; j < mux->count; j++) {
+        if (mux->entries[j].fd == events[i].data.fd) {
+          rb_ary_push(ready, mux->entries[j].client);
+          mysql2_multiplexer_unregister(mux, &mux->entries[j]);
+          break;
+        }
+      }
+    }
+    ALLOCV_END(events_holder);
+
+    if (RARRAY_LEN(ready) > 0 || (deadline >= 0 && mysql2_monotonic_now() >= deadline)) {
+      return ready;
+    }
+  }
+}
+#elif !defined(_WIN32)
+struct nogvl_poll_args {
+  struct pollfd *fds;
+  nfds_t count;
+  int timeout_ms;
+  int result;
+  int error;
+};
+
+static void *nogvl_poll(void *ptr) {
+  struct nogvl_poll_args *args = ptr;
+
+  args->result = poll(args->fds, args->count, args->timeout_ms);
+  args->error = errno;
+  return NULL;
+}
+
+/* Without epoll: one poll() over the sockets of the clients that have a
+ * response to wait for, with the GVL released. */
+static VALUE mysql2_multiplexer_wait_ready(mysql2_multiplexer_wrapper *mux, double deadline) {
+  for (;;) {
+    struct nogvl_poll_args args;
+    VALUE ready, fds_holder;
+    long i, j;
+
+    args.fds = ALLOCV_N(struct pollfd, fds_holder, mux->count > 0 ? mux->count : 1);
+    args.count = 0;
+    for (i = 0; i < mux->count; i++) {
+      int fd, in_flight;
+      GET_CLIENT(mux->entries[i].client);
+
+      fd = mysql2_client_async_socket(wrapper, &in_flight);
+      if (in_flight) {
+        args.fds[args.count].fd = fd;
+        args.fds[args.count].events = POLLIN;
+        args.fds[args.count].revents = 0;
+        args.count++;
+      }
+    }
+    if (args.count == 0) {
+      ALLOCV_END(fds_holder);
+      return Qfalse;
+    }
+    args.timeout_ms = -1;
+    if (deadline >= 0) {
+      double remaining = deadline - mysql2_monotonic_now();
+      args.timeout_ms = remaining > 0 ? (int)ceil(remaining * 1000) : 0;
+    }
+
+    rb_thread_call_without_gvl(nogvl_poll, &args, RUBY_UBF_IO, 0);
+    if (args.result < 0) {
+      ALLOCV_END(fds_holder);
+      if (args.error == EINTR) {
+        rb_thread_check_ints();
+        continue;
+      }
+      errno = args.error;
+      rb_sys_fail("poll");
+    }
+
+    ready = rb_ary_new();
+    for (i = 0; i < (long)args.count; i++) {
+      if (!args.fds[i].revents) continue;
+      for (j = 0; j < mux->count; j++) {
+        int in_flight;
+        GET_CLIENT(mux->entries[j].client);
+
+        if (mysql2_client_async_socket(wrapper, &in_flight) == args.fds[i].fd && in_flight) {
+          rb_ary_push(ready, mux->entries[j].client);
+          break;
+        }
+      }
+    }
+    ALLOCV_END(fds_holder);
+
+    if (args.result == 0 || RARRAY_LEN(ready) > 0 || (deadline >= 0 && mysql2_monotonic_now() >= deadline)) {
+      return ready;
+    }
+  }
+}
+#endif
+
+#ifndef _WIN32
+struct mysql2_multiplexer_wait_args {
+  mysql2_multiplexer_wrapper *mux;
+  double deadline;
+};
+
+static VALUE do_wait(VALUE argsval) {
+  struct mysql2_multiplexer_wait_args *args = (void *)argsval;
+  return mysql2_multiplexer_wait_ready(args->mux, args->deadline);
+}
+
+static VALUE wait_done(VALUE muxval) {
+  mysql2_multiplexer_wrapper *mux = (void *)muxval;
+  mux->waiting = 0;
+  return Qnil;
+}
+
+/* The clients whose response has started arriving, an empty Array when
+ * deadline passed first, or Qfalse when no client has one to wait for. */
+static VALUE mysql2_multiplexer_wait(mysql2_multiplexer_wrapper *mux, double deadline) {
+  struct mysql2_multiplexer_wait_args args;
+
+  if (mux->waiting) {
+    rb_raise(cMysql2Error, "This multiplexer is already being waited on");
+  }
+  args.mux = mux;
+  args.deadline = deadline;
+  mux->waiting = 1;
+  return rb_ensure(do_wait, (VALUE)&args, wait_done, (VALUE)mux);
+}
+#else
+static VALUE mysql2_multiplexer_wait(RB_MYSQL_UNUSED mysql2_multiplexer_wrapper *mux, RB_MYSQL_UNUSED double deadline) {
+  rb_raise(cMysql2Error, "Mysql2::Multiplexer isn't supported on Windows");
+}
+#endif
+
+/* call-seq:
+ *    multiplexer.add(client) -> multiplexer
+ *
+ * Watches client from now on. Adding one twice does nothing.
+ */
+static VALUE rb_mysql2_multiplexer_add(VALUE self, VALUE client) {
+  GET_MULTIPLEXER(self);
+
+  if (!rb_obj_is_kind_of(client, cMysql2Client)) {
+    rb_raise(rb_eTypeError, "wrong argument type %" PRIsVALUE " (expected Mysql2::Client)", rb_obj_class(client));
+  }
+  if (mysql2_multiplexer_find(mux, client) >= 0) {
+    return self;
+  }
+  if (mux->count == mux->capa) {
+    mux->capa = mux->capa ? mux->capa * 2 : 8;
+    REALLOC_N(mux->entries, mysql2_multiplexer_entry, mux->capa);
+  }
+  mux->entries[mux->count].client = client;
+  mux->entries[mux->count].fd = -1;
+  mux->entries[mux->count].queries = 0;
+  mux->count++;
+  return self;
+}
+
+/* call-seq:
+ *    Mysql2::Multiplexer.new(*clients)
+ */
+static VALUE rb_mysql2_multiplexer_initialize(int argc, VALUE *argv, VALUE self) {
+  int i;
+
+  for (i = 0; i < argc; i++) {
+    rb_mysql2_multiplexer_add(self, argv[i]);
+  }
+  return self;
+}
+
+/* call-seq:
+ *    multiplexer.remove(client) -> client or nil
+ *
+ * Stops watching client. Its async query, if any, is left for the caller
+ * to finish with Client#async_result.
+ */
+static VALUE rb_mysql2_multiplexer_remove(VALUE self, VALUE client) {
+  long i;
+  GET_MULTIPLEXER(self);
+
+  i = mysql2_multiplexer_find(mux, client);
+  if (i < 0) {
+    return Qnil;
+  }
+#ifdef HAVE_SYS_EPOLL_H
+  mysql2_multiplexer_unregister(mux, &mux->entries[i]);
+#endif
+  memmove(mux->entries + i, mux->entries + i + 1, (mux->count - i - 1) * sizeof(mysql2_multiplexer_entry));
+  mux->count--;
+  return client;
+}
+
+/* call-seq:
+ *    multiplexer.clients -> Array
+ */
+static VALUE rb_mysql2_multiplexer_clients(VALUE self) {
+  VALUE clients;
+  long i;
+  GET_MULTIPLEXER(self);
+
+  clients = rb_ary_new_capa(mux->count);
+  for (i = 0; i < mux->count; i++) {
+    rb_ary_push(clients, mux->entries[i].client);
+  }
+  return clients;
+}
+
+/* call-seq:
+ *    multiplexer.size -> Integer
+ */
+static VALUE rb_mysql2_multiplexer_size(VALUE self) {
+  GET_MULTIPLEXER(self);
+  return LONG2NUM(mux->count);
+}
+
+/* call-seq:
+ *    multiplexer.pending -> Integer
+ *
+ * How many of the clients have an async query whose result hasn't been
+ * read yet.
+ */
+static VALUE rb_mysql2_multiplexer_pending(VALUE self) {
+  GET_MULTIPLEXER(self);
+  return LONG2NUM(mysql2_multiplexer_in_flight(mux));
+}
+
+/* call-seq:
+ *    multiplexer.wait(timeout = nil) -> Array
+ *
+ * Waits, with the GVL released, until the response to at least one of the
+ * clients' async queries (Client#query with :async => true) starts to
+ * arrive, and returns those clients: Client#async_result on them won't
+ * wait for the server. Returns an empty Array when timeout (in seconds)
+ * passes first, and right away when no client has a query in flight.
+ */
+static VALUE rb_mysql2_multiplexer_wait(int argc, VALUE *argv, VALUE self) {
+  VALUE timeout, ready;
+  GET_MULTIPLEXER(self);
+
+  rb_scan_args(argc, argv, "01", &timeout);
+  ready = mysql2_multiplexer_wait(mux, mysql2_multiplexer_deadline(timeout));
+  return ready == Qfalse ? rb_ary_new() : ready;
+}
+
+/* call-seq:
+ *    multiplexer.each_result(timeout = nil) { |client, result| ... } -> multiplexer
+ *
+ * Finishes every client's async query in the order the responses arrive,
+ * reading each result in C and yielding it with its client. Raises
+ * Mysql2::Error::TimeoutError if timeout (in seconds, for the whole batch)
+ * passes with some still outstanding, and a query's own error as its
+ * Client#async_result would; either way the other clients' queries stay
+ * in flight, and calling each_result again carries on with them.
+ */
+static VALUE rb_mysql2_multiplexer_each_result(int argc, VALUE *argv, VALUE self) {
+  VALUE timeout;
+  double deadline;
+  GET_MULTIPLEXER(self);
+
+  RETURN_ENUMERATOR(self, argc, argv);
+  rb_scan_args(argc, argv, "01", &timeout);
+  deadline = mysql2_multiplexer_deadline(timeout);
+
+  for (;;) {
+    VALUE ready = mysql2_multiplexer_wait(mux, deadline);
+    long i;
+
+    if (ready == Qfalse) {
+      return self;
+    }
+    if (RARRAY_LEN(ready) == 0) {
+      rb_raise(cMysql2TimeoutError, "Timeout waiting for %ld async results. (waited %" PRIsVALUE " seconds)",
+               mysql2_multiplexer_in_flight(mux), timeout);
+    }
+    for (i = 0; i < RARRAY_LEN(ready); i++) {
+      VALUE client = rb_ary_entry(ready, i);
+      rb_yield_values(2, client, rb_mysql_client_async_result(client));
+    }
+  }
+}
+
+void init_mysql2_multiplexer(void) {
+  cMysql2Multiplexer = rb_define_class_under(mMysql2, "Multiplexer", rb_cObject);
+  rb_global_variable(&cMysql2Multiplexer);
+  rb_define_alloc_func(cMysql2Multiplexer, allocate);
+
+  rb_define_method(cMysql2Multiplexer, "initialize", rb_mysql2_multiplexer_initialize, -1);
+  rb_define_method(cMysql2Multiplexer, "add", rb_mysql2_multiplexer_add, 1);
+  rb_define_method(cMysql2Multiplexer, "<<", rb_mysql2_multiplexer_add, 1);
+  rb_define_method(cMysql2Multiplexer, "remove", rb_mysql2_multiplexer_remove, 1);
+  rb_define_method(cMysql2Multiplexer, "clients", rb_mysql2_multiplexer_clients, 0);
+  rb_define_method(cMysql2Multiplexer, "size", rb_mysql2_multiplexer_size, 0);
+  rb_define_method(cMysql2Multiplexer, "pending", rb_mysql2_multiplexer_pending, 0);
+  rb_define_method(cMysql2Multiplexer, "wait", rb_mysql2_multiplexer_wait, -1);
+  rb_define_method(cMysql2Multiplexer, "each_result", rb_mysql2_multiplexer_each_result, -1);
+}
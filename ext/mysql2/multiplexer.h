@@ -0,0 +1,33 @@
+#ifndef MYSQL2_MULTIPLEXER_H
+#define MYSQL2_MULTIPLEXER_H
+
+typedef struct {
+  VALUE client;
+  /* The socket this client is registered under in the epoll set, or -1.
+   * A client is only in the set while its async query's response is
+   * awaited: it is taken out as soon as it is reported ready, so a
+   * reconnect that lands on the same descriptor number can never leave a
+   * stale registration behind. Always -1 without epoll. */
+  int fd;
+  /* The client's query counter when it was registered: a registration is
+   * only good for that one query. */
+  unsigned long long queries;
+} mysql2_multiplexer_entry;
+
+typedef struct {
+  mysql2_multiplexer_entry *entries;
+  long count;
+  long capa;
+  /* The epoll instance, created on the first wait; -1 before that and
+   * without epoll. A forked child gets its own (see epoll_pid): the
+   * parent's instance is shared with it, registrations and all. */
+  int epfd;
+  int epoll_pid;
+  /* A wait is in progress, with the GVL released: another thread waiting
+   * on the same multiplexer would steal its readiness events. */
+  int waiting;
+} mysql2_multiplexer_wrapper;
+
+void init_mysql2_multiplexer(void);
+
+#endif
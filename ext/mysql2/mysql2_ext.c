@@ -1,9 +1,19 @@
 #include <mysql2_ext.h>
 
-VALUE mMysql2, cMysql2Error, cMysql2ConnectionError, cMysql2TimeoutError;
+VALUE mMysql2, cMysql2Error, cMysql2ConnectionError, cMysql2TimeoutError, cMysql2ResultLimitError;
 
 /* Ruby Extension initializer */
 void Init_mysql2(void) {
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+  /* Every Ractor may call in. There is no per-process mutable state: the
+   * globals below and in each init_* are classes, symbols and IDs, or
+   * frozen, set once here while only the main Ractor runs, and the
+   * charsetnr cache in result.c only ever has the same value stored into
+   * a slot. Everything else hangs off a Client, Result or Statement,
+   * which is not shareable and so belongs to one Ractor. */
+  rb_ext_ractor_safe(true);
+#endif
+
   mMysql2 = rb_define_module("Mysql2");
   rb_global_variable(&mMysql2);
 
@@ -16,7 +26,13 @@ void Init_mysql2(void) {
   cMysql2TimeoutError = rb_const_get(cMysql2Error, rb_intern("TimeoutError"));
   rb_global_variable(&cMysql2TimeoutError);
 
+  cMysql2ResultLimitError = rb_const_get(cMysql2Error, rb_intern("ResultLimitError"));
+  rb_global_variable(&cMysql2ResultLimitError);
+
   init_mysql2_client();
   init_mysql2_result();
   init_mysql2_statement();
+  init_mysql2_pool();
+  init_mysql2_multiplexer();
+  init_mysql2_infile();
 }
@@ -51,7 +51,12 @@ typedef bool my_bool;
 
 #include <client.h>
 #include <statement.h>
+#include <spool.h>
 #include <result.h>
 #include <infile.h>
+#include <sql_scan.h>
+#include <pool.h>
+#include <multiplexer.h>
+#include <probes.h>
 
 #endif
@@ -0,0 +1,723 @@
+#include <mysql2_ext.h>
+
+#include <math.h>
+#include <string.h>
+
+extern VALUE mMysql2, cMysql2Client, cMysql2Error, cMysql2TimeoutError;
+static VALUE cMysql2Pool;
+static VALUE sym_min, sym_max, sym_checkout_timeout, sym_idle_timeout, sym_reset_on_checkin, sym_size, sym_idle, sym_in_use,
+  sym_waiting, sym_checkouts, sym_timeouts, sym_created, sym_discarded;
+static ID intern_new, intern_connect_many, intern_close, intern_ping, intern_query, intern_reset_connection, intern_wait, intern_signal, intern_broadcast;
+
+#ifndef NEW_TYPEDDATA_WRAPPER
+#define TypedData_Get_Struct(obj, type, ignore, sval) Data_Get_Struct(obj, type, sval)
+#endif
+
+#define GET_POOL(self) \
+  mysql2_pool_wrapper *pool; \
+  TypedData_Get_Struct(self, mysql2_pool_wrapper, &rb_mysql2_pool_type, pool);
+
+static void rb_mysql2_pool_mark(void *ptr) {
+  mysql2_pool_wrapper *pool = ptr;
+  long i;
+  if (!pool) return;
+
+  rb_gc_mark_movable(pool->client_options);
+  rb_gc_mark_movable(pool->in_use);
+  rb_gc_mark_movable(pool->mutex);
+  rb_gc_mark_movable(pool->cond);
+  for (i = 0; i < pool->idle_count; i++) {
+    rb_gc_mark_movable(pool->idle[i].client);
+  }
+}
+
+static void rb_mysql2_pool_free(void *ptr) {
+  mysql2_pool_wrapper *pool = ptr;
+
+  /* The clients themselves are ordinary GC'd objects and close their own
+   * connections when collected. */
+  xfree(pool->idle);
+  xfree(pool);
+}
+
+static size_t rb_mysql2_pool_memsize(const void *ptr) {
+  const mysql2_pool_wrapper *pool = ptr;
+  return sizeof(*pool) + pool->max * sizeof(mysql2_pool_entry);
+}
+
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+static void rb_mysql2_pool_compact(void *ptr) {
+  mysql2_pool_wrapper *pool = ptr;
+  long i;
+  if (!pool) return;
+
+  rb_mysql2_gc_location(pool->client_options);
+  rb_mysql2_gc_location(pool->in_use);
+  rb_mysql2_gc_location(pool->mutex);
+  rb_mysql2_gc_location(pool->cond);
+  for (i = 0; i < pool->idle_count; i++) {
+    rb_mysql2_gc_location(pool->idle[i].client);
+  }
+}
+#endif
+
+static const rb_data_type_t rb_mysql2_pool_type = {
+  "rb_mysql2_pool",
+  {
+    rb_mysql2_pool_mark,
+    rb_mysql2_pool_free,
+    rb_mysql2_pool_memsize,
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    rb_mysql2_pool_compact,
+#endif
+  },
+  0,
+  0,
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+  RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+static VALUE allocate(VALUE klass) {
+  VALUE obj;
+  mysql2_pool_wrapper *pool;
+#ifdef NEW_TYPEDDATA_WRAPPER
+  obj = TypedData_Make_Struct(klass, mysql2_pool_wrapper, &rb_mysql2_pool_type, pool);
+#else
+  obj = Data_Make_Struct(klass, mysql2_pool_wrapper, rb_mysql2_pool_mark, rb_mysql2_pool_free, pool);
+#endif
+  pool->client_options = Qnil;
+  pool->in_use = Qnil;
+  pool->mutex = Qnil;
+  pool->cond = Qnil;
+  pool->idle = NULL;
+  pool->idle_count = 0;
+  pool->min = 0;
+  pool->max = 0;
+  pool->size = 0;
+  pool->waiting = 0;
+  pool->checkout_timeout = -1;
+  pool->idle_timeout = -1;
+  pool->shutdown = 0;
+  pool->reset_on_checkin = 0;
+  pool->checkouts = 0;
+  pool->timeouts = 0;
+  pool->created = 0;
+  pool->discarded = 0;
+  memset(pool->wait_buckets, 0, sizeof(pool->wait_buckets));
+  return obj;
+}
+
+/* A timeout option in seconds: nil for none (negative internally). */
+static double mysql2_pool_seconds(VALUE value, const char *name) {
+  double seconds;
+
+  if (NIL_P(value)) {
+    return -1;
+  }
+  seconds = NUM2DBL(value);
+  if (seconds < 0) {
+    rb_raise(rb_eArgError, "%s must be nil or a non-negative number of seconds", name);
+  }
+  return seconds;
+}
+
+/* Wakes one checkout waiting on an exhausted pool (all of them when
+ * everyone has to re-check, i.e. on shutdown). Takes the mutex only when
+ * there is a waiter: one that has counted itself in holds the mutex until
+ * it is asleep on the condition variable, so the wakeup can't be lost. */
+static VALUE mysql2_pool_signal_locked(VALUE poolval) {
+  mysql2_pool_wrapper *pool = (void *)poolval;
+  rb_funcall(pool->cond, pool->shutdown ? intern_broadcast : intern_signal, 0);
+  return Qnil;
+}
+
+static void mysql2_pool_signal(mysql2_pool_wrapper *pool) {
+  if (pool->waiting > 0) {
+    rb_mutex_synchronize(pool->mutex, mysql2_pool_signal_locked, (VALUE)pool);
+  }
+}
+
+static VALUE mysql2_pool_close_client(VALUE client) {
+  return rb_funcall(client, intern_close, 0);
+}
+
+/* Closes a connection that is leaving the pool for good and frees its
+ * slot. A failure to close it cleanly changes nothing for the pool. */
+static void mysql2_pool_discard(mysql2_pool_wrapper *pool, VALUE client) {
+  int state = 0;
+
+  pool->size--;
+  pool->discarded++;
+  rb_protect(mysql2_pool_close_client, client, &state);
+  if (state) {
+    rb_set_errinfo(Qnil);
+  }
+  mysql2_pool_signal(pool);
+}
+
+/* Closes connections that have sat idle for idle_timeout, oldest first,
+ * without taking the pool below min. Returns how many it closed. */
+static long mysql2_pool_reap_idle(mysql2_pool_wrapper *pool) {
+  VALUE victims;
+  double now;
+  long count = 0, i;
+
+  if (pool->idle_timeout < 0) {
+    return 0;
+  }
+
+  now = mysql2_monotonic_now();
+  while (count < pool->idle_count && pool->size - count > pool->min &&
+         now - pool->idle[count].idle_since >= pool->idle_timeout) {
+    count++;
+  }
+  if (count == 0) {
+    return 0;
+  }
+
+  /* Off the free list first: closing releases the GVL. */
+  victims = rb_ary_new_capa(count);
+  for (i = 0; i < count; i++) {
+    rb_ary_push(victims, pool->idle[i].client);
+  }
+  memmove(pool->idle, pool->idle + count, (pool->idle_count - count) * sizeof(mysql2_pool_entry));
+  pool->idle_count -= count;
+
+  for (i = 0; i < count; i++) {
+    mysql2_pool_discard(pool, rb_ary_entry(victims, i));
+  }
+  return count;
+}
+
+static VALUE mysql2_pool_ping(VALUE client) {
+  return rb_funcall(client, intern_ping, 0);
+}
+
+/* Pops idle connections until one is usable, closing the dead ones on the
+ * way. A socket with nothing to read is taken as good without a round
+ * trip; only where the socket can't be probed does this fall back to a
+ * ping. Returns Qnil when the free list runs out. */
+static VALUE mysql2_pool_take_idle(mysql2_pool_wrapper *pool) {
+  while (pool->idle_count > 0) {
+    VALUE client;
+    int alive;
+
+    pool->idle_count--;
+    client = pool->idle[pool->idle_count].client;
+    pool->idle[pool->idle_count].client = Qnil;
+
+    {
+      GET_CLIENT(client);
+      alive = mysql2_client_probe_idle(wrapper);
+    }
+    if (alive < 0) {
+      int state = 0;
+      alive = RTEST(rb_protect(mysql2_pool_ping, client, &state));
+      if (state) {
+        rb_set_errinfo(Qnil);
+        alive = 0;
+      }
+    }
+
+    if (alive) {
+      return client;
+    }
+    mysql2_pool_discard(pool, client);
+  }
+
+  return Qnil;
+}
+
+static VALUE mysql2_pool_new_client(VALUE options) {
+  return rb_funcall(cMysql2Client, intern_new, 1, options);
+}
+
+/* Opens a new connection in a slot reserved before connecting, so that
+ * concurrent checkouts can't overshoot max while the handshake runs with
+ * the GVL released. A failed connect gives the slot back and re-raises. */
+static VALUE mysql2_pool_connect(mysql2_pool_wrapper *pool) {
+  VALUE client;
+  int state = 0;
+
+  pool->size++;
+  client = rb_protect(mysql2_pool_new_client, pool->client_options, &state);
+  if (state) {
+    pool->size--;
+    mysql2_pool_signal(pool);
+    rb_jump_tag(state);
+  }
+  pool->created++;
+  return client;
+}
+
+struct mysql2_pool_connect_many_args {
+  VALUE options;
+  long count;
+};
+
+static VALUE mysql2_pool_new_clients(VALUE argsval) {
+  struct mysql2_pool_connect_many_args *args = (void *)argsval;
+  return rb_funcall(cMysql2Client, intern_connect_many, 2, LONG2NUM(args->count), args->options);
+}
+
+/* Fills the free list with count new connections, handshaking them all at
+ * once (Mysql2::Client.connect_many). All or nothing, like
+ * mysql2_pool_connect. */
+static void mysql2_pool_warm(mysql2_pool_wrapper *pool, long count) {
+  struct mysql2_pool_connect_many_args args;
+  VALUE clients;
+  double now;
+  long i;
+  int state = 0;
+
+  if (count <= 0) {
+    return;
+  }
+
+  args.options = pool->client_options;
+  args.count = count;
+
+  pool->size += count;
+  clients = rb_protect(mysql2_pool_new_clients, (VALUE)&args, &state);
+  if (state) {
+    pool->size -= count;
+    mysql2_pool_signal(pool);
+    rb_jump_tag(state);
+  }
+  pool->created += count;
+
+  /* A shutdown can have landed while the handshakes ran. */
+  if (pool->shutdown) {
+    for (i = 0; i < count; i++) {
+      mysql2_pool_discard(pool, rb_ary_entry(clients, i));
+    }
+    return;
+  }
+
+  now = mysql2_monotonic_now();
+  for (i = 0; i < count; i++) {
+    pool->idle[pool->idle_count].client = rb_ary_entry(clients, i);
+    pool->idle[pool->idle_count].idle_since = now;
+    pool->idle_count++;
+  }
+  mysql2_pool_signal(pool);
+}
+
+static VALUE mysql2_pool_hand_out(mysql2_pool_wrapper *pool, VALUE client, double start) {
+  double waited = mysql2_monotonic_now() - start;
+  unsigned long long usec = (start < 0 || waited < 0) ? 0 : (unsigned long long)(waited * 1000000.0);
+  int bucket = 0;
+
+  while (usec > 0 && bucket < MYSQL2_POOL_WAIT_BUCKETS - 1) {
+    usec >>= 1;
+    bucket++;
+  }
+  pool->wait_buckets[bucket]++;
+  pool->checkouts++;
+
+  rb_hash_aset(pool->in_use, client, Qtrue);
+  return client;
+}
+
+struct mysql2_pool_wait_args {
+  mysql2_pool_wrapper *pool;
+  double deadline; /* negative waits forever */
+};
+
+static VALUE mysql2_pool_wait_body(VALUE argsval) {
+  struct mysql2_pool_wait_args *args = (void *)argsval;
+  mysql2_pool_wrapper *pool = args->pool;
+
+  while (pool->idle_count == 0 && pool->size >= pool->max && !pool->shutdown) {
+    VALUE timeout = Qnil;
+
+    if (args->deadline >= 0) {
+      double remaining = args->deadline - mysql2_monotonic_now();
+      if (remaining <= 0) {
+        return Qfalse;
+      }
+      timeout = DBL2NUM(remaining);
+    }
+    rb_funcall(pool->cond, intern_wait, 2, pool->mutex, timeout);
+  }
+
+  return Qtrue;
+}
+
+static VALUE mysql2_pool_wait_ensure(VALUE argsval) {
+  struct mysql2_pool_wait_args *args = (void *)argsval;
+
+  args->pool->waiting--;
+  rb_mutex_unlock(args->pool->mutex);
+  return Qnil;
+}
+
+/* The slow path: sleeps until a checkin or discard frees something up, or
+ * the deadline passes (returns 0). ConditionVariable#wait is interruptible
+ * and yields to a Fiber scheduler. */
+static int mysql2_pool_wait(mysql2_pool_wrapper *pool, double deadline) {
+  struct mysql2_pool_wait_args args;
+
+  args.pool = pool;
+  args.deadline = deadline;
+
+  rb_mutex_lock(pool->mutex);
+  pool->waiting++;
+  return RTEST(rb_ensure(mysql2_pool_wait_body, (VALUE)&args, mysql2_pool_wait_ensure, (VALUE)&args));
+}
+
+/* call-seq:
+ *    Mysql2::Pool.new(options = {})
+ *
+ * A pool of up to +:max+ (default 5) connections, all made with the rest
+ * of +options+ as Mysql2::Client.new would take them. +:min+ (default 0)
+ * connections are opened right away, concurrently, and never reaped. Checkouts wait up
+ * to +:checkout_timeout+ seconds (default 5, nil for no limit) when every
+ * connection is in use; connections idle for +:idle_timeout+ seconds
+ * (default 300, nil to keep them) are closed on the next checkin or #reap.
+ * With +:reset_on_checkin+, every checkin runs Client#reset_connection;
+ * it raises Mysql2::Error where Client::RESET_CONNECTION_SUPPORTED is false.
+ */
+static VALUE rb_mysql2_pool_initialize(int argc, VALUE *argv, VALUE self) {
+  VALUE opts, value;
+  GET_POOL(self);
+
+  rb_scan_args(argc, argv, "01", &opts);
+  opts = NIL_P(opts) ? rb_hash_new() : rb_hash_dup(rb_convert_type(opts, T_HASH, "Hash", "to_hash"));
+
+  value = rb_hash_delete(opts, sym_min);
+  pool->min = NIL_P(value) ? 0 : NUM2LONG(value);
+  value = rb_hash_delete(opts, sym_max);
+  pool->max = NIL_P(value) ? 5 : NUM2LONG(value);
+  if (pool->max < 1 || pool->min < 0 || pool->min > pool->max) {
+    rb_raise(rb_eArgError, "Mysql2::Pool needs 0 <= min <= max and max >= 1 (got min: %ld, max: %ld)", pool->min, pool->max);
+  }
+
+  /* For these two an explicit nil means "no limit", so absent and nil differ. */
+  value = rb_hash_lookup2(opts, sym_checkout_timeout, Qundef);
+  rb_hash_delete(opts, sym_checkout_timeout);
+  pool->checkout_timeout = value == Qundef ? 5.0 : mysql2_pool_seconds(value, "checkout_timeout");
+  value = rb_hash_lookup2(opts, sym_idle_timeout, Qundef);
+  rb_hash_delete(opts, sym_idle_timeout);
+  pool->idle_timeout = value == Qundef ? 300.0 : mysql2_pool_seconds(value, "idle_timeout");
+  pool->reset_on_checkin = RTEST(rb_hash_delete(opts, sym_reset_on_checkin));
+#ifndef HAVE_MYSQL_RESET_CONNECTION
+  /* Every checkin's reset would fail and throw the connection away, so
+   * the pool would reconnect on every checkout. */
+  if (pool->reset_on_checkin) {
+    rb_raise(cMysql2Error, "reset_on_checkin is not available, you may need a newer MySQL client library (mysql_reset_connection was added in MySQL 5.7.3 and MariaDB Connector/C 3.0)");
+  }
+#endif
+
+  pool->client_options = rb_obj_freeze(opts);
+  pool->in_use = rb_hash_new();
+  pool->mutex = rb_mutex_new();
+  pool->cond = rb_funcall(rb_path2class("Thread::ConditionVariable"), intern_new, 0);
+  pool->idle = ALLOC_N(mysql2_pool_entry, pool->max);
+
+  mysql2_pool_warm(pool, pool->min);
+
+  return self;
+}
+
+/* call-seq:
+ *    pool.checkout(timeout = checkout_timeout)
+ *
+ * Hands out a connection for the caller's exclusive use until #checkin:
+ * an idle one if there is one, a new one while the pool is under +:max+,
+ * or else the next one checked in, waiting up to +timeout+ seconds (nil
+ * for no limit) before raising Mysql2::Error::TimeoutError.
+ */
+static VALUE rb_mysql2_pool_checkout(int argc, VALUE *argv, VALUE self) {
+  VALUE timeout_arg;
+  double timeout, start;
+  GET_POOL(self);
+
+  rb_scan_args(argc, argv, "01", &timeout_arg);
+  timeout = argc == 0 ? pool->checkout_timeout : mysql2_pool_seconds(timeout_arg, "timeout");
+  start = mysql2_monotonic_now();
+
+  for (;;) {
+    VALUE client;
+
+    if (pool->shutdown) {
+      rb_raise(cMysql2Error, "Mysql2::Pool has been shut down");
+    }
+
+    client = mysql2_pool_take_idle(pool);
+    if (!NIL_P(client)) {
+      return mysql2_pool_hand_out(pool, client, start);
+    }
+
+    if (pool->size < pool->max) {
+      client = mysql2_pool_connect(pool);
+      if (pool->shutdown) {
+        mysql2_pool_discard(pool, client);
+        continue;
+      }
+      return mysql2_pool_hand_out(pool, client, start);
+    }
+
+    if (!mysql2_pool_wait(pool, timeout < 0 ? -1 : start + timeout)) {
+      pool->timeouts++;
+      rb_raise(cMysql2TimeoutError, "Timeout waiting for a connection from the pool. (waited %.3f seconds, all %ld in use)",
+               timeout, pool->max);
+    }
+  }
+}
+
+struct mysql2_pool_reset_args {
+  mysql2_pool_wrapper *pool;
+  VALUE client;
+};
+
+/* The per-connection state a checkin clears: whatever mysql2_client_reset_for_reuse
+ * clears, plus any transaction left open, which is rolled back rather than
+ * handed to the next user -- or, with :reset_on_checkin, the whole session
+ * (Client#reset_connection). Qfalse if the connection should be dropped. */
+static VALUE mysql2_pool_reset_client(VALUE argsval) {
+  struct mysql2_pool_reset_args *args = (void *)argsval;
+  GET_CLIENT(args->client);
+
+  if (!mysql2_client_reset_for_reuse(wrapper)) {
+    return Qfalse;
+  }
+  if (args->pool->reset_on_checkin) {
+    rb_funcall(args->client, intern_reset_connection, 0);
+  } else if (wrapper->client->server_status & SERVER_STATUS_IN_TRANS) {
+    rb_funcall(args->client, intern_query, 1, rb_str_new_cstr("ROLLBACK"));
+  }
+  return Qtrue;
+}
+
+/* call-seq:
+ *    pool.checkin(client)
+ *
+ * Gives a connection from #checkout back to the pool. One that was left
+ * mid-query, closed, or can't be reset is closed and its slot freed.
+ */
+static VALUE rb_mysql2_pool_checkin(VALUE self, VALUE client) {
+  struct mysql2_pool_reset_args reset_args;
+  int state = 0;
+  VALUE reusable;
+  GET_POOL(self);
+
+  if (NIL_P(pool->in_use) || NIL_P(rb_hash_delete(pool->in_use, client))) {
+    rb_raise(rb_eArgError, "this connection was not checked out of this pool");
+  }
+
+  reset_args.pool = pool;
+  reset_args.client = client;
+  reusable = pool->shutdown ? Qfalse : rb_protect(mysql2_pool_reset_client, (VALUE)&reset_args, &state);
+  if (state) {
+    rb_set_errinfo(Qnil);
+    reusable = Qfalse;
+  }
+  /* A shutdown can also have landed while the reset had the GVL released. */
+  if (!RTEST(reusable) || pool->shutdown) {
+    mysql2_pool_discard(pool, client);
+    return Qnil;
+  }
+
+  pool->idle[pool->idle_count].client = client;
+  pool->idle[pool->idle_count].idle_since = mysql2_monotonic_now();
+  pool->idle_count++;
+
+  mysql2_pool_reap_idle(pool);
+  mysql2_pool_signal(pool);
+  return Qnil;
+}
+
+struct mysql2_pool_with_args {
+  VALUE self;
+  VALUE client;
+};
+
+static VALUE mysql2_pool_with_checkin(VALUE argsval) {
+  struct mysql2_pool_with_args *args = (void *)argsval;
+  return rb_mysql2_pool_checkin(args->self, args->client);
+}
+
+/* call-seq:
+ *    pool.with(timeout = checkout_timeout) { |client| ... }
+ *
+ * Checks out a connection for the duration of the block and returns the
+ * block's value. The connection goes back to the pool however the block
+ * exits.
+ */
+static VALUE rb_mysql2_pool_with(int argc, VALUE *argv, VALUE self) {
+  struct mysql2_pool_with_args args;
+
+  rb_need_block();
+  args.self = self;
+  args.client = rb_mysql2_pool_checkout(argc, argv, self);
+  return rb_ensure(rb_yield, args.client, mysql2_pool_with_checkin, (VALUE)&args);
+}
+
+/* call-seq:
+ *    pool.warmup(count)
+ *
+ * Opens connections, all at once, until at least +count+ are idle or the
+ * pool is at +:max+ -- e.g. right after a deploy, ahead of the first
+ * requests. Returns how many it opened.
+ */
+static VALUE rb_mysql2_pool_warmup(VALUE self, VALUE count) {
+  long wanted;
+  GET_POOL(self);
+
+  if (pool->shutdown) {
+    rb_raise(cMysql2Error, "Mysql2::Pool has been shut down");
+  }
+
+  wanted = NUM2LONG(count) - pool->idle_count;
+  if (wanted > pool->max - pool->size) {
+    wanted = pool->max - pool->size;
+  }
+  if (wanted <= 0) {
+    return INT2FIX(0);
+  }
+
+  mysql2_pool_warm(pool, wanted);
+  return LONG2NUM(wanted);
+}
+
+/* call-seq:
+ *    pool.reap
+ *
+ * Closes connections idle for longer than +:idle_timeout+, keeping +:min+.
+ * Checkins already do this; call it from a timer for a pool that may go
+ * quiet altogether. Returns how many were closed.
+ */
+static VALUE rb_mysql2_pool_reap(VALUE self) {
+  GET_POOL(self);
+  return LONG2NUM(mysql2_pool_reap_idle(pool));
+}
+
+/* call-seq:
+ *    pool.shutdown
+ *
+ * Closes every idle connection, and each checked-out one as it is checked
+ * in. Later checkouts, and any waiting now, raise Mysql2::Error.
+ */
+static VALUE rb_mysql2_pool_shutdown(VALUE self) {
+  VALUE victims;
+  long i, count;
+  GET_POOL(self);
+
+  pool->shutdown = 1;
+
+  count = pool->idle_count;
+  victims = rb_ary_new_capa(count);
+  for (i = 0; i < count; i++) {
+    rb_ary_push(victims, pool->idle[i].client);
+  }
+  pool->idle_count = 0;
+
+  for (i = 0; i < count; i++) {
+    mysql2_pool_discard(pool, rb_ary_entry(victims, i));
+  }
+  mysql2_pool_signal(pool);
+  return Qnil;
+}
+
+/* call-seq:
+ *    pool.size
+ *
+ * How many connections the pool has open, idle or checked out.
+ */
+static VALUE rb_mysql2_pool_size(VALUE self) {
+  GET_POOL(self);
+  return LONG2NUM(pool->size);
+}
+
+/* call-seq:
+ *    pool.stats
+ *
+ * A snapshot of the pool's counters: the current +:size+, +:idle+,
+ * +:in_use+ and +:waiting+, the configured +:min+ and +:max+, and the
+ * running totals of +:checkouts+, checkout +:timeouts+, connections
+ * +:created+, and connections +:discarded+ (dead, reaped or unresettable).
+ */
+static VALUE rb_mysql2_pool_stats(VALUE self) {
+  VALUE stats = rb_hash_new();
+  GET_POOL(self);
+
+  rb_hash_aset(stats, sym_size, LONG2NUM(pool->size));
+  rb_hash_aset(stats, sym_idle, LONG2NUM(pool->idle_count));
+  rb_hash_aset(stats, sym_in_use, NIL_P(pool->in_use) ? INT2FIX(0) : SIZET2NUM(RHASH_SIZE(pool->in_use)));
+  rb_hash_aset(stats, sym_waiting, LONG2NUM(pool->waiting));
+  rb_hash_aset(stats, sym_min, LONG2NUM(pool->min));
+  rb_hash_aset(stats, sym_max, LONG2NUM(pool->max));
+  rb_hash_aset(stats, sym_checkouts, ULL2NUM(pool->checkouts));
+  rb_hash_aset(stats, sym_timeouts, ULL2NUM(pool->timeouts));
+  rb_hash_aset(stats, sym_created, ULL2NUM(pool->created));
+  rb_hash_aset(stats, sym_discarded, ULL2NUM(pool->discarded));
+  return stats;
+}
+
+/* call-seq:
+ *    pool.wait_histogram
+ *
+ * How long successful checkouts waited, as a Hash from each bucket's upper
+ * bound in seconds (powers of two microseconds; Float::INFINITY for the
+ * last) to the number of checkouts that fell in it. Empty buckets are
+ * left out.
+ */
+static VALUE rb_mysql2_pool_wait_histogram(VALUE self) {
+  VALUE histogram = rb_hash_new();
+  int i;
+  GET_POOL(self);
+
+  for (i = 0; i < MYSQL2_POOL_WAIT_BUCKETS; i++) {
+    double upper;
+
+    if (pool->wait_buckets[i] == 0) {
+      continue;
+    }
+    upper = i == MYSQL2_POOL_WAIT_BUCKETS - 1 ? HUGE_VAL : ldexp(1.0, i) / 1000000.0;
+    rb_hash_aset(histogram, DBL2NUM(upper), ULL2NUM(pool->wait_buckets[i]));
+  }
+  return histogram;
+}
+
+void init_mysql2_pool(void) {
+  cMysql2Pool = rb_define_class_under(mMysql2, "Pool", rb_cObject);
+  rb_global_variable(&cMysql2Pool);
+  rb_define_alloc_func(cMysql2Pool, allocate);
+
+  rb_define_method(cMysql2Pool, "initialize", rb_mysql2_pool_initialize, -1);
+  rb_define_method(cMysql2Pool, "checkout", rb_mysql2_pool_checkout, -1);
+  rb_define_method(cMysql2Pool, "checkin", rb_mysql2_pool_checkin, 1);
+  rb_define_method(cMysql2Pool, "with", rb_mysql2_pool_with, -1);
+  rb_define_method(cMysql2Pool, "warmup", rb_mysql2_pool_warmup, 1);
+  rb_define_method(cMysql2Pool, "reap", rb_mysql2_pool_reap, 0);
+  rb_define_method(cMysql2Pool, "shutdown", rb_mysql2_pool_shutdown, 0);
+  rb_define_method(cMysql2Pool, "size", rb_mysql2_pool_size, 0);
+  rb_define_method(cMysql2Pool, "stats", rb_mysql2_pool_stats, 0);
+  rb_define_method(cMysql2Pool, "wait_histogram", rb_mysql2_pool_wait_histogram, 0);
+
+  sym_min = ID2SYM(rb_intern("min"));
+  sym_max = ID2SYM(rb_intern("max"));
+  sym_checkout_timeout = ID2SYM(rb_intern("checkout_timeout"));
+  sym_idle_timeout = ID2SYM(rb_intern("idle_timeout"));
+  sym_reset_on_checkin = ID2SYM(rb_intern("reset_on_checkin"));
+  sym_size = ID2SYM(rb_intern("size"));
+  sym_idle = ID2SYM(rb_intern("idle"));
+  sym_in_use = ID2SYM(rb_intern("in_use"));
+  sym_waiting = ID2SYM(rb_intern("waiting"));
+  sym_checkouts = ID2SYM(rb_intern("checkouts"));
+  sym_timeouts = ID2SYM(rb_intern("timeouts"));
+  sym_created = ID2SYM(rb_intern("created"));
+  sym_discarded = ID2SYM(rb_intern("discarded"));
+
+  intern_new = rb_intern("new");
+  intern_connect_many = rb_intern("connect_many");
+  intern_close = rb_intern("close");
+  intern_ping = rb_intern("ping");
+  intern_query = rb_intern("query");
+  intern_reset_connection = rb_intern("reset_connection");
+  intern_wait = rb_intern("wait");
+  intern_signal = rb_intern("signal");
+  intern_broadcast = rb_intern("broadcast");
+}
@@ -0,0 +1,46 @@
+#ifndef MYSQL2_POOL_H
+#define MYSQL2_POOL_H
+
+/* Checkout waits are counted in power-of-two microsecond buckets: bucket 0
+ * holds waits under 1us, bucket i those under 2^i us, and the last one
+ * everything longer (2^30us is about 18 minutes). */
+#define MYSQL2_POOL_WAIT_BUCKETS 32
+
+typedef struct {
+  VALUE client;
+  double idle_since; /* mysql2_monotonic_now() at checkin */
+} mysql2_pool_entry;
+
+typedef struct {
+  /* Options every new connection is made with (Mysql2::Client.new). */
+  VALUE client_options;
+  /* Checked-out clients, so checkin can refuse one that isn't ours. */
+  VALUE in_use;
+  /* Only taken by a checkout that found the pool exhausted, and by a
+   * checkin or discard that has such a waiter to wake. The free list
+   * itself is only ever touched with the GVL held and no blocking call in
+   * between, which is all the exclusion it needs. */
+  VALUE mutex;
+  VALUE cond;
+  /* Idle connections, used as a stack: checkout takes the most recently
+   * returned (warmest) one, so the oldest sit at the bottom for reaping. */
+  mysql2_pool_entry *idle;
+  long idle_count;
+  long min;
+  long max;
+  long size; /* idle + checked out + being connected */
+  long waiting;
+  double checkout_timeout; /* seconds; negative waits forever */
+  double idle_timeout;     /* seconds; negative never reaps */
+  int shutdown;
+  int reset_on_checkin; /* Client#reset_connection on every checkin */
+  unsigned long long checkouts;
+  unsigned long long timeouts;
+  unsigned long long created;
+  unsigned long long discarded;
+  unsigned long long wait_buckets[MYSQL2_POOL_WAIT_BUCKETS];
+} mysql2_pool_wrapper;
+
+void init_mysql2_pool(void);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef MYSQL2_PROBES_H
+#define MYSQL2_PROBES_H
+
+/* USDT probes, compiled in only with `gem install mysql2 -- --enable-dtrace`
+ * (see extconf.rb), through the systemtap-style <sys/sdt.h> that bpftrace,
+ * perf and stap all read. A probe is a single nop in the instruction stream
+ * plus an ELF note describing where its arguments live, so an unattached
+ * probe costs the argument moves and nothing else. Without the flag every
+ * probe compiles away entirely.
+ *
+ * Every probe's first argument is the connection's server thread id
+ * (mysql_thread_id), the same number SHOW PROCESSLIST and KILL use:
+ *
+ *   query__send(thread_id, sql_len)         a query (Client#query, #pipeline,
+ *                                           #query_all) is about to be written
+ *   query__first__byte(thread_id, ok)       its first response was read
+ *   result__stored(thread_id, rows)         a result set was buffered
+ *   fetch__batch(thread_id, rows, bytes)    a stream: {size: :auto} cursor
+ *                                           batch was used up
+ *   fetch__done(thread_id, rows, streaming) a pass over a Result's rows ended
+ *   stream__abandon(thread_id)              an abandoned stream is drained
+ *   stream__drained(thread_id)              ...and is done
+ *   result__free__reap(thread_id, count)    deferred result frees ran
+ *   stmt__close__reap(thread_id, count)     deferred statement closes ran
+ *
+ * e.g. bpftrace -e 'usdt:/path/to/mysql2.so:mysql2:query__send { @[arg0] = count(); }'
+ */
+#ifdef MYSQL2_USDT
+#include <sys/sdt.h>
+
+#define MYSQL2_PROBE1(name, a) DTRACE_PROBE1(mysql2, name, a)
+#define MYSQL2_PROBE2(name, a, b) DTRACE_PROBE2(mysql2, name, a, b)
+#define MYSQL2_PROBE3(name, a, b, c) DTRACE_PROBE3(mysql2, name, a, b, c)
+#else
+#define MYSQL2_PROBE1(name, a) do {} while (0)
+#define MYSQL2_PROBE2(name, a, b) do {} while (0)
+#define MYSQL2_PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif
@@ -18,7 +18,8 @@ static rb_encoding *binaryEncoding;
  * connection's encoding) is applied per result at use time, never cached.
  *
  * Concurrent writers can only race to store the same deterministic value in
- * an int slot, which is benign everywhere Ruby's GVL-based threading runs. */
+ * an int slot. That includes Ractors, which run in parallel: a reader sees
+ * either 0 and does the lookup itself, or the value, never a torn one. */
 static int mysql2_enc_index_cache[MYSQL2_CHARSETNR_SIZE];
 
 /* on 64bit platforms we can handle dates way outside 2038-01-19T03:14:07
@@ -59,6 +60,10 @@ static int mysql2_enc_index_cache[MYSQL2_CHARSETNR_SIZE];
   mysql2_result_wrapper *wrapper; \
   TypedData_Get_Struct(self, mysql2_result_wrapper, &rb_mysql_result_type, wrapper);
 
+/* The server thread id USDT probes report a Result under (see probes.h). */
+#define MYSQL2_RESULT_THREAD_ID(wrapper) \
+  ((wrapper)->client_wrapper ? mysql_thread_id((wrapper)->client_wrapper->client) : 0)
+
 /* How much per-cell casting #each performs, parsed from the :cast option:
  * false/nil is MYSQL2_CAST_NONE, :fast is MYSQL2_CAST_FAST, and any other
  * truthy value -- not just true -- is MYSQL2_CAST_ALL, so an unrecognized
@@ -99,10 +104,10 @@ static VALUE opt_decimal_zero, opt_float_zero, opt_time_year, opt_time_month, op
 static VALUE opt_time_anchor_utc;
 static ID intern_new, intern_utc, intern_local, intern_localtime, intern_local_offset,
   intern_civil, intern_new_offset, intern_merge, intern_BigDecimal,
-  intern_query_options, intern_plus;
+  intern_query_options, intern_plus, intern_to_a;
 static VALUE sym_symbolize_keys, sym_as, sym_array, sym_database_timezone,
   sym_application_timezone, sym_local, sym_utc, sym_cast_booleans,
-  sym_cache_rows, sym_cast, sym_fast, sym_stream, sym_name, sym_rows_per_gvl_yield,
+  sym_cache_rows, sym_cast, sym_fast, sym_stream, sym_size, sym_auto, sym_name, sym_rows_per_gvl_yield,
   sym_no_good_index_used, sym_no_index_used, sym_query_was_slow,
   sym_force_encoding;
 
@@ -122,6 +127,105 @@ static void rb_mysql_result_mark(void * wrapper) {
   }
 }
 
+size_t mysql2_result_buffers_memsize(const MYSQL_BIND *binds, my_ulonglong count) {
+  size_t memsize;
+  my_ulonglong i;
+
+  if (binds == NULL) {
+    return 0;
+  }
+  memsize = count * (sizeof(MYSQL_BIND) + 2 * sizeof(my_bool) + sizeof(unsigned long));
+  for (i = 0; i < count; i++) {
+    if (binds[i].buffer) {
+      memsize += binds[i].buffer_length;
+    }
+  }
+  return memsize;
+}
+
+/* See result.h. */
+unsigned int mysql2_lenenc_size(unsigned long long n) {
+  if (n < 251) {
+    return 1;
+  } else if (n < (1ULL << 16)) {
+    return 3;
+  } else if (n < (1ULL << 24)) {
+    return 4;
+  }
+  return 9;
+}
+
+/* See result.h. */
+unsigned long long mysql2_text_row_payload(MYSQL_ROW row, const unsigned long *lengths, unsigned int fields) {
+  unsigned long long payload = 0;
+  unsigned int i;
+
+  for (i = 0; i < fields; i++) {
+    /* NULL is the single byte 0xfb */
+    payload += row[i] ? mysql2_lenenc_size(lengths[i]) + lengths[i] : 1;
+  }
+  return payload;
+}
+
+/* See result.h. */
+unsigned long long mysql2_fields_payload(MYSQL_RES *result) {
+  unsigned int count = mysql_num_fields(result), i;
+  MYSQL_FIELD *fields = mysql_fetch_fields(result);
+  unsigned long long payload = mysql2_lenenc_size(count);
+
+  for (i = 0; i < count; i++) {
+    const MYSQL_FIELD *f = &fields[i];
+
+    payload += mysql2_lenenc_size(f->catalog_length) + f->catalog_length +
+      mysql2_lenenc_size(f->db_length) + f->db_length +
+      mysql2_lenenc_size(f->table_length) + f->table_length +
+      mysql2_lenenc_size(f->org_table_length) + f->org_table_length +
+      mysql2_lenenc_size(f->name_length) + f->name_length +
+      mysql2_lenenc_size(f->org_name_length) + f->org_name_length +
+      /* the 0x0c length of the fixed fields, then charset, length, type,
+       * flags, decimals and two filler bytes */
+      13;
+  }
+  return payload;
+}
+
+/* See result.h. */
+size_t mysql2_buffered_rows_memsize(MYSQL_RES *result, unsigned long long *payload) {
+  my_ulonglong rows = mysql_num_rows(result);
+  unsigned int fields = mysql_num_fields(result);
+  size_t memsize = 0;
+  MYSQL_ROW row;
+  unsigned int i;
+
+  *payload = 0;
+  if (rows == 0) {
+    return 0;
+  }
+  while ((row = mysql_fetch_row(result)) != NULL) {
+    unsigned long *lengths = mysql_fetch_lengths(result);
+
+    for (i = 0; i < fields; i++) {
+      memsize += lengths[i];
+    }
+    *payload += mysql2_text_row_payload(row, lengths, fields);
+  }
+  mysql_data_seek(result, 0);
+
+  return memsize + rows * (sizeof(MYSQL_ROWS) + (fields + 1) * sizeof(char *) + fields);
+}
+
+/* Tells the GC about the client library's copy of the rows going away. A
+ * decrease never starts a collection, so this is safe from a dfree callback
+ * too. */
+static void mysql2_result_release_rows_memsize(mysql2_result_wrapper *wrapper) {
+  if (wrapper->rows_memsize) {
+#ifdef HAVE_RB_GC_ADJUST_MEMORY_USAGE
+    rb_gc_adjust_memory_usage(-(ssize_t)wrapper->rows_memsize);
+#endif
+    wrapper->rows_memsize = 0;
+  }
+}
+
 /* Free the statement result bind buffers so the next fetch (or the next
  * statement execute) allocates and binds fresh ones. Called from
  * rb_mysql_result_free_result and when a fetch needs buffers of the other
@@ -263,6 +367,11 @@ static void rb_mysql_result_free_result(mysql2_result_wrapper * wrapper, int fro
     } else {
       mysql_free_result(wrapper->result);
     }
+    /* Only a streaming result is ever deferred, and the only rows_memsize
+     * one of those has is its spool: plain memory, freed right here. */
+    mysql2_spool_free(wrapper->spool);
+    wrapper->spool = NULL;
+    mysql2_result_release_rows_memsize(wrapper);
     wrapper->resultFreed = 1;
   }
 }
@@ -300,7 +409,9 @@ static void rb_mysql_result_free(void *ptr) {
 
 static size_t rb_mysql_result_memsize(const void * wrapper) {
   const mysql2_result_wrapper * w = wrapper;
-  size_t memsize = sizeof(*w);
+  size_t memsize = sizeof(*w) + w->rows_memsize;
+
+  memsize += mysql2_result_buffers_memsize(w->result_buffers, w->numberOfFields);
   if (w->stmt_wrapper) {
     memsize += sizeof(*w->stmt_wrapper);
   }
@@ -396,6 +507,54 @@ static void *nogvl_stmt_fetch(void *ptr) {
   return (void *)r;
 }
 
+/* stream: {size: :auto} sizing. Each COM_STMT_FETCH batch is steered toward
+ * MYSQL2_STREAM_AUTO_TARGET_BYTES of column data from the average row width
+ * the previous batch measured, moving at most MYSQL2_STREAM_AUTO_MAX_STEP
+ * times per batch so one unrepresentative batch can't swing it to an
+ * extreme. A batch whose fetch stalled past MYSQL2_STREAM_AUTO_SLOW_SECONDS
+ * is halved regardless, bounding how long a single #each step can block on
+ * the wire. */
+#define MYSQL2_STREAM_AUTO_TARGET_BYTES (1024 * 1024)
+#define MYSQL2_STREAM_AUTO_MAX_ROWS 65536
+#define MYSQL2_STREAM_AUTO_MAX_STEP 4.0
+#define MYSQL2_STREAM_AUTO_SLOW_SECONDS 1.0
+
+/* Called only when the rows of the previous batch are used up, i.e. right
+ * before the fetch that sends the next COM_STMT_FETCH. Both client libraries
+ * read the statement's prefetch_rows when building each COM_STMT_FETCH, so
+ * re-setting the attribute between fetches resizes the next batch without
+ * touching the open cursor. */
+static void mysql2_stream_auto_next_batch(mysql2_result_wrapper *wrapper) {
+  unsigned long current = wrapper->stream_prefetch_rows;
+
+  if (wrapper->stream_batch_rows > 0) {
+    double avg_row = (double)wrapper->stream_batch_bytes / wrapper->stream_batch_rows;
+    MYSQL2_PROBE3(fetch__batch, MYSQL2_RESULT_THREAD_ID(wrapper), wrapper->stream_batch_rows, wrapper->stream_batch_bytes);
+    double ideal = avg_row > 0 ? MYSQL2_STREAM_AUTO_TARGET_BYTES / avg_row : MYSQL2_STREAM_AUTO_MAX_ROWS;
+    unsigned long next;
+
+    if (ideal > current * MYSQL2_STREAM_AUTO_MAX_STEP) ideal = current * MYSQL2_STREAM_AUTO_MAX_STEP;
+    if (ideal < current / MYSQL2_STREAM_AUTO_MAX_STEP) ideal = current / MYSQL2_STREAM_AUTO_MAX_STEP;
+    if (wrapper->stream_batch_time > MYSQL2_STREAM_AUTO_SLOW_SECONDS && ideal > current / 2.0) {
+      ideal = current / 2.0;
+    }
+    if (ideal > MYSQL2_STREAM_AUTO_MAX_ROWS) ideal = MYSQL2_STREAM_AUTO_MAX_ROWS;
+    if (ideal < 1) ideal = 1;
+
+    next = (unsigned long)ideal;
+    /* A refused attribute leaves the cursor on its current size, which is
+     * still correct, just not adapted. */
+    if (next != current && !mysql_stmt_attr_set(wrapper->stmt_wrapper->stmt, STMT_ATTR_PREFETCH_ROWS, &next)) {
+      wrapper->stream_prefetch_rows = next;
+    }
+  }
+
+  wrapper->stream_batch_rows_left = wrapper->stream_prefetch_rows;
+  wrapper->stream_batch_rows = 0;
+  wrapper->stream_batch_bytes = 0;
+  wrapper->stream_batch_time = -1;
+}
+
 static VALUE rb_mysql_result_fetch_field(VALUE self, unsigned int idx, int symbolize_keys) {
   VALUE rb_field;
   GET_RESULT(self);
@@ -1056,6 +1215,50 @@ static VALUE mysql2_float_from_str(const char *str, unsigned long len, VALUE zer
  * wider grows to fit on first encounter and stays grown. */
 #define MYSQL2_INITIAL_BUFFER_LENGTH 128
 
+/* Zero-copy string binds. Under cast: false / :fast, a variable-length
+ * column is bound with no buffer (buffer NULL, buffer_length 0): the fetch
+ * only reports its length, and rb_mysql_result_stmt_string then copies the
+ * value once, straight from the client library's row buffer into a String
+ * allocated at that exact length. A bound buffer cost two copies per cell
+ * (row buffer to bind buffer, bind buffer to String) plus a grow-and-refetch
+ * whenever a value outgrew it -- most of the fetch time for BLOB/TEXT-heavy
+ * results. Every non-empty cell of such a column makes the fetch report
+ * MYSQL_DATA_TRUNCATED; the truncation handling skips these columns. */
+#define MYSQL2_STMT_ZERO_COPY_BIND_P(bind) ((bind)->buffer_type == MYSQL_TYPE_STRING && (bind)->buffer == NULL)
+
+/* The String value of string-bound column i of the row just fetched. */
+static VALUE rb_mysql_result_stmt_string(mysql2_result_wrapper *wrapper, unsigned int i) {
+  const MYSQL_BIND *result_buffer = &wrapper->result_buffers[i];
+  unsigned long len = wrapper->length[i];
+  VALUE str;
+
+  if (!MYSQL2_STMT_ZERO_COPY_BIND_P(result_buffer)) {
+    return rb_str_new(result_buffer->buffer, len);
+  }
+
+  str = rb_str_buf_new(len);
+  if (len > 0) {
+    MYSQL_BIND column;
+    unsigned long column_length = 0;
+    my_bool column_error = 0;
+    my_bool column_is_null = 0;
+
+    memset(&column, 0, sizeof(column));
+    column.buffer_type = MYSQL_TYPE_STRING;
+    column.buffer = RSTRING_PTR(str);
+    column.buffer_length = len;
+    column.length = &column_length;
+    column.error = &column_error;
+    column.is_null = &column_is_null;
+
+    if (mysql_stmt_fetch_column(wrapper->stmt_wrapper->stmt, &column, i, 0)) {
+      rb_raise_mysql2_stmt_error(wrapper->stmt_wrapper);
+    }
+  }
+  rb_str_set_len(str, len);
+  return str;
+}
+
 static void rb_mysql_result_alloc_result_buffers(VALUE self, MYSQL_FIELD *fields, int stringBinds) {
   unsigned int i;
   GET_RESULT(self);
@@ -1084,9 +1287,8 @@ static void rb_mysql_result_alloc_result_buffers(VALUE self, MYSQL_FIELD *fields
        * enough headroom that the conversion never has to round: libmysql
        * limits my_gcvt precision to the bind's buffer_length, so an
        * undersized buffer would silently lose digits rather than report
-       * truncation. Variable-length types keep max_length sizing and the
-       * MYSQL_DATA_TRUNCATED grow-and-refetch backstop, exactly as under
-       * server-type binds. */
+       * truncation. Variable-length types other than BIT get no buffer at
+       * all -- see MYSQL2_STMT_ZERO_COPY_BIND_P. */
       unsigned long len;
       int fixed_width = 1;
 
@@ -1123,17 +1325,24 @@ static void rb_mysql_result_alloc_result_buffers(VALUE self, MYSQL_FIELD *fields
         case MYSQL_TYPE_TIMESTAMP:
           len = 26;  // "2010-04-04 11:44:00.123456"
           break;
-        default:
-          /* Variable-length: fields[i].length is the declared maximum (4GB
-           * for LONGBLOB), so only the fixed-width widening below wants it. */
+        case MYSQL_TYPE_BIT:
+          /* Variable-length, but :fast with :cast_booleans reads BIT(1)'s
+           * byte straight out of the buffer, so it keeps one, sized like
+           * the server-type binds size theirs. */
           len = fields[i].max_length;
           fixed_width = 0;
           break;
+        default:
+          /* Variable-length: zero-copy, read by rb_mysql_result_stmt_string
+           * straight into its String. */
+          len = 0;
+          fixed_width = 0;
+          break;
       }
       if (fields[i].type != MYSQL_TYPE_NULL) {
         if (fixed_width && len < fields[i].length) len = fields[i].length;
         wrapper->result_buffers[i].buffer_type = MYSQL_TYPE_STRING;
-        wrapper->result_buffers[i].buffer = xmalloc(len);
+        wrapper->result_buffers[i].buffer = (fixed_width || fields[i].type == MYSQL_TYPE_BIT) ? xmalloc(len) : NULL;
       } else {
         wrapper->result_buffers[i].buffer_type = MYSQL_TYPE_NULL;
       }
@@ -1292,7 +1501,16 @@ static VALUE rb_mysql_result_fetch_row_stmt(VALUE self, MYSQL_FIELD * fields, co
      * The release is kept as tight as possible around the client-library call
      * because the GVL is required again immediately to build Ruby objects. */
     if (wrapper->is_streaming) {
+      double batch_start = -1;
+      if (wrapper->stream_prefetch_rows && wrapper->stream_batch_rows_left == 0) {
+        mysql2_stream_auto_next_batch(wrapper);
+        batch_start = mysql2_monotonic_now();
+      }
       fetch_result = (uintptr_t)rb_thread_call_without_gvl(nogvl_stmt_fetch, wrapper->stmt_wrapper->stmt, RUBY_UBF_IO, 0);
+      if (batch_start >= 0) {
+        double batch_end = mysql2_monotonic_now();
+        wrapper->stream_batch_time = batch_end >= 0 ? batch_end - batch_start : -1;
+      }
     } else {
       fetch_result = (uintptr_t)nogvl_stmt_fetch(wrapper->stmt_wrapper->stmt);
     }
@@ -1325,21 +1543,23 @@ static VALUE rb_mysql_result_fetch_row_stmt(VALUE self, MYSQL_FIELD * fields, co
          * differs between client libraries. */
         unsigned int j;
 
-        /* Growing can move a buffer, leaving the binds registered in the
-         * statement handle pointing at freed memory, so re-register them
-         * before the next fetch. Cleared before the loop rather than after
-         * it so a mid-loop allocation failure or fetch_column error cannot
-         * leave a stale registration behind for a rescued fetch to write
-         * through. */
-        wrapper->result_buffers_bound = 0;
-
         for (j = 0; j < wrapper->numberOfFields; j++) {
           MYSQL_BIND tail;
           unsigned long filled, tail_length = 0;
           my_bool tail_error = 0;
           my_bool tail_is_null = 0;
 
-          if (!wrapper->error[j]) continue;
+          /* Zero-copy columns always report truncation; they're read by
+           * rb_mysql_result_stmt_string instead. */
+          if (!wrapper->error[j] || MYSQL2_STMT_ZERO_COPY_BIND_P(&wrapper->result_buffers[j])) continue;
+
+          /* Growing can move a buffer, leaving the binds registered in the
+           * statement handle pointing at freed memory, so re-register them
+           * before the next fetch. Cleared before the grow rather than
+           * after the loop so a mid-loop allocation failure or fetch_column
+           * error cannot leave a stale registration behind for a rescued
+           * fetch to write through. */
+          wrapper->result_buffers_bound = 0;
 
           filled = wrapper->result_buffers[j].buffer_length;
           wrapper->result_buffers[j].buffer = xrealloc(wrapper->result_buffers[j].buffer, wrapper->length[j]);
@@ -1361,6 +1581,31 @@ static VALUE rb_mysql_result_fetch_row_stmt(VALUE self, MYSQL_FIELD * fields, co
     }
   }
 
+  /* Measure the row for Client#stats and for stream: {size: :auto} (see
+   * mysql2_stream_auto_next_batch). Fixed-width columns count at their
+   * binary width, close enough to their share of the wire. */
+  {
+    unsigned long long row_bytes = 0;
+
+    for (i = 0; i < wrapper->numberOfFields; i++) {
+      if (!wrapper->is_null[i]) {
+        row_bytes += wrapper->length[i];
+      }
+    }
+    if (wrapper->client_wrapper) {
+      wrapper->client_wrapper->rows_fetched += wrapper->is_streaming;
+      wrapper->client_wrapper->rows_materialized++;
+      wrapper->client_wrapper->materialized_bytes += row_bytes;
+    }
+    if (wrapper->stream_prefetch_rows) {
+      wrapper->stream_batch_bytes += row_bytes;
+      wrapper->stream_batch_rows++;
+      if (wrapper->stream_batch_rows_left > 0) {
+        wrapper->stream_batch_rows_left--;
+      }
+    }
+  }
+
   /* Placed after the fetch above rather than with the wrapper->fields
    * allocation so an empty result set stays untouched, exactly as it was
    * when the (never-entered) cell loop did the materializing. */
@@ -1383,7 +1628,7 @@ static VALUE rb_mysql_result_fetch_row_stmt(VALUE self, MYSQL_FIELD * fields, co
       VALUE val;
 
       if (!wrapper->is_null[i] && fields[i].type != MYSQL_TYPE_NULL) {
-        val = rb_str_new(wrapper->result_buffers[i].buffer, wrapper->length[i]);
+        val = rb_mysql_result_stmt_string(wrapper, i);
         val = mysql2_set_field_string_encoding(val, fields[i], default_internal_enc, conn_enc, wrapper->forced_enc);
       } else {
         val = Qnil;
@@ -1452,7 +1697,7 @@ static VALUE rb_mysql_result_fetch_row_stmt(VALUE self, MYSQL_FIELD * fields, co
           val = mysql2_float_from_str(str, len, opt_float_zero);
           break;
         default:
-          val = rb_str_new(str, len);
+          val = rb_mysql_result_stmt_string(wrapper, i);
           val = mysql2_set_field_string_encoding(val, fields[i], default_internal_enc, conn_enc, wrapper->forced_enc);
           break;
       }
@@ -1663,6 +1908,7 @@ static VALUE rb_mysql_result_fetch_row(VALUE self, MYSQL_FIELD * fields, const r
   unsigned int i = 0;
   unsigned long * fieldLengths;
   void * ptr;
+  int spooled;
   rb_encoding *default_internal_enc;
   rb_encoding *conn_enc;
   GET_RESULT(self);
@@ -1683,8 +1929,14 @@ static VALUE rb_mysql_result_fetch_row(VALUE self, MYSQL_FIELD * fields, const r
    * socket here, so the GVL is released around that call; a buffered one is
    * already in client-library memory, so releasing costs more than the fetch.
    * The release is kept as tight as possible around the client-library call
-   * because the GVL is required again immediately to build Ruby objects. */
-  if (wrapper->is_streaming) {
+   * because the GVL is required again immediately to build Ruby objects.
+   * Spooled rows (result.h) come first, and are plain memory either way. */
+  spooled = wrapper->spool && wrapper->spool_pos < wrapper->spool->rows;
+  if (spooled) {
+    row = mysql2_spool_row(wrapper->spool, wrapper->spool_pos++, &fieldLengths);
+  } else if (wrapper->spool && !wrapper->is_streaming) {
+    row = NULL;
+  } else if (wrapper->is_streaming) {
     row = (MYSQL_ROW)rb_thread_call_without_gvl(nogvl_fetch_row, ptr, RUBY_UBF_IO, 0);
   } else {
     row = mysql_fetch_row(wrapper->result);
@@ -1711,7 +1963,23 @@ static VALUE rb_mysql_result_fetch_row(VALUE self, MYSQL_FIELD * fields, const r
     rowVal = rb_hash_new();
 #endif
   }
-  fieldLengths = mysql_fetch_lengths(wrapper->result);
+  if (!spooled) {
+    fieldLengths = mysql_fetch_lengths(wrapper->result);
+  }
+  if (wrapper->client_wrapper) {
+    unsigned long long row_bytes = 0;
+
+    for (i = 0; i < wrapper->numberOfFields; i++) {
+      row_bytes += fieldLengths[i];
+    }
+    /* A spooled row was counted as it was read. */
+    if (wrapper->is_streaming && !spooled) {
+      wrapper->client_wrapper->rows_fetched++;
+      wrapper->client_wrapper->payload_received += mysql2_text_row_payload(row, fieldLengths, wrapper->numberOfFields);
+    }
+    wrapper->client_wrapper->rows_materialized++;
+    wrapper->client_wrapper->materialized_bytes += row_bytes;
+  }
 
   /* cast: false wants every non-NULL value as a raw String with the right
    * encoding, so the per-cell type dispatch below is pure overhead for it.
@@ -2143,6 +2411,7 @@ static VALUE rb_mysql_result_each_(VALUE self,
 
       rb_mysql_result_cache_metadata_and_free(self);
       wrapper->streamingComplete = 1;
+      MYSQL2_PROBE3(fetch__done, MYSQL2_RESULT_THREAD_ID(wrapper), wrapper->numberOfRows, 1);
 
       // The cursor is exhausted: the connection is free to run another
       // command. This runs from ordinary Ruby-level code (#each), so it's
@@ -2174,6 +2443,7 @@ static VALUE rb_mysql_result_each_(VALUE self,
     } else {
       unsigned long rowsProcessed = 0;
       unsigned long rowsSinceYield = 0;
+      int cast = 0;
       rowsProcessed = RARRAY_LEN(wrapper->rows);
       fields = mysql_fetch_fields(wrapper->result);
 
@@ -2182,7 +2452,16 @@ static VALUE rb_mysql_result_each_(VALUE self,
         if (args->cacheRows && i < rowsProcessed) {
           row = rb_ary_entry(wrapper->rows, i);
         } else {
+          double cast_start = mysql2_monotonic_now();
+
           row = fetch_row_func(self, fields, args);
+          /* Two clock reads a row, against building the row's Ruby objects;
+           * the interval is only counted once the pass is done, as one
+           * sample per result. */
+          if (cast_start >= 0) {
+            wrapper->cast_time += mysql2_monotonic_now() - cast_start;
+          }
+          cast = 1;
 
           /* fetch_row_func is either rb_mysql_result_fetch_row or
            * rb_mysql_result_fetch_row_stmt, which only need to hit the network
@@ -2215,6 +2494,11 @@ static VALUE rb_mysql_result_each_(VALUE self,
           rb_yield(row);
         }
       }
+      if (cast && wrapper->client_wrapper) {
+        mysql2_latency_record(wrapper->client_wrapper, MYSQL2_LATENCY_CAST, 0, wrapper->cast_time);
+      }
+      MYSQL2_PROBE3(fetch__done, MYSQL2_RESULT_THREAD_ID(wrapper), wrapper->numberOfRows, 0);
+      wrapper->cast_time = 0;
       if (wrapper->lastRowProcessed == wrapper->numberOfRows && args->cacheRows) {
         /* we don't need the mysql C dataset around anymore, peace it */
         rb_mysql_result_cache_metadata_and_free(self);
@@ -2227,6 +2511,65 @@ static VALUE rb_mysql_result_each_(VALUE self,
   return wrapper->rows;
 }
 
+/* Parses the per-#each options out of opts (the merged @query_options) into
+ * parsed, leaving its parsed flag alone. Raises for an invalid
+ * :rows_per_gvl_yield. */
+static void rb_mysql_result_parse_each_opts(VALUE opts, mysql2_each_opts_cache *parsed) {
+  VALUE dbTz, appTz, rowsPerGvlYieldOpt, castOpt;
+
+  parsed->symbolizeKeys = RTEST(rb_hash_aref(opts, sym_symbolize_keys));
+  parsed->asArray       = rb_hash_aref(opts, sym_as) == sym_array;
+  parsed->castBool      = RTEST(rb_hash_aref(opts, sym_cast_booleans));
+  parsed->cacheRows     = RTEST(rb_hash_aref(opts, sym_cache_rows));
+
+  /* See mysql2_cast_mode: only the exact symbol :fast selects partial
+   * casting; any other truthy value stays full casting. */
+  castOpt = rb_hash_aref(opts, sym_cast);
+  if (castOpt == sym_fast) {
+    parsed->cast = MYSQL2_CAST_FAST;
+  } else if (RTEST(castOpt)) {
+    parsed->cast = MYSQL2_CAST_ALL;
+  } else {
+    parsed->cast = MYSQL2_CAST_NONE;
+  }
+
+  /* :rows_per_gvl_yield -- 0 disables yielding; nil uses the default. */
+  parsed->rowsPerGvlYield = MYSQL2_ROWS_PER_GVL_YIELD_DEFAULT;
+  rowsPerGvlYieldOpt = rb_hash_aref(opts, sym_rows_per_gvl_yield);
+  if (!NIL_P(rowsPerGvlYieldOpt)) {
+    long requested = NUM2LONG(rowsPerGvlYieldOpt);
+    if (requested < 0) {
+      rb_raise(cMysql2Error, ":rows_per_gvl_yield must not be negative");
+    }
+    parsed->rowsPerGvlYield = (unsigned long)requested;
+  }
+
+  /* The timezone lookups are hoisted from their historical spot below the
+   * freed-result guard so a complete parse exists to cache; the lookups
+   * themselves are side-effect free, and the invalid-:database_timezone
+   * warning is deferred (warnDbTimezone) to its historical point, after
+   * that guard. */
+  dbTz = rb_hash_aref(opts, sym_database_timezone);
+  parsed->warnDbTimezone = 0;
+  if (dbTz == sym_local) {
+    parsed->db_timezone = intern_local;
+  } else if (dbTz == sym_utc) {
+    parsed->db_timezone = intern_utc;
+  } else {
+    parsed->warnDbTimezone = !NIL_P(dbTz);
+    parsed->db_timezone = intern_local;
+  }
+
+  appTz = rb_hash_aref(opts, sym_application_timezone);
+  if (appTz == sym_local) {
+    parsed->app_timezone = intern_local;
+  } else if (appTz == sym_utc) {
+    parsed->app_timezone = intern_utc;
+  } else {
+    parsed->app_timezone = Qnil;
+  }
+}
+
 static VALUE rb_mysql_result_each(int argc, VALUE * argv, VALUE self) {
   result_each_args args;
   VALUE scratch_holder = 0;
@@ -2237,6 +2580,7 @@ static VALUE rb_mysql_result_each(int argc, VALUE * argv, VALUE self) {
   mysql2_cast_mode cast;
   int warnDbTimezone, perEachOpts;
   unsigned long rowsPerGvlYield;
+  mysql2_each_opts_cache parsed;
 
   GET_RESULT(self);
 
@@ -2264,73 +2608,13 @@ static VALUE rb_mysql_result_each(int argc, VALUE * argv, VALUE self) {
      * parse. Warnings are deliberately not part of the cache -- their
      * conditions are recomputed from the cached (pre-forcing) values below,
      * so they fire on every call exactly as an uncached parse would. */
-    symbolizeKeys   = wrapper->each_opts.symbolizeKeys;
-    asArray         = wrapper->each_opts.asArray;
-    castBool        = wrapper->each_opts.castBool;
-    cacheRows       = wrapper->each_opts.cacheRows;
-    cast            = wrapper->each_opts.cast;
-    warnDbTimezone  = wrapper->each_opts.warnDbTimezone;
-    rowsPerGvlYield = wrapper->each_opts.rowsPerGvlYield;
-    db_timezone     = wrapper->each_opts.db_timezone;
-    app_timezone    = wrapper->each_opts.app_timezone;
+    parsed = wrapper->each_opts;
   } else {
-    VALUE dbTz, appTz, rowsPerGvlYieldOpt, castOpt;
     VALUE defaults = rb_ivar_get(self, intern_query_options);
     Check_Type(defaults, T_HASH);
 
     opts = perEachOpts ? rb_funcall(defaults, intern_merge, 1, opts) : defaults;
-
-    symbolizeKeys = RTEST(rb_hash_aref(opts, sym_symbolize_keys));
-    asArray       = rb_hash_aref(opts, sym_as) == sym_array;
-    castBool      = RTEST(rb_hash_aref(opts, sym_cast_booleans));
-    cacheRows     = RTEST(rb_hash_aref(opts, sym_cache_rows));
-
-    /* See mysql2_cast_mode: only the exact symbol :fast selects partial
-     * casting; any other truthy value stays full casting. */
-    castOpt = rb_hash_aref(opts, sym_cast);
-    if (castOpt == sym_fast) {
-      cast = MYSQL2_CAST_FAST;
-    } else if (RTEST(castOpt)) {
-      cast = MYSQL2_CAST_ALL;
-    } else {
-      cast = MYSQL2_CAST_NONE;
-    }
-
-    /* :rows_per_gvl_yield -- 0 disables yielding; nil uses the default. */
-    rowsPerGvlYield = MYSQL2_ROWS_PER_GVL_YIELD_DEFAULT;
-    rowsPerGvlYieldOpt = rb_hash_aref(opts, sym_rows_per_gvl_yield);
-    if (!NIL_P(rowsPerGvlYieldOpt)) {
-      long requested = NUM2LONG(rowsPerGvlYieldOpt);
-      if (requested < 0) {
-        rb_raise(cMysql2Error, ":rows_per_gvl_yield must not be negative");
-      }
-      rowsPerGvlYield = (unsigned long)requested;
-    }
-
-    /* The timezone lookups are hoisted from their historical spot below the
-     * freed-result guard so a complete parse exists to cache; the lookups
-     * themselves are side-effect free, and the invalid-:database_timezone
-     * warning is deferred (warnDbTimezone) to its historical point, after
-     * that guard. */
-    dbTz = rb_hash_aref(opts, sym_database_timezone);
-    warnDbTimezone = 0;
-    if (dbTz == sym_local) {
-      db_timezone = intern_local;
-    } else if (dbTz == sym_utc) {
-      db_timezone = intern_utc;
-    } else {
-      warnDbTimezone = !NIL_P(dbTz);
-      db_timezone = intern_local;
-    }
-
-    appTz = rb_hash_aref(opts, sym_application_timezone);
-    if (appTz == sym_local) {
-      app_timezone = intern_local;
-    } else if (appTz == sym_utc) {
-      app_timezone = intern_utc;
-    } else {
-      app_timezone = Qnil;
-    }
+    rb_mysql_result_parse_each_opts(opts, &parsed);
 
     if (!perEachOpts) {
       /* Nothing above raised, so this parse of @query_options is complete
@@ -2338,18 +2622,19 @@ static VALUE rb_mysql_result_each(int argc, VALUE * argv, VALUE self) {
        * :rows_per_gvl_yield raises before this point, leaving the cache
        * unset so the next call re-parses and re-raises just as an uncached
        * one would. */
-      wrapper->each_opts.symbolizeKeys   = symbolizeKeys;
-      wrapper->each_opts.asArray         = asArray;
-      wrapper->each_opts.castBool        = castBool;
-      wrapper->each_opts.cacheRows       = cacheRows;
-      wrapper->each_opts.cast            = cast;
-      wrapper->each_opts.warnDbTimezone  = warnDbTimezone;
-      wrapper->each_opts.rowsPerGvlYield = rowsPerGvlYield;
-      wrapper->each_opts.db_timezone     = db_timezone;
-      wrapper->each_opts.app_timezone    = app_timezone;
-      wrapper->each_opts.parsed          = 1;
+      wrapper->each_opts = parsed;
+      wrapper->each_opts.parsed = 1;
     }
   }
+  symbolizeKeys   = parsed.symbolizeKeys;
+  asArray         = parsed.asArray;
+  castBool        = parsed.castBool;
+  cacheRows       = parsed.cacheRows;
+  cast            = parsed.cast;
+  warnDbTimezone  = parsed.warnDbTimezone;
+  rowsPerGvlYield = parsed.rowsPerGvlYield;
+  db_timezone     = parsed.db_timezone;
+  app_timezone    = parsed.app_timezone;
 
   if (wrapper->is_streaming && cacheRows) {
     rb_warn(":cache_rows is ignored if :stream is true");
@@ -2360,6 +2645,13 @@ static VALUE rb_mysql_result_each(int argc, VALUE * argv, VALUE self) {
     cacheRows = 1;
   }
 
+  /* A spilled result is replayed from its mapped file on every pass rather
+   * than from the rows array: keeping every row as Ruby objects too is what
+   * :spill is there to avoid. */
+  if (wrapper->spool && wrapper->spool->spilled) {
+    cacheRows = 0;
+  }
+
   /* A freed result can only be re-iterated from the fully cached rows array
    * (or raise the streaming-specific error below when a completed stream is
    * re-iterated); anything else would dereference the freed MYSQL_RES. The
@@ -2380,7 +2672,11 @@ static VALUE rb_mysql_result_each(int argc, VALUE * argv, VALUE self) {
   }
 
   if (wrapper->rows == Qnil && !wrapper->is_streaming) {
-    wrapper->numberOfRows = wrapper->stmt_wrapper ? mysql_stmt_num_rows(wrapper->stmt_wrapper->stmt) : mysql_num_rows(wrapper->result);
+    if (wrapper->spool) {
+      wrapper->numberOfRows = wrapper->spool->rows;
+    } else {
+      wrapper->numberOfRows = wrapper->stmt_wrapper ? mysql_stmt_num_rows(wrapper->stmt_wrapper->stmt) : mysql_num_rows(wrapper->result);
+    }
     /* Only reserve room for every row when the rows will actually be kept.
      * With cache_rows: false nothing is ever stored in this array, so the
      * reservation is dead weight proportional to the result size. */
@@ -2389,7 +2685,11 @@ static VALUE rb_mysql_result_each(int argc, VALUE * argv, VALUE self) {
     if (wrapper->resultFreed) {
       rb_raise(cMysql2Error, "Result set has already been freed");
     }
-    mysql_data_seek(wrapper->result, 0);
+    if (wrapper->spool) {
+      wrapper->spool_pos = 0;
+    } else {
+      mysql_data_seek(wrapper->result, 0);
+    }
     wrapper->lastRowProcessed = 0;
     wrapper->rows = rb_ary_new();
   }
@@ -2433,6 +2733,99 @@ static VALUE rb_mysql_result_each(int argc, VALUE * argv, VALUE self) {
   return rows;
 }
 
+struct result_aref_args {
+  VALUE self;
+  mysql2_result_wrapper *wrapper;
+  unsigned long index;
+  unsigned long saved_pos;
+  result_each_args *each_args;
+};
+
+static VALUE do_result_aref(VALUE argsval) {
+  struct result_aref_args *args = (void *)argsval;
+
+  args->wrapper->spool_pos = args->index;
+  return rb_mysql_result_fetch_row(args->self, mysql_fetch_fields(args->wrapper->result), args->each_args);
+}
+
+/* Puts #each's place in the spool back, however the row build ended. */
+static VALUE result_aref_restore_pos(VALUE argsval) {
+  struct result_aref_args *args = (void *)argsval;
+
+  args->wrapper->spool_pos = args->saved_pos;
+  return Qnil;
+}
+
+/* call-seq:
+ *    result[index] # => row or nil
+ *
+ * The row at +index+ (negative counts from the end), built under the
+ * result's query options. A result queried with +:spill+ reads just that
+ * row back from its mapped file, without touching the others or caching
+ * anything; a buffered result whose rows are all cached indexes them
+ * directly; any other buffered result is <tt>to_a[index]</tt>. A streaming
+ * result has no random access and raises Mysql2::Error, as a second #each
+ * over it does.
+ */
+static VALUE rb_mysql_result_aref(VALUE self, VALUE index) {
+  struct result_aref_args args;
+  result_each_args each_args;
+  VALUE scratch_holder = 0;
+  VALUE row;
+  long i;
+  GET_RESULT(self);
+
+  if (wrapper->is_streaming) {
+    rb_raise(cMysql2Error, "Result#[] can't index a streaming result; iterate it with #each instead.");
+  }
+  if (wrapper->rows != Qnil && wrapper->lastRowProcessed == wrapper->numberOfRows &&
+      (my_ulonglong)RARRAY_LEN(wrapper->rows) == wrapper->numberOfRows) {
+    return rb_ary_entry(wrapper->rows, NUM2LONG(index));
+  }
+  if (!wrapper->spool || !wrapper->spool->spilled || wrapper->resultFreed) {
+    return rb_ary_entry(rb_funcall(self, intern_to_a, 0), NUM2LONG(index));
+  }
+
+  i = NUM2LONG(index);
+  if (i < 0) {
+    i += (long)wrapper->spool->rows;
+  }
+  if (i < 0 || (unsigned long)i >= wrapper->spool->rows) {
+    return Qnil;
+  }
+
+  if (!wrapper->each_opts.parsed) {
+    VALUE defaults = rb_ivar_get(self, intern_query_options);
+    Check_Type(defaults, T_HASH);
+    rb_mysql_result_parse_each_opts(defaults, &wrapper->each_opts);
+    wrapper->each_opts.parsed = 1;
+  }
+  each_args.symbolizeKeys = wrapper->each_opts.symbolizeKeys;
+  each_args.asArray = wrapper->each_opts.asArray;
+  each_args.castBool = wrapper->each_opts.castBool;
+  each_args.cacheRows = 0;
+  each_args.rowsPerGvlYield = wrapper->each_opts.rowsPerGvlYield;
+  each_args.cast = wrapper->each_opts.cast;
+  each_args.db_timezone = wrapper->each_opts.db_timezone;
+  each_args.app_timezone = wrapper->each_opts.app_timezone;
+  each_args.block_given = 0;
+  each_args.default_internal_enc = rb_default_internal_encoding();
+  each_args.rowScratch = NULL;
+  if (each_args.asArray) {
+    each_args.rowScratch = ALLOCV_N(VALUE, scratch_holder, mysql_num_fields(wrapper->result));
+  }
+
+  args.self = self;
+  args.wrapper = wrapper;
+  args.index = (unsigned long)i;
+  args.saved_pos = wrapper->spool_pos;
+  args.each_args = &each_args;
+  row = rb_ensure(do_result_aref, (VALUE)&args, result_aref_restore_pos, (VALUE)&args);
+  ALLOCV_END(scratch_holder);
+
+  return row;
+}
+
 /* call-seq:
  *    result.server_flags # => Hash
  *
@@ -2493,7 +2886,9 @@ static VALUE rb_mysql_result_count(VALUE self) {
     return LONG2NUM(RARRAY_LEN(wrapper->rows));
   } else {
     /* MySQL returns an unsigned 64-bit long here */
-    if (wrapper->stmt_wrapper) {
+    if (wrapper->spool) {
+      return ULONG2NUM(wrapper->spool->rows);
+    } else if (wrapper->stmt_wrapper) {
       return ULL2NUM(mysql_stmt_num_rows(wrapper->stmt_wrapper->stmt));
     } else {
       return ULL2NUM(mysql_num_rows(wrapper->result));
@@ -2524,7 +2919,8 @@ static VALUE rb_mysql_result_query_time(VALUE self) {
 }
 
 /* Mysql2::Result */
-VALUE rb_mysql_result_to_obj(VALUE client, VALUE encoding, VALUE options, MYSQL_RES *r, VALUE statement, double query_time) {
+static VALUE mysql2_result_new(VALUE client, VALUE encoding, VALUE options, MYSQL_RES *r, mysql2_row_spool *spool, size_t rows_memsize,
+                               VALUE statement, double query_time) {
   VALUE obj;
   mysql2_result_wrapper * wrapper;
 
@@ -2561,6 +2957,7 @@ VALUE rb_mysql_result_to_obj(VALUE client, VALUE encoding, VALUE options, MYSQL_
    * lifecycle rules in client.c/statement.c. */
   wrapper->server_status = wrapper->client_wrapper->client->server_status;
   wrapper->query_time = query_time;
+  wrapper->cast_time = 0;
   wrapper->result_buffers = NULL;
   wrapper->result_buffers_bound = 0;
   wrapper->is_null = NULL;
@@ -2628,7 +3025,7 @@ VALUE rb_mysql_result_to_obj(VALUE client, VALUE encoding, VALUE options, MYSQL_
 
   /* Options that cannot be changed in results.each(...) { |row| }
    * should be processed here. */
-  /* Both streaming spellings: stream: true, and stream: {size: N} (already
+  /* Both streaming spellings: stream: true, and stream: {size: N | :auto} (already
    * validated at the execute entry point; only Statement#execute lets the
    * hash form through). Any other value -- including other truthy ones --
    * means the query ran buffered, so this test must match the execute-side
@@ -2636,6 +3033,41 @@ VALUE rb_mysql_result_to_obj(VALUE client, VALUE encoding, VALUE options, MYSQL_
   {
     VALUE stream = rb_hash_aref(options, sym_stream);
     wrapper->is_streaming = (stream == Qtrue || RB_TYPE_P(stream, T_HASH)) ? 1 : 0;
+
+    /* stream: {size: :auto}: the cursor was opened with
+     * MYSQL2_STREAM_AUTO_INITIAL_ROWS, and the first fetch opens the first
+     * batch. */
+    wrapper->stream_prefetch_rows = 0;
+    wrapper->stream_batch_rows_left = 0;
+    wrapper->stream_batch_rows = 0;
+    wrapper->stream_batch_bytes = 0;
+    wrapper->stream_batch_time = -1;
+    if (wrapper->stmt_wrapper && RB_TYPE_P(stream, T_HASH) && rb_hash_aref(stream, sym_size) == sym_auto) {
+      wrapper->stream_prefetch_rows = MYSQL2_STREAM_AUTO_INITIAL_ROWS;
+    }
+  }
+
+  /* The buffered rows live in client-library malloc memory the GC can't
+   * see; without this a loop over big reports grows RSS long before
+   * anything prompts a collection that would free the Results holding
+   * them. A statement's rows are stored in the MYSQL_STMT, in a binary
+   * layout with no public way to measure, so only plain queries count. */
+  wrapper->spool = spool;
+  wrapper->spool_pos = 0;
+  wrapper->rows_memsize = 0;
+  if (spool) {
+    wrapper->rows_memsize = mysql2_spool_memsize(spool);
+#ifdef HAVE_RB_GC_ADJUST_MEMORY_USAGE
+    rb_gc_adjust_memory_usage((ssize_t)wrapper->rows_memsize);
+#endif
+  } else if (rows_memsize) {
+    wrapper->rows_memsize = rows_memsize;
+#ifdef HAVE_RB_GC_ADJUST_MEMORY_USAGE
+    rb_gc_adjust_memory_usage((ssize_t)wrapper->rows_memsize);
+#endif
+  }
+  if (wrapper->client_wrapper) {
+    wrapper->client_wrapper->buffered_bytes += wrapper->rows_memsize;
   }
 
   /* :force_encoding was canonicalized to an Encoding object at the
@@ -2650,6 +3082,18 @@ VALUE rb_mysql_result_to_obj(VALUE client, VALUE encoding, VALUE options, MYSQL_
   return obj;
 }
 
+VALUE rb_mysql_result_to_obj(VALUE client, VALUE encoding, VALUE options, MYSQL_RES *r, VALUE statement, double query_time) {
+  return mysql2_result_new(client, encoding, options, r, NULL, 0, statement, query_time);
+}
+
+VALUE rb_mysql_result_stored_to_obj(VALUE client, VALUE encoding, VALUE options, MYSQL_RES *r, size_t rows_memsize, double query_time) {
+  return mysql2_result_new(client, encoding, options, r, NULL, rows_memsize, Qnil, query_time);
+}
+
+VALUE rb_mysql_result_spooled_to_obj(VALUE client, VALUE encoding, VALUE options, MYSQL_RES *r, mysql2_row_spool *spool, double query_time) {
+  return mysql2_result_new(client, encoding, options, r, spool, 0, Qnil, query_time);
+}
+
 void init_mysql2_result(void) {
   cDate = rb_const_get(rb_cObject, rb_intern("Date"));
   rb_global_variable(&cDate);
@@ -2667,6 +3111,7 @@ void init_mysql2_result(void) {
   rb_define_method(cMysql2Result, "field_types", rb_mysql_result_fetch_field_types, 0);
   rb_define_method(cMysql2Result, "free", rb_mysql_result_free_, 0);
   rb_define_method(cMysql2Result, "count", rb_mysql_result_count, 0);
+  rb_define_method(cMysql2Result, "[]", rb_mysql_result_aref, 1);
   rb_define_method(cMysql2Result, "server_flags", rb_mysql_result_server_flags, 0);
   rb_define_method(cMysql2Result, "query_time", rb_mysql_result_query_time, 0);
   rb_define_alias(cMysql2Result, "size", "count");
@@ -2675,6 +3120,7 @@ void init_mysql2_result(void) {
   intern_utc          = rb_intern("utc");
   intern_local        = rb_intern("local");
   intern_merge        = rb_intern("merge");
+  intern_to_a         = rb_intern("to_a");
   intern_localtime    = rb_intern("localtime");
   intern_local_offset = rb_intern("local_offset");
   intern_civil        = rb_intern("civil");
@@ -2696,13 +3142,17 @@ void init_mysql2_result(void) {
   sym_cast           = ID2SYM(rb_intern("cast"));
   sym_fast           = ID2SYM(rb_intern("fast"));
   sym_stream         = ID2SYM(rb_intern("stream"));
+  sym_size           = ID2SYM(rb_intern("size"));
+  sym_auto           = ID2SYM(rb_intern("auto"));
   sym_name           = ID2SYM(rb_intern("name"));
   sym_no_good_index_used = ID2SYM(rb_intern("no_good_index_used"));
   sym_no_index_used      = ID2SYM(rb_intern("no_index_used"));
   sym_query_was_slow     = ID2SYM(rb_intern("query_was_slow"));
   sym_force_encoding = ID2SYM(rb_intern("force_encoding"));
 
-  opt_decimal_zero = rb_str_new2("0.0");
+  /* Frozen, like everything these globals hold, so that every Ractor can
+   * use them (see Init_mysql2). */
+  opt_decimal_zero = rb_obj_freeze(rb_str_new2("0.0"));
   rb_global_variable(&opt_decimal_zero); /*never GC */
   opt_float_zero = rb_float_new((double)0);
   rb_global_variable(&opt_float_zero);
@@ -2715,6 +3165,7 @@ void init_mysql2_result(void) {
    * rebuilt per call there. */
   opt_time_anchor_utc = rb_funcall(rb_cTime, intern_utc, 7, opt_time_year, opt_time_month, opt_time_day,
                                    INT2FIX(0), INT2FIX(0), INT2FIX(0), INT2FIX(0));
+  rb_obj_freeze(opt_time_anchor_utc);
   rb_global_variable(&opt_time_anchor_utc); /* never GC */
 
   binaryEncoding = rb_enc_find("binary");
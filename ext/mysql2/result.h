@@ -5,6 +5,33 @@ void init_mysql2_result(void);
 /* query_time is the round trip that produced this result in seconds
  * (Result#query_time); pass a negative value when no reading applies. */
 VALUE rb_mysql_result_to_obj(VALUE client, VALUE encoding, VALUE options, MYSQL_RES *r, VALUE statement, double query_time);
+/* The same for a mysql_store_result() result of a plain query, whose rows
+ * the client library holds rows_memsize bytes for (see
+ * mysql2_buffered_rows_memsize); the Result reports them to the GC as
+ * external memory until it frees them. */
+VALUE rb_mysql_result_stored_to_obj(VALUE client, VALUE encoding, VALUE options, MYSQL_RES *r, size_t rows_memsize, double query_time);
+/* The same for a mysql_use_result() result whose leading rows were read into
+ * spool (see spool.h), which the Result takes ownership of: its rows are
+ * yielded first, then -- when options say stream: true -- the rest from r.
+ * Without :stream, r must already be exhausted and the Result behaves as a
+ * buffered one. */
+VALUE rb_mysql_result_spooled_to_obj(VALUE client, VALUE encoding, VALUE options, MYSQL_RES *r, mysql2_row_spool *spool, double query_time);
+
+/* What mysql_store_result allocated for result's rows: per row, a
+ * MYSQL_ROWS, the column pointer array, and each value plus its NUL. It
+ * walks every row, leaving the row cursor at the start, and touches nothing
+ * Ruby, so callers measure from inside the GVL-free store call rather than
+ * holding the GVL for a second pass over a large result. The same walk sums
+ * the rows' packet payloads (mysql2_text_row_payload) into *payload. */
+size_t mysql2_buffered_rows_memsize(MYSQL_RES *result, unsigned long long *payload);
+
+/* Client#stats' bytes_received, rebuilt from what the client library kept:
+ * the payload of the text-protocol row packet that carried row, and of
+ * result's column count and column definition packets. Neither touches Ruby. */
+unsigned long long mysql2_text_row_payload(MYSQL_ROW row, const unsigned long *lengths, unsigned int fields);
+unsigned long long mysql2_fields_payload(MYSQL_RES *result);
+/* Bytes of the protocol's length-encoded integer for n. */
+unsigned int mysql2_lenenc_size(unsigned long long n);
 
 /* Resolve a :force_encoding query option (an Encoding object or an encoding
  * name) to its Encoding object, in place in the given options hash, raising
@@ -18,6 +45,11 @@ VALUE rb_mysql_result_to_obj(VALUE client, VALUE encoding, VALUE options, MYSQL_
  * Result from later mutation of the value the caller passed. */
 void mysql2_canonicalize_force_encoding(VALUE opts);
 
+/* The prefetch a Statement#execute(stream: {size: :auto}) cursor opens
+ * with; rb_mysql_result_fetch_row_stmt resizes it from there, one
+ * COM_STMT_FETCH batch at a time. */
+#define MYSQL2_STREAM_AUTO_INITIAL_ROWS 64
+
 /* Force-free a Result's underlying MYSQL_RES/MYSQL_STMT result right now,
  * from ordinary Ruby-level code (not a dfree callback) -- so this performs
  * the real mysql_free_result()/mysql_stmt_free_result() call directly
@@ -26,6 +58,11 @@ void mysql2_canonicalize_force_encoding(VALUE opts);
  * see mysql2_abandon_active_stream in client.c. No-op if already freed. */
 void mysql2_result_force_free(VALUE self);
 
+/* Bytes held by count statement result binds: the MYSQL_BIND array, its
+ * is_null/error/length arrays, and every allocated buffer. For the
+ * ObjectSpace.memsize_of of Results and Statements. */
+size_t mysql2_result_buffers_memsize(const MYSQL_BIND *binds, my_ulonglong count);
+
 /* Parsed form of the stored @query_options hash, filled in by the first
  * argument-less #each and reused by later argument-less calls so they skip
  * the per-call hash lookups. Plain C scalars and static symbol IDs only --
@@ -78,6 +115,20 @@ typedef struct {
    * negative when no reading applies (e.g. Client#store_result results).
    * Exposed as #query_time. */
   double query_time;
+  /* Seconds spent building rows from the buffered result in the current
+   * pass over it, counted into the client's :cast latency when the pass
+   * finishes (see Client#latency_histogram). */
+  double cast_time;
+  /* What the client library holds for a buffered, plain-query result's
+   * rows, measured when they were stored and reported to the GC as
+   * external memory until the rows are freed; 0 for any other result. */
+  size_t rows_memsize;
+  /* Rows read ahead of the Result by a :max_result_rows/:max_result_bytes
+   * or :spill query (see spool.h), NULL for any other. They stand in for
+   * the stored rows of a buffered result, and come before the live cursor's
+   * of a streaming one; spool_pos is the next to fetch. */
+  mysql2_row_spool *spool;
+  unsigned long spool_pos;
   my_ulonglong numberOfFields;
   my_ulonglong numberOfRows;
   unsigned long lastRowProcessed;
@@ -113,6 +164,17 @@ typedef struct {
    * built so the statement cache can refuse to reuse the array for an
    * execute with a different :symbolize_keys. */
   int fields_symbolized;
+  /* stream: {size: :auto} cursor state. stream_prefetch_rows is the
+   * STMT_ATTR_PREFETCH_ROWS the cursor currently runs with, 0 when the
+   * Result isn't adaptive. The batch counters measure the COM_STMT_FETCH
+   * batch being consumed: rows still buffered client-side before the next
+   * fetch goes to the wire, rows and column bytes seen so far, and how long
+   * the fetch that opened the batch took (-1 if unmeasured). */
+  unsigned long stream_prefetch_rows;
+  unsigned long stream_batch_rows_left;
+  unsigned long stream_batch_rows;
+  unsigned long long stream_batch_bytes;
+  double stream_batch_time;
   mysql2_each_opts_cache each_opts;
 } mysql2_result_wrapper;
 
@@ -0,0 +1,204 @@
+#include <mysql2_ext.h>
+
+#include <errno.h>
+#include <string.h>
+#ifndef _WIN32
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+/* See spool.h. */
+mysql2_row_spool *mysql2_spool_new(unsigned int fields, const char *spill_dir) {
+  mysql2_row_spool *spool = calloc(1, sizeof(mysql2_row_spool));
+
+  if (!spool) return NULL;
+  spool->fd = -1;
+  spool->fields = fields;
+  spool->cells = calloc(fields + 1, sizeof(char *));
+  spool->lengths = calloc(fields + 1, sizeof(unsigned long));
+  if (!spool->cells || !spool->lengths) {
+    mysql2_spool_free(spool);
+    return NULL;
+  }
+
+  if (spill_dir) {
+#ifndef _WIN32
+    static const char name[] = "/mysql2-spill-XXXXXX";
+    size_t dir_len = strlen(spill_dir);
+    char *path = malloc(dir_len + sizeof(name));
+
+    if (!path) {
+      mysql2_spool_free(spool);
+      return NULL;
+    }
+    memcpy(path, spill_dir, dir_len);
+    memcpy(path + dir_len, name, sizeof(name));
+    spool->fd = mkstemp(path);
+    if (spool->fd >= 0) {
+      /* Nothing else ever opens it: the space goes back to the filesystem
+       * when the descriptor (or, later, the mapping) goes, however the
+       * process ends. */
+      unlink(path);
+    }
+    free(path);
+    if (spool->fd < 0) {
+      int err = errno;
+      mysql2_spool_free(spool);
+      errno = err;
+      return NULL;
+    }
+#else
+    mysql2_spool_free(spool);
+    errno = ENOSYS;
+    return NULL;
+#endif
+  }
+  return spool;
+}
+
+/* Grow *buf to hold at least need elements of size, doubling. */
+static int mysql2_spool_reserve(void **buf, size_t *capa, size_t need, size_t size) {
+  size_t new_capa = *capa ? *capa : 64;
+  void *grown;
+
+  if (need <= *capa) return 0;
+  while (new_capa < need) {
+    new_capa *= 2;
+  }
+  grown = realloc(*buf, new_capa * size);
+  if (!grown) return -1;
+  *buf = grown;
+  *capa = new_capa;
+  return 0;
+}
+
+#ifndef _WIN32
+/* Writes the buffered rows out to the temp file and empties the buffer. */
+static int mysql2_spool_flush(mysql2_row_spool *spool) {
+  size_t done = 0;
+
+  while (done < spool->len) {
+    ssize_t n = write(spool->fd, spool->data + done, spool->len - done);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    done += n;
+  }
+  spool->flushed += spool->len;
+  spool->len = 0;
+  return 0;
+}
+#endif
+
+int mysql2_spool_push(mysql2_row_spool *spool, MYSQL_ROW row, const unsigned long *lengths) {
+  size_t need = spool->len, rows_capa = spool->rows_capa, pos;
+  unsigned long long bytes = 0;
+  unsigned int i;
+
+  for (i = 0; i < spool->fields; i++) {
+    need += sizeof(unsigned long) + (row[i] ? lengths[i] + 1 : 0);
+  }
+  if (mysql2_spool_reserve((void **)&spool->data, &spool->capa, need, 1) ||
+      mysql2_spool_reserve((void **)&spool->row_offsets, &rows_capa, spool->rows + 1, sizeof(size_t))) {
+    errno = ENOMEM;
+    return -1;
+  }
+  spool->rows_capa = rows_capa;
+
+  pos = spool->len;
+  for (i = 0; i < spool->fields; i++) {
+    unsigned long len = row[i] ? lengths[i] : MYSQL2_SPOOL_NULL;
+
+    memcpy(spool->data + pos, &len, sizeof(len));
+    pos += sizeof(len);
+    if (row[i]) {
+      memcpy(spool->data + pos, row[i], lengths[i]);
+      pos += lengths[i];
+      spool->data[pos++] = '\0';
+      bytes += lengths[i];
+    }
+  }
+  spool->row_offsets[spool->rows++] = spool->flushed + spool->len;
+  spool->len = pos;
+  spool->bytes += bytes;
+
+#ifndef _WIN32
+  if (spool->fd >= 0 && spool->len >= MYSQL2_SPOOL_WRITE_BUFFER) {
+    return mysql2_spool_flush(spool);
+  }
+#endif
+  return 0;
+}
+
+int mysql2_spool_finish(mysql2_row_spool *spool) {
+#ifndef _WIN32
+  void *map = NULL;
+
+  if (spool->fd < 0) return 0;
+  if (mysql2_spool_flush(spool)) return -1;
+  if (spool->flushed) {
+    map = mmap(NULL, spool->flushed, PROT_READ, MAP_PRIVATE, spool->fd, 0);
+    if (map == MAP_FAILED) return -1;
+  }
+  close(spool->fd);
+  spool->fd = -1;
+  free(spool->data);
+  spool->data = map;
+  spool->len = spool->flushed;
+  spool->capa = 0;
+  spool->spilled = 1;
+#endif
+  return 0;
+}
+
+MYSQL_ROW mysql2_spool_row(mysql2_row_spool *spool, unsigned long index, unsigned long **lengths) {
+  size_t pos = spool->row_offsets[index];
+  unsigned int i;
+
+  for (i = 0; i < spool->fields; i++) {
+    unsigned long len;
+
+    memcpy(&len, spool->data + pos, sizeof(len));
+    pos += sizeof(len);
+    if (len == MYSQL2_SPOOL_NULL) {
+      spool->cells[i] = NULL;
+      spool->lengths[i] = 0;
+    } else {
+      spool->cells[i] = spool->data + pos;
+      spool->lengths[i] = len;
+      pos += len + 1;
+    }
+  }
+  *lengths = spool->lengths;
+  return spool->cells;
+}
+
+size_t mysql2_spool_memsize(const mysql2_row_spool *spool) {
+  if (!spool) return 0;
+  return sizeof(*spool) + spool->capa + spool->rows_capa * sizeof(size_t) +
+         (spool->fields + 1) * (sizeof(char *) + sizeof(unsigned long));
+}
+
+void mysql2_spool_free(mysql2_row_spool *spool) {
+  if (!spool) return;
+#ifndef _WIN32
+  if (spool->spilled) {
+    if (spool->data) {
+      munmap(spool->data, spool->len);
+    }
+  } else {
+    free(spool->data);
+  }
+  if (spool->fd >= 0) {
+    close(spool->fd);
+  }
+#else
+  free(spool->data);
+#endif
+  free(spool->row_offsets);
+  free(spool->cells);
+  free(spool->lengths);
+  free(spool);
+}
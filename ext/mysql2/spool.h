@@ -0,0 +1,64 @@
+#ifndef MYSQL2_SPOOL_H
+#define MYSQL2_SPOOL_H
+
+/* A client-side copy of a mysql_use_result() result set's rows, read off the
+ * wire by Client#query when a :max_result_rows/:max_result_bytes budget or
+ * :spill is set (see mysql2_fetch_spooled_result_set in client.c).
+ * mysql_store_result would buffer the whole result before anyone could look
+ * at its size; the spool is filled a row at a time, so the budget is
+ * checked as it grows.
+ *
+ * Rows are kept back to back in one buffer, each cell as its length
+ * (MYSQL2_SPOOL_NULL for SQL NULL) followed by its bytes and a NUL, the same
+ * layout mysql_fetch_row hands out, so the row-building code in result.c
+ * reads a spooled row exactly as it reads a stored one.
+ *
+ * A spilled spool writes that buffer out to an unlinked temp file whenever
+ * it passes MYSQL2_SPOOL_WRITE_BUFFER bytes, and mysql2_spool_finish maps
+ * the whole file back read-only: the rows then cost page cache the kernel
+ * can evict, not heap, and only the per-row offsets stay resident.
+ *
+ * Filled without the GVL, so everything here uses plain malloc(), never
+ * Ruby's xmalloc(), and reports failure through errno instead of raising. */
+#define MYSQL2_SPOOL_NULL ((unsigned long)-1)
+#define MYSQL2_SPOOL_WRITE_BUFFER (256 * 1024)
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t capa;
+  /* The temp file of a spool made with a spill_dir, -1 otherwise or once
+   * it is mapped; flushed is how much of the rows is already in it. */
+  int fd;
+  size_t flushed;
+  /* data is the mapped file (len bytes), not a malloc()ed buffer. */
+  int spilled;
+  /* Offset of each row's first cell, counted from the first row. */
+  size_t *row_offsets;
+  unsigned long rows;
+  unsigned long rows_capa;
+  unsigned int fields;
+  /* Sum of the cell lengths pushed so far: what the budget counts. */
+  unsigned long long bytes;
+  /* The row mysql2_spool_row last decoded; pointers into data. */
+  MYSQL_ROW cells;
+  unsigned long *lengths;
+} mysql2_row_spool;
+
+/* A spool kept in memory, or with spill_dir, one spilled to a temp file
+ * there. NULL on failure. */
+mysql2_row_spool *mysql2_spool_new(unsigned int fields, const char *spill_dir);
+/* Appends a copy of row; -1 on failure, leaving the rows pushed before it
+ * intact. */
+int mysql2_spool_push(mysql2_row_spool *spool, MYSQL_ROW row, const unsigned long *lengths);
+/* Done pushing: maps a spilled spool's file. -1 on failure. */
+int mysql2_spool_finish(mysql2_row_spool *spool);
+/* Row index (< spool->rows) of a finished spool, with its lengths in
+ * *lengths. Both stay valid until the next call or until the spool is
+ * freed. */
+MYSQL_ROW mysql2_spool_row(mysql2_row_spool *spool, unsigned long index, unsigned long **lengths);
+/* Bytes the spool holds, for ObjectSpace.memsize_of and the GC. */
+size_t mysql2_spool_memsize(const mysql2_row_spool *spool);
+void mysql2_spool_free(mysql2_row_spool *spool);
+
+#endif
@@ -0,0 +1,80 @@
+#include <mysql2_ext.h>
+
+/* See sql_scan.h. */
+const char *mysql2_sql_skip_literal(const char *p, const char *end, rb_encoding *enc) {
+  char c = *p;
+  int len = rb_enc_mbclen(p, end, enc);
+
+  if (len > 1) {
+    /* A multibyte character is never a quote, comment or placeholder:
+     * step over it whole, trailing bytes and all. */
+    return p + len;
+  }
+
+  if (c == '\'' || c == '"' || c == '`') {
+    p++;
+    while (p < end) {
+      len = rb_enc_mbclen(p, end, enc);
+      if (len > 1) {
+        p += len;
+      } else if (*p == '\\' && c != '`' && p + 1 < end) {
+        /* The escaped character may itself be multibyte. */
+        p++;
+        p += rb_enc_mbclen(p, end, enc);
+      } else if (*p == c) {
+        /* A doubled quote is an escaped quote inside the literal. */
+        if (p + 1 < end && p[1] == c) {
+          p += 2;
+        } else {
+          return p + 1;
+        }
+      } else {
+        p++;
+      }
+    }
+    return NULL;
+  } else if (c == '#' || (c == '-' && p + 2 < end && p[1] == '-' && (p[2] == ' ' || p[2] == '\t' || p[2] == '\n' || p[2] == '\r'))) {
+    while (p < end && *p != '\n') p++;
+    return p;
+  } else if (c == '/' && p + 1 < end && p[1] == '*') {
+    p += 2;
+    while (p + 1 < end && !(p[0] == '*' && p[1] == '/')) p++;
+    return p + 1 < end ? p + 2 : NULL;
+  }
+
+  return p;
+}
+
+/* See sql_scan.h. */
+int mysql2_sql_is_single_statement(const char *p, const char *end, rb_encoding *enc) {
+  while (p < end) {
+    const char *next = mysql2_sql_skip_literal(p, end, enc);
+
+    if (!next || (next == p && *p == ';')) {
+      return 0;
+    }
+    p = next == p ? p + 1 : next;
+  }
+
+  return 1;
+}
+
+/* See sql_scan.h. */
+int mysql2_sql_starts_with_keyword(const char *p, const char *end, rb_encoding *enc, const char *keyword) {
+  long len = (long)strlen(keyword);
+
+  while (p < end) {
+    const char *next = mysql2_sql_skip_literal(p, end, enc);
+
+    if (ISSPACE(*p)) {
+      p++;
+    } else if (next && next != p && (*p == '#' || *p == '-' || *p == '/')) {
+      p = next;
+    } else {
+      break;
+    }
+  }
+
+  return end - p >= len && STRNCASECMP(p, keyword, len) == 0 &&
+    (end - p == len || !(ISALNUM(p[len]) || p[len] == '_' || p[len] == '$'));
+}
@@ -0,0 +1,33 @@
+#ifndef MYSQL2_SQL_SCAN_H
+#define MYSQL2_SQL_SCAN_H
+
+/* The one SQL scanner every client-side look into a query goes through:
+ * Client#query's ? interpolation and Client#pipeline's statement check in
+ * client.c, and Statement's :name rewriting in statement.c. It recognizes
+ * quoted strings and identifiers ('...', "...", `...`, backslash and
+ * doubled-quote escapes) and comments (#..., -- ..., / * ... * /), so a
+ * placeholder or ; inside one is never taken for the real thing.
+ *
+ * The SQL is walked a character at a time in enc, the encoding it was
+ * exported to, as the server's lexer walks it: in SJIS, GBK and Big5 the
+ * trailing byte of a two-byte character can be 0x5C or 0x60, and taking
+ * it for a backslash or backtick would put the scan out of step with the
+ * server's about where a literal ends. */
+
+/* If p starts a quoted string or identifier or a comment, returns the first
+ * byte past it; if it starts a multibyte character, the first byte past
+ * that; otherwise p itself. NULL for a quote or block comment still open at
+ * end. */
+const char *mysql2_sql_skip_literal(const char *p, const char *end, rb_encoding *enc);
+
+/* Whether sql can stand as one statement of a multi-statement batch: no
+ * top-level ; and no quote or block comment left open to swallow the
+ * separator Client#pipeline appends after it. A trailing -- or # comment is
+ * fine: the separator starts with a newline. */
+int mysql2_sql_is_single_statement(const char *p, const char *end, rb_encoding *enc);
+
+/* Whether the first word of sql, past leading whitespace and comments, is
+ * keyword (upper case, matched case-insensitively). */
+int mysql2_sql_starts_with_keyword(const char *p, const char *end, rb_encoding *enc, const char *keyword);
+
+#endif
@@ -1,12 +1,15 @@
 #include <mysql2_ext.h>
 
 #include <string.h>
+#ifdef MYSQL2_NONBLOCKING_STMT_EXECUTE
+#include "wait_for_single_fd.h"
+#endif
 
 extern VALUE mMysql2, cMysql2Error;
 static VALUE cMysql2Statement, cBigDecimal, cDateTime, cDate;
-static VALUE sym_stream, sym_size, intern_new_with_args, intern_each, intern_to_s, intern_merge_bang;
+static VALUE sym_stream, sym_size, sym_auto, sym_async, intern_new_with_args, intern_each, intern_to_s, intern_merge_bang, intern_read, intern_Pathname, intern_keys;
 static VALUE intern_sec_fraction, intern_usec, intern_sec, intern_min, intern_hour, intern_day, intern_month, intern_year,
-  intern_query_options, intern_mul, intern_truncate;
+  intern_query_options, intern_current_query_options, intern_mul, intern_truncate;
 
 #ifndef NEW_TYPEDDATA_WRAPPER
 #define TypedData_Get_Struct(obj, type, ignore, sval) Data_Get_Struct(obj, type, sval)
@@ -27,6 +30,7 @@ static void rb_mysql_stmt_mark(void * ptr) {
 
   rb_gc_mark_movable(stmt_wrapper->client);
   rb_gc_mark_movable(stmt_wrapper->cached_fields);
+  rb_gc_mark_movable(stmt_wrapper->param_names);
 }
 
 static void rb_mysql_stmt_free(void *ptr) {
@@ -36,7 +40,12 @@ static void rb_mysql_stmt_free(void *ptr) {
 
 static size_t rb_mysql_stmt_memsize(const void * ptr) {
   const mysql_stmt_wrapper *stmt_wrapper = ptr;
-  return sizeof(*stmt_wrapper);
+  size_t memsize = sizeof(*stmt_wrapper);
+
+  if (stmt_wrapper->cached_field_meta) {
+    memsize += stmt_wrapper->cached_field_count * sizeof(*stmt_wrapper->cached_field_meta);
+  }
+  return memsize + mysql2_result_buffers_memsize(stmt_wrapper->cached_result_buffers, stmt_wrapper->cached_field_count);
 }
 
 #ifdef HAVE_RB_GC_MARK_MOVABLE
@@ -46,6 +55,7 @@ static void rb_mysql_stmt_compact(void * ptr) {
 
   rb_mysql2_gc_location(stmt_wrapper->client);
   rb_mysql2_gc_location(stmt_wrapper->cached_fields);
+  rb_mysql2_gc_location(stmt_wrapper->param_names);
 }
 #endif
 
@@ -180,7 +190,15 @@ void decr_mysql2_stmt(mysql_stmt_wrapper *stmt_wrapper) {
      * If the GC got to the Client first, client_wrapper is NULL and there
      * is nothing left to notify -- the connection (and every prepared
      * statement on it, server-side) is already gone.
+     *
+     * An async execute nobody collected leaves the connection QUERYING,
+     * its response unread, and only this statement's #async_result could
+     * have finished it. Drop the connection rather than leave the Client
+     * claimed forever; invalidate_socket is plain syscalls, fine here.
      */
+    if (stmt_wrapper->async_pending && stmt_wrapper->client_wrapper) {
+      mysql2_invalidate_after_interrupted_query(stmt_wrapper->client_wrapper);
+    }
     if (stmt_wrapper->client_wrapper && stmt_wrapper->stmt) {
       mysql2_enqueue_pending_stmt_close(stmt_wrapper->client_wrapper, stmt_wrapper->stmt,
                                          (uintptr_t)stmt_wrapper);
@@ -239,6 +257,84 @@ static void *nogvl_prepare_statement(void *ptr) {
   }
 }
 
+#define MYSQL2_IDENT_START_P(c) (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') || (c) == '_')
+#define MYSQL2_IDENT_CHAR_P(c) (MYSQL2_IDENT_START_P(c) || ((c) >= '0' && (c) <= '9'))
+
+/* Rewrite :name placeholders in sql to ?, for the server, which only knows
+ * positional ones. Quoted strings and identifiers and comments (see
+ * sql_scan.h) are copied through untouched, as is MySQL's := assignment
+ * operator. Returns sql itself when it has no named placeholders, leaving
+ * *names_out Qnil; otherwise the rewritten String, with *names_out set to
+ * the per-slot name Array and *distinct_out to the number of distinct
+ * names. Mixing :name and ? placeholders is an ArgumentError: there would
+ * be no way to say which Hash value fills a ?. */
+static VALUE mysql2_stmt_rewrite_named_params(VALUE sql, VALUE *names_out, unsigned long *distinct_out) {
+  const char *p = RSTRING_PTR(sql);
+  const char *end = p + RSTRING_LEN(sql);
+  const char *copied = p;
+  rb_encoding *enc = rb_enc_get(sql);
+  VALUE rewritten = Qnil, names = Qnil, seen = Qnil;
+  long positional = 0;
+
+  *names_out = Qnil;
+  *distinct_out = 0;
+
+  while (p < end) {
+    const char *next = mysql2_sql_skip_literal(p, end, enc);
+    char c = *p;
+
+    if (!next) {
+      break;
+    } else if (next != p) {
+      p = next;
+    } else if (c == '?') {
+      positional++;
+      p++;
+    } else if (c == ':' && p + 1 < end && MYSQL2_IDENT_START_P(p[1]) &&
+               (p == RSTRING_PTR(sql) || p[-1] != ':')) {
+      const char *name = p + 1;
+      const char *name_end = name;
+      VALUE sym;
+
+      while (name_end < end && MYSQL2_IDENT_CHAR_P(*name_end)) name_end++;
+
+      if (NIL_P(rewritten)) {
+        rewritten = rb_str_buf_new(RSTRING_LEN(sql));
+        rb_enc_associate(rewritten, rb_enc_get(sql));
+        names = rb_ary_new();
+        seen = rb_hash_new();
+      }
+      rb_str_buf_cat(rewritten, copied, p - copied);
+      rb_str_buf_cat(rewritten, "?", 1);
+      copied = name_end;
+
+      sym = ID2SYM(rb_intern2(name, name_end - name));
+      rb_ary_push(names, sym);
+      if (!RTEST(rb_hash_lookup(seen, sym))) {
+        rb_hash_aset(seen, sym, Qtrue);
+        (*distinct_out)++;
+      }
+      p = name_end;
+    } else {
+      p++;
+    }
+  }
+
+  if (NIL_P(rewritten)) {
+    return sql;
+  }
+  if (positional > 0) {
+    rb_raise(rb_eArgError, "Cannot mix named (:%"PRIsVALUE") and positional (?) placeholders in one statement",
+             rb_sym2str(rb_ary_entry(names, 0)));
+  }
+
+  if (copied < end) {
+    rb_str_buf_cat(rewritten, copied, end - copied);
+  }
+  *names_out = rb_obj_freeze(names);
+  return rewritten;
+}
+
 VALUE rb_mysql_stmt_new(VALUE rb_client, VALUE sql) {
   mysql_stmt_wrapper *stmt_wrapper;
   VALUE rb_stmt;
@@ -265,6 +361,12 @@ VALUE rb_mysql_stmt_new(VALUE rb_client, VALUE sql) {
     stmt_wrapper->cached_error = NULL;
     stmt_wrapper->cached_length = NULL;
     stmt_wrapper->cached_result_buffers_string_binds = 0;
+    stmt_wrapper->async_pending = 0;
+    stmt_wrapper->async_status = 0;
+    stmt_wrapper->async_ret = 0;
+    stmt_wrapper->query_start = 0;
+    stmt_wrapper->param_names = Qnil;
+    stmt_wrapper->named_param_count = 0;
 
     /* Keep a handle to the Client to ensure it doesn't get garbage collected first */
     stmt_wrapper->client = rb_client;
@@ -301,9 +403,12 @@ VALUE rb_mysql_stmt_new(VALUE rb_client, VALUE sql) {
     args.stmt = stmt_wrapper->stmt;
     // ensure the string is in the encoding the connection is expecting
     args.sql = rb_str_export_to_enc(sql, conn_enc);
+    args.sql = mysql2_stmt_rewrite_named_params(args.sql, &stmt_wrapper->param_names, &stmt_wrapper->named_param_count);
     args.sql_ptr = RSTRING_PTR(args.sql);
     args.sql_len = RSTRING_LEN(args.sql);
 
+    /* COM_STMT_PREPARE: the command byte, then the statement text */
+    mysql2_net_count_command(stmt_wrapper->client_wrapper, 1 + (unsigned long long)args.sql_len);
     if ((VALUE)rb_thread_call_without_gvl(nogvl_prepare_statement, &args, RUBY_UBF_IO, 0) == Qfalse) {
       rb_raise_mysql2_stmt_error(stmt_wrapper);
     }
@@ -361,6 +466,167 @@ static void *nogvl_stmt_execute(void *ptr) {
   return (void*)(rv == 0 ? Qtrue : Qfalse);
 }
 
+/* Bytes requested from an IO parameter per #read call, and so the most any
+ * one COM_STMT_SEND_LONG_DATA packet carries: small enough that a
+ * multi-megabyte upload never has more than one chunk resident, and well
+ * under the smallest max_allowed_packet a server can be configured with. */
+#define MYSQL2_LONG_DATA_CHUNK_SIZE (64 * 1024)
+
+struct nogvl_send_long_data_args {
+  MYSQL_STMT *stmt;
+  unsigned int param_number;
+  const char *data;
+  unsigned long length;
+};
+
+static void *nogvl_send_long_data(void *ptr) {
+  struct nogvl_send_long_data_args *args = ptr;
+  int rv = mysql_stmt_send_long_data(args->stmt, args->param_number, args->data, args->length);
+
+  return (void*)(rv == 0 ? Qtrue : Qfalse);
+}
+
+static void *nogvl_stmt_reset(void *ptr) {
+  MYSQL_STMT *stmt = ptr;
+  mysql_stmt_reset(stmt);
+  return NULL;
+}
+
+/* Whether a bind parameter should be streamed: anything with #read, except
+ * a Pathname, whose #read re-reads the file from the start on every call
+ * and so would never reach EOF. Pathname stays a TypeError, as before. */
+static int mysql2_io_like_p(VALUE value) {
+  if (!rb_respond_to(value, intern_read)) return 0;
+
+  if (rb_const_defined(rb_cObject, intern_Pathname)) {
+    VALUE cPathname = rb_const_get(rb_cObject, intern_Pathname);
+    if (RB_TYPE_P(cPathname, T_CLASS) && rb_obj_is_kind_of(value, cPathname)) return 0;
+  }
+
+  return 1;
+}
+
+struct stream_long_data_args {
+  mysql_stmt_wrapper *stmt_wrapper;
+  MYSQL_BIND *bind_buffers;
+  unsigned long bind_count;
+  VALUE *argv;
+};
+
+/* Feed every IO parameter to the server with mysql_stmt_send_long_data, one
+ * #read chunk at a time. Reading happens with the GVL held, since it calls
+ * back into Ruby; each chunk is then written with the GVL released, so the
+ * only copy of the value ever resident is the chunk in flight. Chunks go out
+ * as raw bytes, with no conversion to the connection encoding: a multibyte
+ * character can straddle two chunks, and the server reassembles them before
+ * interpreting the value anyway.
+ *
+ * Runs under rb_protect in rb_mysql_stmt_execute; a failed send raises here
+ * so both failure modes unwind through the same cleanup. */
+static VALUE stream_long_data(VALUE argsval) {
+  struct stream_long_data_args *args = (struct stream_long_data_args *)argsval;
+  struct nogvl_send_long_data_args send_args;
+  unsigned long i;
+
+  send_args.stmt = args->stmt_wrapper->stmt;
+
+  for (i = 0; i < args->bind_count; i++) {
+    int sent_any = 0;
+
+    if (args->bind_buffers[i].buffer_type != MYSQL_TYPE_LONG_BLOB) continue;
+
+    send_args.param_number = (unsigned int)i;
+
+    for (;;) {
+      VALUE chunk = rb_funcall(args->argv[i], intern_read, 1, INT2FIX(MYSQL2_LONG_DATA_CHUNK_SIZE));
+      int eof = NIL_P(chunk);
+
+      if (!eof) {
+        StringValue(chunk);
+        eof = RSTRING_LEN(chunk) == 0;
+      }
+
+      if (eof) {
+        /* An IO already at EOF is sent as one empty chunk, so the value
+         * is an empty string rather than whatever the library makes of a
+         * bind with no buffer. */
+        if (sent_any) break;
+        send_args.data = "";
+        send_args.length = 0;
+      } else {
+        send_args.data = RSTRING_PTR(chunk);
+        send_args.length = RSTRING_LEN(chunk);
+      }
+
+      /* COM_STMT_SEND_LONG_DATA: the command byte, statement id and
+       * parameter number, then the chunk; the server doesn't answer it */
+      mysql2_net_count_command(args->stmt_wrapper->client_wrapper, 1 + 4 + 2 + (unsigned long long)send_args.length);
+      if ((VALUE)rb_thread_call_without_gvl(nogvl_send_long_data, &send_args, RUBY_UBF_IO, 0) == Qfalse) {
+        rb_raise_mysql2_stmt_error(args->stmt_wrapper);
+      }
+      RB_GC_GUARD(chunk);
+
+      if (eof) break;
+      sent_any = 1;
+    }
+  }
+
+  return Qnil;
+}
+
+/* The COM_STMT_EXECUTE payload mysql_stmt_execute builds from binds, for
+ * Client#stats: the command byte, statement id, flags and iteration count,
+ * then with any parameters the NULL bitmap, the new-params-bound flag, two
+ * type bytes each and the values -- length-encoded strings, or the binary
+ * width of the rest (temporals at their longest). IO parameters went ahead
+ * as COM_STMT_SEND_LONG_DATA and carry nothing here. */
+static unsigned long long mysql2_stmt_execute_payload(const MYSQL_BIND *binds, unsigned long count) {
+  unsigned long long payload = 1 + 4 + 1 + 4;
+  unsigned long i;
+
+  if (count == 0) {
+    return payload;
+  }
+  payload += (count + 7) / 8 + 1 + 2 * (unsigned long long)count;
+  for (i = 0; i < count; i++) {
+    switch (binds[i].buffer_type) {
+      case MYSQL_TYPE_NULL:
+        break;
+      case MYSQL_TYPE_TINY:
+        payload += 1;
+        break;
+      case MYSQL_TYPE_SHORT:
+        payload += 2;
+        break;
+      case MYSQL_TYPE_LONG:
+      case MYSQL_TYPE_FLOAT:
+        payload += 4;
+        break;
+      case MYSQL_TYPE_LONGLONG:
+      case MYSQL_TYPE_DOUBLE:
+        payload += 8;
+        break;
+      case MYSQL_TYPE_DATE:
+        payload += 1 + 4;
+        break;
+      case MYSQL_TYPE_DATETIME:
+      case MYSQL_TYPE_TIMESTAMP:
+        payload += 1 + 11;
+        break;
+      case MYSQL_TYPE_TIME:
+        payload += 1 + 12;
+        break;
+      default:
+        if (binds[i].buffer) {
+          unsigned long length = binds[i].length ? *binds[i].length : binds[i].buffer_length;
+          payload += mysql2_lenenc_size(length) + length;
+        }
+        break;
+    }
+  }
+  return payload;
+}
+
 static void set_buffer_for_string(MYSQL_BIND* bind_buffer, unsigned long *length_buffer, VALUE string) {
   unsigned long length;
 
@@ -432,6 +698,180 @@ overflow:
   return 1;
 }
 
+/* Build the positional argument list for a named statement from its Hash
+ * of parameters, in slot order. Keys may be Symbols or Strings. Every name
+ * must be present, and a key naming no placeholder is an ArgumentError
+ * rather than being silently ignored -- it is almost always a typo. */
+static VALUE mysql2_stmt_map_named_params(mysql_stmt_wrapper *stmt_wrapper, VALUE params) {
+  long slots = RARRAY_LEN(stmt_wrapper->param_names);
+  VALUE args = rb_ary_new_capa(slots);
+  long i;
+
+  for (i = 0; i < slots; i++) {
+    VALUE name = rb_ary_entry(stmt_wrapper->param_names, i);
+    VALUE value = rb_hash_lookup2(params, name, Qundef);
+    if (value == Qundef) {
+      value = rb_hash_lookup2(params, rb_sym2str(name), Qundef);
+    }
+    if (value == Qundef) {
+      rb_raise(rb_eArgError, "missing value for named parameter :%"PRIsVALUE, rb_sym2str(name));
+    }
+    rb_ary_push(args, value);
+  }
+
+  if (RHASH_SIZE(params) != stmt_wrapper->named_param_count) {
+    VALUE keys = rb_funcall(params, intern_keys, 0);
+    for (i = 0; i < RARRAY_LEN(keys); i++) {
+      VALUE key = rb_ary_entry(keys, i);
+      VALUE sym = RB_TYPE_P(key, T_STRING) ? rb_str_intern(key) : key;
+      if (!RTEST(rb_ary_includes(stmt_wrapper->param_names, sym))) {
+        rb_raise(rb_eArgError, "unknown named parameter %"PRIsVALUE, rb_inspect(key));
+      }
+    }
+    rb_raise(rb_eArgError, "named parameters given more than once (as both Symbol and String keys)");
+  }
+
+  return args;
+}
+
+/* Everything after the execute's first response has been read: result
+ * metadata, buffering (or opening the stream), and the Result itself.
+ * Shared by the blocking execute and the nonblocking one, which may finish
+ * in a later Statement#async_result call. Expects the connection QUERYING. */
+static VALUE mysql2_stmt_execute_finish(VALUE self, VALUE current, int is_streaming, double query_elapsed) {
+  MYSQL_RES *metadata;
+  VALUE resultObj;
+  GET_STATEMENT(self);
+  GET_CLIENT(stmt_wrapper->client);
+
+  metadata = mysql_stmt_result_metadata(stmt_wrapper->stmt);
+  if (metadata == NULL) {
+    wrapper->state = MYSQL2_CLIENT_IDLE;
+    if (mysql_stmt_errno(stmt_wrapper->stmt) != 0) {
+      // either CR_OUT_OF_MEMORY or CR_UNKNOWN_ERROR. both fatal.
+      wrapper->active_fiber = Qnil;
+      rb_raise_mysql2_stmt_error(stmt_wrapper);
+    }
+    // no data and no error, so query was not a SELECT
+    mysql2_reap_pending_result_frees(wrapper);
+    mysql2_reap_pending_stmt_closes(wrapper);
+    return Qnil;
+  }
+
+  if (!is_streaming) {
+    double store_start = mysql2_monotonic_now();
+
+    // receive the whole result set from the server
+    if (mysql_stmt_store_result(stmt_wrapper->stmt)) {
+      mysql_free_result(metadata);
+      wrapper->state = MYSQL2_CLIENT_IDLE;
+      rb_raise_mysql2_stmt_error(stmt_wrapper);
+    }
+    mysql2_latency_record(wrapper, MYSQL2_LATENCY_STORE, store_start, mysql2_monotonic_now());
+    wrapper->rows_fetched += mysql_stmt_num_rows(stmt_wrapper->stmt);
+    MYSQL2_PROBE2(result__stored, mysql_thread_id(wrapper->client), mysql_stmt_num_rows(stmt_wrapper->stmt));
+    wrapper->active_fiber = Qnil;
+    // The whole result set is buffered locally; free to reap and to run
+    // another command right away.
+    wrapper->state = MYSQL2_CLIENT_IDLE;
+    mysql2_reap_pending_result_frees(wrapper);
+    mysql2_reap_pending_stmt_closes(wrapper);
+  } else {
+    // A cursor is now open on the server; leave the connection BUSY until
+    // the Result finishes (or abandons) streaming rows -- see result.c.
+    wrapper->state = MYSQL2_CLIENT_STREAMING;
+  }
+
+  /* The metadata was read fresh above -- reading it is cheap and it goes
+   * stale under ALTER TABLE -- and only the artifacts derived from it are
+   * cached. On a match the field-name array and result buffers from the
+   * previous execute remain compatible and rb_mysql_result_to_obj below
+   * adopts them; on a miss they are dropped and rebuilt from scratch. */
+  mysql2_stmt_validate_metadata_cache(stmt_wrapper, metadata);
+
+  resultObj = rb_mysql_result_to_obj(stmt_wrapper->client, wrapper->encoding, current, metadata, self, query_elapsed);
+
+  /* Track the open cursor so a later command can force-drain it if it's
+   * abandoned instead of exhausted -- see mysql2_abandon_active_stream. */
+  if (is_streaming) {
+    wrapper->active_streaming_result = resultObj;
+  }
+
+  if (!is_streaming) {
+    // cache all result
+    rb_funcall(resultObj, intern_each, 0);
+  }
+
+  return resultObj;
+}
+
+#ifdef MYSQL2_NONBLOCKING_STMT_EXECUTE
+struct stmt_execute_wait_args {
+  mysql_stmt_wrapper *stmt_wrapper;
+  double query_end;
+  int completed;
+};
+
+/* Drives a suspended mysql_stmt_execute_start to completion: waits on the
+ * socket for whatever the connector suspended on -- through Ruby, so a
+ * Fiber scheduler gets to run other fibers meanwhile -- then resumes it
+ * with the events that fired. _cont never blocks, so it runs with the GVL
+ * held. */
+static VALUE stmt_execute_wait(VALUE argsval) {
+  struct stmt_execute_wait_args *args = (void *)argsval;
+  mysql_stmt_wrapper *stmt_wrapper = args->stmt_wrapper;
+  MYSQL *mysql = stmt_wrapper->client_wrapper->client;
+
+  while (stmt_wrapper->async_status != 0) {
+    int ready_status = mysql2_wait_for_async_status(stmt_wrapper->client, mysql, stmt_wrapper->async_status, 0);
+    stmt_wrapper->async_status = mysql_stmt_execute_cont(&stmt_wrapper->async_ret, stmt_wrapper->stmt, ready_status);
+  }
+
+  args->query_end = mysql2_monotonic_now();
+  args->completed = 1;
+  return Qnil;
+}
+
+/* rb_ensure companion: an interrupt (Thread#raise, Timeout.timeout, a
+ * read_timeout) while suspended leaves the connector mid-exchange, with its
+ * async context still active, so the connection can't be trusted again. */
+static VALUE stmt_execute_wait_ensure(VALUE argsval) {
+  struct stmt_execute_wait_args *args = (void *)argsval;
+
+  args->stmt_wrapper->async_pending = 0;
+  if (!args->completed) {
+    mysql2_invalidate_after_interrupted_query(args->stmt_wrapper->client_wrapper);
+  }
+
+  return Qnil;
+}
+
+/* Waits out a started nonblocking execute and finishes it. */
+static VALUE mysql2_stmt_execute_complete(VALUE self, VALUE current) {
+  struct stmt_execute_wait_args args;
+  double query_elapsed;
+  GET_STATEMENT(self);
+  GET_CLIENT(stmt_wrapper->client);
+
+  args.stmt_wrapper = stmt_wrapper;
+  args.query_end = 0;
+  args.completed = 0;
+  rb_ensure(stmt_execute_wait, (VALUE)&args, stmt_execute_wait_ensure, (VALUE)&args);
+
+  query_elapsed = (stmt_wrapper->query_start < 0 || args.query_end < 0)
+    ? -1 : args.query_end - stmt_wrapper->query_start;
+  mysql2_latency_record(wrapper, MYSQL2_LATENCY_SERVER, stmt_wrapper->query_start, args.query_end);
+
+  wrapper->active_fiber = Qnil;
+  if (stmt_wrapper->async_ret != 0) {
+    wrapper->state = MYSQL2_CLIENT_IDLE;
+    rb_raise_mysql2_stmt_error(stmt_wrapper);
+  }
+
+  return mysql2_stmt_execute_finish(self, current, RTEST(rb_hash_aref(current, sym_stream)), query_elapsed);
+}
+#endif
+
 /* call-seq: stmt.execute
  *
  * Executes the current prepared statement, returns +result+.
@@ -442,15 +882,16 @@ static VALUE rb_mysql_stmt_execute(int argc, VALUE *argv, VALUE self) {
   unsigned long bind_count;
   unsigned long i;
   MYSQL_STMT *stmt;
-  MYSQL_RES *metadata;
   VALUE opts;
   VALUE current;
-  VALUE resultObj;
   VALUE *params_enc = NULL;
   int is_streaming;
+  int is_async;
   struct nogvl_stmt_execute_args execute_args;
   double query_start, query_elapsed;
   unsigned long prefetch_rows = 1;
+  int has_long_data = 0;
+  VALUE named_args = Qnil;
   rb_encoding *conn_enc;
 
   GET_STATEMENT(self);
@@ -460,6 +901,12 @@ static VALUE rb_mysql_stmt_execute(int argc, VALUE *argv, VALUE self) {
     mysql2_warn_forked_without_reconnect(wrapper, "execute a statement");
   }
 
+  // An async query or execute is still waiting for its #async_result: its
+  // response is next on the wire, so nothing else may be sent yet.
+  if (wrapper->state == MYSQL2_CLIENT_QUERYING) {
+    rb_raise(cMysql2Error, "This connection is still waiting for a result, try again once you have the result");
+  }
+
   /* We're about to issue a new command on this connection: a safe point to
    * close out any statements that were GC'd while it was last busy, and to
    * free any abandoned result sets left over from a stream that was
@@ -481,7 +928,23 @@ static VALUE rb_mysql_stmt_execute(int argc, VALUE *argv, VALUE self) {
   // Use a local scope to avoid leaking the temporary count variable
   {
     int c = rb_scan_args(argc, argv, "*:", NULL, &opts);
-    if (c != (long)bind_count) {
+    if (stmt_wrapper->param_names != Qnil) {
+      VALUE params;
+      // A named statement takes its parameters as one Hash, either
+      // positionally, leaving room for options after it, or as the keyword
+      // arguments themselves when no options are given.
+      if (c == 1 && RB_TYPE_P(argv[0], T_HASH)) {
+        params = argv[0];
+      } else if (c == 0 && !NIL_P(opts)) {
+        params = opts;
+        opts = Qnil;
+      } else {
+        rb_raise(rb_eArgError, "Statement has named parameters, pass them as a Hash");
+      }
+      named_args = mysql2_stmt_map_named_params(stmt_wrapper, params);
+      argv = (VALUE *)RARRAY_CONST_PTR(named_args);
+      argc = (int)bind_count;
+    } else if (c != (long)bind_count) {
       rb_raise(cMysql2Error, "Bind parameter count (%ld) doesn't match number of arguments (%d)", bind_count, c);
     }
   }
@@ -504,36 +967,57 @@ static VALUE rb_mysql_stmt_execute(int argc, VALUE *argv, VALUE self) {
 
   mysql2_canonicalize_force_encoding(current);
 
-  // :stream comes in two shapes: true streams with the default prefetch of
-  // one row per COM_STMT_FETCH round trip, and {size: N} streams fetching N
-  // rows per round trip (STMT_ATTR_PREFETCH_ROWS below). The hash form is
-  // validated here, before any bind buffer is allocated and before anything
-  // is written to the wire, under the same no-raise-downstream rules as
-  // :force_encoding above. It admits exactly one key so that a future
-  // sizing key can be added without a silently-ignored spelling existing
-  // today.
+  // :stream comes in three shapes: true streams with the default prefetch of
+  // one row per COM_STMT_FETCH round trip, {size: N} streams fetching N
+  // rows per round trip (STMT_ATTR_PREFETCH_ROWS below), and {size: :auto}
+  // starts at MYSQL2_STREAM_AUTO_INITIAL_ROWS and lets
+  // rb_mysql_result_fetch_row_stmt resize each batch toward a byte target.
+  // The hash form is validated here, before any bind buffer is allocated
+  // and before anything is written to the wire, under the same
+  // no-raise-downstream rules as :force_encoding above. It admits exactly
+  // one key so that a misspelled key raises rather than being ignored.
   {
     VALUE stream = rb_hash_aref(current, sym_stream);
     if (RB_TYPE_P(stream, T_HASH)) {
       VALUE size = rb_hash_aref(stream, sym_size);
       long size_l;
       if (NIL_P(size) || RHASH_SIZE(stream) != 1) {
-        rb_raise(rb_eArgError, "stream: hash accepts only {size: Integer}");
+        rb_raise(rb_eArgError, "stream: hash accepts only {size: Integer} or {size: :auto}");
       }
-      if (!RB_TYPE_P(size, T_FIXNUM) && !RB_TYPE_P(size, T_BIGNUM)) {
-        rb_raise(rb_eTypeError, "stream: {size: } must be an Integer");
+      if (size == sym_auto) {
+        prefetch_rows = MYSQL2_STREAM_AUTO_INITIAL_ROWS;
+      } else {
+        if (!RB_TYPE_P(size, T_FIXNUM) && !RB_TYPE_P(size, T_BIGNUM)) {
+          rb_raise(rb_eTypeError, "stream: {size: } must be an Integer or :auto");
+        }
+        size_l = NUM2LONG(size);
+        if (size_l <= 0) {
+          rb_raise(rb_eArgError, "stream: {size: } must be positive (got %ld)", size_l);
+        }
+        prefetch_rows = (unsigned long)size_l;
       }
-      size_l = NUM2LONG(size);
-      if (size_l <= 0) {
-        rb_raise(rb_eArgError, "stream: {size: } must be positive (got %ld)", size_l);
-      }
-      prefetch_rows = (unsigned long)size_l;
       is_streaming = 1;
     } else {
       is_streaming = (Qtrue == stream);
     }
   }
 
+  // :async is only honored when passed to this execute itself: a client-wide
+  // async default predates it and has only ever applied to Client#query.
+  is_async = !NIL_P(opts) && Qtrue == rb_hash_aref(opts, sym_async);
+  if (is_async && is_streaming) {
+    rb_raise(rb_eArgError, "async: true cannot be combined with stream:");
+  }
+  // wrapper->nonblocking alone isn't enough: on libmysqlclient it only
+  // covers Client#query's text protocol.
+#ifdef MYSQL2_NONBLOCKING_STMT_EXECUTE
+  if (is_async && !wrapper->nonblocking) {
+#else
+  if (is_async) {
+#endif
+    rb_raise(cMysql2Error, "async: true needs a client library with nonblocking prepared statement execution (MariaDB Connector/C)");
+  }
+
   // setup any bind variables in the query
   if (bind_count > 0) {
     // Scratch space for string encoding exports, allocate on the stack
@@ -655,6 +1139,13 @@ static VALUE rb_mysql_stmt_execute(int argc, VALUE *argv, VALUE self) {
             params_enc[i] = rb_val_as_string;
             params_enc[i] = rb_str_export_to_enc(params_enc[i], conn_enc);
             set_buffer_for_string(&bind_buffers[i], &length_buffers[i], params_enc[i]);
+          } else if (mysql2_io_like_p(argv[i])) {
+            // IO, StringIO, or anything else with #read: bound without a
+            // buffer and streamed to the server in chunks by
+            // stream_long_data once the binds are in place.
+            bind_buffers[i].buffer_type = MYSQL_TYPE_LONG_BLOB;
+            bind_buffers[i].length = &length_buffers[i];
+            has_long_data = 1;
           } else {
             int state = 0;
             VALUE inspect = rb_protect(rb_inspect, argv[i], &state);
@@ -681,6 +1172,36 @@ static VALUE rb_mysql_stmt_execute(int argc, VALUE *argv, VALUE self) {
       FREE_BINDS;
       rb_raise_mysql2_stmt_error(stmt_wrapper);
     }
+
+    if (has_long_data) {
+      struct stream_long_data_args long_data_args;
+      int state = 0;
+
+      long_data_args.stmt_wrapper = stmt_wrapper;
+      long_data_args.bind_buffers = bind_buffers;
+      long_data_args.bind_count = bind_count;
+      long_data_args.argv = argv;
+
+      // Long data packets carry no response, but they are still writes to
+      // the socket: keep the connection BUSY for their duration.
+      wrapper->state = MYSQL2_CLIENT_QUERYING;
+      rb_protect(stream_long_data, (VALUE)&long_data_args, &state);
+      wrapper->state = MYSQL2_CLIENT_IDLE;
+
+      if (state) {
+        // The server accumulates long data on the statement until the next
+        // execute; discard what was sent so far, or it would be prepended to
+        // the same parameter on this statement's next execute.
+        FREE_BINDS;
+        /* COM_STMT_RESET: the command byte and statement id */
+        mysql2_net_count_command(wrapper, 1 + 4);
+        rb_thread_call_without_gvl(nogvl_stmt_reset, stmt, RUBY_UBF_IO, 0);
+        rb_jump_tag(state);
+      }
+    }
+
+    // argv may point into named_args (see mysql2_stmt_map_named_params).
+    RB_GC_GUARD(named_args);
   }
 
   // From stmt_execute to mysql_stmt_result_metadata to stmt_store_result, no
@@ -728,8 +1249,32 @@ static VALUE rb_mysql_stmt_execute(int argc, VALUE *argv, VALUE self) {
   // must not be allowed to write COM_STMT_CLOSE to this socket. See
   // mysql2_enqueue_pending_stmt_close / mysql2_reap_pending_stmt_closes.
   wrapper->state = MYSQL2_CLIENT_QUERYING;
+  wrapper->queries++;
+  mysql2_net_count_command(wrapper, mysql2_stmt_execute_payload(bind_buffers, bind_count));
 
   query_start = mysql2_monotonic_now();
+
+#ifdef MYSQL2_NONBLOCKING_STMT_EXECUTE
+  if (wrapper->nonblocking) {
+    stmt_wrapper->query_start = query_start;
+    stmt_wrapper->async_status = mysql_stmt_execute_start(&stmt_wrapper->async_ret, stmt);
+
+    // The connector serializes the whole COM_STMT_EXECUTE packet before its
+    // first write, so the bind buffers are no longer referenced even if
+    // that write suspended.
+    FREE_BINDS;
+
+    if (is_async) {
+      stmt_wrapper->async_pending = 1;
+      wrapper->active_fiber = rb_fiber_current();
+      rb_ivar_set(self, intern_current_query_options, current);
+      return Qnil;
+    }
+
+    return mysql2_stmt_execute_complete(self, current);
+  }
+#endif
+
   execute_args.stmt = stmt;
 
   if ((VALUE)rb_thread_call_without_gvl(nogvl_stmt_execute, &execute_args, RUBY_UBF_IO, 0) == Qfalse) {
@@ -746,63 +1291,31 @@ static VALUE rb_mysql_stmt_execute(int argc, VALUE *argv, VALUE self) {
    * the sentinel through so the reading is nil, not garbage. */
   query_elapsed = (query_start < 0 || execute_args.query_end < 0)
     ? -1 : execute_args.query_end - query_start;
+  mysql2_latency_record(wrapper, MYSQL2_LATENCY_SERVER, query_start, execute_args.query_end);
 
   FREE_BINDS;
 
-  metadata = mysql_stmt_result_metadata(stmt);
-  if (metadata == NULL) {
-    wrapper->state = MYSQL2_CLIENT_IDLE;
-    if (mysql_stmt_errno(stmt) != 0) {
-      // either CR_OUT_OF_MEMORY or CR_UNKNOWN_ERROR. both fatal.
-      wrapper->active_fiber = Qnil;
-      rb_raise_mysql2_stmt_error(stmt_wrapper);
-    }
-    // no data and no error, so query was not a SELECT
-    mysql2_reap_pending_result_frees(wrapper);
-    mysql2_reap_pending_stmt_closes(wrapper);
-    return Qnil;
-  }
-
-  if (!is_streaming) {
-    // receive the whole result set from the server
-    if (mysql_stmt_store_result(stmt)) {
-      mysql_free_result(metadata);
-      wrapper->state = MYSQL2_CLIENT_IDLE;
-      rb_raise_mysql2_stmt_error(stmt_wrapper);
-    }
-    wrapper->active_fiber = Qnil;
-    // The whole result set is buffered locally; free to reap and to run
-    // another command right away.
-    wrapper->state = MYSQL2_CLIENT_IDLE;
-    mysql2_reap_pending_result_frees(wrapper);
-    mysql2_reap_pending_stmt_closes(wrapper);
-  } else {
-    // A cursor is now open on the server; leave the connection BUSY until
-    // the Result finishes (or abandons) streaming rows -- see result.c.
-    wrapper->state = MYSQL2_CLIENT_STREAMING;
-  }
-
-  /* The metadata was read fresh above -- reading it is cheap and it goes
-   * stale under ALTER TABLE -- and only the artifacts derived from it are
-   * cached. On a match the field-name array and result buffers from the
-   * previous execute remain compatible and rb_mysql_result_to_obj below
-   * adopts them; on a miss they are dropped and rebuilt from scratch. */
-  mysql2_stmt_validate_metadata_cache(stmt_wrapper, metadata);
-
-  resultObj = rb_mysql_result_to_obj(stmt_wrapper->client, wrapper->encoding, current, metadata, self, query_elapsed);
+  return mysql2_stmt_execute_finish(self, current, is_streaming, query_elapsed);
+}
 
-  /* Track the open cursor so a later command can force-drain it if it's
-   * abandoned instead of exhausted -- see mysql2_abandon_active_stream. */
-  if (is_streaming) {
-    wrapper->active_streaming_result = resultObj;
-  }
+/* call-seq: stmt.async_result
+ *
+ * Returns the result of the last execute issued with +async: true+, waiting
+ * for it if the response has not arrived yet. Returns nil if no async
+ * execute is pending.
+ */
+static VALUE rb_mysql_stmt_async_result(VALUE self) {
+  GET_STATEMENT(self);
 
-  if (!is_streaming) {
-    // cache all result
-    rb_funcall(resultObj, intern_each, 0);
+  if (!stmt_wrapper->async_pending) {
+    return Qnil;
   }
 
-  return resultObj;
+#ifdef MYSQL2_NONBLOCKING_STMT_EXECUTE
+  return mysql2_stmt_execute_complete(self, rb_ivar_get(self, intern_current_query_options));
+#else
+  return Qnil;
+#endif
 }
 
 /* call-seq: stmt.fields # => array
@@ -919,6 +1432,8 @@ static VALUE rb_mysql_stmt_close(VALUE self) {
 
       stmt_wrapper->closed = 1;
       rb_hash_delete(wrapper->prepared_statements, ULL2NUM((unsigned long long)stmt_wrapper));
+      /* COM_STMT_CLOSE: the command byte and statement id, unanswered */
+      mysql2_net_count_command(wrapper, 1 + 4);
       rb_thread_call_without_gvl(nogvl_stmt_close, stmt_wrapper, RUBY_UBF_IO, 0);
       mysql2_stmt_metadata_cache_clear(stmt_wrapper);
   }
@@ -954,6 +1469,7 @@ void init_mysql2_statement(void) {
   rb_define_method(cMysql2Statement, "param_count", rb_mysql_stmt_param_count, 0);
   rb_define_method(cMysql2Statement, "field_count", rb_mysql_stmt_field_count, 0);
   rb_define_method(cMysql2Statement, "_execute", rb_mysql_stmt_execute, -1);
+  rb_define_method(cMysql2Statement, "async_result", rb_mysql_stmt_async_result, 0);
   rb_define_method(cMysql2Statement, "fields", rb_mysql_stmt_fields, 0);
   rb_define_method(cMysql2Statement, "last_id", rb_mysql_stmt_last_id, 0);
   rb_define_method(cMysql2Statement, "affected_rows", rb_mysql_stmt_affected_rows, 0);
@@ -962,6 +1478,8 @@ void init_mysql2_statement(void) {
 
   sym_stream = ID2SYM(rb_intern("stream"));
   sym_size = ID2SYM(rb_intern("size"));
+  sym_auto = ID2SYM(rb_intern("auto"));
+  sym_async = ID2SYM(rb_intern("async"));
 
   intern_new_with_args = rb_intern("new_with_args");
   intern_each = rb_intern("each");
@@ -978,6 +1496,19 @@ void init_mysql2_statement(void) {
   intern_year = rb_intern("year");
 
   intern_to_s = rb_intern("to_s");
+  intern_read = rb_intern("read");
+  intern_keys = rb_intern("keys");
+  intern_Pathname = rb_intern("Pathname");
   intern_merge_bang = rb_intern("merge!");
   intern_query_options = rb_intern("@query_options");
+  intern_current_query_options = rb_intern("@current_query_options");
+
+  /* Whether Statement#execute can wait on the socket through Ruby -- and so
+   * through a Fiber scheduler -- and accepts async: true. Needs MariaDB
+   * Connector/C's mysql_stmt_execute_start/_cont. */
+#ifdef MYSQL2_NONBLOCKING_STMT_EXECUTE
+  rb_const_set(cMysql2Statement, rb_intern("NONBLOCKING_EXECUTE_SUPPORTED"), Qtrue);
+#else
+  rb_const_set(cMysql2Statement, rb_intern("NONBLOCKING_EXECUTE_SUPPORTED"), Qfalse);
+#endif
 }
@@ -50,6 +50,23 @@ typedef struct {
    * is deliberately not part of cache validation: it can never decode
    * values through the wrong types, only miss the cache. */
   char cached_result_buffers_string_binds;
+  /* A nonblocking execute (MYSQL2_NONBLOCKING_STMT_EXECUTE) issued with
+   * async: true, whose response Statement#async_result has yet to read.
+   * async_status holds the MYSQL_WAIT_* bits the last _start/_cont call
+   * suspended on, async_ret its eventual return value, and query_start the
+   * round-trip stamp taken before the command was written -- the bracket
+   * closes in a later Ruby call, same as Client#query with :async. */
+  int async_pending;
+  int async_status;
+  int async_ret;
+  double query_start;
+  /* For SQL prepared with :name placeholders (rewritten to ? before
+   * mysql_stmt_prepare): a frozen Array holding, for each parameter slot in
+   * order, the Symbol naming it -- a name used twice fills two slots.
+   * named_param_count is the number of distinct names. Qnil and 0 for a
+   * positional statement. */
+  VALUE param_names;
+  unsigned long named_param_count;
 } mysql_stmt_wrapper;
 
 void init_mysql2_statement(void);
@@ -71,6 +71,23 @@ module Mysql2
       Hash[hash.map { |k, v| [k.to_sym, v] }]
     end
 
+    #
+    # Whether this is the main Ractor (always, before Ruby 3.0). Only the
+    # main one can read global variables or a class's mutable state.
+    #
+    def self.main_ractor?
+      !defined?(::Ractor) || ::Ractor.current == ::Ractor.main
+    end
+
+    #
+    # $PROGRAM_NAME, which other Ractors can't read: they get its value as
+    # of when mysql2 was loaded.
+    #
+    PROGRAM_NAME = $PROGRAM_NAME.dup.freeze
+    def self.program_name
+      main_ractor? ? $PROGRAM_NAME : PROGRAM_NAME
+    end
+
     #
     # In Mysql2::Client#query and Mysql2::Statement#execute,
     # Thread#handle_interrupt is used to prevent Timeout#timeout
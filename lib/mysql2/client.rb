@@ -2,21 +2,28 @@ module Mysql2
   class Client
     attr_reader :query_options, :read_timeout
 
+    DEFAULT_QUERY_OPTIONS = {
+      as: :hash,                   # the type of object you want each row back as; also supports :array (an array of values)
+      async: false,                # don't wait for a result after sending the query, you'll have to monitor the socket yourself then eventually call Mysql2::Client#async_result
+      cast_booleans: false,        # cast tinyint(1) fields as true/false in ruby
+      symbolize_keys: false,       # return field names as symbols instead of strings
+      database_timezone: :local,   # timezone Mysql2 will assume datetime objects are stored in
+      application_timezone: nil,   # timezone Mysql2 will convert to before handing the object back to the caller
+      cache_rows: true,            # tells Mysql2 to use its internal row cache for results
+      rows_per_gvl_yield: 8192,    # buffered rows to materialize between GVL yields; 0 disables yielding
+      connect_flags: REMEMBER_OPTIONS | LONG_PASSWORD | LONG_FLAG | TRANSACTIONS | PROTOCOL_41 | SECURE_CONNECTION | CONNECT_ATTRS,
+      cast: true,
+      default_file: nil,
+      default_group: nil,
+    }.freeze
+
+    # A class's mutable instance variables can't be read outside the main
+    # Ractor, so every other Ractor keeps its own copy, starting from
+    # DEFAULT_QUERY_OPTIONS rather than whatever the main one changed.
     def self.default_query_options
-      @default_query_options ||= {
-        as: :hash,                   # the type of object you want each row back as; also supports :array (an array of values)
-        async: false,                # don't wait for a result after sending the query, you'll have to monitor the socket yourself then eventually call Mysql2::Client#async_result
-        cast_booleans: false,        # cast tinyint(1) fields as true/false in ruby
-        symbolize_keys: false,       # return field names as symbols instead of strings
-        database_timezone: :local,   # timezone Mysql2 will assume datetime objects are stored in
-        application_timezone: nil,   # timezone Mysql2 will convert to before handing the object back to the caller
-        cache_rows: true,            # tells Mysql2 to use its internal row cache for results
-        rows_per_gvl_yield: 8192,    # buffered rows to materialize between GVL yields; 0 disables yielding
-        connect_flags: REMEMBER_OPTIONS | LONG_PASSWORD | LONG_FLAG | TRANSACTIONS | PROTOCOL_41 | SECURE_CONNECTION | CONNECT_ATTRS,
-        cast: true,
-        default_file: nil,
-        default_group: nil,
-      }
+      return @default_query_options ||= DEFAULT_QUERY_OPTIONS.dup if Mysql2::Util.main_ractor?
+
+      Ractor.current[:mysql2_default_query_options] ||= DEFAULT_QUERY_OPTIONS.dup
     end
 
     # :tls_key/:tls_cert/:tls_ca/:tls_capath/:tls_cipher are the modern names
@@ -42,6 +49,40 @@ module Mysql2
     }.freeze
     private_constant :TLS_OPTION_ALIASES
 
+    # Opens +count+ clients with the same +opts+, running their handshakes
+    # (TCP, TLS, auth) concurrently: each connect releases the GVL, so
+    # connecting 64 clients costs about as long as the slowest handshake
+    # rather than 64 of them back to back. If any connect fails, the ones
+    # that succeeded are closed and the first error is raised. So are they
+    # when an interrupt or Timeout lands mid-wait, after the connects still
+    # running are killed.
+    def self.connect_many(count, opts = {})
+      threads = Array.new(Integer(count)) do
+        Thread.new do
+          Thread.current.report_on_exception = false if Thread.current.respond_to?(:report_on_exception=)
+          new(opts)
+        end
+      end
+
+      clients = []
+      begin
+        threads.each { |thread| clients << thread.value }
+      ensure
+        unless clients.size == threads.size
+          threads.each(&:kill)
+          threads.each do |thread|
+            begin
+              client = thread.value
+            rescue StandardError
+              next
+            end
+            client.close if client
+          end
+        end
+      end
+      clients
+    end
+
     def initialize(opts = {})
       raise Mysql2::Error, "Options parameter must be a Hash" unless opts.is_a? Hash
 
@@ -62,14 +103,18 @@ module Mysql2
       opts[:local_infile] = false unless opts.key?(:local_infile)
 
       # TODO: stricter validation rather than silent massaging
-      %i[reconnect connect_timeout local_infile read_timeout write_timeout default_file default_group secure_auth init_command automatic_close enable_cleartext_plugin default_auth get_server_public_key tls_version].each do |key|
+      %i[reconnect connect_timeout local_infile read_timeout write_timeout default_file default_group secure_auth init_command automatic_close enable_cleartext_plugin default_auth get_server_public_key tls_version
+         compression compression_level].each do |key|
         next unless opts.key?(key)
 
         case key
         when :reconnect, :local_infile, :secure_auth, :automatic_close, :enable_cleartext_plugin, :get_server_public_key
           send(:"#{key}=", !!opts[key]) # rubocop:disable Style/DoubleNegation
-        when :connect_timeout, :read_timeout, :write_timeout
+        when :connect_timeout, :write_timeout
           send(:"#{key}=", Integer(opts[key])) unless opts[key].nil?
+        when :read_timeout
+          # mysql2 waits out read_timeout itself, so fractional seconds work
+          send(:"#{key}=", opts[key].is_a?(Float) ? opts[key] : Integer(opts[key])) unless opts[key].nil?
         else
           send(:"#{key}=", opts[key])
         end
@@ -222,7 +267,7 @@ module Mysql2
       return {} if Mysql2::Client::CONNECT_ATTRS.zero?
 
       conn_attrs ||= {}
-      conn_attrs[:program_name] ||= $PROGRAM_NAME
+      conn_attrs[:program_name] ||= Mysql2::Util.program_name
       conn_attrs.each_with_object({}) do |(key, value), hash|
         hash[key.to_s] = value.to_s
       end
@@ -237,9 +282,33 @@ module Mysql2
     EMPTY_QUERY_OPTIONS = {}.freeze
     private_constant :EMPTY_QUERY_OPTIONS
 
-    def query(sql, options = EMPTY_QUERY_OPTIONS)
+    def query(sql, binds = nil, options = EMPTY_QUERY_OPTIONS)
+      if binds.is_a?(Hash)
+        options = binds
+        binds = nil
+      end
+      Thread.handle_interrupt(::Mysql2::Util::TIMEOUT_ERROR_NEVER) do
+        _query(sql, binds, @query_options.merge(options))
+      end
+    end
+
+    def bulk_insert(table, columns, rows, options = EMPTY_QUERY_OPTIONS)
+      # Read once per connection: it's a global, and a session's copy can't change
+      @max_allowed_packet ||= Integer(query('SELECT @@max_allowed_packet', as: :array).first.first)
+      Thread.handle_interrupt(::Mysql2::Util::TIMEOUT_ERROR_NEVER) do
+        _bulk_insert(table, columns, rows, @max_allowed_packet, @query_options.merge(options))
+      end
+    end
+
+    def pipeline(statements, options = EMPTY_QUERY_OPTIONS)
+      Thread.handle_interrupt(::Mysql2::Util::TIMEOUT_ERROR_NEVER) do
+        _pipeline(statements, @query_options.merge(options))
+      end
+    end
+
+    def query_all(sql, options = EMPTY_QUERY_OPTIONS)
       Thread.handle_interrupt(::Mysql2::Util::TIMEOUT_ERROR_NEVER) do
-        _query(sql, @query_options.merge(options))
+        _query_all(sql, @query_options.merge(options))
       end
     end
 
@@ -8,6 +8,8 @@ module Mysql2
 
     ConnectionError = Class.new(Error)
     TimeoutError = Class.new(Error)
+    # A result set outgrew the :max_result_rows/:max_result_bytes query options
+    ResultLimitError = Class.new(Error)
 
     CODES = {
       1205 => TimeoutError, # ER_LOCK_WAIT_TIMEOUT
@@ -1,5 +1,7 @@
 require 'spec_helper'
 require 'socket'
+require 'stringio'
+require 'tmpdir'
 
 RSpec.describe Mysql2::Client do # rubocop:disable Metrics/BlockLength
   let(:performance_schema_enabled) do
@@ -1104,6 +1106,82 @@ RSpec.describe Mysql2::Client do # rubocop:disable Metrics/BlockLength
       result = client.query "SELECT * FROM infileTest"
       expect(result.first).to eql('id' => 1, 'foo' => 'Hello', 'bar' => 'World')
     end
+
+    context "from an :infile source" do
+      let(:client) { new_client(local_infile: true) }
+      let(:sql) { "LOAD DATA LOCAL INFILE 'rows' INTO TABLE infileTest (foo, bar)" }
+
+      it "should load a String as is" do
+        client.query(sql, infile: "a\tb\nc\td\n")
+        expect(client.query_info[:records]).to eql(2)
+      end
+
+      it "should load an IO in chunks" do
+        client.query(sql, infile: StringIO.new("a\tb\n" * 100_000))
+        expect(client.query_info[:records]).to eql(100_000)
+      end
+
+      it "should encode an Array of rows, escaping and NULLs included" do
+        client.query("DELETE FROM infileTest WHERE foo = 'escapes'")
+        client.query(sql, infile: [["escapes", "tab\there\nnewline\\"], ["escapes", nil]])
+        expect(client.query_info[:records]).to eql(2)
+        rows = client.query("SELECT bar FROM infileTest WHERE foo = 'escapes' ORDER BY id").map { |row| row['bar'] }
+        expect(rows).to eql(["tab\there\nnewline\\", nil])
+      end
+
+      it "should not escape a multibyte character's trailing 0x5C byte" do
+        # In Shift_JIS "ソ" is 0x83 0x5C; doubling its second byte would
+        # load a different string.
+        sjis_client = new_client(local_infile: true, encoding: 'sjis')
+        sjis_client.query("DELETE FROM infileTest WHERE foo = 'sjis'")
+        sjis_client.query("LOAD DATA LOCAL INFILE 'rows' INTO TABLE infileTest CHARACTER SET sjis (foo, bar)",
+                          infile: [["sjis", "ソ\\ソ"]])
+        with_internal_encoding nil do
+          bar = sjis_client.query("SELECT bar FROM infileTest WHERE foo = 'sjis'").first['bar']
+          expect(bar).to eql("ソ\\ソ".encode(Encoding::Shift_JIS))
+        end
+      end
+
+      it "should pull rows from an Enumerator" do
+        rows = Enumerator.new { |y| 3.times { |i| y << ["enum", i] } }
+        client.query(sql, infile: rows)
+        expect(client.query_info[:records]).to eql(3)
+      end
+
+      it "should end each String row with a newline" do
+        rows = Enumerator.new do |y|
+          y << "lines\ta"
+          y << "lines\tb\n"
+          y << "lines\tc"
+        end
+        client.query(sql, infile: rows)
+        expect(client.query_info[:records]).to eql(3)
+      end
+
+      it "should re-raise what the source raised and keep the connection usable" do
+        rows = Enumerator.new { |_y| raise "source broke" }
+        expect { client.query(sql, infile: rows) }.to raise_error(RuntimeError, "source broke")
+        expect(client.query("SELECT 1 AS one").first).to eql('one' => 1)
+      end
+
+      it "should let a throw out of the source through once the statement is aborted" do
+        source = Object.new
+        def source.read(_length)
+          throw :stop_loading
+        end
+        expect(catch(:stop_loading) { client.query(sql, infile: source) }).to be_nil
+        expect(client.query("SELECT 1 AS one").first).to eql('one' => 1)
+      end
+
+      it "should not swallow an Interrupt raised by the source" do
+        rows = Enumerator.new { |_y| raise Interrupt }
+        expect { client.query(sql, infile: rows) }.to raise_error(Interrupt)
+      end
+
+      it "should reject a source it can't read before sending" do
+        expect { client.query(sql, infile: 42) }.to raise_error(TypeError)
+      end
+    end
   end
 
   it "should expect connect_timeout to be a positive integer" do
@@ -1153,6 +1231,50 @@ RSpec.describe Mysql2::Client do # rubocop:disable Metrics/BlockLength
   end
 
   context "#query" do
+    context "with binds" do
+      it "should interpolate escaped values for each ?" do
+        result = @client.query("SELECT ? AS s, ? AS i, ? AS f, ? AS n, ? AS t", ["gi'thu\"bbe\0r's", 42, 1.5, nil, true]).first
+        expect(result).to eql('s' => "gi'thu\"bbe\0r's", 'i' => 42, 'f' => 1.5, 'n' => nil, 't' => 1)
+      end
+
+      it "should expand an Array for IN (?)" do
+        expect(@client.query("SELECT 2 IN (?) AS hit, 4 IN (?) AS miss", [[1, 2, 3], []]).first).to eql('hit' => 1, 'miss' => nil)
+      end
+
+      it "should write times and dates from their own fields" do
+        time = Time.new(2020, 1, 2, 3, 4, 5.25)
+        result = @client.query("SELECT CAST(? AS CHAR) AS t, CAST(? AS CHAR) AS d", [time, Date.new(2020, 1, 2)]).first
+        expect(result).to eql('t' => '2020-01-02 03:04:05.250000', 'd' => '2020-01-02')
+      end
+
+      it "should leave ? inside quotes and comments alone" do
+        result = @client.query("SELECT '?' AS q, ? AS v /* ? */", [1]).first
+        expect(result).to eql('q' => '?', 'v' => 1)
+      end
+
+      it "should not take a multibyte trailing 0x5C byte for a backslash" do
+        # In Shift_JIS "ソ" is 0x83 0x5C: read byte-wise, its second byte
+        # escapes the closing quote and the quoted ? below becomes a bind.
+        client = new_client(encoding: 'sjis')
+        with_internal_encoding nil do
+          result = client.query("SELECT 'ソ' AS a, ? AS b", ["x"]).first
+          expect(result['a']).to eql("ソ".encode(Encoding::Shift_JIS))
+          expect(result['b']).to eql("x".encode(Encoding::Shift_JIS))
+        end
+        expect { client.query("SELECT 'ソ' AS a, '?' AS b", [1]) }.to raise_error(ArgumentError, /given 1, expected 0/)
+      end
+
+      it "should raise before sending when the bind count doesn't match" do
+        expect { @client.query("SELECT ?, ?", [1]) }.to raise_error(ArgumentError, /given 1, expected 2/)
+        expect { @client.query("SELECT ?", [Object.new]) }.to raise_error(TypeError)
+        expect(@client.query("SELECT 1 AS one").first).to eql('one' => 1)
+      end
+
+      it "should still take query options after the binds" do
+        expect(@client.query("SELECT ? AS v", [1], as: :array).first).to eql([1])
+      end
+    end
+
     it "should reject stream: {size: N}, which only prepared statements support" do
       # Text-protocol streaming is mysql_use_result -- no cursor, no
       # prefetch to size. Raising beats silently streaming row-by-row.
@@ -1347,6 +1469,44 @@ RSpec.describe Mysql2::Client do # rubocop:disable Metrics/BlockLength
         end.to raise_error(Mysql2::Error::TimeoutError)
       end
 
+      it "should honor a fractional :read_timeout" do
+        client = new_client(read_timeout: 0.2)
+        start = clock_time
+        expect do
+          client.query('SELECT SLEEP(2)')
+        end.to raise_error(Mysql2::Error::TimeoutError)
+        expect(clock_time - start).to be < 1
+      end
+
+      it "should kill a query that exceeds :timeout and keep the connection usable" do
+        start = clock_time
+        expect do
+          @client.query('SELECT SLEEP(5)', timeout: 0.25)
+        end.to raise_error(Mysql2::Error::TimeoutError, /was killed$/)
+        expect(clock_time - start).to be < 2
+        expect(@client.query('SELECT 1 AS one').first).to eql('one' => 1)
+      end
+
+      it "should send KILL QUERY over TLS when the client itself required TLS" do
+        ssl_disabled = @client.query("SHOW VARIABLES LIKE 'have_ssl'").any? { |x| %w[OFF DISABLED].include?(x['Value']) }
+        skip("SSL is not enabled in your MySQL daemon") if ssl_disabled
+
+        ssl_accepts = -> { @client.query("SHOW GLOBAL STATUS LIKE 'Ssl_accepts'").first['Value'].to_i }
+        client = new_client(ssl_mode: 'required')
+        before = ssl_accepts.call
+        expect do
+          client.query('SELECT SLEEP(5)', timeout: 0.25)
+        end.to raise_error(Mysql2::Error::TimeoutError, /was killed$/)
+        expect(ssl_accepts.call).to be > before
+      end
+
+      it "should reject a negative :timeout before sending anything" do
+        expect do
+          @client.query('SELECT 1', timeout: -1)
+        end.to raise_error(ArgumentError)
+        expect(@client.query('SELECT 1 AS one').first).to eql('one' => 1)
+      end
+
       # XXX this test is not deterministic (because Unix signal handling is not)
       # and may fail on a loaded system
       it "should run signal handlers while waiting for a response" do
@@ -1536,6 +1696,78 @@ RSpec.describe Mysql2::Client do # rubocop:disable Metrics/BlockLength
         @client.close
         expect(@client.async_result).to be nil
       end
+
+      it "should not hold the handshake to :read_timeout" do
+        skip "client library has no nonblocking query API" unless Mysql2::Client::NONBLOCKING_QUERY_SUPPORTED
+
+        client = new_client(read_timeout: 0.000001)
+        expect { client.query("SELECT SLEEP(0.1)") }.to raise_error(Mysql2::Error::TimeoutError, /response from the last query/)
+      end
+
+      it "should run queries on several connections concurrently from one thread under a Fiber scheduler" do
+        skip "client library has no nonblocking query API" unless Mysql2::Client::NONBLOCKING_QUERY_SUPPORTED
+        skip "requires Fiber.set_scheduler" unless Fiber.respond_to?(:set_scheduler) && RUBY_VERSION >= "3.1"
+
+        # Just enough of the Fiber::Scheduler interface for mysql2's socket
+        # waits: io_wait parks the fiber, and run resumes each one once
+        # IO.select reports its socket ready.
+        scheduler_class = Class.new do
+          def initialize
+            @waiting = {}
+          end
+
+          def fiber(&block)
+            Fiber.new(blocking: false, &block).tap(&:resume)
+          end
+
+          def io_wait(io, events, _timeout)
+            @waiting[Fiber.current] = [io, events]
+            Fiber.yield
+            events
+          end
+
+          def run
+            until @waiting.empty?
+              readers = @waiting.values.select { |_, e| e & IO::READABLE != 0 }.map(&:first)
+              writers = @waiting.values.select { |_, e| e & IO::WRITABLE != 0 }.map(&:first)
+              r, w = IO.select(readers, writers)
+              @waiting.select { |_, (io, _)| r.include?(io) || w.include?(io) }.each_key do |fiber|
+                @waiting.delete(fiber)
+                fiber.resume
+              end
+            end
+          end
+
+          def close
+            run
+          end
+
+          def block(*)
+            raise NotImplementedError
+          end
+
+          def unblock(*); end
+
+          def kernel_sleep(*)
+            raise NotImplementedError
+          end
+        end
+
+        clients = Array.new(3) { new_client }
+        results = []
+        start = clock_time
+        Thread.new do
+          Fiber.set_scheduler(scheduler_class.new)
+          clients.each_with_index do |client, i|
+            Fiber.schedule { results[i] = client.query("SELECT SLEEP(0.5) AS s, #{i} AS i").first['i'] }
+          end
+        end.join
+
+        expect(results).to eq([0, 1, 2])
+        expect(clock_time - start).to be < 1.2
+      ensure
+        clients&.each(&:close)
+      end
     end
 
     context "Multiple results sets" do
@@ -1735,6 +1967,405 @@ RSpec.describe Mysql2::Client do # rubocop:disable Metrics/BlockLength
     end
   end
 
+  context ".connect_many" do
+    it "returns that many distinct, connected clients" do
+      clients = Mysql2::Client.connect_many(3, DatabaseCredentials['root'])
+      begin
+        expect(clients.size).to eq(3)
+        expect(clients.map(&:thread_id).uniq.size).to eq(3)
+        clients.each { |client| expect(client.query("SELECT 1 AS a").first).to eq('a' => 1) }
+      ensure
+        clients.each(&:close)
+      end
+    end
+
+    it "raises the connect error when the handshakes fail" do
+      expect do
+        Mysql2::Client.connect_many(2, DatabaseCredentials['root'].merge('username' => 'connect_many_nobody', 'password' => 'nope'))
+      end.to raise_error(Mysql2::Error)
+    end
+
+    it "returns an empty Array for zero clients" do
+      expect(Mysql2::Client.connect_many(0, DatabaseCredentials['root'])).to eq([])
+    end
+
+    it "kills the connects still running and closes the opened clients when interrupted" do
+      # Only the first client to connect returns; the rest hang until killed.
+      opened = []
+      lock = Mutex.new
+      slow_client = Class.new(Mysql2::Client) do
+        define_method(:initialize) do |opts|
+          super(opts)
+          first = lock.synchronize { (opened << self).size == 1 }
+          sleep 10 unless first
+        end
+      end
+
+      expect do
+        Timeout.timeout(1) { slow_client.connect_many(3, DatabaseCredentials['root']) }
+      end.to raise_error(Timeout::Error)
+      expect(opened.first).to be_closed
+    end
+  end
+
+  context "#reset_connection" do
+    before(:example) do
+      skip "client library has no mysql_reset_connection" unless Mysql2::Client::RESET_CONNECTION_SUPPORTED
+    end
+
+    it "clears session state without reconnecting" do
+      thread_id = @client.thread_id
+      @client.query("SET @reset_var = 1")
+      @client.query("CREATE TEMPORARY TABLE reset_connection_test (id INT)")
+
+      @client.reset_connection
+
+      expect(@client.thread_id).to eq(thread_id)
+      expect(@client.query("SELECT @reset_var AS v").first).to eq('v' => nil)
+      expect { @client.query("SELECT * FROM reset_connection_test") }.to raise_error(Mysql2::Error)
+    end
+
+    it "rolls back an open transaction" do
+      other = new_client
+      other.query("CREATE TABLE IF NOT EXISTS reset_rollback_durable (id INT) ENGINE=InnoDB")
+      begin
+        @client.query("BEGIN")
+        @client.query("INSERT INTO reset_rollback_durable VALUES (1)")
+        @client.reset_connection
+        expect(other.query("SELECT COUNT(*) AS n FROM reset_rollback_durable").first['n']).to eq(0)
+      ensure
+        other.query("DROP TABLE IF EXISTS reset_rollback_durable")
+      end
+    end
+
+    it "closes the client's prepared statements and clears its bookkeeping" do
+      statement = @client.prepare("SELECT 1")
+      expect(@client.prepared_statements).to include(statement)
+
+      @client.reset_connection
+
+      expect(statement).to be_closed
+      expect(@client.prepared_statements).to be_empty
+      expect(@client.pending_prepared_statement_closes).to eq(0)
+      expect(@client.prepare("SELECT 2 AS a").execute.first).to eq('a' => 2)
+    end
+
+    it "drains an abandoned stream first" do
+      result = @client.query("SELECT 1 UNION SELECT 2", stream: true, cache_rows: false)
+      result.first
+
+      @client.reset_connection
+      expect(@client.query("SELECT 3 AS a").first).to eq('a' => 3)
+    end
+  end
+
+  context "#bulk_insert" do
+    before(:each) do
+      @client.query("CREATE TEMPORARY TABLE bulk_insert_test (id INT PRIMARY KEY, name VARCHAR(255))")
+    end
+
+    it "inserts every row and returns the affected row count" do
+      expect(@client.bulk_insert("bulk_insert_test", %w[id name], [[1, "a'b"], [2, nil]])).to eq(2)
+      expect(@client.affected_rows).to eq(2)
+      expect(@client.query("SELECT * FROM bulk_insert_test ORDER BY id").to_a).to eq([{ 'id' => 1, 'name' => "a'b" }, { 'id' => 2, 'name' => nil }])
+    end
+
+    it "splits into several statements to stay under max_allowed_packet" do
+      @client.instance_variable_set(:@max_allowed_packet, 2048)
+      rows = Array.new(200) { |i| [i, "x" * 50] }
+      expect(@client.bulk_insert("bulk_insert_test", %i[id name], rows)).to eq(200)
+      expect(@client.query("SELECT COUNT(*) AS n FROM bulk_insert_test").first).to eq('n' => 200)
+    end
+
+    it "handles duplicates as asked" do
+      @client.bulk_insert("bulk_insert_test", %w[id name], [[1, "old"]])
+      @client.bulk_insert("bulk_insert_test", %w[id name], [[1, "ignored"]], on_duplicate: :ignore)
+      expect(@client.query("SELECT name FROM bulk_insert_test").first).to eq('name' => 'old')
+      @client.bulk_insert("bulk_insert_test", %w[id name], [[1, "new"]], on_duplicate: :update)
+      expect(@client.query("SELECT name FROM bulk_insert_test").first).to eq('name' => 'new')
+    end
+
+    it "checks every row before sending anything" do
+      expect do
+        @client.bulk_insert("bulk_insert_test", %w[id name], [[1, "a"], [2]])
+      end.to raise_error(ArgumentError, /row 1 has 1 values for 2 columns/)
+      expect(@client.query("SELECT COUNT(*) AS n FROM bulk_insert_test").first).to eq('n' => 0)
+    end
+
+    it "rejects a NaN value before sending any statement" do
+      rows = Array.new(200) { |i| [i, "x" * 1000] }
+      rows << [200, Float::NAN]
+      @client.instance_variable_set(:@max_allowed_packet, 16 * 1024)
+      expect do
+        @client.bulk_insert("bulk_insert_test", %w[id name], rows)
+      end.to raise_error(ArgumentError, /no literal for NaN/)
+      expect(@client.query("SELECT COUNT(*) AS n FROM bulk_insert_test").first).to eq('n' => 0)
+    end
+
+    it "quotes a multibyte identifier whose trailing byte is a backtick byte" do
+      client = new_client(encoding: 'gbk')
+      column = "c乣"
+      client.query("CREATE TEMPORARY TABLE bulk_insert_gbk (id INT, `#{column}` INT)")
+      expect(client.bulk_insert("bulk_insert_gbk", ["id", column], [[1, 2]])).to eq(1)
+      expect(client.query("SELECT `#{column}` AS v FROM bulk_insert_gbk").first).to eq('v' => 2)
+    end
+  end
+
+  context "#pipeline" do
+    it "returns one entry per statement, in order" do
+      results = @client.pipeline(["SELECT 1 AS a", "SET @pipeline_var = 2", "SELECT @pipeline_var AS b"])
+      expect(results.size).to eq(3)
+      expect(results[0].to_a).to eq([{ 'a' => 1 }])
+      expect(results[1]).to be_nil
+      expect(results[2].to_a).to eq([{ 'b' => 2 }])
+    end
+
+    it "captures a failed statement's error and keeps running the rest" do
+      results = @client.pipeline(["SELECT 1 AS a", "SELECT * FROM pipeline_no_such_table", "SELECT 3 AS c"])
+      expect(results[0].to_a).to eq([{ 'a' => 1 }])
+      expect(results[1]).to be_a(Mysql2::Error)
+      expect(results[1].message).to match(/pipeline_no_such_table/)
+      expect(results[2].to_a).to eq([{ 'c' => 3 }])
+    end
+
+    it "leaves MULTI_STATEMENTS off afterwards on a connection made without it" do
+      @client.pipeline(["SELECT 1", "SELECT 2"])
+      expect { @client.query("SELECT 1; SELECT 2") }.to raise_error(Mysql2::Error)
+      expect(@client.query("SELECT 4 AS a").first).to eq('a' => 4)
+    end
+
+    it "applies query options to every result" do
+      results = @client.pipeline(["SELECT 1 AS a", "SELECT 2 AS b"], as: :array)
+      expect(results.map(&:to_a)).to eq([[[1]], [[2]]])
+    end
+
+    it "returns an empty Array for no statements" do
+      expect(@client.pipeline([])).to eq([])
+    end
+
+    it "rejects statements that aren't a single complete statement before sending anything" do
+      expect { @client.pipeline(["SELECT 1; SELECT 2"]) }.to raise_error(ArgumentError)
+      expect { @client.pipeline(["SELECT 'unterminated"]) }.to raise_error(ArgumentError)
+      expect { @client.pipeline(["SELECT 1 /* open"]) }.to raise_error(ArgumentError)
+      expect(@client.pipeline(["SELECT ';' AS a -- trailing comment"]).first.first).to eq('a' => ';')
+    end
+
+    it "rejects CALL, whose result sets wouldn't line up with the statements" do
+      expect { @client.pipeline(["SELECT 1", " /* c */ call p()"]) }.to raise_error(ArgumentError, /statement 1 is a CALL/)
+      expect(@client.pipeline(["SELECT 1 AS callback"]).first.first).to eq('callback' => 1)
+    end
+
+    it "rejects :stream and :async" do
+      expect { @client.pipeline(["SELECT 1"], stream: true) }.to raise_error(ArgumentError)
+      expect { @client.pipeline(["SELECT 1"], async: true) }.to raise_error(ArgumentError)
+    end
+  end
+
+  context "#latency_histogram" do
+    it "counts each phase of a query" do
+      @client.reset_latency_histogram
+      @client.query("SELECT 1").to_a
+      histogram = @client.latency_histogram
+      expect(histogram.keys).to eq(%i[send server store cast])
+      histogram.each_value do |buckets|
+        expect(buckets.values.inject(0, :+)).to eq(1)
+        expect(buckets.keys).to all(be_a(Float))
+      end
+    end
+
+    it "counts a prepared statement's execute under :server" do
+      @client.reset_latency_histogram
+      @client.prepare("SELECT 1").execute
+      expect(@client.latency_histogram[:send]).to be_empty
+      expect(@client.latency_histogram[:server].values.inject(0, :+)).to eq(1)
+    end
+
+    it "can be reset" do
+      @client.query("SELECT 1")
+      @client.reset_latency_histogram
+      expect(@client.latency_histogram.values).to all(be_empty)
+    end
+  end
+
+  context "#stats" do
+    it "returns a frozen Hash of counters" do
+      stats = @client.stats
+      expect(stats).to be_frozen
+      expect(stats.keys.first(10)).to eq(%i[queries bytes_sent bytes_received packets_sent packets_received rows_fetched buffered_bytes rows_materialized materialized_bytes compression])
+      expect(stats.keys.drop(10) - %i[tcp_bytes_sent tcp_bytes_received tcp_segments_sent tcp_segments_received]).to be_empty
+    end
+
+    it "counts queries and the rows they fetched and built" do
+      before = @client.stats
+      @client.query("SELECT 'abc' AS a UNION ALL SELECT 'de'").to_a
+      after = @client.stats
+      expect(after[:queries] - before[:queries]).to eq(1)
+      expect(after[:rows_fetched] - before[:rows_fetched]).to eq(2)
+      expect(after[:rows_materialized] - before[:rows_materialized]).to eq(2)
+      expect(after[:materialized_bytes] - before[:materialized_bytes]).to eq(5)
+    end
+
+    it "counts streamed rows as they are read" do
+      before = @client.stats
+      @client.query("SELECT 1 UNION ALL SELECT 2 UNION ALL SELECT 3", stream: true, cache_rows: false).each {}
+      expect(@client.stats[:rows_fetched] - before[:rows_fetched]).to eq(3)
+    end
+
+    it "counts the client library memory a buffered result took" do
+      require "objspace"
+      before = @client.stats
+      result = @client.query("SELECT REPEAT('x', 10000) AS x")
+      buffered = @client.stats[:buffered_bytes] - before[:buffered_bytes]
+      expect(buffered).to be >= 10000
+      expect(ObjectSpace.memsize_of(result)).to be >= buffered
+    end
+
+    it "counts the protocol packets and bytes of a command" do
+      sql = "SELECT 'abc' AS a"
+      before = @client.stats
+      @client.query(sql).to_a
+      after = @client.stats
+      expect(after[:packets_sent] - before[:packets_sent]).to eq(1)
+      expect(after[:bytes_sent] - before[:bytes_sent]).to eq(4 + 1 + sql.bytesize)
+      # the column count, its definition, the row and at least one OK or EOF
+      expect(after[:packets_received] - before[:packets_received]).to be >= 4
+    end
+
+    it "counts a prepared statement's packets" do
+      statement = @client.prepare("SELECT ? AS a")
+      before = @client.stats
+      statement.execute("abc").to_a
+      after = @client.stats
+      expect(after[:packets_sent] - before[:packets_sent]).to eq(1)
+      expect(after[:packets_received] - before[:packets_received]).to be >= 4
+    end
+
+    it "has protocol counters but no TCP counters over a Unix socket" do
+      client = new_socket_client
+      before = client.stats
+      client.query("SELECT 1").to_a
+      after = client.stats
+      expect(after.values_at(:bytes_sent, :bytes_received, :packets_sent, :packets_received)).to all(be_a(Integer))
+      expect(after[:packets_sent] - before[:packets_sent]).to eq(1)
+      expect(after.keys).not_to include(:tcp_bytes_sent, :tcp_bytes_received, :tcp_segments_sent, :tcp_segments_received)
+    end
+
+    it "reports the bytes a query moved" do
+      before = @client.stats
+      @client.query("SELECT REPEAT('x', 10000)").to_a
+      expect(@client.stats[:bytes_received] - before[:bytes_received]).to be > 10000
+    end
+
+    it "reports the kernel's counters for a TCP connection" do
+      before = @client.stats
+      skip "no kernel TCP counters for this connection" unless before.key?(:tcp_bytes_received)
+      @client.query("SELECT REPEAT('x', 10000)").to_a
+      expect(@client.stats[:tcp_bytes_received] - before[:tcp_bytes_received]).to be > 10000
+      expect(@client.stats[:tcp_segments_sent]).to be > 0
+    end
+  end
+
+  context ":compression" do
+    it "is off unless asked for" do
+      expect(@client.stats[:compression]).to be_nil
+    end
+
+    it "negotiates zlib" do
+      client = new_client(compression: true)
+      expect(client.stats[:compression]).to eq('zlib')
+      expect(client.query("SELECT REPEAT('x', 10000) AS x").first['x'].size).to eq(10000)
+    end
+
+    it "negotiates zstd at the requested level" do
+      skip("DON'T WORRY, THIS TEST PASSES - but this client library does not support zstd.") unless Mysql2::Client::ZSTD_COMPRESSION_SUPPORTED
+
+      client = new_client(compression: [:zstd], compression_level: 5)
+      expect(client.stats[:compression]).to eq('zstd')
+      expect(client.query("SHOW SESSION STATUS LIKE 'Compression_algorithm'").first['Value']).to eq('zstd')
+    end
+
+    it "refuses zstd where the client library can't speak it" do
+      skip("DON'T WORRY, THIS TEST PASSES - but this client library supports zstd.") if Mysql2::Client::ZSTD_COMPRESSION_SUPPORTED
+
+      expect { new_client(compression: :zstd) }.to raise_error(Mysql2::Error, /zstd/)
+    end
+
+    it "rejects unknown algorithms before connecting" do
+      expect { new_client(compression: :lz4) }.to raise_error(ArgumentError, /lz4/)
+    end
+  end
+
+  context "in a Ractor" do
+    around(:example) do |example|
+      skip "Ractors need Ruby 3.0+" unless defined?(Ractor)
+      experimental = Warning[:experimental]
+      Warning[:experimental] = false
+      example.run
+      Warning[:experimental] = experimental
+    end
+
+    it "connects, queries and casts outside the main Ractor" do
+      ractors = Array.new(2) do |i|
+        Ractor.new(DatabaseCredentials['root'], i) do |credentials, n|
+          client = Mysql2::Client.new(credentials)
+          row = client.query("SELECT #{n} AS n, 'abc' AS s, CAST('2024-01-02' AS DATE) AS d, 1.5 AS f, TIME('12:00:00') AS t").first
+          client.close
+          [row, Mysql2::Client.default_query_options[:as]]
+        end
+      end
+
+      ractors.each_with_index do |ractor, i|
+        # Ractor#value replaced Ractor#take in Ruby 4.0
+        row, as = ractor.respond_to?(:value) ? ractor.value : ractor.take
+        expect(row.values_at('n', 's', 'd', 'f')).to eq([i, 'abc', Date.new(2024, 1, 2), BigDecimal('1.5')])
+        expect(row['t']).to be_a(Time)
+        expect(as).to eq(:hash)
+      end
+    end
+  end
+
+  context "#query_all" do
+    it "returns a Result or an affected-row count per statement, in order" do
+      @client.query "DROP TABLE IF EXISTS query_all_test"
+      @client.query "CREATE TABLE query_all_test (id INT)"
+      results = @client.query_all("INSERT INTO query_all_test VALUES (1), (2); SELECT id FROM query_all_test ORDER BY id; DELETE FROM query_all_test")
+      expect(results.size).to eq(3)
+      expect(results[0]).to eq(2)
+      expect(results[1].to_a).to eq([{ 'id' => 1 }, { 'id' => 2 }])
+      expect(results[2]).to eq(2)
+      expect(@client.affected_rows).to eq(2)
+      @client.query "DROP TABLE query_all_test"
+    end
+
+    it "raises a failing statement's error and leaves the connection usable" do
+      expect { @client.query_all("SELECT 1; SELECT * FROM query_all_no_such_table; SELECT 3") }.to raise_error(Mysql2::Error, /query_all_no_such_table/)
+      expect(@client.query("SELECT 4 AS a").first).to eq('a' => 4)
+    end
+
+    it "leaves MULTI_STATEMENTS off afterwards on a connection made without it" do
+      @client.query_all("SELECT 1; SELECT 2")
+      expect { @client.query("SELECT 1; SELECT 2") }.to raise_error(Mysql2::Error)
+    end
+
+    it "applies query options to every result" do
+      results = @client.query_all("SELECT 1 AS a; SELECT 2 AS b", as: :array)
+      expect(results.map(&:to_a)).to eq([[[1]], [[2]]])
+    end
+
+    it "rejects :stream and :async" do
+      expect { @client.query_all("SELECT 1", stream: true) }.to raise_error(ArgumentError)
+      expect { @client.query_all("SELECT 1", async: true) }.to raise_error(ArgumentError)
+    end
+
+    it "rejects options it can't honor instead of ignoring them" do
+      expect { @client.query_all("SELECT 1", timeout: 1) }.to raise_error(ArgumentError, /:timeout/)
+      expect { @client.query_all("SELECT 1", max_result_rows: 10) }.to raise_error(ArgumentError, /:max_result_rows/)
+      expect { @client.query_all("SELECT 1", max_result_bytes: 1024) }.to raise_error(ArgumentError, /:max_result_bytes/)
+      expect { @client.query_all("SELECT 1", spill: Dir.tmpdir) }.to raise_error(ArgumentError, /:spill/)
+      expect(@client.query("SELECT 1 AS a").first).to eq('a' => 1)
+    end
+  end
+
   it "should respond to #socket" do
     expect(@client).to respond_to(:socket)
   end
@@ -0,0 +1,98 @@
+require 'spec_helper'
+
+RSpec.describe Mysql2::Multiplexer do
+  before(:example) do
+    skip "Mysql2::Multiplexer isn't supported on Windows" if RUBY_PLATFORM =~ /mswin|mingw/
+  end
+
+  let(:clients) { Array.new(3) { new_client } }
+
+  it "keeps a set of clients" do
+    multiplexer = Mysql2::Multiplexer.new(clients[0])
+    multiplexer << clients[1] << clients[0]
+    multiplexer.add(clients[2])
+    expect(multiplexer.clients).to eq(clients)
+    expect(multiplexer.remove(clients[1])).to equal(clients[1])
+    expect(multiplexer.remove(clients[1])).to be_nil
+    expect(multiplexer.size).to eq(2)
+  end
+
+  it "only takes clients" do
+    expect { Mysql2::Multiplexer.new(Object.new) }.to raise_error(TypeError)
+  end
+
+  it "returns at once when no client has a query in flight" do
+    multiplexer = Mysql2::Multiplexer.new(*clients)
+    expect(multiplexer.wait).to eq([])
+    expect(multiplexer.pending).to eq(0)
+  end
+
+  it "returns the clients as their results arrive" do
+    multiplexer = Mysql2::Multiplexer.new(*clients)
+    clients.each_with_index { |client, i| client.query("SELECT SLEEP(#{0.2 * i}), #{i} AS i", async: true) }
+    expect(multiplexer.pending).to eq(3)
+
+    order = []
+    until multiplexer.pending.zero?
+      multiplexer.wait.each do |client|
+        order << client.async_result.first['i']
+      end
+    end
+    expect(order).to eq([0, 1, 2])
+  end
+
+  it "returns an empty Array when the timeout passes first" do
+    multiplexer = Mysql2::Multiplexer.new(clients[0])
+    clients[0].query("SELECT SLEEP(0.5)", async: true)
+    expect(multiplexer.wait(0.05)).to eq([])
+    expect(multiplexer.wait(5)).to eq([clients[0]])
+    clients[0].async_result
+  end
+
+  it "picks up a client's next query too" do
+    multiplexer = Mysql2::Multiplexer.new(clients[0])
+    2.times do |i|
+      clients[0].query("SELECT #{i} AS i", async: true)
+      expect(multiplexer.wait(5)).to eq([clients[0]])
+      expect(clients[0].async_result.first['i']).to eq(i)
+    end
+  end
+
+  context "#each_result" do
+    it "yields every client with its result, fastest first" do
+      multiplexer = Mysql2::Multiplexer.new(*clients)
+      clients.reverse.each_with_index { |client, i| client.query("SELECT SLEEP(#{0.2 * i}), #{i} AS i", async: true) }
+
+      yielded = []
+      expect(multiplexer.each_result { |client, result| yielded << [client, result.first['i']] }).to equal(multiplexer)
+      expect(yielded).to eq(clients.reverse.each_with_index.to_a)
+      expect(multiplexer.pending).to eq(0)
+    end
+
+    it "raises on timeout and carries on with the rest when called again" do
+      multiplexer = Mysql2::Multiplexer.new(*clients.first(2))
+      clients[0].query("SELECT 1", async: true)
+      clients[1].query("SELECT SLEEP(0.5)", async: true)
+
+      yielded = []
+      expect do
+        multiplexer.each_result(0.2) { |client, _| yielded << client }
+      end.to raise_error(Mysql2::Error::TimeoutError)
+      expect(yielded).to eq([clients[0]])
+
+      multiplexer.each_result(5) { |client, _| yielded << client }
+      expect(yielded).to eq(clients.first(2))
+    end
+
+    it "raises a query's error, leaving the others in flight" do
+      multiplexer = Mysql2::Multiplexer.new(*clients.first(2))
+      clients[0].query("SELECT * FROM multiplexer_no_such_table", async: true)
+      clients[1].query("SELECT SLEEP(0.2)", async: true)
+
+      expect { multiplexer.each_result {} }.to raise_error(Mysql2::Error, /multiplexer_no_such_table/)
+      expect(multiplexer.pending).to eq(1)
+      multiplexer.each_result {}
+      expect(clients[0].query("SELECT 1 AS a").first).to eq('a' => 1)
+    end
+  end
+end
@@ -0,0 +1,147 @@
+require 'spec_helper'
+
+RSpec.describe Mysql2::Pool do
+  def new_pool(options = {})
+    @pool = Mysql2::Pool.new(DatabaseCredentials['root'].merge(options))
+  end
+
+  after(:example) do
+    @pool&.shutdown
+  end
+
+  it "opens :min connections up front and grows up to :max on demand" do
+    pool = new_pool(min: 2, max: 3)
+    expect(pool.size).to eq(2)
+
+    clients = Array.new(3) { pool.checkout }
+    expect(pool.size).to eq(3)
+    expect(clients.uniq.size).to eq(3)
+    expect(pool.stats).to include(idle: 0, in_use: 3, created: 3)
+
+    clients.each { |client| pool.checkin(client) }
+    expect(pool.stats).to include(idle: 3, in_use: 0)
+  end
+
+  it "#warmup tops the idle connections up, within :max" do
+    pool = new_pool(max: 3)
+    expect(pool.warmup(2)).to eq(2)
+    expect(pool.stats).to include(idle: 2, created: 2)
+    expect(pool.warmup(5)).to eq(1)
+    expect(pool.warmup(3)).to eq(0)
+    expect(pool.size).to eq(3)
+  end
+
+  it "hands the most recently checked-in connection out again" do
+    pool = new_pool(max: 2)
+    first = pool.checkout
+    pool.checkin(first)
+    expect(pool.checkout).to equal(first)
+  end
+
+  it "#with checks a connection in however the block exits" do
+    pool = new_pool(max: 1)
+    expect(pool.with { |client| client.query("SELECT 1 AS a").first }).to eq('a' => 1)
+
+    expect { pool.with { raise ArgumentError, "boom" } }.to raise_error(ArgumentError, "boom")
+    expect(pool.stats).to include(idle: 1, in_use: 0)
+  end
+
+  it "raises Mysql2::Error::TimeoutError when a checkout can't be satisfied in time" do
+    pool = new_pool(max: 1, checkout_timeout: 0.2)
+    pool.checkout
+
+    start = clock_time
+    expect { pool.checkout }.to raise_error(Mysql2::Error::TimeoutError)
+    expect(clock_time - start).to be_within(0.15).of(0.2)
+    expect(pool.stats[:timeouts]).to eq(1)
+  end
+
+  it "wakes a waiting checkout on checkin and records the wait" do
+    pool = new_pool(max: 1)
+    client = pool.checkout
+
+    waiter = Thread.new { pool.checkout(5) }
+    sleep 0.1 until pool.stats[:waiting] == 1
+    pool.checkin(client)
+
+    expect(waiter.value).to equal(client)
+    expect(pool.wait_histogram.select { |upper, _| upper >= 0.05 }.values.sum).to eq(1)
+  end
+
+  it "replaces a connection the server closed while it sat idle" do
+    pool = new_pool(max: 1)
+    client = pool.checkout
+    thread_id = client.thread_id
+    pool.checkin(client)
+
+    new_client { |killer| killer.query("KILL #{thread_id}") }
+    sleep 0.1
+
+    replacement = pool.checkout
+    expect(replacement.thread_id).not_to eq(thread_id)
+    expect(pool.stats).to include(discarded: 1, created: 2)
+  end
+
+  it "rolls back a transaction left open at checkin" do
+    pool = new_pool(max: 1)
+    pool.with do |client|
+      client.query("CREATE TEMPORARY TABLE pool_rollback_test (id INT) ENGINE=InnoDB")
+      client.query("BEGIN")
+      client.query("INSERT INTO pool_rollback_test VALUES (1)")
+    end
+
+    count = pool.with { |client| client.query("SELECT COUNT(*) AS n FROM pool_rollback_test").first['n'] }
+    expect(count).to eq(0)
+  end
+
+  it "resets the whole session on checkin with :reset_on_checkin" do
+    skip "client library has no mysql_reset_connection" unless Mysql2::Client::RESET_CONNECTION_SUPPORTED
+
+    pool = new_pool(max: 1, reset_on_checkin: true)
+    pool.with { |client| client.query("SET @pool_reset_var = 1") }
+    expect(pool.with { |client| client.query("SELECT @pool_reset_var AS v").first }).to eq('v' => nil)
+  end
+
+  it "refuses :reset_on_checkin without mysql_reset_connection" do
+    skip "client library has mysql_reset_connection" if Mysql2::Client::RESET_CONNECTION_SUPPORTED
+
+    expect { new_pool(reset_on_checkin: true) }.to raise_error(Mysql2::Error, /reset_on_checkin is not available/)
+  end
+
+  it "closes a connection checked in mid-query instead of reusing it" do
+    pool = new_pool(max: 1)
+    client = pool.checkout
+    client.query("SELECT SLEEP(0.1)", async: true)
+    pool.checkin(client)
+
+    expect(client.closed?).to be true
+    expect(pool.stats).to include(size: 0, discarded: 1)
+  end
+
+  it "reaps connections idle longer than :idle_timeout, down to :min" do
+    pool = new_pool(min: 1, max: 3, idle_timeout: 0.1)
+    clients = Array.new(3) { pool.checkout }
+    clients.each { |client| pool.checkin(client) }
+
+    sleep 0.2
+    expect(pool.reap).to eq(2)
+    expect(pool.size).to eq(1)
+  end
+
+  it "refuses a connection that wasn't checked out of it" do
+    pool = new_pool(max: 1)
+    expect { pool.checkin(new_client) }.to raise_error(ArgumentError)
+  end
+
+  it "rejects inconsistent sizing" do
+    expect { Mysql2::Pool.new(min: 2, max: 1) }.to raise_error(ArgumentError)
+    expect { Mysql2::Pool.new(max: 0) }.to raise_error(ArgumentError)
+  end
+
+  it "raises on checkout after #shutdown" do
+    pool = new_pool(min: 1, max: 1)
+    pool.shutdown
+    expect(pool.size).to eq(0)
+    expect { pool.checkout }.to raise_error(Mysql2::Error, /shut down/)
+  end
+end
@@ -1,5 +1,6 @@
 require 'spec_helper'
 require 'clocale'
+require 'tmpdir'
 
 RSpec.describe Mysql2::Result do # rubocop:disable Metrics/BlockLength
   before(:example) do
@@ -748,6 +749,33 @@ RSpec.describe Mysql2::Result do # rubocop:disable Metrics/BlockLength
     end
   end
 
+  context "ObjectSpace.memsize_of" do
+    before(:all) { require "objspace" }
+
+    it "counts the buffered rows held by the client library" do
+      small = @client.query("SELECT 'x' AS a")
+      big = @client.query("SELECT REPEAT('x', 100000) AS a UNION ALL SELECT REPEAT('y', 100000)")
+      expect(ObjectSpace.memsize_of(big) - ObjectSpace.memsize_of(small)).to be >= 200000
+    end
+
+    it "stops counting the rows once they are freed" do
+      result = @client.query("SELECT REPEAT('x', 100000) AS a")
+      before = ObjectSpace.memsize_of(result)
+      result.free
+      expect(ObjectSpace.memsize_of(result)).to be < before - 100000
+    end
+
+    it "counts a prepared statement's result buffers" do
+      statement = @client.prepare("SELECT REPEAT('x', 100000) AS a")
+      before = ObjectSpace.memsize_of(statement)
+      result = statement.execute(stream: true)
+      during = nil
+      result.each { during = ObjectSpace.memsize_of(result) + ObjectSpace.memsize_of(statement) }
+      # The bound buffer for a 100000-character column is at least that long.
+      expect(during - before).to be >= 100000
+    end
+  end
+
   context "streaming" do
     it "should maintain a count while streaming" do
       result = @client.query('SELECT 1', stream: true, cache_rows: false)
@@ -854,6 +882,129 @@ RSpec.describe Mysql2::Result do # rubocop:disable Metrics/BlockLength
     end
   end
 
+  context "result size limits" do
+    let(:ten_rows) { "SELECT n, REPEAT('x', 10) AS s, NULL AS z FROM (#{(1..10).map { |i| "SELECT #{i} AS n" }.join(' UNION ALL ')}) t" }
+
+    it "should behave as a buffered result within the limits" do
+      result = @client.query(ten_rows, max_result_rows: 10, max_result_bytes: 1000)
+      expect(result.count).to eql(10)
+      expect(result.map { |row| row['n'] }).to eql((1..10).to_a)
+      expect(result.first).to eql('n' => 1, 's' => 'x' * 10, 'z' => nil)
+    end
+
+    it "should re-iterate a spooled result without row caching" do
+      result = @client.query(ten_rows, max_result_rows: 10, cache_rows: false)
+      expect(result.to_a.size).to eql(10)
+      expect(result.map { |row| row['n'] }).to eql((1..10).to_a)
+    end
+
+    it "should raise past max_result_rows and leave the connection usable" do
+      expect do
+        @client.query(ten_rows, max_result_rows: 9)
+      end.to raise_error(Mysql2::Error::ResultLimitError, /max_result_rows/)
+      expect(@client.query("SELECT 1 AS one").first).to eql('one' => 1)
+    end
+
+    it "should raise past max_result_bytes" do
+      expect do
+        @client.query(ten_rows, max_result_bytes: 50)
+      end.to raise_error(Mysql2::Error::ResultLimitError, /max_result_bytes/)
+      expect(@client.ping).to eql(true)
+    end
+
+    it "should fall back to streaming with on_result_limit: :stream" do
+      result = @client.query(ten_rows, max_result_rows: 3, on_result_limit: :stream, cache_rows: false)
+      expect(result.map { |row| row['n'] }).to eql((1..10).to_a)
+      expect(result.count).to eql(10)
+      expect { result.each.to_a }.to raise_error(Mysql2::Error, /streaming is true/)
+      expect(@client.query("SELECT 1 AS one").first).to eql('one' => 1)
+    end
+
+    it "should drain an abandoned fallback stream before the next query" do
+      @client.query(ten_rows, max_result_rows: 3, on_result_limit: :stream)
+      expect(@client.query("SELECT 1 AS one").first).to eql('one' => 1)
+    end
+
+    it "should ignore the limits for statements without a result set" do
+      expect(@client.query("SET @mysql2_limit_test = 1", max_result_rows: 1)).to be_nil
+    end
+
+    it "should reject invalid limits before sending the query" do
+      expect { @client.query("SELECT 1", max_result_rows: 0) }.to raise_error(ArgumentError)
+      expect { @client.query("SELECT 1", max_result_bytes: "1") }.to raise_error(TypeError)
+      expect { @client.query("SELECT 1", max_result_rows: 1, on_result_limit: :warn) }.to raise_error(ArgumentError)
+      expect(@client.query("SELECT 1 AS one").first).to eql('one' => 1)
+    end
+  end
+
+  context "with the :spill query option" do
+    let(:rows_query) { "SELECT n, REPEAT('y', n) AS s, IF(n % 2 = 0, NULL, n) AS odd FROM (#{(1..20).map { |i| "SELECT #{i} AS n" }.join(' UNION ALL ')}) t" }
+
+    before(:each) do
+      skip "spill is not supported on Windows" if RUBY_PLATFORM =~ /mswin|mingw/
+    end
+
+    it "should iterate the same rows as a buffered result, repeatedly" do
+      expected = @client.query(rows_query).to_a
+      result = @client.query(rows_query, spill: true)
+      expect(result.count).to eql(20)
+      expect(result.to_a).to eql(expected)
+      expect(result.to_a).to eql(expected)
+    end
+
+    it "should look rows up by index" do
+      result = @client.query(rows_query, spill: true, as: :array, symbolize_keys: true)
+      expect(result[0]).to eql([1, 'y', 1])
+      expect(result[1]).to eql([2, 'yy', nil])
+      expect(result[-1]).to eql([20, 'y' * 20, nil])
+      expect(result[20]).to be_nil
+    end
+
+    it "should not disturb an iteration in progress when indexing" do
+      result = @client.query(rows_query, spill: true)
+      seen = []
+      result.each do |row|
+        seen << row['n']
+        result[5]
+      end
+      expect(seen).to eql((1..20).to_a)
+    end
+
+    it "should spill into a given directory" do
+      Dir.mktmpdir do |dir|
+        result = @client.query(rows_query, spill: dir)
+        expect(result.map { |row| row['n'] }).to eql((1..20).to_a)
+      end
+    end
+
+    it "should raise for a directory it cannot write to, leaving the connection usable" do
+      expect do
+        @client.query(rows_query, spill: "/nonexistent/mysql2-spill")
+      end.to raise_error(SystemCallError)
+      expect(@client.query("SELECT 1 AS one").first).to eql('one' => 1)
+    end
+
+    it "should reject :stream" do
+      expect { @client.query(rows_query, spill: true, stream: true) }.to raise_error(ArgumentError)
+    end
+  end
+
+  context "#[] without :spill" do
+    it "should index the cached rows of a buffered result" do
+      result = @client.query("SELECT 1 AS n UNION ALL SELECT 2")
+      rows = result.to_a
+      expect(result[1]).to equal(rows[1])
+      expect(result[-1]).to equal(rows[1])
+      expect(result[2]).to be_nil
+    end
+
+    it "should raise for a streaming result instead of consuming it" do
+      result = @client.query("SELECT 1 AS n UNION ALL SELECT 2", stream: true, cache_rows: false)
+      expect { result[0] }.to raise_error(Mysql2::Error, /streaming/)
+      expect(result.map { |row| row['n'] }).to eql([1, 2])
+    end
+  end
+
   context "row data type mapping" do # rubocop:disable Metrics/BlockLength
     let(:test_result) { @client.query("SELECT * FROM mysql2_test ORDER BY id DESC LIMIT 1").first }
 
@@ -0,0 +1,80 @@
+require 'spec_helper'
+require 'tmpdir'
+require_relative '../../benchmark/stand_in_server'
+
+# The benchmarks' scripted stand-in server, checked against the client it
+# is meant to measure: if it drifts from what the client library expects,
+# the benchmarks quietly measure the wrong thing.
+RSpec.describe StandInServer do
+  before(:example) do
+    skip "no Unix sockets on Windows" if RUBY_PLATFORM =~ /mswin|mingw/
+  end
+
+  let(:socket) { File.join(Dir.tmpdir, "mysql2-stand-in-#{Process.pid}.sock") }
+  let(:server) { StandInServer.new(port: 0, socket: socket).start }
+
+  after(:example) do
+    server.stop
+  end
+
+  def stand_in_client(opts = {})
+    Mysql2::Client.new({ host: '127.0.0.1', port: server.port, username: 'root', password: 'secret' }.merge(opts))
+  end
+
+  it "replays a scripted result set over TCP and a Unix socket" do
+    server.script('SELECT * FROM stand_in', columns: [[:id, :long], [:name, :varchar, 8]], rows: 2)
+    [stand_in_client, Mysql2::Client.new(socket: socket, username: 'root')].each do |client|
+      expect(client.query('SELECT * FROM stand_in').to_a).to eq([
+        { 'id' => 1, 'name' => 'row 1 ro' },
+        { 'id' => 2, 'name' => 'row 2 ro' },
+      ])
+      expect(client.ping).to be true
+    end
+  end
+
+  it "casts the default columns" do
+    server.script(/\ASELECT/, rows: 1)
+    row = stand_in_client.query('SELECT 1').first
+    expect(row['amount']).to eq(BigDecimal('1.001'))
+    expect(row['ratio']).to eq(1.5)
+    expect(row['created_at']).to eq(Time.local(2024, 1, 1, 0, 1, 1))
+    expect(row['birthday']).to eq(Date.new(2024, 1, 2))
+    expect(row['notes'].encoding).to eq(Encoding::UTF_8)
+    expect(row['nothing']).to be_nil
+  end
+
+  it "round-trips length-encoded integers of every width" do
+    codec = described_class.allocate
+    [0, 250, 251, 0xffff, 0x10000, 0xffffff, 0x1000000].each do |int|
+      payload = codec.send(:lenenc_int, int) + "tail".b
+      expect(codec.send(:read_lenenc, payload, 0)).to eq([int, payload.bytesize - 4])
+    end
+  end
+
+  it "streams" do
+    server.script(/\ASELECT/, columns: [[:id, :long]], rows: 100)
+    ids = []
+    stand_in_client.query('SELECT id', stream: true, cache_rows: false).each { |row| ids << row['id'] }
+    expect(ids).to eq((1..100).to_a)
+  end
+
+  it "replays scripted OK packets and errors" do
+    server.script(/\AINSERT/, affected_rows: 3, insert_id: 42)
+    server.script('SELECT broken', error: [1146, "Table 'test.broken' doesn't exist", '42S02'])
+    client = stand_in_client
+
+    client.query('INSERT INTO t VALUES (1), (2), (3)')
+    expect(client.affected_rows).to eq(3)
+    expect(client.last_id).to eq(42)
+    expect { client.query('SELECT broken') }.to raise_error(Mysql2::Error) { |e| expect(e.error_number).to eq(1146) }
+    expect { client.query('SELECT unscripted') }.to raise_error(Mysql2::Error, /unscripted/)
+  end
+
+  it "waits out the scripted latency" do
+    server.script('SELECT 1', columns: [[:one, :long]], rows: 1, latency: 0.2)
+    client = stand_in_client
+    start = clock_time
+    client.query('SELECT 1')
+    expect(clock_time - start).to be >= 0.2
+  end
+end
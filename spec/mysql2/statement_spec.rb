@@ -1,5 +1,6 @@
 require './spec/spec_helper'
 require 'clocale'
+require 'stringio'
 
 RSpec.describe Mysql2::Statement do # rubocop:disable Metrics/BlockLength
   before(:example) do
@@ -214,6 +215,103 @@ RSpec.describe Mysql2::Statement do # rubocop:disable Metrics/BlockLength
     @client.query 'DROP TABLE IF EXISTS mysql2_stmt_bind_type_test'
   end
 
+  context "named parameters" do
+    it "should map a Hash of named parameters onto the placeholders" do
+      stmt = @client.prepare 'SELECT :a AS a, :b AS b, :a AS c'
+      expect(stmt.param_count).to eq(3)
+      expect(stmt.execute(a: 1, b: "two").first).to eq("a" => 1, "b" => "two", "c" => 1)
+      expect(stmt.execute("a" => 3, "b" => nil).first).to eq("a" => 3, "b" => nil, "c" => 3)
+    end
+
+    it "should accept query options after a braced Hash of parameters" do
+      stmt = @client.prepare 'SELECT :a AS a'
+      expect(stmt.execute({ a: 1 }, as: :array).first).to eq([1])
+    end
+
+    it "should leave quoted strings, identifiers, comments and := alone" do
+      stmt = @client.prepare "SELECT ':x' AS `:y`, @v := :v AS v /* :z */ -- :w
+"
+      expect(stmt.param_count).to eq(1)
+      expect(stmt.execute(v: 5).first).to eq(":y" => ":x", "v" => 5)
+    end
+
+    it "should raise for missing and unknown names" do
+      stmt = @client.prepare 'SELECT :a AS a'
+      expect { stmt.execute(b: 1) }.to raise_error(ArgumentError, /:a/)
+      expect { stmt.execute(a: 1, b: 1) }.to raise_error(ArgumentError, /:b/)
+      expect { stmt.execute(1) }.to raise_error(ArgumentError, /Hash/)
+      expect(stmt.execute(a: 1).first).to eq("a" => 1)
+    end
+
+    it "should refuse to mix named and positional placeholders" do
+      expect { @client.prepare 'SELECT :a, ?' }.to raise_error(ArgumentError, /mix/)
+    end
+  end
+
+  context "IO parameters" do
+    before(:example) do
+      @client.query 'USE test'
+      @client.query 'DROP TABLE IF EXISTS mysql2_stmt_long_data_test'
+      @client.query 'CREATE TABLE mysql2_stmt_long_data_test (id INT, body LONGBLOB)'
+    end
+
+    after(:example) do
+      @client.query 'DROP TABLE IF EXISTS mysql2_stmt_long_data_test'
+    end
+
+    it "should stream an IO parameter in chunks" do
+      body = Random.new(42).bytes(200 * 1024)
+      stmt = @client.prepare 'INSERT INTO mysql2_stmt_long_data_test VALUES (?, ?)'
+      stmt.execute(1, StringIO.new(body))
+
+      row = @client.query('SELECT body FROM mysql2_stmt_long_data_test WHERE id = 1').first
+      expect(row['body']).to eq(body.b)
+    end
+
+    it "should stream a File parameter" do
+      require 'tempfile'
+      Tempfile.create('mysql2_long_data') do |file|
+        file.binmode
+        file.write("x" * 100_000)
+        file.rewind
+
+        @client.prepare('INSERT INTO mysql2_stmt_long_data_test VALUES (?, ?)').execute(1, file)
+      end
+
+      expect(@client.query('SELECT LENGTH(body) AS len FROM mysql2_stmt_long_data_test').first['len']).to eq(100_000)
+    end
+
+    it "should bind an empty IO as an empty value" do
+      @client.prepare('INSERT INTO mysql2_stmt_long_data_test VALUES (?, ?)').execute(1, StringIO.new(''))
+
+      expect(@client.query('SELECT body FROM mysql2_stmt_long_data_test').first['body']).to eq('')
+    end
+
+    it "should discard partially sent data when #read raises" do
+      failing_io = StringIO.new("a" * 100_000)
+      calls = 0
+      failing_io.define_singleton_method(:read) do |*args|
+        calls += 1
+        raise IOError, "boom" if calls == 2
+
+        super(*args)
+      end
+
+      stmt = @client.prepare 'INSERT INTO mysql2_stmt_long_data_test VALUES (?, ?)'
+      expect { stmt.execute(1, failing_io) }.to raise_error(IOError, "boom")
+
+      stmt.execute(2, StringIO.new("b"))
+      expect(@client.query('SELECT id, body FROM mysql2_stmt_long_data_test').to_a).to eq([{ 'id' => 2, 'body' => 'b' }])
+    end
+
+    it "should still refuse a Pathname" do
+      require 'pathname'
+      stmt = @client.prepare 'SELECT ? AS a'
+
+      expect { stmt.execute(Pathname.new(__FILE__)) }.to raise_error(TypeError, /no conversion for Pathname/)
+    end
+  end
+
   it "should keep its result after other query" do
     @client.query 'USE test'
     @client.query 'CREATE TABLE IF NOT EXISTS mysql2_stmt_q(a int)'
@@ -370,6 +468,65 @@ RSpec.describe Mysql2::Statement do # rubocop:disable Metrics/BlockLength
     end
   end
 
+  context "async execute" do
+    it "should return nil and deliver the result through #async_result" do
+      skip "needs nonblocking prepared statement execution" unless Mysql2::Statement::NONBLOCKING_EXECUTE_SUPPORTED
+
+      stmt = @client.prepare 'SELECT ? AS a, SLEEP(0.1) AS s'
+      expect(stmt.execute(7, async: true)).to be_nil
+      expect(stmt.async_result.to_a).to eq([{ 'a' => 7, 's' => 0 }])
+      expect(stmt.async_result).to be_nil
+    end
+
+    it "should refuse other commands until the async result is read" do
+      skip "needs nonblocking prepared statement execution" unless Mysql2::Statement::NONBLOCKING_EXECUTE_SUPPORTED
+
+      stmt = @client.prepare 'SELECT 1 AS a'
+      stmt.execute(async: true)
+      expect { @client.query('SELECT 2') }.to raise_error(Mysql2::Error, /still waiting for a result/)
+      expect { stmt.execute }.to raise_error(Mysql2::Error, /still waiting for a result/)
+      expect(stmt.async_result.first).to eq('a' => 1)
+      expect(@client.query('SELECT 2 AS b').first).to eq('b' => 2)
+    end
+
+    it "should raise the server's error from #async_result" do
+      skip "needs nonblocking prepared statement execution" unless Mysql2::Statement::NONBLOCKING_EXECUTE_SUPPORTED
+
+      stmt = @client.prepare 'SELECT CAST(? AS SIGNED) AS a FROM DUAL WHERE (SELECT 1 UNION SELECT 2) = 1'
+      stmt.execute(1, async: true)
+      expect { stmt.async_result }.to raise_error(Mysql2::Error, /more than 1 row/)
+      expect(@client.query('SELECT 1 AS a').first).to eq('a' => 1)
+    end
+
+    it "should let go of the connection when a statement is collected with its async result unread" do
+      skip "needs nonblocking prepared statement execution" unless Mysql2::Statement::NONBLOCKING_EXECUTE_SUPPORTED
+
+      client = new_client
+      # In a block of its own so no stack slot keeps the statement alive.
+      1.times { client.prepare('SELECT 1 AS a').execute(async: true) }
+      20.times do
+        break if client.closed?
+
+        GC.start
+      end
+      expect(client.closed?).to be true
+      expect { client.query('SELECT 1') }.to raise_error(Mysql2::Error) { |e| expect(e.message).not_to match(/still waiting/) }
+    end
+
+    it "should refuse async: true where nonblocking execution is unavailable" do
+      skip "nonblocking prepared statement execution is available" if Mysql2::Statement::NONBLOCKING_EXECUTE_SUPPORTED
+
+      stmt = @client.prepare 'SELECT 1'
+      expect { stmt.execute(async: true) }.to raise_error(Mysql2::Error, /nonblocking/)
+      expect(stmt.execute.first).to eq('1' => 1)
+    end
+
+    it "should ignore a client-wide async default" do
+      client = new_client(async: true)
+      expect(client.prepare('SELECT 1 AS a').execute.first).to eq('a' => 1)
+    end
+  end
+
   context "streaming result" do
     it "should be able to stream query result" do
       n = 1
@@ -431,6 +588,34 @@ RSpec.describe Mysql2::Statement do # rubocop:disable Metrics/BlockLength
       end
     end
 
+    it "should read variable-length columns straight into Strings under cast: false and :fast" do
+      # String-bound variable-length columns have no bind buffer at all (see
+      # MYSQL2_STMT_ZERO_COPY_BIND_P in result.c): each value is fetched
+      # into a String of its exact length, so large, empty and NULL values
+      # must all come back intact, buffered or streamed.
+      @client.query("DROP TABLE IF EXISTS stmt_zero_copy_test")
+      @client.query("CREATE TABLE stmt_zero_copy_test (id INT PRIMARY KEY AUTO_INCREMENT, data MEDIUMBLOB, note VARCHAR(32), flag BIT(1))")
+
+      begin
+        values = ["a" * 10, "b" * 300_000, "", nil, "\0c\0"]
+        ins = @client.prepare("INSERT INTO stmt_zero_copy_test (data, note, flag) VALUES (?, ?, b'1')")
+        values.each { |v| ins.execute(v, v && v[0, 32]) }
+
+        stmt = @client.prepare("SELECT data, note, flag FROM stmt_zero_copy_test ORDER BY id")
+        [{}, { stream: true, cache_rows: false }].each do |opts|
+          rows = stmt.execute(**opts, cast: false).to_a
+          expect(rows.map { |r| r["data"] }).to eq(values)
+          expect(rows.map { |r| r["note"] }).to eq(values.map { |v| v && v[0, 32] })
+
+          rows = stmt.execute(**opts, cast: :fast, cast_booleans: true).to_a
+          expect(rows.map { |r| r["data"] }).to eq(values)
+          expect(rows.map { |r| r["flag"] }).to all(eq(true))
+        end
+      ensure
+        @client.query("DROP TABLE IF EXISTS stmt_zero_copy_test")
+      end
+    end
+
     context "with stream: {size: N}" do
       # Com_stmt_fetch counts COM_STMT_FETCH commands the server received on
       # this session -- a direct observation of how many round trips a
@@ -508,6 +693,37 @@ RSpec.describe Mysql2::Statement do # rubocop:disable Metrics/BlockLength
         end
       end
 
+      it "adapts the batch size with stream: {size: :auto} and returns the same rows" do
+        stmt = @client.prepare("SELECT * FROM stream_prefetch_test ORDER BY id")
+        expected = stmt.execute(cache_rows: false).to_a
+
+        rows = nil
+        auto = fetches_during do
+          rows = stmt.execute(stream: { size: :auto }, cache_rows: false).to_a
+        end
+
+        expect(rows).to eq(expected)
+        # 20 narrow rows fit in the initial batch.
+        expect(auto).to be <= 2
+      end
+
+      it "drains a cursor with stream: {size: :auto} across several resized batches" do
+        # Enough rows that the initial batch is consumed and the cursor is
+        # resized between fetches at least once.
+        6.times { @client.query("INSERT INTO stream_prefetch_test (v) SELECT v FROM stream_prefetch_test") }
+        stmt = @client.prepare("SELECT id, v FROM stream_prefetch_test ORDER BY id")
+        expected = stmt.execute(cache_rows: false).to_a
+
+        streamed = stmt.execute(stream: { size: :auto }, cache_rows: false).to_a
+        expect(streamed).to eq(expected)
+
+        # The adjusted prefetch doesn't leak into a later stream: true execute.
+        single = fetches_during do
+          stmt.execute(stream: true, cache_rows: false).to_a
+        end
+        expect(single).to be >= expected.length
+      end
+
       it "accepts stream: {size: 1} as equivalent to stream: true" do
         stmt = @client.prepare("SELECT * FROM stream_prefetch_test ORDER BY id")
         expect(stmt.execute(stream: { size: 1 }, cache_rows: false).to_a.length).to eq(20)
@@ -519,6 +735,7 @@ RSpec.describe Mysql2::Statement do # rubocop:disable Metrics/BlockLength
         expect { stmt.execute(stream: { size: -1 }) }.to raise_error(ArgumentError, /positive/)
         expect { stmt.execute(stream: { size: 1.5 }) }.to raise_error(TypeError, /Integer/)
         expect { stmt.execute(stream: { size: "10" }) }.to raise_error(TypeError, /Integer/)
+        expect { stmt.execute(stream: { size: :automatic }) }.to raise_error(TypeError, /Integer or :auto/)
         expect { stmt.execute(stream: {}) }.to raise_error(ArgumentError, /size/)
         expect { stmt.execute(stream: { sise: 10 }) }.to raise_error(ArgumentError, /size/)
         expect { stmt.execute(stream: { size: 10, max_memory: 1 }) }.to raise_error(ArgumentError, /size/)